@@ -0,0 +1,704 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+#include "../src/pipeline.h"
+#include "../src/reqrep.h"
+#include "../src/survey.h"
+#include "../src/bus.h"
+#include "../src/tcp.h"
+
+#include "../src/utils/attr.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/clock.c"
+#include "../src/utils/hist.c"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Benchmark harness. Runs every combination of the selected scenarios,
+    transports, message sizes and connection counts and prints one JSON
+    object with the results per run. Both ends of each run live in this
+    process; every peer socket is driven by a thread of its own. */
+
+/*  How long to wait for a message before giving up on the rest of the run.
+    Messages dropped by PUB, SURVEYOR and BUS sockets are accounted for this
+    way. */
+#define BENCH_TIMEOUT 1000
+
+#define BENCH_MAX_CONNECTIONS 256
+
+/*  A percentile is reported only if at least this many samples lie above
+    it. With fewer samples the tail falls into the same histogram bucket as
+    the maximum and the percentile says nothing new. */
+#define BENCH_TAIL_SAMPLES 100
+
+struct bench_run;
+struct bench_peer;
+
+typedef void (*bench_fn) (struct bench_peer *peer);
+
+struct bench_peer {
+    struct bench_run *run;
+    int s;
+    bench_fn fn;
+    uint64_t messages;
+    uint64_t last;
+    struct nn_hist latency;
+    struct nn_thread thread;
+};
+
+struct bench_run {
+    const char *scenario;
+    const char *metric;
+    const char *transport;
+    char addr [128];
+    size_t size;
+    int connections;
+    int count;
+
+    /*  Number of messages (or round-trips) that should be delivered and
+        number of those actually delivered. */
+    uint64_t expected;
+    uint64_t delivered;
+    uint64_t start;
+    uint64_t last;
+    struct nn_hist latency;
+    struct bench_peer peers [BENCH_MAX_CONNECTIONS];
+};
+
+struct bench_scenario {
+    const char *name;
+    void (*fn) (struct bench_run *run);
+
+    /*  Name of the timing metric in the report. Streaming scenarios send as
+        fast as possible, so the time between sending and receiving a message
+        is dominated by the time it spends queued. Only request/reply style
+        scenarios measure latency proper. */
+    const char *metric;
+};
+
+static void bench_fan_in (struct bench_run *run, int central, int peer);
+static void bench_pair (struct bench_run *run);
+static void bench_pipeline (struct bench_run *run);
+static void bench_bus (struct bench_run *run);
+static void bench_pubsub (struct bench_run *run);
+static void bench_reqrep (struct bench_run *run);
+static void bench_survey (struct bench_run *run);
+
+static const struct bench_scenario bench_scenarios [] = {
+    {"pair", bench_pair, "queue_delay_us"},
+    {"pipeline", bench_pipeline, "queue_delay_us"},
+    {"pubsub", bench_pubsub, "queue_delay_us"},
+    {"reqrep", bench_reqrep, "latency_us"},
+    {"survey", bench_survey, "latency_us"},
+    {"bus", bench_bus, "queue_delay_us"},
+    {NULL, NULL, NULL}
+};
+
+static const char *bench_transports [] = {"inproc", "ipc", "tcp", "ws", NULL};
+
+static int bench_socket (struct bench_run *run, int protocol)
+{
+    int s;
+    int rc;
+    int opt;
+
+    s = nn_socket (AF_SP, protocol);
+    nn_assert (s >= 0);
+    opt = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+    opt = BENCH_TIMEOUT;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_SNDTIMEO, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+    if (strcmp (run->transport, "tcp") == 0) {
+        opt = 1;
+        rc = nn_setsockopt (s, NN_TCP, NN_TCP_NODELAY, &opt, sizeof (opt));
+        nn_assert (rc == 0);
+    }
+    return s;
+}
+
+/*  Sends a message. If the message is large enough, the send time is
+    stored at its beginning so that the receiver can compute the latency. */
+static int bench_send (struct bench_run *run, int s, char *buf)
+{
+    int rc;
+    uint64_t now;
+
+    if (run->size >= sizeof (now)) {
+        now = nn_clock_us ();
+        memcpy (buf, &now, sizeof (now));
+    }
+    rc = nn_send (s, buf, run->size, 0);
+    if (rc < 0) {
+        errno_assert (nn_errno () == ETIMEDOUT);
+        return -1;
+    }
+    nn_assert (rc == (int) run->size);
+    return 0;
+}
+
+/*  Receives a message and records how long ago it was sent. Returns -1 if
+    no message arrived in time. */
+static int bench_recv (struct bench_run *run, int s, char *buf,
+    struct nn_hist *latency, uint64_t *last)
+{
+    int rc;
+    uint64_t now;
+    uint64_t stamp;
+
+    rc = nn_recv (s, buf, run->size, 0);
+    if (rc < 0) {
+        errno_assert (nn_errno () == ETIMEDOUT);
+        return -1;
+    }
+    nn_assert (rc == (int) run->size);
+    now = nn_clock_us ();
+    if (latency && run->size >= sizeof (stamp)) {
+        memcpy (&stamp, buf, sizeof (stamp));
+        nn_hist_record (latency, now - stamp);
+    }
+    *last = now;
+    return 0;
+}
+
+static void bench_peer_routine (void *arg)
+{
+    struct bench_peer *peer;
+
+    peer = (struct bench_peer*) arg;
+    peer->fn (peer);
+}
+
+/*  Creates the peer sockets, connects them to the central socket and
+    waits till the connections are established. */
+static void bench_peers_init (struct bench_run *run, int protocol,
+    bench_fn fn)
+{
+    int i;
+    int rc;
+    struct bench_peer *peer;
+
+    for (i = 0; i != run->connections; ++i) {
+        peer = &run->peers [i];
+        peer->run = run;
+        peer->fn = fn;
+        peer->messages = 0;
+        peer->last = 0;
+        nn_hist_init (&peer->latency);
+        peer->s = bench_socket (run, protocol);
+        if (protocol == NN_SUB) {
+            rc = nn_setsockopt (peer->s, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+            nn_assert (rc == 0);
+        }
+        rc = nn_connect (peer->s, run->addr);
+        nn_assert (rc >= 0);
+    }
+    nn_sleep (100);
+}
+
+static void bench_peers_start (struct bench_run *run)
+{
+    int i;
+
+    for (i = 0; i != run->connections; ++i)
+        nn_thread_init (&run->peers [i].thread, bench_peer_routine,
+            &run->peers [i]);
+}
+
+/*  Waits for the peers to finish and collects their results. */
+static void bench_peers_term (struct bench_run *run, int received)
+{
+    int i;
+    int rc;
+    struct bench_peer *peer;
+
+    for (i = 0; i != run->connections; ++i) {
+        peer = &run->peers [i];
+        nn_thread_term (&peer->thread);
+        rc = nn_close (peer->s);
+        errno_assert (rc == 0);
+        nn_hist_merge (&run->latency, &peer->latency);
+        if (received) {
+            run->delivered += peer->messages;
+            if (peer->last > run->last)
+                run->last = peer->last;
+        }
+    }
+}
+
+static void bench_sender (struct bench_peer *peer)
+{
+    int i;
+    char *buf;
+
+    buf = malloc (peer->run->size);
+    alloc_assert (buf);
+    memset (buf, 111, peer->run->size);
+    for (i = 0; i != peer->run->count; ++i) {
+        if (bench_send (peer->run, peer->s, buf) < 0)
+            break;
+        ++peer->messages;
+    }
+    free (buf);
+}
+
+static void bench_receiver (struct bench_peer *peer)
+{
+    char *buf;
+
+    buf = malloc (peer->run->size);
+    alloc_assert (buf);
+    while (peer->messages != (uint64_t) peer->run->count) {
+        if (bench_recv (peer->run, peer->s, buf, &peer->latency,
+              &peer->last) < 0)
+            break;
+        ++peer->messages;
+    }
+    free (buf);
+}
+
+static void bench_requester (struct bench_peer *peer)
+{
+    int i;
+    uint64_t start;
+    char *buf;
+
+    buf = malloc (peer->run->size);
+    alloc_assert (buf);
+    memset (buf, 111, peer->run->size);
+    for (i = 0; i != peer->run->count; ++i) {
+        start = nn_clock_us ();
+        if (bench_send (peer->run, peer->s, buf) < 0)
+            break;
+        if (bench_recv (peer->run, peer->s, buf, NULL, &peer->last) < 0)
+            break;
+        nn_hist_record (&peer->latency, peer->last - start);
+        ++peer->messages;
+    }
+    free (buf);
+}
+
+static void bench_responder (struct bench_peer *peer)
+{
+    int i;
+    uint64_t last;
+    char *buf;
+
+    buf = malloc (peer->run->size);
+    alloc_assert (buf);
+    for (i = 0; i != peer->run->count; ++i) {
+        if (bench_recv (peer->run, peer->s, buf, NULL, &last) < 0)
+            break;
+        if (bench_send (peer->run, peer->s, buf) < 0)
+            break;
+    }
+    free (buf);
+}
+
+/*  Many peers send messages to a single central socket. */
+static void bench_fan_in (struct bench_run *run, int central, int peer)
+{
+    int s;
+    int rc;
+    char *buf;
+
+    s = bench_socket (run, central);
+    rc = nn_bind (s, run->addr);
+    nn_assert (rc >= 0);
+    bench_peers_init (run, peer, bench_sender);
+    buf = malloc (run->size);
+    alloc_assert (buf);
+
+    run->expected = (uint64_t) run->count * run->connections;
+    run->start = nn_clock_us ();
+    bench_peers_start (run);
+    while (run->delivered != run->expected) {
+        if (bench_recv (run, s, buf, &run->latency, &run->last) < 0)
+            break;
+        ++run->delivered;
+    }
+    bench_peers_term (run, 0);
+
+    free (buf);
+    rc = nn_close (s);
+    errno_assert (rc == 0);
+}
+
+static void bench_pair (struct bench_run *run)
+{
+    bench_fan_in (run, NN_PAIR, NN_PAIR);
+}
+
+static void bench_pipeline (struct bench_run *run)
+{
+    bench_fan_in (run, NN_PULL, NN_PUSH);
+}
+
+static void bench_bus (struct bench_run *run)
+{
+    bench_fan_in (run, NN_BUS, NN_BUS);
+}
+
+/*  Single publisher sends messages to many subscribers. */
+static void bench_pubsub (struct bench_run *run)
+{
+    int s;
+    int rc;
+    int i;
+    char *buf;
+
+    s = bench_socket (run, NN_PUB);
+    rc = nn_bind (s, run->addr);
+    nn_assert (rc >= 0);
+    bench_peers_init (run, NN_SUB, bench_receiver);
+    bench_peers_start (run);
+    buf = malloc (run->size);
+    alloc_assert (buf);
+    memset (buf, 111, run->size);
+
+    run->expected = (uint64_t) run->count * run->connections;
+    run->start = nn_clock_us ();
+    for (i = 0; i != run->count; ++i)
+        if (bench_send (run, s, buf) < 0)
+            break;
+    bench_peers_term (run, 1);
+
+    free (buf);
+    rc = nn_close (s);
+    errno_assert (rc == 0);
+}
+
+/*  Many clients send requests to a single server. */
+static void bench_reqrep (struct bench_run *run)
+{
+    int s;
+    int rc;
+    uint64_t served;
+    uint64_t last;
+    char *buf;
+
+    s = bench_socket (run, NN_REP);
+    rc = nn_bind (s, run->addr);
+    nn_assert (rc >= 0);
+    bench_peers_init (run, NN_REQ, bench_requester);
+    buf = malloc (run->size);
+    alloc_assert (buf);
+
+    run->expected = (uint64_t) run->count * run->connections;
+    run->start = nn_clock_us ();
+    bench_peers_start (run);
+    for (served = 0; served != run->expected; ++served) {
+        if (bench_recv (run, s, buf, NULL, &last) < 0)
+            break;
+        if (bench_send (run, s, buf) < 0)
+            break;
+    }
+    bench_peers_term (run, 1);
+
+    free (buf);
+    rc = nn_close (s);
+    errno_assert (rc == 0);
+}
+
+/*  Surveyor waits for responses from all the respondents before starting
+    the next survey. */
+static void bench_survey (struct bench_run *run)
+{
+    int s;
+    int rc;
+    int i;
+    int j;
+    int opt;
+    uint64_t start;
+    char *buf;
+
+    s = bench_socket (run, NN_SURVEYOR);
+    opt = BENCH_TIMEOUT;
+    rc = nn_setsockopt (s, NN_SURVEYOR, NN_SURVEYOR_DEADLINE, &opt,
+        sizeof (opt));
+    nn_assert (rc == 0);
+    rc = nn_bind (s, run->addr);
+    nn_assert (rc >= 0);
+    bench_peers_init (run, NN_RESPONDENT, bench_responder);
+    bench_peers_start (run);
+    buf = malloc (run->size);
+    alloc_assert (buf);
+    memset (buf, 111, run->size);
+
+    run->expected = run->count;
+    run->start = nn_clock_us ();
+    for (i = 0; i != run->count; ++i) {
+        start = nn_clock_us ();
+        if (bench_send (run, s, buf) < 0)
+            break;
+        for (j = 0; j != run->connections; ++j)
+            if (bench_recv (run, s, buf, NULL, &run->last) < 0)
+                break;
+        if (j != run->connections)
+            break;
+        nn_hist_record (&run->latency, run->last - start);
+        ++run->delivered;
+    }
+    bench_peers_term (run, 0);
+
+    free (buf);
+    rc = nn_close (s);
+    errno_assert (rc == 0);
+}
+
+/*  Prints the percentile, or null if there are too few samples to tell it
+    apart from the maximum. */
+static void bench_percentile (FILE *out, const char *name,
+    struct nn_hist *hist, int permille)
+{
+    if (hist->count * (1000 - permille) < BENCH_TAIL_SAMPLES * 1000) {
+        fprintf (out, ",\"%s\":null", name);
+        return;
+    }
+    fprintf (out, ",\"%s\":%llu", name,
+        (unsigned long long) nn_hist_percentile (hist, permille));
+}
+
+static void bench_report (FILE *out, struct bench_run *run)
+{
+    double seconds;
+    double rate;
+
+    seconds = run->last > run->start ?
+        (double) (run->last - run->start) / 1000000 : 0;
+    rate = seconds > 0 ? run->delivered / seconds : 0;
+
+    fprintf (out, "{\"scenario\":\"%s\",\"transport\":\"%s\","
+        "\"size\":%d,\"connections\":%d,\"expected\":%llu,"
+        "\"delivered\":%llu,\"seconds\":%.6f,\"msgs_per_sec\":%.0f,"
+        "\"mbits_per_sec\":%.3f,\"%s\":{\"count\":%llu,\"mean\":%llu",
+        run->scenario, run->transport, (int) run->size, run->connections,
+        (unsigned long long) run->expected,
+        (unsigned long long) run->delivered, seconds, rate,
+        rate * run->size * 8 / 1000000, run->metric,
+        (unsigned long long) run->latency.count,
+        (unsigned long long) nn_hist_mean (&run->latency));
+    bench_percentile (out, "p50", &run->latency, 500);
+    bench_percentile (out, "p90", &run->latency, 900);
+    bench_percentile (out, "p99", &run->latency, 990);
+    bench_percentile (out, "p999", &run->latency, 999);
+    fprintf (out, ",\"max\":%llu}}\n",
+        (unsigned long long) run->latency.max);
+    fflush (out);
+}
+
+/*  Checks whether 'name' is in the comma-separated list. */
+static int bench_selected (const char *list, const char *name)
+{
+    size_t len;
+
+    if (strcmp (list, "all") == 0)
+        return 1;
+    len = strlen (name);
+    while (*list) {
+        if (strncmp (list, name, len) == 0 &&
+              (list [len] == ',' || list [len] == 0))
+            return 1;
+        list = strchr (list, ',');
+        if (!list)
+            break;
+        ++list;
+    }
+    return 0;
+}
+
+/*  Parses a comma-separated list of numbers. Returns number of items. */
+static int bench_numbers (const char *list, int *values, int max)
+{
+    int n;
+    char *end;
+
+    for (n = 0; n != max; ++n) {
+        values [n] = (int) strtol (list, &end, 10);
+        if (end == list || values [n] <= 0)
+            return -1;
+        if (*end == 0)
+            return n + 1;
+        if (*end != ',')
+            return -1;
+        list = end + 1;
+    }
+    return -1;
+}
+
+static void bench_usage (void)
+{
+    fprintf (stderr, "usage: bench [-s scenarios] [-t transports] "
+        "[-m sizes] [-c connections]\n"
+        "             [-n count] [-p port] [-o file]\n\n"
+        "  -s  comma-separated scenarios: pair, pipeline, pubsub, reqrep,\n"
+        "      survey, bus (default: all)\n"
+        "  -t  comma-separated transports: inproc, ipc, tcp, ws "
+        "(default: all)\n"
+        "  -m  comma-separated message sizes in bytes "
+        "(default: 64,1024,65536)\n"
+        "  -c  comma-separated numbers of connections (default: 1,4)\n"
+        "  -n  messages per connection (default: 10000); percentiles\n"
+        "      with fewer than %d samples above them are reported as null\n"
+        "  -p  first TCP port to use (default: 5560)\n"
+        "  -o  write results to the file instead of stdout\n",
+        BENCH_TAIL_SAMPLES);
+}
+
+int main (int argc, char *argv [])
+{
+    int i;
+    int c;
+    int m;
+    int t;
+    int port;
+    int count;
+    int nsizes;
+    int nconnections;
+    int sizes [32];
+    int connections [32];
+    const char *scenarios;
+    const char *transports;
+    const char *output;
+    const struct bench_scenario *scenario;
+    struct bench_run *run;
+    FILE *out;
+
+    scenarios = "all";
+    transports = "all";
+    output = NULL;
+    count = 10000;
+    port = 5560;
+    nsizes = bench_numbers ("64,1024,65536", sizes, 32);
+    nconnections = bench_numbers ("1,4", connections, 32);
+
+    for (i = 1; i < argc; i += 2) {
+        if (argv [i][0] != '-' || argv [i][1] == 0 || argv [i][2] != 0 ||
+              i + 1 == argc) {
+            bench_usage ();
+            return 1;
+        }
+        switch (argv [i][1]) {
+        case 's':
+            scenarios = argv [i + 1];
+            break;
+        case 't':
+            transports = argv [i + 1];
+            break;
+        case 'm':
+            nsizes = bench_numbers (argv [i + 1], sizes, 32);
+            break;
+        case 'c':
+            nconnections = bench_numbers (argv [i + 1], connections, 32);
+            break;
+        case 'n':
+            count = atoi (argv [i + 1]);
+            break;
+        case 'p':
+            port = atoi (argv [i + 1]);
+            break;
+        case 'o':
+            output = argv [i + 1];
+            break;
+        default:
+            bench_usage ();
+            return 1;
+        }
+    }
+    if (nsizes < 0 || nconnections < 0 || count <= 0 || port <= 0) {
+        bench_usage ();
+        return 1;
+    }
+    for (c = 0; c != nconnections; ++c) {
+        if (connections [c] > BENCH_MAX_CONNECTIONS) {
+            fprintf (stderr, "at most %d connections are supported\n",
+                BENCH_MAX_CONNECTIONS);
+            return 1;
+        }
+    }
+
+    out = stdout;
+    if (output) {
+        out = fopen (output, "w");
+        if (!out) {
+            perror (output);
+            return 1;
+        }
+    }
+
+    run = malloc (sizeof (struct bench_run));
+    alloc_assert (run);
+
+    for (scenario = bench_scenarios; scenario->name; ++scenario) {
+        if (!bench_selected (scenarios, scenario->name))
+            continue;
+        for (t = 0; bench_transports [t]; ++t) {
+            if (!bench_selected (transports, bench_transports [t]))
+                continue;
+            for (m = 0; m != nsizes; ++m) {
+                for (c = 0; c != nconnections; ++c) {
+
+                    /*  PAIR socket accepts a single connection only. */
+                    if (scenario->fn == bench_pair && connections [c] != 1)
+                        continue;
+
+                    memset (run, 0, sizeof (struct bench_run));
+                    run->scenario = scenario->name;
+                    run->metric = scenario->metric;
+                    run->transport = bench_transports [t];
+                    run->size = sizes [m];
+                    run->connections = connections [c];
+                    run->count = count;
+                    nn_hist_init (&run->latency);
+                    if (strcmp (run->transport, "inproc") == 0)
+                        sprintf (run->addr, "inproc://bench");
+                    else if (strcmp (run->transport, "ipc") == 0)
+                        sprintf (run->addr, "ipc://bench.ipc");
+                    else
+                        sprintf (run->addr, "%s://127.0.0.1:%d",
+                            run->transport, port++);
+
+                    scenario->fn (run);
+                    bench_report (out, run);
+                }
+            }
+        }
+    }
+
+    free (run);
+    if (output)
+        fclose (out);
+
+    return 0;
+}
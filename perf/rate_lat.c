@@ -0,0 +1,269 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/tcp.h"
+#include "../src/pair.h"
+
+#include "../src/utils/attr.h"
+
+#include "../src/utils/err.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/sleep.c"
+#include "../src/utils/clock.c"
+#include "../src/utils/hist.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*  Open-loop latency test. Messages are sent at a fixed rate, independently
+    of how fast the replies arrive, and each one carries the time at which
+    it was supposed to be sent according to the schedule. Measuring the
+    latency from that time rather than from the actual send time accounts
+    for the messages that were delayed because the sender was blocked
+    (coordinated omission). The peer echoes the messages back; it can be
+    local_lat running on another box, or a thread in this process. */
+
+/*  Every message starts with its scheduled and its actual send time. */
+#define RATE_LAT_HDR (2 * sizeof (uint64_t))
+
+/*  A percentile is reported only if at least this many samples lie above
+    it, the same rule the bench tool applies. */
+#define RATE_LAT_TAIL_SAMPLES 100
+
+static const char *address;
+static size_t msg_size;
+static int msg_count;
+static int rate;
+
+static void echo (void *arg)
+{
+    int rc;
+    int s;
+    int i;
+    char *buf;
+
+    s = *(int*) arg;
+    buf = malloc (msg_size);
+    nn_assert (buf);
+    for (i = 0; i != msg_count; i++) {
+        rc = nn_recv (s, buf, msg_size, 0);
+        if (rc < 0) {
+            errno_assert (nn_errno () == ETIMEDOUT || nn_errno () == EBADF);
+            break;
+        }
+        rc = nn_send (s, buf, msg_size, 0);
+        if (rc < 0) {
+            errno_assert (nn_errno () == ETIMEDOUT || nn_errno () == EBADF);
+            break;
+        }
+        nn_assert (rc == (int) msg_size);
+    }
+    free (buf);
+}
+
+static void sender (void *arg)
+{
+    int rc;
+    int s;
+    int i;
+    char *buf;
+    uint64_t start;
+    uint64_t scheduled;
+    uint64_t now;
+
+    s = *(int*) arg;
+    buf = malloc (msg_size);
+    nn_assert (buf);
+    memset (buf, 111, msg_size);
+
+    start = nn_clock_us ();
+    for (i = 0; i != msg_count; i++) {
+
+        /*  Wait till the message is due. If we are late, don't try to catch
+            up by skipping messages; the delay is accounted for in the
+            latency of the messages. */
+        scheduled = start + (uint64_t) i * 1000000 / rate;
+        while (1) {
+            now = nn_clock_us ();
+            if (now >= scheduled)
+                break;
+            if (scheduled - now > 2000)
+                nn_sleep ((int) ((scheduled - now) / 1000) - 1);
+        }
+
+        memcpy (buf, &scheduled, sizeof (scheduled));
+        memcpy (buf + sizeof (scheduled), &now, sizeof (now));
+        rc = nn_send (s, buf, msg_size, 0);
+        errno_assert (rc == (int) msg_size);
+    }
+    free (buf);
+}
+
+/*  Prints the percentile, or n/a if there are too few samples to tell it
+    apart from the maximum. */
+static void print_percentile (const char *name, struct nn_hist *hist,
+    int permille)
+{
+    if (hist->count * (1000 - permille) < RATE_LAT_TAIL_SAMPLES * 1000) {
+        printf (", %s n/a", name);
+        return;
+    }
+    printf (", %s %llu", name,
+        (unsigned long long) nn_hist_percentile (hist, permille));
+}
+
+static void print_hist (const char *name, struct nn_hist *hist)
+{
+    printf ("%s latency [us]: mean %llu", name,
+        (unsigned long long) nn_hist_mean (hist));
+    print_percentile ("p50", hist, 500);
+    print_percentile ("p90", hist, 900);
+    print_percentile ("p99", hist, 990);
+    print_percentile ("p99.9", hist, 999);
+    printf (", max %llu\n", (unsigned long long) hist->max);
+}
+
+int main (int argc, char *argv [])
+{
+    int rc;
+    int s;
+    int e;
+    int i;
+    int opt;
+    int local;
+    char *buf;
+    uint64_t now;
+    uint64_t scheduled;
+    uint64_t sent;
+    uint64_t first;
+    struct nn_thread sender_thread;
+    struct nn_thread echo_thread;
+    struct nn_hist corrected;
+    struct nn_hist uncorrected;
+
+    local = argc == 6 && strcmp (argv [1], "-l") == 0;
+    if (argc != 5 + local) {
+        printf ("usage: rate_lat [-l] <connect-to> <msg-size> <msgs-per-sec> "
+            "<msg-count>\n");
+        printf ("  -l  echo the messages from within this process\n");
+        printf ("percentiles with fewer than %d samples above them are "
+            "reported as n/a\n", RATE_LAT_TAIL_SAMPLES);
+        return 1;
+    }
+    address = argv [1 + local];
+    msg_size = atoi (argv [2 + local]);
+    rate = atoi (argv [3 + local]);
+    msg_count = atoi (argv [4 + local]);
+    if (msg_size < RATE_LAT_HDR) {
+        printf ("message size must be at least %d bytes\n",
+            (int) RATE_LAT_HDR);
+        return 1;
+    }
+    if (rate <= 0 || msg_count <= 0) {
+        printf ("rate and message count must be positive\n");
+        return 1;
+    }
+
+    e = -1;
+    if (local) {
+        e = nn_socket (AF_SP, NN_PAIR);
+        nn_assert (e != -1);
+        opt = -1;
+        rc = nn_setsockopt (e, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt,
+            sizeof (opt));
+        nn_assert (rc == 0);
+        opt = 1;
+        rc = nn_setsockopt (e, NN_TCP, NN_TCP_NODELAY, &opt, sizeof (opt));
+        nn_assert (rc == 0);
+        rc = nn_bind (e, address);
+        nn_assert (rc >= 0);
+        nn_thread_init (&echo_thread, echo, &e);
+    }
+
+    s = nn_socket (AF_SP, NN_PAIR);
+    nn_assert (s != -1);
+    opt = -1;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+    opt = 1;
+    rc = nn_setsockopt (s, NN_TCP, NN_TCP_NODELAY, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+    opt = 5000;
+    rc = nn_setsockopt (s, NN_SOL_SOCKET, NN_RCVTIMEO, &opt, sizeof (opt));
+    nn_assert (rc == 0);
+    rc = nn_connect (s, address);
+    nn_assert (rc >= 0);
+
+    /*  Give the connection time to be established. */
+    nn_sleep (100);
+
+    buf = malloc (msg_size);
+    nn_assert (buf);
+    nn_hist_init (&corrected);
+    nn_hist_init (&uncorrected);
+
+    /*  Sending is done in a separate thread, so that it's not held up by
+        the replies. */
+    nn_thread_init (&sender_thread, sender, &s);
+    first = 0;
+    now = 0;
+    for (i = 0; i != msg_count; i++) {
+        rc = nn_recv (s, buf, msg_size, 0);
+        if (rc < 0) {
+            errno_assert (nn_errno () == ETIMEDOUT);
+            break;
+        }
+        nn_assert (rc == (int) msg_size);
+        now = nn_clock_us ();
+        memcpy (&scheduled, buf, sizeof (scheduled));
+        memcpy (&sent, buf + sizeof (scheduled), sizeof (sent));
+        if (i == 0)
+            first = scheduled;
+        nn_hist_record (&corrected, now - scheduled);
+        nn_hist_record (&uncorrected, now - sent);
+    }
+    nn_thread_term (&sender_thread);
+
+    printf ("message size: %d [B]\n", (int) msg_size);
+    printf ("target rate: %d [msg/s]\n", rate);
+    printf ("achieved rate: %.0f [msg/s]\n", now > first ?
+        (double) i * 1000000 / (now - first) : 0.0);
+    printf ("messages lost: %d\n", msg_count - i);
+    print_hist ("corrected", &corrected);
+    print_hist ("uncorrected", &uncorrected);
+
+    free (buf);
+    rc = nn_close (s);
+    nn_assert (rc == 0);
+    if (local) {
+
+        /*  Lost messages leave the echo thread waiting in nn_recv. Closing
+            the socket makes it fail with EBADF so that the thread can exit. */
+        rc = nn_close (e);
+        nn_assert (rc == 0);
+        nn_thread_term (&echo_thread);
+    }
+
+    return 0;
+}
@@ -54,19 +54,25 @@ void nn_ctx_leave (struct nn_ctx *self)
     struct nn_fsm_event *event;
     struct nn_queue eventsto;
 
-    /*  Process any queued events before leaving the context. */
     while (1) {
-        item = nn_queue_pop (&self->events);
-        event = nn_cont (item, struct nn_fsm_event, item);
-        if (!event)
+
+        /*  Process any queued events before leaving the context. */
+        while (1) {
+            item = nn_queue_pop (&self->events);
+            event = nn_cont (item, struct nn_fsm_event, item);
+            if (!event)
+                break;
+            nn_fsm_event_process (event);
+        }
+
+        /*  Notify the owner that we are leaving the context. The owner may
+            raise new events in the process. */
+        if (nn_fast (self->onleave != NULL))
+            self->onleave (self);
+        if (nn_fast (nn_queue_empty (&self->events)))
             break;
-        nn_fsm_event_process (event);
     }
 
-    /*  Notify the owner that we are leaving the context. */
-    if (nn_fast (self->onleave != NULL))
-        self->onleave (self);
-
     /*  Shortcut in the case there are no external events. */
     if (nn_queue_empty (&self->eventsto)) {
         nn_mutex_unlock (&self->sync);
@@ -26,6 +26,7 @@
 
 #include "../utils/err.h"
 #include "../utils/attr.h"
+#include "../utils/trace.h"
 
 #include <stddef.h>
 
@@ -79,11 +80,19 @@ void nn_fsm_event_process (struct nn_fsm_event *self)
 
 void nn_fsm_feed (struct nn_fsm *self, int src, int type, void *srcptr)
 {
+#if defined NN_TRACE
+    uint64_t start;
+
+    start = nn_trace_now ();
+#endif
     if (nn_slow (self->state != NN_FSM_STATE_STOPPING)) {
         self->fn (self, src, type, srcptr);
     } else {
         self->shutdown_fn (self, src, type, srcptr);
     }
+#if defined NN_TRACE
+    nn_trace_record (NN_TRACE_FSM, self, src, type, start);
+#endif
 }
 
 void nn_fsm_init_root (struct nn_fsm *self, nn_fsm_fn fn,
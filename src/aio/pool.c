@@ -22,20 +22,50 @@
 
 #include "pool.h"
 
-/*  TODO: The dummy implementation of a thread pool. As for now there's only
-    one worker thread created. */
+#include "../utils/err.h"
+#include "../utils/fast.h"
+
+#include <stdlib.h>
 
 int nn_pool_init (struct nn_pool *self)
 {
-    return nn_worker_init (&self->worker);
+    int rc;
+    int i;
+    const char *envvar;
+
+    envvar = getenv ("NN_WORKERS");
+    self->nworkers = envvar ? atoi (envvar) : 1;
+    if (self->nworkers < 1)
+        self->nworkers = 1;
+    if (self->nworkers > NN_POOL_MAX_WORKERS)
+        self->nworkers = NN_POOL_MAX_WORKERS;
+    nn_atomic_init (&self->next, 0);
+
+    for (i = 0; i != self->nworkers; ++i) {
+        rc = nn_worker_init (&self->workers [i]);
+        if (nn_slow (rc < 0)) {
+            while (i--)
+                nn_worker_term (&self->workers [i]);
+            nn_atomic_term (&self->next);
+            return rc;
+        }
+    }
+
+    return 0;
 }
 
 void nn_pool_term (struct nn_pool *self)
 {
-    nn_worker_term (&self->worker);
+    int i;
+
+    for (i = 0; i != self->nworkers; ++i)
+        nn_worker_term (&self->workers [i]);
+    nn_atomic_term (&self->next);
 }
 
 struct nn_worker *nn_pool_choose_worker (struct nn_pool *self)
 {
-    return &self->worker;
+    if (nn_fast (self->nworkers == 1))
+        return &self->workers [0];
+    return &self->workers [nn_atomic_inc (&self->next, 1) % self->nworkers];
 }
@@ -25,10 +25,22 @@
 
 #include "worker.h"
 
-/*  Worker thread pool. */
+#include "../utils/atomic.h"
+
+/*  Maximum number of worker threads in the pool. */
+#define NN_POOL_MAX_WORKERS 16
+
+/*  Worker thread pool. The number of workers is taken from the NN_WORKERS
+    environment variable and defaults to one. Objects are assigned to
+    the workers in round-robin fashion. Note that the workers only wait for
+    events in parallel; handling an event requires the lock (nn_ctx) of the
+    socket the object belongs to, so all the objects of a single socket are
+    still processed one at a time. */
 
 struct nn_pool {
-    struct nn_worker worker;
+    struct nn_worker workers [NN_POOL_MAX_WORKERS];
+    int nworkers;
+    struct nn_atomic next;
 };
 
 int nn_pool_init (struct nn_pool *self);
@@ -91,4 +91,9 @@ void nn_usock_recv (struct nn_usock *self, void *buf, size_t len, int *fd);
 
 int nn_usock_geterrno (struct nn_usock *self);
 
+/*  Retrieve the address of the connected peer. On input 'addrlen' is the size
+    of the 'addr' buffer, on output it's the size of the address. */
+int nn_usock_getpeer (struct nn_usock *self, struct sockaddr *addr,
+    size_t *addrlen);
+
 #endif
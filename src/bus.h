@@ -31,6 +31,9 @@ extern "C" {
 
 #define NN_BUS (NN_PROTO_BUS * 16 + 0)
 
+#define NN_BUS_DEDUP 1
+#define NN_BUS_DEDUP_MAX 2
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,398 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "async.h"
+#include "sock.h"
+
+#include "../utils/err.h"
+#include "../utils/attr.h"
+#include "../utils/alloc.h"
+#include "../utils/cont.h"
+#include "../utils/fast.h"
+#include "../utils/clock.h"
+
+/*  Source ID and type of the events raised by the socket to the completion
+    context. */
+#define NN_ASYNC_SRC_OP 1
+#define NN_ASYNC_DONE 1
+
+/*  Private functions. */
+static void nn_async_handler (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_async_shutdown (struct nn_fsm *self, int src, int type,
+    void *srcptr);
+static void nn_async_onleave (struct nn_ctx *ctx);
+static void nn_async_done (struct nn_async *self, struct nn_async_op *op);
+static void nn_async_dispatch (struct nn_async *self);
+static void nn_async_invoke (struct nn_async_op *op);
+
+void nn_async_init (struct nn_async *self, struct nn_sock *sock)
+{
+    self->sock = sock;
+    nn_queue_init (&self->recvs);
+    nn_queue_init (&self->sends);
+    nn_ctx_init (&self->ctx, sock->ctx.pool, nn_async_onleave);
+    nn_fsm_init_root (&self->fsm, nn_async_handler, nn_async_shutdown,
+        &self->ctx);
+    nn_fsm_event_init (&self->done);
+    nn_mutex_init (&self->sync);
+    nn_queue_init (&self->completed);
+    self->notifying = 0;
+    self->delivered = 0;
+    self->dispatching = 0;
+    self->outstanding = 0;
+    self->closing = 0;
+    nn_sem_init (&self->idle);
+
+    /*  The object is not visible to other threads yet, so the state machine
+        can be started without entering the context. */
+    nn_fsm_start (&self->fsm);
+}
+
+void nn_async_term (struct nn_async *self)
+{
+    int rc;
+    int busy;
+    struct nn_queue_item *item;
+    struct nn_async_op *op;
+
+    /*  The socket is stopped at this point, so no other thread accesses
+        the pending queues any more. Fail the operations that are still
+        waiting. */
+    nn_mutex_lock (&self->sync);
+    while (1) {
+        item = nn_queue_pop (&self->recvs);
+        if (!item)
+            item = nn_queue_pop (&self->sends);
+        if (!item)
+            break;
+        op = nn_cont (item, struct nn_async_op, item);
+        op->rc = -EBADF;
+        nn_queue_push (&self->completed, &op->item);
+    }
+    nn_mutex_unlock (&self->sync);
+    nn_ctx_enter (&self->ctx);
+    nn_async_dispatch (self);
+    nn_ctx_leave (&self->ctx);
+
+    /*  The 'done' event may still be in flight and other threads may be
+        invoking the callbacks. Wait till they are done. */
+    nn_mutex_lock (&self->sync);
+    self->closing = 1;
+    busy = self->outstanding || self->notifying;
+    nn_mutex_unlock (&self->sync);
+    while (busy) {
+        rc = nn_sem_wait (&self->idle);
+        if (nn_slow (rc == -EINTR))
+            continue;
+        errnum_assert (rc == 0, -rc);
+        nn_mutex_lock (&self->sync);
+        busy = self->outstanding || self->notifying;
+        nn_mutex_unlock (&self->sync);
+    }
+
+    /*  The thread that posted the semaphore can still have the context
+        locked for a short while. */
+    nn_ctx_enter (&self->ctx);
+    nn_fsm_stop (&self->fsm);
+    nn_ctx_leave (&self->ctx);
+
+    nn_sem_term (&self->idle);
+    nn_queue_term (&self->completed);
+    nn_mutex_term (&self->sync);
+    nn_fsm_event_term (&self->done);
+    nn_fsm_term (&self->fsm);
+    nn_ctx_term (&self->ctx);
+    nn_queue_term (&self->sends);
+    nn_queue_term (&self->recvs);
+}
+
+struct nn_async_op *nn_async_op_alloc (int s, nn_async_fn fn, void *arg,
+    struct nn_msg *msg)
+{
+    struct nn_async_op *self;
+
+    self = nn_alloc (sizeof (struct nn_async_op), "async operation");
+    if (nn_slow (!self))
+        return NULL;
+    nn_queue_item_init (&self->item);
+    self->s = s;
+    self->fn = fn;
+    self->arg = arg;
+    self->rc = 0;
+    self->stamp = 0;
+    if (msg) {
+        self->send = 1;
+        nn_msg_mv (&self->msg, msg);
+    }
+    else {
+        self->send = 0;
+        nn_msg_init (&self->msg, 0);
+    }
+    return self;
+}
+
+void nn_async_op_free (struct nn_async_op *self)
+{
+    nn_msg_term (&self->msg);
+    nn_queue_item_term (&self->item);
+    nn_free (self);
+}
+
+void nn_async_submit (struct nn_async *self, struct nn_async_op *op)
+{
+    nn_mutex_lock (&self->sync);
+    ++self->outstanding;
+    nn_mutex_unlock (&self->sync);
+
+    if (op->send) {
+        op->stamp = nn_clock_us ();
+        nn_queue_push (&self->sends, &op->item);
+        nn_async_out (self);
+    }
+    else {
+        nn_queue_push (&self->recvs, &op->item);
+        nn_async_in (self);
+    }
+}
+
+int nn_async_in (struct nn_async *self)
+{
+    int rc;
+    int done;
+    struct nn_sockbase *sockbase;
+    struct nn_queue_item *item;
+    struct nn_async_op *op;
+    struct nn_msg msg;
+
+    sockbase = self->sock->sockbase;
+    done = 0;
+    while (!nn_queue_empty (&self->recvs)) {
+        rc = sockbase->vfptr->recv (sockbase, &msg);
+        if (rc == -EAGAIN)
+            break;
+
+        /*  Operations are completed in the order they were submitted. Any
+            error other than EAGAIN fails the operation, same as with
+            nn_recv. */
+        item = nn_queue_pop (&self->recvs);
+        op = nn_cont (item, struct nn_async_op, item);
+        if (nn_fast (rc == 0)) {
+            nn_msg_term (&op->msg);
+            nn_msg_mv (&op->msg, &msg);
+            op->rc = (int) nn_chunkref_size (&op->msg.body);
+            nn_sock_stat_increment (self->sock, NN_STAT_MESSAGES_RECEIVED, 1);
+            nn_sock_stat_increment (self->sock, NN_STAT_BYTES_RECEIVED,
+                op->rc);
+        }
+        else
+            op->rc = rc;
+        nn_async_done (self, op);
+        done = 1;
+    }
+
+    return done;
+}
+
+int nn_async_out (struct nn_async *self)
+{
+    int rc;
+    int done;
+    size_t sz;
+    struct nn_sockbase *sockbase;
+    struct nn_async_op *op;
+
+    sockbase = self->sock->sockbase;
+    done = 0;
+    while (!nn_queue_empty (&self->sends)) {
+        op = nn_cont (self->sends.head, struct nn_async_op, item);
+        sz = nn_chunkref_size (&op->msg.body);
+
+        /*  The pipe the message ends up in uses the timestamp to measure
+            send latency. */
+        self->sock->sendstamp = op->stamp;
+        rc = sockbase->vfptr->send (sockbase, &op->msg);
+        self->sock->sendstamp = 0;
+        if (rc == -EAGAIN)
+            break;
+
+        nn_queue_pop (&self->sends);
+        if (nn_fast (rc == 0)) {
+
+            /*  The message was handed over to the socket. */
+            nn_msg_init (&op->msg, 0);
+            op->rc = (int) sz;
+            nn_sock_stat_increment (self->sock, NN_STAT_MESSAGES_SENT, 1);
+            nn_sock_stat_increment (self->sock, NN_STAT_BYTES_SENT, sz);
+        }
+        else
+            op->rc = rc;
+        nn_async_done (self, op);
+        done = 1;
+    }
+
+    return done;
+}
+
+static void nn_async_done (struct nn_async *self, struct nn_async_op *op)
+{
+    int notify;
+
+    /*  The callback can't be invoked from within the socket context as it
+        would not be able to use the socket. Pass the operation to
+        the completion context. The event is processed once the socket
+        context is left. If a thread is invoking the callbacks at the moment,
+        it will pick up the operation once it's done with the current one.
+        This also prevents a callback that submits an operation which
+        completes straight away from entering the completion context
+        recursively. */
+    nn_mutex_lock (&self->sync);
+    nn_queue_push (&self->completed, &op->item);
+    notify = !self->notifying && !self->dispatching;
+    if (notify)
+        self->notifying = 1;
+    nn_mutex_unlock (&self->sync);
+
+    if (notify)
+        nn_fsm_raiseto (&self->sock->fsm, &self->fsm, &self->done,
+            NN_ASYNC_SRC_OP, NN_ASYNC_DONE, NULL);
+}
+
+static void nn_async_onleave (struct nn_ctx *ctx)
+{
+    struct nn_async *self;
+
+    self = nn_cont (ctx, struct nn_async, ctx);
+
+    /*  The 'done' event is not referred to by the thread that delivered it
+        any more, so it can be raised anew. Operations that were completed
+        in the meantime didn't raise it, so pick them up now. */
+    if (!self->delivered)
+        return;
+    self->delivered = 0;
+    nn_mutex_lock (&self->sync);
+    while (!nn_queue_empty (&self->completed)) {
+        nn_mutex_unlock (&self->sync);
+        nn_async_dispatch (self);
+        nn_mutex_lock (&self->sync);
+    }
+    self->notifying = 0;
+    if (nn_slow (self->closing && !self->outstanding && !self->dispatching))
+        nn_sem_post (&self->idle);
+    nn_mutex_unlock (&self->sync);
+}
+
+static void nn_async_dispatch (struct nn_async *self)
+{
+    struct nn_queue_item *item;
+
+    nn_mutex_lock (&self->sync);
+    if (nn_slow (self->dispatching)) {
+        nn_mutex_unlock (&self->sync);
+        return;
+    }
+    self->dispatching = 1;
+
+    while (1) {
+        item = nn_queue_pop (&self->completed);
+        if (!item)
+            break;
+        nn_mutex_unlock (&self->sync);
+        nn_async_invoke (nn_cont (item, struct nn_async_op, item));
+        nn_mutex_lock (&self->sync);
+        --self->outstanding;
+    }
+
+    self->dispatching = 0;
+    if (nn_slow (self->closing && !self->outstanding && !self->notifying))
+        nn_sem_post (&self->idle);
+    nn_mutex_unlock (&self->sync);
+}
+
+static void nn_async_invoke (struct nn_async_op *op)
+{
+    int s;
+    int rc;
+    void *chunk;
+    nn_async_fn fn;
+    void *arg;
+
+    /*  Received messages are passed to the user. Messages that failed to be
+        sent are passed back to the user. */
+    chunk = NULL;
+    if (op->send ? op->rc < 0 : op->rc >= 0)
+        chunk = nn_chunkref_getchunk (&op->msg.body);
+
+    s = op->s;
+    rc = op->rc;
+    fn = op->fn;
+    arg = op->arg;
+    nn_async_op_free (op);
+
+    if (rc < 0) {
+        errno = -rc;
+        rc = -1;
+    }
+    fn (s, rc, chunk, arg);
+}
+
+static void nn_async_handler (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    struct nn_async *async;
+
+    async = nn_cont (self, struct nn_async, fsm);
+
+    switch (src) {
+    case NN_FSM_ACTION:
+        switch (type) {
+        case NN_FSM_START:
+            return;
+        default:
+            nn_fsm_bad_action (self->state, src, type);
+        }
+
+    case NN_ASYNC_SRC_OP:
+        switch (type) {
+        case NN_ASYNC_DONE:
+            async->delivered = 1;
+            nn_async_dispatch (async);
+            return;
+        default:
+            nn_fsm_bad_action (self->state, src, type);
+        }
+
+    default:
+        nn_fsm_bad_source (self->state, src, type);
+    }
+}
+
+static void nn_async_shutdown (struct nn_fsm *self, int src, int type,
+    NN_UNUSED void *srcptr)
+{
+    if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
+        nn_fsm_stopped_noevent (self);
+        return;
+    }
+
+    nn_fsm_bad_state (self->state, src, type);
+}
@@ -0,0 +1,142 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_ASYNC_INCLUDED
+#define NN_ASYNC_INCLUDED
+
+#include "../nn.h"
+
+#include "../aio/ctx.h"
+#include "../aio/fsm.h"
+
+#include "../utils/msg.h"
+#include "../utils/mutex.h"
+#include "../utils/queue.h"
+#include "../utils/sem.h"
+
+#include <stdint.h>
+
+/*  Asynchronous send and receive operations. Operations submitted by the user
+    are queued in the socket and completed from within the socket context,
+    typically by the worker thread that processes the incoming or outgoing
+    pipe event. Completed operations are handed over to a separate completion
+    context using a cross-context event and the user callbacks are invoked
+    from there, with the socket context unlocked. Callbacks of a single socket
+    are never invoked concurrently and are invoked in the order
+    the operations completed. */
+
+struct nn_sock;
+
+struct nn_async_op {
+
+    /*  The operation is either in one of the socket's pending queues or in
+        the queue of completed operations. */
+    struct nn_queue_item item;
+
+    /*  1 for send operations, 0 for receive operations. */
+    int send;
+
+    /*  Socket handle, callback and its argument as supplied by the user. */
+    int s;
+    nn_async_fn fn;
+    void *arg;
+
+    /*  Size of the message on success, negative error number otherwise. */
+    int rc;
+
+    /*  Message to send or the message received. */
+    struct nn_msg msg;
+
+    /*  Time the send operation was submitted, for latency statistics. */
+    uint64_t stamp;
+};
+
+struct nn_async {
+
+    /*  The socket the operations are submitted to. */
+    struct nn_sock *sock;
+
+    /*  Operations waiting to be completed. Accessed only from within
+        the socket context. */
+    struct nn_queue recvs;
+    struct nn_queue sends;
+
+    /*  Completion context. The callbacks are invoked by its state
+        machine. */
+    struct nn_ctx ctx;
+    struct nn_fsm fsm;
+
+    /*  Raised to the completion context when there are new completed
+        operations. */
+    struct nn_fsm_event done;
+
+    /*  Guards the following fields. The queue is filled from the socket
+        context and drained from the completion context. */
+    struct nn_mutex sync;
+
+    /*  Completed operations whose callbacks were not yet invoked. */
+    struct nn_queue completed;
+
+    /*  Set while the 'done' event is in flight. The thread that delivers
+        the event refers to it till it leaves the completion context, so
+        the flag is cleared only then. */
+    int notifying;
+
+    /*  Set by the completion context once it processed the 'done' event.
+        Accessed only from within the completion context. */
+    int delivered;
+
+    /*  Set while a thread is invoking the callbacks. */
+    int dispatching;
+
+    /*  Number of submitted operations whose callbacks haven't returned yet. */
+    int outstanding;
+
+    /*  Set when the socket is being deallocated. */
+    int closing;
+
+    /*  Posted when the last outstanding operation is done while closing. */
+    struct nn_sem idle;
+};
+
+void nn_async_init (struct nn_async *self, struct nn_sock *sock);
+
+/*  Fails the operations that were not completed with EBADF and waits till
+    all the callbacks return. Called when the socket is deallocated. */
+void nn_async_term (struct nn_async *self);
+
+/*  Allocate an operation. The message of a send operation is moved into
+    the operation. */
+struct nn_async_op *nn_async_op_alloc (int s, nn_async_fn fn, void *arg,
+    struct nn_msg *msg);
+void nn_async_op_free (struct nn_async_op *self);
+
+/*  Following functions are called by the socket from within its context.
+    nn_async_submit queues a new operation and tries to complete it straight
+    away. nn_async_in and nn_async_out complete pending operations while
+    the socket is readable or writable. They return 1 if any operation was
+    completed, 0 otherwise. */
+void nn_async_submit (struct nn_async *self, struct nn_async_op *op);
+int nn_async_in (struct nn_async *self);
+int nn_async_out (struct nn_async *self);
+
+#endif
@@ -58,6 +58,7 @@ int nn_ep_init (struct nn_ep *self, int src, struct nn_sock *sock, int eid,
     self->sock = sock;
     self->eid = eid;
     self->last_errno = 0;
+    self->bind = bind;
     nn_list_item_init (&self->item);
     memcpy (&self->options, &sock->ep_template, sizeof(struct nn_ep_options));
 
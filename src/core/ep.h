@@ -43,6 +43,9 @@ struct nn_ep {
     char addr [NN_SOCKADDR_MAX + 1];
     int protocol;
 
+    /*  1 if the endpoint was created by nn_bind, 0 if by nn_connect. */
+    int bind;
+
     /*  Error state for endpoint */
     int last_errno;
 
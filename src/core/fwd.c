@@ -0,0 +1,257 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "fwd.h"
+#include "sock.h"
+
+#include "../nn.h"
+
+#include "../utils/err.h"
+#include "../utils/fast.h"
+
+/*  The 'pushed' event is in flight. */
+#define NN_FWD_FLAG_PUSHING 1
+
+/*  The 'drained' event is in flight. */
+#define NN_FWD_FLAG_DRAINING 2
+
+/*  The source socket stopped receiving messages because the queue was
+    full. */
+#define NN_FWD_FLAG_STALLED 4
+
+/*  nn_fwd_term was called. */
+#define NN_FWD_FLAG_CLOSING 8
+
+int nn_fwd_init (struct nn_fwd *self, struct nn_sock *src,
+    struct nn_sock *dst, struct nn_sem *stopsem)
+{
+    int rc;
+
+    self->src = src;
+    self->dst = dst;
+    self->stopsem = stopsem;
+    nn_mutex_init (&self->sync);
+    self->head = 0;
+    self->count = 0;
+    self->flags = 0;
+    nn_sem_init (&self->idle);
+    nn_fsm_event_init (&self->pushed);
+    nn_fsm_event_init (&self->drained);
+
+    /*  Destination has to be attached first so that it's able to handle
+        the messages received from the source straight away. */
+    rc = nn_sock_setfwd (dst, self, 0);
+    if (nn_slow (rc < 0))
+        goto fail;
+    rc = nn_sock_setfwd (src, self, 1);
+    if (nn_slow (rc < 0)) {
+        nn_sock_setfwd (dst, NULL, 0);
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    nn_fsm_event_term (&self->drained);
+    nn_fsm_event_term (&self->pushed);
+    nn_sem_term (&self->idle);
+    nn_mutex_term (&self->sync);
+    return rc;
+}
+
+void nn_fwd_term (struct nn_fwd *self)
+{
+    int rc;
+    int busy;
+
+    /*  Detach from the sockets. From now on they won't pass any new events
+        to the object. */
+    nn_sock_setfwd (self->src, NULL, 1);
+    nn_sock_setfwd (self->dst, NULL, 0);
+
+    /*  There may still be events in flight. Wait till they are processed. */
+    nn_mutex_lock (&self->sync);
+    self->flags |= NN_FWD_FLAG_CLOSING;
+    busy = self->flags & (NN_FWD_FLAG_PUSHING | NN_FWD_FLAG_DRAINING);
+    nn_mutex_unlock (&self->sync);
+    while (busy) {
+        rc = nn_sem_wait (&self->idle);
+        if (nn_slow (rc == -EINTR))
+            continue;
+        errnum_assert (rc == 0, -rc);
+        nn_mutex_lock (&self->sync);
+        busy = self->flags & (NN_FWD_FLAG_PUSHING | NN_FWD_FLAG_DRAINING);
+        nn_mutex_unlock (&self->sync);
+    }
+
+    /*  Threads that processed the events can still have the contexts locked
+        for a short while. Entering the contexts makes sure they are gone. */
+    nn_ctx_enter (nn_sock_getctx (self->src));
+    nn_ctx_leave (nn_sock_getctx (self->src));
+    nn_ctx_enter (nn_sock_getctx (self->dst));
+    nn_ctx_leave (nn_sock_getctx (self->dst));
+
+    /*  Drop the messages that were not forwarded. */
+    while (self->count) {
+        nn_msg_term (&self->queue [self->head]);
+        self->head = (self->head + 1) % NN_FWD_QUEUE_SIZE;
+        --self->count;
+    }
+
+    nn_fsm_event_term (&self->drained);
+    nn_fsm_event_term (&self->pushed);
+    nn_sem_term (&self->idle);
+    nn_mutex_term (&self->sync);
+}
+
+void nn_fwd_pull (struct nn_fwd *self)
+{
+    int rc;
+    int notify;
+    int tail;
+    struct nn_msg msg;
+
+    notify = 0;
+    while (1) {
+
+        /*  If the queue is full, wait till the destination drains it. */
+        nn_mutex_lock (&self->sync);
+        if (nn_slow (self->count == NN_FWD_QUEUE_SIZE)) {
+            self->flags |= NN_FWD_FLAG_STALLED;
+            nn_mutex_unlock (&self->sync);
+            break;
+        }
+        tail = (self->head + self->count) % NN_FWD_QUEUE_SIZE;
+        nn_mutex_unlock (&self->sync);
+
+        rc = self->src->sockbase->vfptr->recv (self->src->sockbase, &msg);
+        if (rc < 0)
+            break;
+        nn_sock_stat_increment (self->src, NN_STAT_MESSAGES_RECEIVED, 1);
+        nn_sock_stat_increment (self->src, NN_STAT_BYTES_RECEIVED,
+            nn_chunkref_size (&msg.body));
+
+        /*  Only the source adds messages to the queue, so the slot can be
+            filled in without holding the lock. */
+        nn_msg_mv (&self->queue [tail], &msg);
+
+        nn_mutex_lock (&self->sync);
+        ++self->count;
+        if (!(self->flags & NN_FWD_FLAG_PUSHING)) {
+            self->flags |= NN_FWD_FLAG_PUSHING;
+            notify = 1;
+        }
+        nn_mutex_unlock (&self->sync);
+    }
+
+    if (notify)
+        nn_fsm_raiseto (&self->src->fsm, &self->dst->fsm, &self->pushed,
+            NN_SOCK_SRC_FWD, NN_FWD_PUSHED, self);
+}
+
+void nn_fwd_push (struct nn_fwd *self)
+{
+    int rc;
+    int notify;
+    size_t sz;
+    struct nn_msg *msg;
+
+    notify = 0;
+    while (1) {
+        nn_mutex_lock (&self->sync);
+        if (self->count == 0) {
+            nn_mutex_unlock (&self->sync);
+            break;
+        }
+        nn_mutex_unlock (&self->sync);
+
+        /*  Only the destination removes messages from the queue, so
+            the message at the head can be accessed without holding
+            the lock. */
+        msg = &self->queue [self->head];
+        sz = nn_chunkref_size (&msg->body);
+        rc = self->dst->sockbase->vfptr->send (self->dst->sockbase, msg);
+        if (rc == -EAGAIN)
+            break;
+        if (nn_fast (rc == 0)) {
+            nn_sock_stat_increment (self->dst, NN_STAT_MESSAGES_SENT, 1);
+            nn_sock_stat_increment (self->dst, NN_STAT_BYTES_SENT, sz);
+        }
+        else
+            nn_msg_term (msg);
+
+        /*  Once the queue is half empty, let the source know it can
+            continue receiving. */
+        nn_mutex_lock (&self->sync);
+        self->head = (self->head + 1) % NN_FWD_QUEUE_SIZE;
+        --self->count;
+        if (self->flags & NN_FWD_FLAG_STALLED &&
+              !(self->flags & NN_FWD_FLAG_DRAINING) &&
+              self->count <= NN_FWD_QUEUE_SIZE / 2) {
+            self->flags &= ~NN_FWD_FLAG_STALLED;
+            self->flags |= NN_FWD_FLAG_DRAINING;
+            notify = 1;
+        }
+        nn_mutex_unlock (&self->sync);
+    }
+
+    if (notify)
+        nn_fsm_raiseto (&self->dst->fsm, &self->src->fsm, &self->drained,
+            NN_SOCK_SRC_FWD, NN_FWD_DRAINED, self);
+}
+
+void nn_fwd_event (struct nn_fwd *self, int type, int active)
+{
+    int closing;
+
+    nn_mutex_lock (&self->sync);
+    switch (type) {
+    case NN_FWD_PUSHED:
+        self->flags &= ~NN_FWD_FLAG_PUSHING;
+        break;
+    case NN_FWD_DRAINED:
+        self->flags &= ~NN_FWD_FLAG_DRAINING;
+        break;
+    default:
+        nn_assert (0);
+    }
+    closing = self->flags & NN_FWD_FLAG_CLOSING;
+    nn_mutex_unlock (&self->sync);
+
+    /*  The object is being closed and it's waiting for the event. */
+    if (closing) {
+        nn_sem_post (&self->idle);
+        return;
+    }
+
+    if (!active)
+        return;
+    if (type == NN_FWD_PUSHED)
+        nn_fwd_push (self);
+    else
+        nn_fwd_pull (self);
+}
+
+void nn_fwd_stopped (struct nn_fwd *self)
+{
+    nn_sem_post (self->stopsem);
+}
@@ -0,0 +1,97 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_FWD_INCLUDED
+#define NN_FWD_INCLUDED
+
+#include "../aio/fsm.h"
+
+#include "../utils/msg.h"
+#include "../utils/mutex.h"
+#include "../utils/sem.h"
+
+/*  In-library device. Moves messages from one socket to another directly
+    in the worker threads, without handing them to the user. Messages are
+    received from 'src' socket in its context and stored in a small queue.
+    From there they are sent to 'dst' socket in its context. The two
+    contexts are never locked at the same time; they notify each other
+    using cross-context events instead. */
+
+/*  Events sent by nn_fwd to the sockets. */
+#define NN_FWD_PUSHED 1
+#define NN_FWD_DRAINED 2
+
+/*  Maximum number of messages waiting to be sent to the destination. */
+#define NN_FWD_QUEUE_SIZE 64
+
+struct nn_sock;
+
+struct nn_fwd {
+
+    /*  Messages are moved from 'src' socket to 'dst' socket. */
+    struct nn_sock *src;
+    struct nn_sock *dst;
+
+    /*  Posted when either of the sockets is being closed. */
+    struct nn_sem *stopsem;
+
+    /*  Guards the queue and the flags. The queue is filled from the context
+        of 'src' and drained from the context of 'dst'. */
+    struct nn_mutex sync;
+    struct nn_msg queue [NN_FWD_QUEUE_SIZE];
+    int head;
+    int count;
+    int flags;
+
+    /*  Posted when an event that was in flight while closing the object
+        is processed. */
+    struct nn_sem idle;
+
+    /*  'pushed' is raised to 'dst' when there are new messages in the queue.
+        'drained' is raised to 'src' when the queue, previously full, has
+        enough space again. */
+    struct nn_fsm_event pushed;
+    struct nn_fsm_event drained;
+};
+
+/*  Start forwarding messages from 'src' to 'dst'. The sockets must be held
+    by the caller till nn_fwd_term returns. */
+int nn_fwd_init (struct nn_fwd *self, struct nn_sock *src,
+    struct nn_sock *dst, struct nn_sem *stopsem);
+
+/*  Stop forwarding. Messages still in the queue are dropped. */
+void nn_fwd_term (struct nn_fwd *self);
+
+/*  Following functions are called by the sockets from within their
+    contexts. nn_fwd_pull moves messages from the source socket to the
+    queue, nn_fwd_push moves them from the queue to the destination socket. */
+void nn_fwd_pull (struct nn_fwd *self);
+void nn_fwd_push (struct nn_fwd *self);
+
+/*  Handle an event sent by nn_fwd. If 'active' is 0, the socket is no longer
+    forwarding messages and the event is simply acknowledged. */
+void nn_fwd_event (struct nn_fwd *self, int type, int active);
+
+/*  Called by the socket when it is being closed. */
+void nn_fwd_stopped (struct nn_fwd *self);
+
+#endif
@@ -29,6 +29,7 @@
 #include "global.h"
 #include "sock.h"
 #include "ep.h"
+#include "fwd.h"
 
 #include "../aio/pool.h"
 #include "../aio/timer.h"
@@ -44,11 +45,14 @@
 #include "../utils/chunk.h"
 #include "../utils/msg.h"
 #include "../utils/attr.h"
+#include "../utils/thread.h"
+#include "../utils/efd.h"
 
 #include "../pubsub.h"
 #include "../pipeline.h"
 
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -64,6 +68,12 @@
 #define NN_MAX_SOCKETS 512
 #endif
 
+/*  Default interval between two statistics reports, in milliseconds. */
+#define NN_STATISTICS_INTERVAL 10000
+
+/*  Maximum size of a single statistics report. */
+#define NN_STATISTICS_BUFSZ 4096
+
 /*  To save some space, list of unused socket slots uses uint16_t integers to
     refer to individual sockets. If there's a need to more that 0x10000 sockets,
     the type should be changed to uint32_t or int. */
@@ -163,8 +173,18 @@ struct nn_global {
     /*  Pool of worker threads. */
     struct nn_pool pool;
 
-    /*  Timer and other machinery for submitting statistics  */
-    int state;
+    /*  Thread and other machinery for submitting statistics  */
+    struct {
+        char addr [NN_SOCKADDR_MAX];
+        int interval;
+        int running;
+        int stopping;
+        struct nn_sock *sock;
+        struct nn_efd efd;
+        struct nn_thread thread;
+        char hostname [64];
+        char appname [64];
+    } statistics;
 
     int print_errors;
 
@@ -195,6 +215,15 @@ static int nn_global_hold_socket (struct nn_sock **sockp, int s);
 static int nn_global_hold_socket_locked (struct nn_sock **sockp, int s);
 static void nn_global_rele_socket(struct nn_sock *);
 
+/*  Statistics reporting. */
+static void nn_global_start_statistics (void);
+static void nn_global_stop_statistics (void);
+static void nn_global_statistics_routine (void *arg);
+static void nn_global_submit_statistics (const int *ids, const char **names,
+    int nids);
+static int nn_global_get_stat (struct nn_sock *sock, int statistic,
+    uint64_t *val);
+
 int nn_errno (void)
 {
     return nn_err_errno ();
@@ -248,6 +277,28 @@ static void nn_global_init (void)
     /*  any non-empty string is true */
     self.print_errors = envvar && *envvar;
 
+    /*  Periodically publish statistics of all sockets to this address  */
+    self.statistics.addr [0] = 0;
+    envvar = getenv("NN_STATISTICS_SOCKET");
+    if (envvar && strlen (envvar) < NN_SOCKADDR_MAX)
+        strcpy (self.statistics.addr, envvar);
+    envvar = getenv("NN_STATISTICS_INTERVAL");
+    self.statistics.interval = envvar ? atoi (envvar) : 0;
+    if (self.statistics.interval <= 0)
+        self.statistics.interval = NN_STATISTICS_INTERVAL;
+    envvar = getenv("NN_APPLICATION_NAME");
+    if (envvar && *envvar)
+        sprintf (self.statistics.appname, "%.63s", envvar);
+    else
+#if defined NN_HAVE_WINDOWS
+        sprintf (self.statistics.appname, "%d",
+            (int) GetCurrentProcessId ());
+#else
+        sprintf (self.statistics.appname, "%d", (int) getpid ());
+#endif
+    self.statistics.running = 0;
+    self.statistics.stopping = 0;
+
     /*  Allocate the stack of unused file descriptors. */
     self.unused = (uint16_t*) (self.socks + NN_MAX_SOCKETS);
     alloc_assert (self.unused);
@@ -263,6 +314,9 @@ static void nn_global_init (void)
 
     /*  Start the worker threads. */
     nn_pool_init (&self.pool);
+
+    if (self.statistics.addr [0])
+        nn_global_start_statistics ();
 }
 
 static void nn_global_term (void)
@@ -278,6 +332,21 @@ static void nn_global_term (void)
     if (self.nsocks > 0)
         return;
 
+    /*  The statistics thread uses the global lock, so the lock has to be
+        released while waiting for the thread to finish. A new socket may
+        be created in the meantime, in which case the library stays alive.
+        If it's closed again in the meantime, the thread stopping the
+        statistics will take care of the termination. */
+    if (self.statistics.stopping)
+        return;
+    if (self.statistics.running) {
+        nn_global_stop_statistics ();
+        if (self.nsocks > 0) {
+            nn_global_start_statistics ();
+            return;
+        }
+    }
+
     /*  Shut down the worker threads. */
     nn_pool_term (&self.pool);
 
@@ -679,6 +748,60 @@ int nn_shutdown (int s, int how)
     return 0;
 }
 
+int nn_global_forward (int s1, int s2, int twoway)
+{
+    int rc;
+    struct nn_sock *sock1;
+    struct nn_sock *sock2;
+    struct nn_sem stopsem;
+    struct nn_fwd fwd1;
+    struct nn_fwd fwd2;
+
+    /*  The sockets are held while the device is running. Thus, closing
+        either of them blocks till the device exits. */
+    rc = nn_global_hold_socket (&sock1, s1);
+    if (nn_slow (rc < 0))
+        return rc;
+    rc = nn_global_hold_socket (&sock2, s2);
+    if (nn_slow (rc < 0)) {
+        nn_global_rele_socket (sock1);
+        return rc;
+    }
+
+    nn_sem_init (&stopsem);
+    rc = nn_fwd_init (&fwd1, sock1, sock2, &stopsem);
+    if (nn_slow (rc < 0))
+        goto fail;
+    if (twoway) {
+        rc = nn_fwd_init (&fwd2, sock2, sock1, &stopsem);
+        if (nn_slow (rc < 0)) {
+            nn_fwd_term (&fwd1);
+            goto fail;
+        }
+    }
+
+    /*  Messages are forwarded by the worker threads. Wait till one of
+        the sockets is closed. */
+    while (1) {
+        rc = nn_sem_wait (&stopsem);
+        if (nn_slow (rc == -EINTR))
+            continue;
+        errnum_assert (rc == 0, -rc);
+        break;
+    }
+
+    if (twoway)
+        nn_fwd_term (&fwd2);
+    nn_fwd_term (&fwd1);
+    rc = -EBADF;
+
+fail:
+    nn_sem_term (&stopsem);
+    nn_global_rele_socket (sock2);
+    nn_global_rele_socket (sock1);
+    return rc;
+}
+
 int nn_send (int s, const void *buf, size_t len, int flags)
 {
     struct nn_iovec iov;
@@ -984,74 +1107,235 @@ fail:
     return -1;
 }
 
-uint64_t nn_get_statistic (int s, int statistic)
+int nn_recv_async (int s, nn_async_fn fn, void *arg)
 {
     int rc;
     struct nn_sock *sock;
-    uint64_t val;
+    struct nn_async_op *op;
 
     rc = nn_global_hold_socket (&sock, s);
     if (nn_slow (rc < 0)) {
         errno = -rc;
-        return (uint64_t)-1;
+        return -1;
     }
 
-    switch (statistic) {
-    case NN_STAT_ESTABLISHED_CONNECTIONS:
-        val = sock->statistics.established_connections;
-        break;
-    case NN_STAT_ACCEPTED_CONNECTIONS:
-        val = sock->statistics.accepted_connections;
-        break;
-    case NN_STAT_DROPPED_CONNECTIONS:
-        val = sock->statistics.dropped_connections;
-        break;
-    case NN_STAT_BROKEN_CONNECTIONS:
-        val = sock->statistics.broken_connections;
-        break;
-    case NN_STAT_CONNECT_ERRORS:
-        val = sock->statistics.connect_errors;
-        break;
-    case NN_STAT_BIND_ERRORS:
-        val = sock->statistics.bind_errors;
-        break;
-    case NN_STAT_ACCEPT_ERRORS:
-        val = sock->statistics.bind_errors;
-        break;
-    case NN_STAT_MESSAGES_SENT:
-        val = sock->statistics.messages_sent;
-        break;
-    case NN_STAT_MESSAGES_RECEIVED:
-        val = sock->statistics.messages_received;
+    if (nn_slow (!fn)) {
+        rc = -EINVAL;
+        goto fail;
+    }
+
+    op = nn_async_op_alloc (s, fn, arg, NULL);
+    if (nn_slow (!op)) {
+        rc = -ENOMEM;
+        goto fail;
+    }
+
+    rc = nn_sock_async (sock, op);
+    if (nn_slow (rc < 0)) {
+        nn_async_op_free (op);
+        goto fail;
+    }
+
+    nn_global_rele_socket (sock);
+
+    return 0;
+
+fail:
+    nn_global_rele_socket (sock);
+
+    errno = -rc;
+    return -1;
+}
+
+int nn_send_async (int s, void *msg, nn_async_fn fn, void *arg)
+{
+    int rc;
+    struct nn_sock *sock;
+    struct nn_async_op *op;
+    struct nn_msg nnmsg;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    if (nn_slow (!fn)) {
+        rc = -EINVAL;
+        goto fail;
+    }
+    if (nn_slow (!msg)) {
+        rc = -EFAULT;
+        goto fail;
+    }
+
+    nn_msg_init_chunk (&nnmsg, msg);
+    op = nn_async_op_alloc (s, fn, arg, &nnmsg);
+    if (nn_slow (!op)) {
+        nn_chunkref_init (&nnmsg.body, 0);
+        nn_msg_term (&nnmsg);
+        rc = -ENOMEM;
+        goto fail;
+    }
+
+    rc = nn_sock_async (sock, op);
+    if (nn_slow (rc < 0)) {
+
+        /*  The message remains owned by the user. */
+        nn_chunkref_init (&op->msg.body, 0);
+        nn_async_op_free (op);
+        goto fail;
+    }
+
+    nn_global_rele_socket (sock);
+
+    return 0;
+
+fail:
+    nn_global_rele_socket (sock);
+
+    errno = -rc;
+    return -1;
+}
+
+/*  Latency statistics are laid out in groups of ten, one group per
+    histogram, starting at NN_STAT_SEND_LATENCY_COUNT. */
+static int nn_global_get_latency (struct nn_sock *sock, int statistic,
+    uint64_t *val)
+{
+    int hist;
+    struct nn_hist *h;
+
+    if (nn_slow (statistic < NN_STAT_SEND_LATENCY_COUNT))
+        return -EINVAL;
+    hist = (statistic - NN_STAT_SEND_LATENCY_COUNT) / 10;
+    if (nn_slow (hist >= NN_SOCKBASE_HIST_COUNT))
+        return -EINVAL;
+    h = &sock->latency [hist];
+
+    switch ((statistic - NN_STAT_SEND_LATENCY_COUNT) % 10) {
+    case 0:
+        *val = h->count;
         break;
-    case NN_STAT_BYTES_SENT:
-        val = sock->statistics.bytes_sent;
+    case 1:
+        *val = nn_hist_mean (h);
         break;
-    case NN_STAT_BYTES_RECEIVED:
-        val = sock->statistics.bytes_received;
+    case 2:
+        *val = nn_hist_percentile (h, 500);
         break;
-    case NN_STAT_CURRENT_CONNECTIONS:
-        val = sock->statistics.current_connections;
+    case 3:
+        *val = nn_hist_percentile (h, 900);
         break;
-    case NN_STAT_INPROGRESS_CONNECTIONS:
-        val = sock->statistics.inprogress_connections;
+    case 4:
+        *val = nn_hist_percentile (h, 990);
         break;
-    case NN_STAT_CURRENT_SND_PRIORITY:
-        val = sock->statistics.current_snd_priority;
+    case 5:
+        *val = nn_hist_percentile (h, 999);
         break;
-    case NN_STAT_CURRENT_EP_ERRORS:
-        val = sock->statistics.current_ep_errors;
+    case 6:
+        *val = h->max;
         break;
     default:
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/*  Must be called with the socket's context entered. */
+static int nn_global_get_stat (struct nn_sock *sock, int statistic,
+    uint64_t *val)
+{
+    int rc;
+
+    rc = nn_sock_stat_get (sock, statistic, val);
+    if (rc == -EINVAL)
+        rc = nn_global_get_latency (sock, statistic, val);
+    return rc;
+}
+
+uint64_t nn_get_statistic (int s, int statistic)
+{
+    int rc;
+    struct nn_sock *sock;
+    uint64_t val;
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return (uint64_t)-1;
+    }
+
+    nn_ctx_enter (&sock->ctx);
+    rc = nn_global_get_stat (sock, statistic, &val);
+    nn_ctx_leave (&sock->ctx);
+    if (nn_slow (rc < 0)) {
         val = (uint64_t)-1;
-        errno = EINVAL;
-        break;
+        errno = -rc;
     }
 
     nn_global_rele_socket (sock);
     return val;
 }
 
+int nn_get_statistics (int s, const int *stats, uint64_t *values, int nstats)
+{
+    int rc;
+    int i;
+    struct nn_sock *sock;
+
+    if (nn_slow (nstats < 0 || (nstats > 0 && (!stats || !values)))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    /*  All the values are retrieved under a single lock so that they form
+        a consistent snapshot. */
+    rc = 0;
+    nn_ctx_enter (&sock->ctx);
+    for (i = 0; i != nstats; ++i) {
+        rc = nn_global_get_stat (sock, stats [i], &values [i]);
+        if (nn_slow (rc < 0))
+            break;
+    }
+    nn_ctx_leave (&sock->ctx);
+
+    nn_global_rele_socket (sock);
+
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+    return 0;
+}
+
+int nn_get_pipe_statistics (int s, struct nn_pipe_stats *stats, int npipes)
+{
+    int rc;
+    struct nn_sock *sock;
+
+    if (nn_slow (npipes < 0 || (npipes > 0 && !stats))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rc = nn_global_hold_socket (&sock, s);
+    if (nn_slow (rc < 0)) {
+        errno = -rc;
+        return -1;
+    }
+
+    rc = nn_sock_getpipestats (sock, stats, npipes);
+
+    nn_global_rele_socket (sock);
+    return rc;
+}
+
 static int nn_global_create_ep (struct nn_sock *sock, const char *addr,
     int bind)
 {
@@ -1096,6 +1380,162 @@ static int nn_global_create_ep (struct nn_sock *sock, const char *addr,
     return rc;
 }
 
+/*  Must be called with the global lock held. */
+static void nn_global_start_statistics (void)
+{
+    int rc;
+    struct nn_sock *sock;
+
+    nn_assert (!self.statistics.running);
+
+    /*  The socket used for publishing statistics is not part of the socket
+        table, so that it neither counts as an open socket nor reports
+        statistics about itself. */
+    sock = nn_alloc (sizeof (struct nn_sock), "statistics socket");
+    alloc_assert (sock);
+    rc = nn_sock_init (sock, &nn_pub_socktype, -1);
+    errnum_assert (rc == 0, -rc);
+    rc = nn_global_create_ep (sock, self.statistics.addr, 0);
+    if (nn_slow (rc < 0)) {
+        if (self.print_errors)
+            fprintf (stderr, "nanomsg: can't publish statistics to %s: %s\n",
+                self.statistics.addr, nn_strerror (-rc));
+        goto fail;
+    }
+    rc = nn_efd_init (&self.statistics.efd);
+    if (nn_slow (rc < 0))
+        goto fail;
+
+    if (gethostname (self.statistics.hostname,
+          sizeof (self.statistics.hostname)) != 0)
+        strcpy (self.statistics.hostname, "localhost");
+    self.statistics.hostname [sizeof (self.statistics.hostname) - 1] = 0;
+
+    self.statistics.sock = sock;
+    self.statistics.running = 1;
+    nn_thread_init (&self.statistics.thread, nn_global_statistics_routine,
+        NULL);
+    return;
+
+fail:
+    nn_sock_stop (sock);
+    nn_sock_rele (sock);
+    rc = nn_sock_term (sock);
+    errnum_assert (rc == 0, -rc);
+    nn_free (sock);
+}
+
+/*  Must be called with the global lock held. The lock is released while
+    waiting for the statistics thread to finish. */
+static void nn_global_stop_statistics (void)
+{
+    int rc;
+    struct nn_sock *sock;
+
+    nn_assert (self.statistics.running);
+
+    self.statistics.stopping = 1;
+    nn_efd_signal (&self.statistics.efd);
+    nn_mutex_unlock (&self.lock);
+    nn_thread_term (&self.statistics.thread);
+    sock = self.statistics.sock;
+    nn_sock_stop (sock);
+    nn_sock_rele (sock);
+    rc = nn_sock_term (sock);
+    errnum_assert (rc == 0, -rc);
+    nn_free (sock);
+    nn_efd_term (&self.statistics.efd);
+    nn_mutex_lock (&self.lock);
+
+    self.statistics.sock = NULL;
+    self.statistics.running = 0;
+    self.statistics.stopping = 0;
+}
+
+static void nn_global_statistics_routine (NN_UNUSED void *arg)
+{
+    int rc;
+    int i;
+    int nids;
+    int ids [64];
+    const char *names [64];
+    struct nn_symbol_properties sym;
+
+    /*  Report all the statistics known to the library. */
+    nids = 0;
+    for (i = 0; nids != 64; ++i) {
+        rc = nn_symbol_info (i, &sym, (int) sizeof (sym));
+        if (rc == 0)
+            break;
+        if (sym.ns != NN_NS_STATISTIC)
+            continue;
+        ids [nids] = sym.value;
+        names [nids] = strncmp (sym.name, "NN_STAT_", 8) == 0 ?
+            sym.name + 8 : sym.name;
+        ++nids;
+    }
+
+    /*  Wait till the interval expires or till the thread is asked to
+        exit. */
+    while (1) {
+        rc = nn_efd_wait (&self.statistics.efd, self.statistics.interval);
+        if (rc == 0)
+            break;
+        errnum_assert (rc == -ETIMEDOUT, -rc);
+        nn_global_submit_statistics (ids, names, nids);
+    }
+}
+
+/*  Publishes a single message per open socket. The first line identifies
+    the socket: hostname, application name, socket name and a UNIX
+    timestamp. Each subsequent line contains name and value of a single
+    statistic. */
+static void nn_global_submit_statistics (const int *ids, const char **names,
+    int nids)
+{
+    int rc;
+    int s;
+    int i;
+    size_t sz;
+    char buf [NN_STATISTICS_BUFSZ];
+    uint64_t values [64];
+    struct nn_sock *sock;
+    struct nn_msg msg;
+
+    for (s = 0; s != NN_MAX_SOCKETS; ++s) {
+        rc = nn_global_hold_socket (&sock, s);
+        if (rc < 0)
+            continue;
+
+        /*  Take a consistent snapshot of the socket's statistics. */
+        nn_ctx_enter (&sock->ctx);
+        for (i = 0; i != nids; ++i) {
+            rc = nn_global_get_stat (sock, ids [i], &values [i]);
+            errnum_assert (rc == 0, -rc);
+        }
+        nn_ctx_leave (&sock->ctx);
+
+        sz = sprintf (buf, "%s %s %.64s %lu\n", self.statistics.hostname,
+            self.statistics.appname, sock->socket_name,
+            (unsigned long) time (NULL));
+        nn_global_rele_socket (sock);
+
+        for (i = 0; i != nids; ++i) {
+            if (sz + strlen (names [i]) + 24 > sizeof (buf))
+                break;
+            sz += sprintf (buf + sz, "%s %llu\n", names [i],
+                (unsigned long long) values [i]);
+        }
+
+        /*  If there are no subscribers the message is simply dropped. */
+        nn_msg_init (&msg, sz);
+        memcpy (nn_chunkref_data (&msg.body), buf, sz);
+        rc = nn_sock_send (self.statistics.sock, &msg, NN_DONTWAIT);
+        if (nn_slow (rc < 0))
+            nn_msg_term (&msg);
+    }
+}
+
 const struct nn_transport *nn_global_transport (int id)
 {
     const struct nn_transport *tp;
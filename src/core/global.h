@@ -31,4 +31,10 @@ const struct nn_transport *nn_global_transport (int id);
 struct nn_pool *nn_global_getpool ();
 int nn_global_print_errors();
 
+/*  In-library device. Forwards messages from socket 's1' to socket 's2' and,
+    if 'twoway' is set, also the other way round. Messages are moved by
+    the worker threads, the calling thread just waits till one of the sockets
+    is closed. */
+int nn_global_forward (int s1, int s2, int twoway);
+
 #endif
@@ -29,6 +29,7 @@
 
 #include "../utils/err.h"
 #include "../utils/fast.h"
+#include "../utils/clock.h"
 
 /*  Internal pipe states. */
 #define NN_PIPEBASE_STATE_IDLE 1
@@ -58,15 +59,23 @@ void nn_pipebase_init (struct nn_pipebase *self,
     self->instate = NN_PIPEBASE_INSTATE_DEACTIVATED;
     self->outstate = NN_PIPEBASE_OUTSTATE_DEACTIVATED;
     self->sock = ep->sock;
+    self->ep = ep;
     memcpy (&self->options, &ep->options, sizeof (struct nn_ep_options));
     nn_fsm_event_init (&self->in);
     nn_fsm_event_init (&self->out);
+    self->sendstamp = 0;
+    self->recvstamp = 0;
+    self->id = 0;
+    nn_list_item_init (&self->item);
+    nn_pipebase_setpeer (self, nn_ep_getaddr (ep));
+    memset (&self->statistics, 0, sizeof (self->statistics));
 }
 
 void nn_pipebase_term (struct nn_pipebase *self)
 {
     nn_assert_state (self, NN_PIPEBASE_STATE_IDLE);
 
+    nn_list_item_term (&self->item);
     nn_fsm_event_term (&self->out);
     nn_fsm_event_term (&self->in);
     nn_fsm_term (&self->fsm);
@@ -106,20 +115,38 @@ void nn_pipebase_received (struct nn_pipebase *self)
     }
     nn_assert (self->instate == NN_PIPEBASE_INSTATE_ASYNC);
     self->instate = NN_PIPEBASE_INSTATE_IDLE;
+    self->recvstamp = nn_clock_us ();
     nn_fsm_raise (&self->fsm, &self->in, NN_PIPE_IN);
 }
 
 void nn_pipebase_sent (struct nn_pipebase *self)
 {
+    uint64_t now;
+
     if (nn_fast (self->outstate == NN_PIPEBASE_OUTSTATE_SENDING)) {
         self->outstate = NN_PIPEBASE_OUTSTATE_SENT;
         return;
     }
     nn_assert (self->outstate == NN_PIPEBASE_OUTSTATE_ASYNC);
     self->outstate = NN_PIPEBASE_OUTSTATE_IDLE;
+    now = nn_clock_us ();
+    self->statistics.queued_bytes = 0;
+    self->statistics.blocked_us += now - self->statistics.blockstamp;
+    self->statistics.blockstamp = 0;
+    if (self->sendstamp) {
+        nn_sock_stat_latency (self->sock, NN_SOCKBASE_HIST_SEND_LATENCY,
+            now - self->sendstamp);
+        self->sendstamp = 0;
+    }
     nn_fsm_raise (&self->fsm, &self->out, NN_PIPE_OUT);
 }
 
+void nn_pipebase_setpeer (struct nn_pipebase *self, const char *addr)
+{
+    strncpy (self->peer, addr, NN_SOCKADDR_MAX);
+    self->peer [NN_SOCKADDR_MAX] = 0;
+}
+
 void nn_pipebase_getopt (struct nn_pipebase *self, int level, int option,
     void *optval, size_t *optvallen)
 {
@@ -177,25 +204,43 @@ void *nn_pipe_getdata (struct nn_pipe *self)
 int nn_pipe_send (struct nn_pipe *self, struct nn_msg *msg)
 {
     int rc;
+    uint64_t stamp;
+    size_t sz;
     struct nn_pipebase *pipebase;
 
     pipebase = (struct nn_pipebase*) self;
     nn_assert (pipebase->outstate == NN_PIPEBASE_OUTSTATE_IDLE);
     pipebase->outstate = NN_PIPEBASE_OUTSTATE_SENDING;
+    sz = nn_chunkref_size (&msg->sphdr) + nn_chunkref_size (&msg->body);
     rc = pipebase->vfptr->send (pipebase, msg);
     errnum_assert (rc >= 0, -rc);
+    ++pipebase->statistics.messages_sent;
+    pipebase->statistics.bytes_sent += sz;
+
+    /*  Messages that don't originate in nn_send (e.g. resent requests)
+        carry no timestamp and are not accounted for. */
+    stamp = pipebase->sock->sendstamp;
     if (nn_fast (pipebase->outstate == NN_PIPEBASE_OUTSTATE_SENT)) {
         pipebase->outstate = NN_PIPEBASE_OUTSTATE_IDLE;
+        if (stamp)
+            nn_sock_stat_latency (pipebase->sock,
+                NN_SOCKBASE_HIST_SEND_LATENCY, nn_clock_us () - stamp);
         return rc;
     }
     nn_assert (pipebase->outstate == NN_PIPEBASE_OUTSTATE_SENDING);
     pipebase->outstate = NN_PIPEBASE_OUTSTATE_ASYNC;
+    pipebase->sendstamp = stamp;
+
+    /*  The pipe can't accept more messages till this one is sent. */
+    pipebase->statistics.queued_bytes = sz;
+    pipebase->statistics.blockstamp = nn_clock_us ();
     return rc | NN_PIPEBASE_RELEASE;
 }
 
 int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg)
 {
     int rc;
+    uint64_t now;
     struct nn_pipebase *pipebase;
 
     pipebase = (struct nn_pipebase*) self;
@@ -203,9 +248,23 @@ int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg)
     pipebase->instate = NN_PIPEBASE_INSTATE_RECEIVING;
     rc = pipebase->vfptr->recv (pipebase, msg);
     errnum_assert (rc >= 0, -rc);
+    ++pipebase->statistics.messages_received;
+    pipebase->statistics.bytes_received += nn_chunkref_size (&msg->sphdr) +
+        nn_chunkref_size (&msg->body);
+
+    /*  Account for the time the message have been waiting in the pipe. */
+    now = nn_clock_us ();
+    if (pipebase->recvstamp)
+        nn_sock_stat_latency (pipebase->sock, NN_SOCKBASE_HIST_RECV_LATENCY,
+            now - pipebase->recvstamp);
+    pipebase->recvstamp = 0;
 
     if (nn_fast (pipebase->instate == NN_PIPEBASE_INSTATE_RECEIVED)) {
         pipebase->instate = NN_PIPEBASE_INSTATE_IDLE;
+
+        /*  The next message is already available. We don't know when it
+            arrived so take the current time as an estimate. */
+        pipebase->recvstamp = now;
         return rc;
     }
     nn_assert (pipebase->instate == NN_PIPEBASE_INSTATE_RECEIVING);
@@ -222,3 +281,41 @@ void nn_pipe_getopt (struct nn_pipe *self, int level, int option,
     pipebase = (struct nn_pipebase*) self;
     nn_pipebase_getopt (pipebase, level, option, optval, optvallen);
 }
+
+const char *nn_pipe_getaddr (struct nn_pipe *self)
+{
+    struct nn_pipebase *pipebase;
+
+    pipebase = (struct nn_pipebase*) self;
+    return nn_ep_getaddr (pipebase->ep);
+}
+
+const char *nn_pipe_getpeer (struct nn_pipe *self)
+{
+    return ((struct nn_pipebase*) self)->peer;
+}
+
+int nn_pipe_isbound (struct nn_pipe *self)
+{
+    return ((struct nn_pipebase*) self)->ep->bind;
+}
+
+void nn_pipe_getstats (struct nn_pipe *self, struct nn_pipe_stats *stats)
+{
+    struct nn_pipebase *pipebase;
+
+    pipebase = (struct nn_pipebase*) self;
+    stats->id = pipebase->id;
+    stats->eid = pipebase->ep->eid;
+    memcpy (stats->addr, pipebase->peer, sizeof (stats->addr));
+    stats->messages_sent = pipebase->statistics.messages_sent;
+    stats->messages_received = pipebase->statistics.messages_received;
+    stats->bytes_sent = pipebase->statistics.bytes_sent;
+    stats->bytes_received = pipebase->statistics.bytes_received;
+    stats->queued_bytes = pipebase->statistics.queued_bytes;
+    stats->blocked_us = pipebase->statistics.blocked_us;
+
+    /*  Include the time the pipe has been blocked so far. */
+    if (pipebase->statistics.blockstamp)
+        stats->blocked_us += nn_clock_us () - pipebase->statistics.blockstamp;
+}
@@ -0,0 +1,419 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../nn.h"
+
+#include "../utils/alloc.h"
+#include "../utils/fast.h"
+#include "../utils/err.h"
+#include "../utils/fd.h"
+#include "../utils/sleep.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined NN_USE_EPOLL
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#elif defined NN_HAVE_WINDOWS
+#include "../utils/win.h"
+#else
+#include <poll.h>
+#endif
+
+#ifndef NN_MAX_SOCKETS
+#define NN_MAX_SOCKETS 512
+#endif
+
+/*  Persistent set of sockets to poll on. File descriptors of the sockets
+    are looked up only once, when the socket is added to the set. With epoll
+    the cost of a wait is proportional to the number of ready sockets.
+    Elsewhere, a pollset passed to poll(2) is maintained incrementally. */
+
+/*  Each socket is registered with up to two file descriptors. The owner of
+    a file descriptor is encoded as the socket number shifted left by one
+    with the lowest bit set for NN_SNDFD. */
+#define NN_POLLSET_OWNER(s, dir) (((uint64_t) (s) << 1) | (dir))
+
+struct nn_pollset_item {
+
+    /*  Events the socket was registered for. */
+    int events;
+
+    /*  Wait during which the socket was last reported, and its index
+        in the output array. */
+    uint64_t gen;
+    int out;
+
+#if defined NN_USE_EPOLL
+    /*  File descriptors registered with epoll. */
+    int fds [2];
+#else
+    /*  Indices of the file descriptors in the pollset. */
+    int pos [2];
+#endif
+};
+
+struct nn_pollset {
+#if defined NN_USE_EPOLL
+    int ep;
+    struct epoll_event *events;
+    int nevents;
+#else
+#if defined NN_HAVE_WINDOWS
+    WSAPOLLFD *pfds;
+#else
+    struct pollfd *pfds;
+#endif
+    uint64_t *owners;
+    int npfds;
+    int capacity;
+    int next;
+#endif
+    uint64_t gen;
+    struct nn_pollset_item *items [NN_MAX_SOCKETS];
+};
+
+/*  Private functions. */
+static int nn_pollset_register (struct nn_pollset *self,
+    struct nn_pollset_item *item, int s, int dir, nn_fd fd);
+static void nn_pollset_unregister (struct nn_pollset *self,
+    struct nn_pollset_item *item, int s);
+static void nn_pollset_report (struct nn_pollset *self,
+    struct nn_pollfd *fds, int nfds, int *res, uint64_t owner);
+
+struct nn_pollset *nn_pollset_create (void)
+{
+    struct nn_pollset *self;
+#if defined NN_USE_EPOLL
+    int rc;
+#endif
+
+    self = nn_alloc (sizeof (struct nn_pollset), "pollset");
+    if (nn_slow (!self)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset (self, 0, sizeof (struct nn_pollset));
+
+#if defined NN_USE_EPOLL
+#ifdef EPOLL_CLOEXEC
+    self->ep = epoll_create1 (EPOLL_CLOEXEC);
+#else
+    self->ep = epoll_create (1);
+    if (self->ep != -1) {
+        rc = fcntl (self->ep, F_SETFD, FD_CLOEXEC);
+        errno_assert (rc != -1);
+    }
+#endif
+    if (nn_slow (self->ep == -1)) {
+        rc = errno;
+        nn_free (self);
+        errno = rc;
+        return NULL;
+    }
+#endif
+
+    return self;
+}
+
+int nn_pollset_close (struct nn_pollset *self)
+{
+    int i;
+
+    for (i = 0; i != NN_MAX_SOCKETS; ++i)
+        if (self->items [i])
+            nn_free (self->items [i]);
+#if defined NN_USE_EPOLL
+    close (self->ep);
+    nn_free (self->events);
+#else
+    nn_free (self->pfds);
+    nn_free (self->owners);
+#endif
+    nn_free (self);
+    return 0;
+}
+
+int nn_pollset_add (struct nn_pollset *self, int s, int events)
+{
+    int rc;
+    int err;
+    int dir;
+    int opt;
+    nn_fd fd;
+    size_t sz;
+    struct nn_pollset_item *item;
+
+    if (nn_slow (s < 0 || s >= NN_MAX_SOCKETS)) {
+        errno = EBADF;
+        return -1;
+    }
+    if (nn_slow (!events || (events & ~(NN_POLLIN | NN_POLLOUT)))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*  Adding a socket that is already in the set replaces its events. */
+    if (self->items [s])
+        nn_pollset_rm (self, s);
+
+    item = nn_alloc (sizeof (struct nn_pollset_item), "pollset item");
+    if (nn_slow (!item)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    item->events = 0;
+    item->gen = 0;
+    item->out = 0;
+
+    for (dir = 0; dir != 2; ++dir) {
+        if (!(events & (dir ? NN_POLLOUT : NN_POLLIN)))
+            continue;
+        opt = dir ? NN_SNDFD : NN_RCVFD;
+        sz = sizeof (fd);
+        rc = nn_getsockopt (s, NN_SOL_SOCKET, opt, &fd, &sz);
+        if (nn_slow (rc < 0))
+            goto error;
+        nn_assert (sz == sizeof (fd));
+        rc = nn_pollset_register (self, item, s, dir, fd);
+        if (nn_slow (rc < 0))
+            goto error;
+    }
+
+    self->items [s] = item;
+    return 0;
+
+error:
+    err = errno;
+    nn_pollset_unregister (self, item, s);
+    nn_free (item);
+    errno = err;
+    return -1;
+}
+
+int nn_pollset_rm (struct nn_pollset *self, int s)
+{
+    struct nn_pollset_item *item;
+
+    if (nn_slow (s < 0 || s >= NN_MAX_SOCKETS || !self->items [s])) {
+        errno = ENOENT;
+        return -1;
+    }
+    item = self->items [s];
+    nn_pollset_unregister (self, item, s);
+    self->items [s] = NULL;
+    nn_free (item);
+    return 0;
+}
+
+int nn_pollset_wait (struct nn_pollset *self, struct nn_pollfd *fds,
+    int nfds, int timeout)
+{
+    int rc;
+    int i;
+    int res;
+#if !defined NN_USE_EPOLL
+    int pos;
+#endif
+
+    if (nn_slow (nfds <= 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ++self->gen;
+    res = 0;
+
+#if defined NN_USE_EPOLL
+
+    /*  Every reported socket takes at least one event, so there's no point
+        in asking for more events than there's space in the output. */
+    if (self->nevents < nfds) {
+        nn_free (self->events);
+        self->events = nn_alloc (sizeof (struct epoll_event) * nfds,
+            "pollset events");
+        if (nn_slow (!self->events)) {
+            self->nevents = 0;
+            errno = ENOMEM;
+            return -1;
+        }
+        self->nevents = nfds;
+    }
+    rc = epoll_wait (self->ep, self->events, nfds, timeout);
+    if (nn_slow (rc < 0))
+        return -1;
+    for (i = 0; i != rc; ++i)
+        nn_pollset_report (self, fds, nfds, &res, self->events [i].data.u64);
+
+#else
+
+    if (nn_slow (!self->npfds)) {
+        if (timeout > 0)
+            nn_sleep (timeout);
+        return 0;
+    }
+#if defined NN_HAVE_WINDOWS
+    rc = WSAPoll (self->pfds, self->npfds, timeout);
+    if (nn_slow (rc == SOCKET_ERROR)) {
+        errno = nn_err_wsa_to_posix (WSAGetLastError ());
+        return -1;
+    }
+#else
+    rc = poll (self->pfds, self->npfds, timeout);
+    if (nn_slow (rc < 0))
+        return -1;
+#endif
+
+    /*  Start the scan where the last one ended, so that the sockets at
+        the end of the pollset aren't starved if the output is too small. */
+    if (self->next >= self->npfds)
+        self->next = 0;
+    pos = self->next;
+    for (i = 0; rc && i != self->npfds; ++i) {
+        if (self->pfds [pos].revents & POLLIN) {
+            --rc;
+            if (res == nfds &&
+                  self->items [self->owners [pos] >> 1]->gen != self->gen)
+                break;
+            nn_pollset_report (self, fds, nfds, &res, self->owners [pos]);
+        }
+        pos = pos + 1 == self->npfds ? 0 : pos + 1;
+    }
+    self->next = pos;
+
+#endif
+
+    return res;
+}
+
+static int nn_pollset_register (struct nn_pollset *self,
+    struct nn_pollset_item *item, int s, int dir, nn_fd fd)
+{
+#if defined NN_USE_EPOLL
+    int rc;
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = NN_POLLSET_OWNER (s, dir);
+    rc = epoll_ctl (self->ep, EPOLL_CTL_ADD, fd, &ev);
+    if (nn_slow (rc < 0))
+        return -1;
+    item->fds [dir] = fd;
+#else
+    int capacity;
+    void *pfds;
+    void *owners;
+
+    if (self->npfds == self->capacity) {
+        capacity = self->capacity ? self->capacity * 2 : 16;
+        pfds = nn_realloc (self->pfds, sizeof (self->pfds [0]) * capacity);
+        if (nn_slow (!pfds)) {
+            errno = ENOMEM;
+            return -1;
+        }
+        self->pfds = pfds;
+        owners = nn_realloc (self->owners, sizeof (uint64_t) * capacity);
+        if (nn_slow (!owners)) {
+            errno = ENOMEM;
+            return -1;
+        }
+        self->owners = owners;
+        self->capacity = capacity;
+    }
+    self->pfds [self->npfds].fd = fd;
+    self->pfds [self->npfds].events = POLLIN;
+    self->pfds [self->npfds].revents = 0;
+    self->owners [self->npfds] = NN_POLLSET_OWNER (s, dir);
+    item->pos [dir] = self->npfds;
+    ++self->npfds;
+#endif
+
+    item->events |= dir ? NN_POLLOUT : NN_POLLIN;
+    return 0;
+}
+
+static void nn_pollset_unregister (struct nn_pollset *self,
+    struct nn_pollset_item *item, int s)
+{
+    int dir;
+#if defined NN_USE_EPOLL
+    struct epoll_event ev;
+#else
+    int pos;
+    int last;
+    struct nn_pollset_item *moved;
+#endif
+
+    for (dir = 0; dir != 2; ++dir) {
+        if (!(item->events & (dir ? NN_POLLOUT : NN_POLLIN)))
+            continue;
+#if defined NN_USE_EPOLL
+
+        /*  If the socket was already closed, its file descriptors were
+            removed from the epoll set automatically and this fails. */
+        memset (&ev, 0, sizeof (ev));
+        epoll_ctl (self->ep, EPOLL_CTL_DEL, item->fds [dir], &ev);
+        (void) s;
+#else
+
+        /*  Move the last file descriptor to the vacated slot. */
+        pos = item->pos [dir];
+        last = self->npfds - 1;
+        if (pos != last) {
+            self->pfds [pos] = self->pfds [last];
+            self->owners [pos] = self->owners [last];
+            moved = (int) (self->owners [pos] >> 1) == s ?
+                item : self->items [self->owners [pos] >> 1];
+            moved->pos [self->owners [pos] & 1] = pos;
+        }
+        --self->npfds;
+#endif
+    }
+    item->events = 0;
+}
+
+static void nn_pollset_report (struct nn_pollset *self,
+    struct nn_pollfd *fds, int nfds, int *res, uint64_t owner)
+{
+    struct nn_pollset_item *item;
+
+    item = self->items [owner >> 1];
+
+    /*  The socket may have been removed in the meantime. */
+    if (nn_slow (!item))
+        return;
+
+    if (item->gen != self->gen) {
+        if (*res == nfds)
+            return;
+        item->gen = self->gen;
+        item->out = *res;
+        fds [*res].fd = (int) (owner >> 1);
+        fds [*res].events = (short) item->events;
+        fds [*res].revents = 0;
+        ++*res;
+    }
+    fds [item->out].revents |= (owner & 1) ? NN_POLLOUT : NN_POLLIN;
+}
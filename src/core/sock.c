@@ -29,6 +29,7 @@
 #include "sock.h"
 #include "global.h"
 #include "ep.h"
+#include "fwd.h"
 
 #include "../utils/err.h"
 #include "../utils/cont.h"
@@ -58,7 +59,26 @@
 /*  Subordinated source objects. */
 #define NN_SOCK_SRC_EP 1
 
+/*  Indices of the statistics counters. The ever-incrementing counters
+    go first, the level-style values follow. */
+#define NN_SOCK_STAT_ESTABLISHED_CONNECTIONS 0
+#define NN_SOCK_STAT_ACCEPTED_CONNECTIONS 1
+#define NN_SOCK_STAT_DROPPED_CONNECTIONS 2
+#define NN_SOCK_STAT_BROKEN_CONNECTIONS 3
+#define NN_SOCK_STAT_CONNECT_ERRORS 4
+#define NN_SOCK_STAT_BIND_ERRORS 5
+#define NN_SOCK_STAT_ACCEPT_ERRORS 6
+#define NN_SOCK_STAT_MESSAGES_SENT 7
+#define NN_SOCK_STAT_MESSAGES_RECEIVED 8
+#define NN_SOCK_STAT_BYTES_SENT 9
+#define NN_SOCK_STAT_BYTES_RECEIVED 10
+#define NN_SOCK_STAT_ACCEPT_PAUSES 11
+#define NN_SOCK_STAT_CURRENT_CONNECTIONS 12
+#define NN_SOCK_STAT_INPROGRESS_CONNECTIONS 13
+#define NN_SOCK_STAT_CURRENT_EP_ERRORS 14
+
 /*  Private functions. */
+static int nn_sock_stat_counter (int name);
 static struct nn_optset *nn_sock_optset (struct nn_sock *self, int id);
 static int nn_sock_setopt_inner (struct nn_sock *self, int level,
     int option, const void *optval, size_t optvallen);
@@ -118,9 +138,14 @@ int nn_sock_init (struct nn_sock *self, const struct nn_socktype *socktype,
     }
 
     self->holds = 1;   /*  Callers hold. */
+    self->fwdout = NULL;
+    self->fwdin = NULL;
+    nn_async_init (&self->async, self);
     self->flags = 0;
     nn_list_init (&self->eps);
     nn_list_init (&self->sdeps);
+    nn_list_init (&self->pipes);
+    self->pipeid = 1;
     self->eid = 1;
 
     /*  Default values for NN_SOL_SOCKET options. */
@@ -132,12 +157,19 @@ int nn_sock_init (struct nn_sock *self, const struct nn_socktype *socktype,
     self->reconnect_ivl = 100;
     self->reconnect_ivl_max = 0;
     self->maxttl = 8;
+    self->interleave = 0;
+    self->partsize = 0;
+    self->rcvcredit = 0;
     self->ep_template.sndprio = 8;
     self->ep_template.rcvprio = 8;
     self->ep_template.ipv4only = 1;
 
     /* Clear statistic entries */
-    memset(&self->statistics, 0, sizeof (self->statistics));
+    nn_counters_init (&self->statistics);
+    self->current_snd_priority = 0;
+    for (i = 0; i != NN_SOCKBASE_HIST_COUNT; ++i)
+        nn_hist_init (&self->latency [i]);
+    self->sendstamp = 0;
 
     /*  Should be pretty much enough space for just the number  */
     sprintf(self->socket_name, "%d", fd);
@@ -221,6 +253,10 @@ int nn_sock_term (struct nn_sock *self)
     nn_ctx_enter (&self->ctx);
     nn_ctx_leave (&self->ctx);
 
+    /*  Fail the asynchronous operations that were not completed and wait
+        for the callbacks still being invoked. */
+    nn_async_term (&self->async);
+
     /*  At this point, we can be reasonably certain that no other thread
         has any references to the socket. */
 
@@ -236,6 +272,8 @@ int nn_sock_term (struct nn_sock *self)
     nn_fsm_term (&self->fsm);
     nn_sem_term (&self->termsem);
     nn_sem_term (&self->relesem);
+    nn_counters_term (&self->statistics);
+    nn_list_term (&self->pipes);
     nn_list_term (&self->sdeps);
     nn_list_term (&self->eps);
     nn_ctx_term (&self->ctx);
@@ -371,6 +409,29 @@ static int nn_sock_setopt_inner (struct nn_sock *self, int level,
             return -EINVAL;
         self->maxttl = val;
         return 0;
+    case NN_INTERLEAVE:
+        if (val < 0)
+            return -EINVAL;
+        self->interleave = val;
+        return 0;
+    case NN_PARTSIZE:
+        if (val < 0)
+            return -EINVAL;
+        if (val > 0 && !(self->socktype->flags & NN_SOCKTYPE_FLAG_PARTS))
+            return -ENOPROTOOPT;
+        self->partsize = val;
+        return 0;
+    case NN_RCVCREDIT:
+        if (val < 0)
+            return -EINVAL;
+
+        /*  Credit grants share the connection with the messages sent the
+            other way. If the socket could send, a peer that doesn't receive
+            would never read the grants and the two would deadlock. */
+        if (val > 0 && !(self->socktype->flags & NN_SOCKTYPE_FLAG_NOSEND))
+            return -EINVAL;
+        self->rcvcredit = val;
+        return 0;
     case NN_LINGER:
 	/*  Ignored, retained for compatibility. */
         return 0;
@@ -461,6 +522,15 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level,
     case NN_MAXTTL:
         intval = self->maxttl;
         break;
+    case NN_INTERLEAVE:
+        intval = self->interleave;
+        break;
+    case NN_PARTSIZE:
+        intval = self->partsize;
+        break;
+    case NN_RCVCREDIT:
+        intval = self->rcvcredit;
+        break;
     case NN_SNDFD:
         if (self->socktype->flags & NN_SOCKTYPE_FLAG_NOSEND)
             return -ENOPROTOOPT;
@@ -567,12 +637,19 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
     int rc;
     uint64_t deadline;
     uint64_t now;
+    uint64_t stamp;
     int timeout;
 
     /*  Some sockets types cannot be used for sending messages. */
     if (nn_slow (self->socktype->flags & NN_SOCKTYPE_FLAG_NOSEND))
         return -ENOTSUP;
 
+    /*  Messages can be sent in parts only if NN_PARTSIZE is set. */
+    if (nn_slow (!self->partsize && nn_msg_more (msg)))
+        return -EINVAL;
+
+    stamp = nn_clock_us ();
+
     nn_ctx_enter (&self->ctx);
 
     /*  Compute the deadline for SNDTIMEO timer. */
@@ -605,8 +682,11 @@ int nn_sock_send (struct nn_sock *self, struct nn_msg *msg, int flags)
             return -EBADF;
         }
 
-        /*  Try to send the message in a non-blocking way. */
+        /*  Try to send the message in a non-blocking way. The pipe the
+            message ends up in uses the timestamp to measure send latency. */
+        self->sendstamp = stamp;
         rc = self->sockbase->vfptr->send (self->sockbase, msg);
+        self->sendstamp = 0;
         if (nn_fast (rc == 0)) {
             nn_ctx_leave (&self->ctx);
             return 0;
@@ -749,16 +829,90 @@ int nn_sock_recv (struct nn_sock *self, struct nn_msg *msg, int flags)
 int nn_sock_add (struct nn_sock *self, struct nn_pipe *pipe)
 {
     int rc;
+    struct nn_pipebase *pipebase;
 
     rc = self->sockbase->vfptr->add (self->sockbase, pipe);
     if (nn_slow (rc >= 0)) {
         nn_sock_stat_increment (self, NN_STAT_CURRENT_CONNECTIONS, 1);
+        pipebase = (struct nn_pipebase*) pipe;
+        pipebase->id = self->pipeid++;
+        nn_list_insert (&self->pipes, &pipebase->item,
+            nn_list_end (&self->pipes));
     }
     return rc;
 }
 
+int nn_sock_getpipestats (struct nn_sock *self, struct nn_pipe_stats *stats,
+    int npipes)
+{
+    int count;
+    struct nn_list_item *it;
+
+    nn_ctx_enter (&self->ctx);
+    count = 0;
+    for (it = nn_list_begin (&self->pipes); it != nn_list_end (&self->pipes);
+          it = nn_list_next (&self->pipes, it)) {
+        if (count < npipes)
+            nn_pipe_getstats ((struct nn_pipe*) nn_cont (it,
+                struct nn_pipebase, item), &stats [count]);
+        ++count;
+    }
+    nn_ctx_leave (&self->ctx);
+
+    return count;
+}
+
+int nn_sock_setfwd (struct nn_sock *self, struct nn_fwd *fwd, int out)
+{
+    struct nn_fwd **slot;
+
+    nn_ctx_enter (&self->ctx);
+
+    slot = out ? &self->fwdout : &self->fwdin;
+    if (fwd) {
+        if (nn_slow (self->state != NN_SOCK_STATE_ACTIVE)) {
+            nn_ctx_leave (&self->ctx);
+            return -EBADF;
+        }
+        if (nn_slow (*slot != NULL)) {
+            nn_ctx_leave (&self->ctx);
+            return -EBUSY;
+        }
+    }
+    *slot = fwd;
+
+    /*  Forward the messages that are already waiting in the socket. */
+    if (fwd && out)
+        nn_fwd_pull (fwd);
+
+    nn_ctx_leave (&self->ctx);
+
+    return 0;
+}
+
+int nn_sock_async (struct nn_sock *self, struct nn_async_op *op)
+{
+    /*  Some sockets types cannot be used for sending or receiving. */
+    if (nn_slow (self->socktype->flags &
+          (op->send ? NN_SOCKTYPE_FLAG_NOSEND : NN_SOCKTYPE_FLAG_NORECV)))
+        return -ENOTSUP;
+
+    nn_ctx_enter (&self->ctx);
+
+    if (nn_slow (self->state != NN_SOCK_STATE_ACTIVE)) {
+        nn_ctx_leave (&self->ctx);
+        return -EBADF;
+    }
+    nn_async_submit (&self->async, op);
+
+    nn_ctx_leave (&self->ctx);
+
+    return 0;
+}
+
 void nn_sock_rm (struct nn_sock *self, struct nn_pipe *pipe)
 {
+    nn_list_erase (&self->pipes, &((struct nn_pipebase*) pipe)->item);
     self->sockbase->vfptr->rm (self->sockbase, pipe);
     nn_sock_stat_increment (self, NN_STAT_CURRENT_CONNECTIONS, -1);
 }
@@ -779,6 +933,15 @@ static void nn_sock_onleave (struct nn_ctx *self)
     events = sock->sockbase->vfptr->events (sock->sockbase);
     errnum_assert (events >= 0, -events);
 
+    /*  Retry the pending asynchronous operations. Doing so here rather than
+        on pipe events only makes sure that operations completed by
+        a protocol timer, e.g. an expired survey, complete as well. */
+    if (((events & NN_SOCKBASE_EVENT_IN) && nn_async_in (&sock->async)) |
+          ((events & NN_SOCKBASE_EVENT_OUT) && nn_async_out (&sock->async))) {
+        events = sock->sockbase->vfptr->events (sock->sockbase);
+        errnum_assert (events >= 0, -events);
+    }
+
     /*  Signal/unsignal IN as needed. */
     if (!(sock->socktype->flags & NN_SOCKTYPE_FLAG_NORECV)) {
         if (events & NN_SOCKBASE_EVENT_IN) {
@@ -848,9 +1011,22 @@ static void nn_sock_shutdown (struct nn_fsm *self, int src, int type,
 
     sock = nn_cont (self, struct nn_sock, fsm);
 
+    /*  In-library device events may still arrive while the socket is
+        stopping. Just acknowledge them. */
+    if (nn_slow (src == NN_SOCK_SRC_FWD)) {
+        nn_fwd_event ((struct nn_fwd*) srcptr, type, 0);
+        return;
+    }
+
     if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
         nn_assert (sock->state == NN_SOCK_STATE_ACTIVE);
 
+        /*  Let the in-library device know it should stop. */
+        if (sock->fwdout)
+            nn_fwd_stopped (sock->fwdout);
+        if (sock->fwdin)
+            nn_fwd_stopped (sock->fwdin);
+
         /*  Close sndfd and rcvfd. This should make any current
             select/poll using SNDFD and/or RCVFD exit. */
         if (!(sock->socktype->flags & NN_SOCKTYPE_FLAG_NORECV)) {
@@ -929,6 +1105,7 @@ static void nn_sock_handler (struct nn_fsm *self, int src, int type,
 {
     struct nn_sock *sock;
     struct nn_ep *ep;
+    struct nn_fwd *fwd;
 
     sock = nn_cont (self, struct nn_sock, fsm);
 
@@ -981,17 +1158,37 @@ static void nn_sock_handler (struct nn_fsm *self, int src, int type,
                 nn_fsm_bad_action (sock->state, src, type);
             }
 
+        case NN_SOCK_SRC_FWD:
+            fwd = (struct nn_fwd*) srcptr;
+            switch (type) {
+            case NN_FWD_PUSHED:
+                nn_fwd_event (fwd, type, sock->fwdin == fwd);
+                return;
+            case NN_FWD_DRAINED:
+                nn_fwd_event (fwd, type, sock->fwdout == fwd);
+                return;
+            default:
+                nn_fsm_bad_action (sock->state, src, type);
+            }
+
         default:
 
-            /*  The assumption is that all the other events come from pipes. */
+            /*  The assumption is that all the other events come from pipes.
+                If the socket is part of an in-library device, pass
+                the messages on straight away. Pending asynchronous
+                operations are retried once the context is left. */
             switch (type) {
             case NN_PIPE_IN:
                 sock->sockbase->vfptr->in (sock->sockbase,
                     (struct nn_pipe*) srcptr);
+                if (sock->fwdout)
+                    nn_fwd_pull (sock->fwdout);
                 return;
             case NN_PIPE_OUT:
                 sock->sockbase->vfptr->out (sock->sockbase,
                     (struct nn_pipe*) srcptr);
+                if (sock->fwdin)
+                    nn_fwd_push (sock->fwdin);
                 return;
             default:
                 nn_fsm_bad_action (sock->state, src, type);
@@ -1029,76 +1226,92 @@ void nn_sock_report_error (struct nn_sock *self, struct nn_ep *ep, int errnum)
 
 void nn_sock_stat_increment (struct nn_sock *self, int name, int64_t increment)
 {
-    switch (name) {
-        case NN_STAT_ESTABLISHED_CONNECTIONS:
-            nn_assert (increment > 0);
-            self->statistics.established_connections += increment;
-            break;
-        case NN_STAT_ACCEPTED_CONNECTIONS:
-            nn_assert (increment > 0);
-            self->statistics.accepted_connections += increment;
-            break;
-        case NN_STAT_DROPPED_CONNECTIONS:
-            nn_assert (increment > 0);
-            self->statistics.dropped_connections += increment;
-            break;
-        case NN_STAT_BROKEN_CONNECTIONS:
-            nn_assert (increment > 0);
-            self->statistics.broken_connections += increment;
-            break;
-        case NN_STAT_CONNECT_ERRORS:
-            nn_assert (increment > 0);
-            self->statistics.connect_errors += increment;
-            break;
-        case NN_STAT_BIND_ERRORS:
-            nn_assert (increment > 0);
-            self->statistics.bind_errors += increment;
-            break;
-        case NN_STAT_ACCEPT_ERRORS:
-            nn_assert (increment > 0);
-            self->statistics.accept_errors += increment;
-            break;
-        case NN_STAT_MESSAGES_SENT:
-            nn_assert (increment > 0);
-            self->statistics.messages_sent += increment;
-            break;
-        case NN_STAT_MESSAGES_RECEIVED:
-            nn_assert (increment > 0);
-            self->statistics.messages_received += increment;
-            break;
-        case NN_STAT_BYTES_SENT:
-            nn_assert (increment >= 0);
-            self->statistics.bytes_sent += increment;
-            break;
-        case NN_STAT_BYTES_RECEIVED:
+    int counter;
+
+    /*  This is an exception, we don't want to increment priority  */
+    if (name == NN_STAT_CURRENT_SND_PRIORITY) {
+        nn_assert((increment > 0 && increment <= 16) || increment == -1);
+        self->current_snd_priority = (int) increment;
+        return;
+    }
+
+    counter = nn_sock_stat_counter (name);
+    if (nn_slow (counter < 0))
+        return;
+
+    /*  The ever-incrementing counters can't go down. The level-style values
+        can, but they can't be checked for underflow without summing up
+        all the shards. */
+    if (counter < NN_SOCK_STAT_CURRENT_CONNECTIONS) {
+        if (name == NN_STAT_BYTES_SENT || name == NN_STAT_BYTES_RECEIVED)
             nn_assert (increment >= 0);
-            self->statistics.bytes_received += increment;
-            break;
+        else
+            nn_assert (increment > 0);
+    }
+    else
+        nn_assert(increment < INT_MAX && increment > -INT_MAX);
 
-        case NN_STAT_CURRENT_CONNECTIONS:
-            nn_assert (increment > 0 ||
-                self->statistics.current_connections >= -increment);
-            nn_assert(increment < INT_MAX && increment > -INT_MAX);
-            self->statistics.current_connections += (int) increment;
-            break;
-        case NN_STAT_INPROGRESS_CONNECTIONS:
-            nn_assert (increment > 0 ||
-                self->statistics.inprogress_connections >= -increment);
-            nn_assert(increment < INT_MAX && increment > -INT_MAX);
-            self->statistics.inprogress_connections += (int) increment;
-            break;
-        case NN_STAT_CURRENT_SND_PRIORITY:
-            /*  This is an exception, we don't want to increment priority  */
-            nn_assert((increment > 0 && increment <= 16) || increment == -1);
-            self->statistics.current_snd_priority = (int) increment;
-            break;
-        case NN_STAT_CURRENT_EP_ERRORS:
-            nn_assert (increment > 0 ||
-                self->statistics.current_ep_errors >= -increment);
-            nn_assert(increment < INT_MAX && increment > -INT_MAX);
-            self->statistics.current_ep_errors += (int) increment;
-            break;
+    nn_counters_add (&self->statistics, counter, increment);
+}
+
+int nn_sock_stat_get (struct nn_sock *self, int name, uint64_t *val)
+{
+    int counter;
+
+    if (name == NN_STAT_CURRENT_SND_PRIORITY) {
+        *val = self->current_snd_priority;
+        return 0;
     }
+
+    counter = nn_sock_stat_counter (name);
+    if (nn_slow (counter < 0))
+        return -EINVAL;
+    *val = (uint64_t) nn_counters_get (&self->statistics, counter);
+    return 0;
+}
+
+static int nn_sock_stat_counter (int name)
+{
+    switch (name) {
+    case NN_STAT_ESTABLISHED_CONNECTIONS:
+        return NN_SOCK_STAT_ESTABLISHED_CONNECTIONS;
+    case NN_STAT_ACCEPTED_CONNECTIONS:
+        return NN_SOCK_STAT_ACCEPTED_CONNECTIONS;
+    case NN_STAT_DROPPED_CONNECTIONS:
+        return NN_SOCK_STAT_DROPPED_CONNECTIONS;
+    case NN_STAT_BROKEN_CONNECTIONS:
+        return NN_SOCK_STAT_BROKEN_CONNECTIONS;
+    case NN_STAT_CONNECT_ERRORS:
+        return NN_SOCK_STAT_CONNECT_ERRORS;
+    case NN_STAT_BIND_ERRORS:
+        return NN_SOCK_STAT_BIND_ERRORS;
+    case NN_STAT_ACCEPT_ERRORS:
+        return NN_SOCK_STAT_ACCEPT_ERRORS;
+    case NN_STAT_ACCEPT_PAUSES:
+        return NN_SOCK_STAT_ACCEPT_PAUSES;
+    case NN_STAT_MESSAGES_SENT:
+        return NN_SOCK_STAT_MESSAGES_SENT;
+    case NN_STAT_MESSAGES_RECEIVED:
+        return NN_SOCK_STAT_MESSAGES_RECEIVED;
+    case NN_STAT_BYTES_SENT:
+        return NN_SOCK_STAT_BYTES_SENT;
+    case NN_STAT_BYTES_RECEIVED:
+        return NN_SOCK_STAT_BYTES_RECEIVED;
+    case NN_STAT_CURRENT_CONNECTIONS:
+        return NN_SOCK_STAT_CURRENT_CONNECTIONS;
+    case NN_STAT_INPROGRESS_CONNECTIONS:
+        return NN_SOCK_STAT_INPROGRESS_CONNECTIONS;
+    case NN_STAT_CURRENT_EP_ERRORS:
+        return NN_SOCK_STAT_CURRENT_EP_ERRORS;
+    default:
+        return -1;
+    }
+}
+
+void nn_sock_stat_latency (struct nn_sock *self, int hist, uint64_t us)
+{
+    nn_assert (hist >= 0 && hist < NN_SOCKBASE_HIST_COUNT);
+    nn_hist_record (&self->latency [hist], us);
 }
 
 int nn_sock_hold (struct nn_sock *self)
@@ -30,15 +30,23 @@
 #include "../aio/ctx.h"
 #include "../aio/fsm.h"
 
+#include "async.h"
+
 #include "../utils/efd.h"
 #include "../utils/sem.h"
 #include "../utils/list.h"
+#include "../utils/hist.h"
+#include "../utils/counters.h"
 
 struct nn_pipe;
+struct nn_fwd;
 
 /*  The maximum implemented transport ID. */
 #define NN_MAX_TRANSPORT 4
 
+/*  Source ID of the events sent to the socket by nn_fwd objects. */
+#define NN_SOCK_SRC_FWD 2
+
 struct nn_sock
 {
     /*  Socket state machine. */
@@ -68,9 +76,25 @@ struct nn_sock
     /*  Next endpoint ID to assign to a new endpoint. */
     int eid;
 
+    /*  List of all active pipes, for the purposes of statistics. */
+    struct nn_list pipes;
+
+    /*  Next pipe ID to assign to a new pipe. */
+    int pipeid;
+
     /*  Count of active holds against the socket. */
     int holds;
 
+    /*  In-library device. If 'fwdout' is set, messages received by
+        the socket are forwarded to another socket by the worker threads.
+        If 'fwdin' is set, the socket sends messages forwarded from another
+        socket. */
+    struct nn_fwd *fwdout;
+    struct nn_fwd *fwdin;
+
+    /*  Asynchronous send and receive operations submitted to the socket. */
+    struct nn_async async;
+
     /*  Socket-level socket options. */
     int sndbuf;
     int rcvbuf;
@@ -80,6 +104,9 @@ struct nn_sock
     int reconnect_ivl;
     int reconnect_ivl_max;
     int maxttl;
+    int interleave;
+    int partsize;
+    int rcvcredit;
 
     /*  Endpoint-specific options.  */
     struct nn_ep_options ep_template;
@@ -87,46 +114,19 @@ struct nn_sock
     /*  Transport-specific socket options. */
     struct nn_optset *optsets [NN_MAX_TRANSPORT];
 
-    struct {
-
-        /*****  The ever-incrementing counters  *****/
-
-        /*  Successfully established nn_connect() connections  */
-        uint64_t established_connections;
-        /*  Successfully accepted connections  */
-        uint64_t accepted_connections;
-        /*  Forcedly closed connections  */
-        uint64_t dropped_connections;
-        /*  Connections closed by peer  */
-        uint64_t broken_connections;
-        /*  Errors trying to establish active connection  */
-        uint64_t connect_errors;
-        /*  Errors binding to specified port  */
-        uint64_t bind_errors;
-        /*  Errors accepting connections at nn_bind()'ed endpoint  */
-        uint64_t accept_errors;
-
-        /*  Messages sent  */
-        uint64_t messages_sent;
-        /*  Messages received  */
-        uint64_t messages_received;
-        /*  Bytes sent (sum length of data in messages sent)  */
-        uint64_t bytes_sent;
-        /*  Bytes recevied (sum length of data in messages received)  */
-        uint64_t bytes_received;
-
-        /*****  Level-style values *****/
-
-        /*  Number of currently established connections  */
-        int current_connections;
-        /*  Number of connections currently in progress  */
-        int inprogress_connections;
-        /*  The currently set priority for sending data  */
-        int current_snd_priority;
-        /*  Number of endpoints having last_errno set to non-zero value  */
-        int current_ep_errors;
-
-    } statistics;
+    /*  Statistics counters, indexed by NN_SOCK_STAT_* constants. They are
+        updated both from user threads and from the worker threads. */
+    struct nn_counters statistics;
+
+    /*  The currently set priority for sending data  */
+    int current_snd_priority;
+
+    /*  Latency histograms, indexed by NN_SOCKBASE_HIST_* constants. */
+    struct nn_hist latency [NN_SOCKBASE_HIST_COUNT];
+
+    /*  Time when the message currently being sent was passed to
+        nn_sock_send, zero when no send is in progress. */
+    uint64_t sendstamp;
 
     /*  The socket name for statistics  */
     char socket_name[64];
@@ -190,9 +190,25 @@ int nn_sock_getopt_inner (struct nn_sock *self, int level, int option,
 int nn_sock_add (struct nn_sock *self, struct nn_pipe *pipe);
 void nn_sock_rm (struct nn_sock *self, struct nn_pipe *pipe);
 
+/*  Fill in statistics of up to 'npipes' pipes of the socket. Returns the
+    total number of pipes. */
+int nn_sock_getpipestats (struct nn_sock *self, struct nn_pipe_stats *stats,
+    int npipes);
+
+/*  Attach the socket to an in-library device, either as a source of
+    messages ('out' is 1) or as a destination ('out' is 0). If 'fwd' is NULL
+    the socket is detached. */
+int nn_sock_setfwd (struct nn_sock *self, struct nn_fwd *fwd, int out);
+
+/*  Submit an asynchronous send or receive operation. The socket owns
+    the operation once the function succeeds. */
+int nn_sock_async (struct nn_sock *self, struct nn_async_op *op);
+
 /*  Monitoring callbacks  */
 void nn_sock_report_error(struct nn_sock *self, struct nn_ep *ep,  int errnum);
 void nn_sock_stat_increment(struct nn_sock *self, int name, int64_t increment);
+int nn_sock_stat_get (struct nn_sock *self, int name, uint64_t *val);
+void nn_sock_stat_latency (struct nn_sock *self, int hist, uint64_t us);
 
 /*  Holds and releases. */
 int nn_sock_hold (struct nn_sock *self);
@@ -60,3 +60,9 @@ void nn_sockbase_stat_increment (struct nn_sockbase *self, int name,
 {
     nn_sock_stat_increment (self->sock, name, increment);
 }
+
+void nn_sockbase_stat_latency (struct nn_sockbase *self, int hist,
+    uint64_t us)
+{
+    nn_sock_stat_latency (self->sock, hist, us);
+}
@@ -70,6 +70,7 @@ static const struct nn_symbol_properties sym_value_names [] = {
     NN_SYM(NN_UNIT_BOOLEAN, OPTION_UNIT, NONE, NONE),
     NN_SYM(NN_UNIT_COUNTER, OPTION_UNIT, NONE, NONE),
     NN_SYM(NN_UNIT_MESSAGES, OPTION_UNIT, NONE, NONE),
+    NN_SYM(NN_UNIT_MICROSECONDS, OPTION_UNIT, NONE, NONE),
 
     NN_SYM(NN_VERSION_CURRENT, VERSION, NONE, NONE),
     NN_SYM(NN_VERSION_REVISION, VERSION, NONE, NONE),
@@ -115,15 +116,35 @@ static const struct nn_symbol_properties sym_value_names [] = {
     NN_SYM(NN_IPV4ONLY, SOCKET_OPTION, INT, BOOLEAN),
     NN_SYM(NN_SOCKET_NAME, SOCKET_OPTION, STR, NONE),
     NN_SYM(NN_MAXTTL, SOCKET_OPTION, INT, NONE),
+    NN_SYM(NN_INTERLEAVE, SOCKET_OPTION, INT, BYTES),
+    NN_SYM(NN_PARTSIZE, SOCKET_OPTION, INT, BYTES),
+    NN_SYM(NN_RCVCREDIT, SOCKET_OPTION, INT, MESSAGES),
 
     NN_SYM(NN_SUB_SUBSCRIBE, TRANSPORT_OPTION, STR, NONE),
     NN_SYM(NN_SUB_UNSUBSCRIBE, TRANSPORT_OPTION, STR, NONE),
+    NN_SYM(NN_SUB_CONFLATE, TRANSPORT_OPTION, INT, BOOLEAN),
     NN_SYM(NN_REQ_RESEND_IVL, TRANSPORT_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_REQ_LB_POLICY, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_REQ_PIPELINE, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_REQ_LAST_ID, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_REP_PIPELINE, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_PUSH_LB_POLICY, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_PULL_CONFLATE, TRANSPORT_OPTION, INT, BOOLEAN),
     NN_SYM(NN_SURVEYOR_DEADLINE, TRANSPORT_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_SURVEYOR_QUORUM, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_SURVEYOR_CONCURRENT, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_SURVEYOR_LAST_ID, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_BUS_DEDUP, TRANSPORT_OPTION, INT, MILLISECONDS),
+    NN_SYM(NN_BUS_DEDUP_MAX, TRANSPORT_OPTION, INT, NONE),
     NN_SYM(NN_TCP_NODELAY, TRANSPORT_OPTION, INT, BOOLEAN),
+    NN_SYM(NN_TCP_LISTENERS, TRANSPORT_OPTION, INT, NONE),
+    NN_SYM(NN_TCP_MAX_HANDSHAKES, TRANSPORT_OPTION, INT, NONE),
     NN_SYM(NN_WS_MSG_TYPE, TRANSPORT_OPTION, INT, NONE),
 
     NN_SYM(NN_DONTWAIT, FLAG, NONE, NONE),
+    NN_SYM(NN_LB_ROUND_ROBIN, FLAG, NONE, NONE),
+    NN_SYM(NN_LB_LEAST_LOADED, FLAG, NONE, NONE),
+    NN_SYM(NN_LB_CONSISTENT_HASH, FLAG, NONE, NONE),
     NN_SYM(NN_WS_MSG_TYPE_TEXT, FLAG, NONE, NONE),
     NN_SYM(NN_WS_MSG_TYPE_BINARY, FLAG, NONE, NONE),
 
@@ -170,6 +191,7 @@ static const struct nn_symbol_properties sym_value_names [] = {
     NN_SYM(NN_STAT_CONNECT_ERRORS, STATISTIC, INT, COUNTER),
     NN_SYM(NN_STAT_BIND_ERRORS, STATISTIC, INT, COUNTER),
     NN_SYM(NN_STAT_ACCEPT_ERRORS, STATISTIC, INT, COUNTER),
+    NN_SYM(NN_STAT_ACCEPT_PAUSES, STATISTIC, INT, COUNTER),
     NN_SYM(NN_STAT_MESSAGES_SENT, STATISTIC, INT, MESSAGES),
     NN_SYM(NN_STAT_MESSAGES_RECEIVED, STATISTIC, INT, MESSAGES),
     NN_SYM(NN_STAT_BYTES_SENT, STATISTIC, INT, BYTES),
@@ -177,7 +199,28 @@ static const struct nn_symbol_properties sym_value_names [] = {
     NN_SYM(NN_STAT_CURRENT_CONNECTIONS, STATISTIC, INT, NONE),
     NN_SYM(NN_STAT_INPROGRESS_CONNECTIONS, STATISTIC, INT, NONE),
     NN_SYM(NN_STAT_CURRENT_SND_PRIORITY, STATISTIC, INT, PRIORITY),
-    NN_SYM(NN_STAT_CURRENT_EP_ERRORS, STATISTIC, INT, NONE)
+    NN_SYM(NN_STAT_CURRENT_EP_ERRORS, STATISTIC, INT, NONE),
+    NN_SYM(NN_STAT_SEND_LATENCY_COUNT, STATISTIC, INT, MESSAGES),
+    NN_SYM(NN_STAT_SEND_LATENCY_MEAN, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_SEND_LATENCY_P50, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_SEND_LATENCY_P90, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_SEND_LATENCY_P99, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_SEND_LATENCY_P999, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_SEND_LATENCY_MAX, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_LATENCY_COUNT, STATISTIC, INT, MESSAGES),
+    NN_SYM(NN_STAT_RECV_LATENCY_MEAN, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_LATENCY_P50, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_LATENCY_P90, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_LATENCY_P99, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_LATENCY_P999, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_RECV_LATENCY_MAX, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_REQ_RTT_COUNT, STATISTIC, INT, MESSAGES),
+    NN_SYM(NN_STAT_REQ_RTT_MEAN, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_REQ_RTT_P50, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_REQ_RTT_P90, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_REQ_RTT_P99, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_REQ_RTT_P999, STATISTIC, INT, MICROSECONDS),
+    NN_SYM(NN_STAT_REQ_RTT_MAX, STATISTIC, INT, MICROSECONDS)
 };
 
 const int SYM_VALUE_NAMES_LEN = (sizeof (sym_value_names) /
@@ -28,8 +28,11 @@
 #include "../utils/fd.h"
 #include "../utils/attr.h"
 #include "../utils/thread.h"
+#include "../utils/alloc.h"
+#include "../core/global.h"
 #include "device.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #ifndef NN_HAVE_WINDOWS
@@ -38,6 +41,10 @@
 #define	NN_BAD_FD	INVALID_SOCKET
 #endif
 
+/*  Private functions. */
+static int nn_device_run (struct nn_device_recipe *device, int s1, int s2,
+    int twoway);
+
 int nn_custom_device(struct nn_device_recipe *device, int s1, int s2,
     int flags)
 {
@@ -214,11 +221,24 @@ int nn_device_loopback (struct nn_device_recipe *device, int s)
         return -1;
     }
 
-    for (;;) {
-        rc = nn_device_mvmsg (device, s, s, 0);
-        if (nn_slow (rc < 0))
-            return -1;
+    return nn_device_run (device, s, s, 0);
+}
+
+static int nn_device_nthreads (struct nn_device_recipe *device)
+{
+    const char *envvar;
+    int nthreads;
+
+    nthreads = device->threads;
+    if (nthreads <= 0) {
+        envvar = getenv ("NN_DEVICE_THREADS");
+        nthreads = envvar ? atoi (envvar) : 1;
     }
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > NN_DEVICE_MAX_THREADS)
+        nthreads = NN_DEVICE_MAX_THREADS;
+    return nthreads;
 }
 
 struct nn_device_forwarder_args {
@@ -233,7 +253,7 @@ static void nn_device_forwarder (void *a)
 {
     struct nn_device_forwarder_args *args = a;
     for (;;) {
-        args->rc = nn_device_mvmsg (args->device, args->s1, args->s2, 0);
+        args->rc = nn_device_mvbatch (args->device, args->s1, args->s2);
         if (nn_slow (args->rc < 0)) {
             args->err = nn_errno ();
             return;
@@ -241,44 +261,80 @@ static void nn_device_forwarder (void *a)
     }
 }
 
-int nn_device_twoway (struct nn_device_recipe *device, int s1, int s2)
+static int nn_device_run (struct nn_device_recipe *device, int s1, int s2,
+    int twoway)
 {
-    struct nn_thread t1;
-    struct nn_thread t2;
-    struct nn_device_forwarder_args a1;
-    struct nn_device_forwarder_args a2;
+    int rc;
+    int err;
+    int i;
+    int nthreads;
+    int nargs;
+    struct nn_thread *threads;
+    struct nn_device_forwarder_args *args;
+
+    /*  Unless the messages have to be intercepted or the user asked for
+        multiple forwarding threads, let the worker threads do the job
+        inside the library. */
+    nthreads = nn_device_nthreads (device);
+    if (nthreads == 1 &&
+          device->nn_device_rewritemsg == nn_device_rewritemsg) {
+        rc = nn_global_forward (s1, s2, twoway);
+        errno = -rc;
+        return -1;
+    }
 
-    a1.device = device;
-    a1.s1 = s1;
-    a1.s2 = s2;
+    /*  With a single thread in a single direction there's no need to spawn
+        any threads at all. */
+    if (nthreads == 1 && !twoway) {
+        while (1) {
+            rc = nn_device_mvbatch (device, s1, s2);
+            if (nn_slow (rc < 0))
+                return -1;
+        }
+    }
 
-    a2.device = device;
-    a2.s1 = s2;
-    a2.s2 = s1;
+    /*  Spawn the forwarders. Threads with even indices pass messages from
+        s1 to s2, those with odd indices from s2 to s1. */
+    nargs = twoway ? nthreads * 2 : nthreads;
+    threads = nn_alloc (sizeof (struct nn_thread) * nargs, "device threads");
+    alloc_assert (threads);
+    args = nn_alloc (sizeof (struct nn_device_forwarder_args) * nargs,
+        "device args");
+    alloc_assert (args);
+    for (i = 0; i != nargs; ++i) {
+        args [i].device = device;
+        args [i].s1 = twoway && i % 2 ? s2 : s1;
+        args [i].s2 = twoway && i % 2 ? s1 : s2;
+        args [i].rc = 0;
+        args [i].err = 0;
+        nn_thread_init (&threads [i], nn_device_forwarder, &args [i]);
+    }
 
-    nn_thread_init (&t1, nn_device_forwarder, &a1);
-    nn_thread_init (&t2, nn_device_forwarder, &a2);
+    /*  Wait for all the forwarders to exit and report the first failure. */
+    rc = 0;
+    err = 0;
+    for (i = 0; i != nargs; ++i) {
+        nn_thread_term (&threads [i]);
+        if (rc == 0 && args [i].rc != 0) {
+            rc = args [i].rc;
+            err = args [i].err;
+        }
+    }
+    nn_free (args);
+    nn_free (threads);
 
-    nn_thread_term (&t1);
-    nn_thread_term (&t2);
+    errno = err;
+    return rc;
+}
 
-    if (a1.rc != 0) {
-        errno = a1.err;
-        return (a1.rc);
-    }
-    errno = a2.err;
-    return a2.rc;
+int nn_device_twoway (struct nn_device_recipe *device, int s1, int s2)
+{
+    return nn_device_run (device, s1, s2, 1);
 }
 
 int nn_device_oneway (struct nn_device_recipe *device, int s1, int s2)
 {
-    int rc;
-
-    while (1) {
-        rc = nn_device_mvmsg (device, s1, s2, 0);
-        if (nn_slow (rc < 0))
-            return -1;
-    }
+    return nn_device_run (device, s1, s2, 0);
 }
 
 int nn_device_mvmsg (struct nn_device_recipe *device,
@@ -306,8 +362,13 @@ int nn_device_mvmsg (struct nn_device_recipe *device,
     rc = device->nn_device_rewritemsg (device, from, to, flags, &hdr, rc);
     if (nn_slow (rc == -1))
         return -1;
-    else if (rc == 0)
+    else if (rc == 0) {
+
+        /*  The message is dropped. */
+        nn_freemsg (body);
+        nn_freemsg (control);
         return 0;
+    }
     nn_assert(rc == 1);
 
     rc = nn_sendmsg (to, &hdr, flags);
@@ -324,3 +385,77 @@ int nn_device_rewritemsg (NN_UNUSED struct nn_device_recipe *device,
 {
     return 1; /* always forward */
 }
+
+int nn_device_mvbatch (struct nn_device_recipe *device, int from, int to)
+{
+    int rc;
+    int i;
+    int n;
+    void *body [NN_DEVICE_BATCH];
+    void *control [NN_DEVICE_BATCH];
+    struct nn_iovec iov [NN_DEVICE_BATCH];
+    struct nn_msghdr hdr [NN_DEVICE_BATCH];
+
+    /*  Wait for the first message, then grab whatever else is already
+        queued without blocking. Messages are passed as NN_MSG chunks so
+        they are never copied. */
+    n = 0;
+    while (n != NN_DEVICE_BATCH) {
+        iov [n].iov_base = &body [n];
+        iov [n].iov_len = NN_MSG;
+        memset (&hdr [n], 0, sizeof (hdr [n]));
+        hdr [n].msg_iov = &iov [n];
+        hdr [n].msg_iovlen = 1;
+        hdr [n].msg_control = &control [n];
+        hdr [n].msg_controllen = NN_MSG;
+        rc = nn_recvmsg (from, &hdr [n], n == 0 ? 0 : NN_DONTWAIT);
+        if (nn_slow (rc < 0)) {
+            if (n > 0 && nn_errno () == EAGAIN)
+                break;
+            i = 0;
+            goto fail;
+        }
+
+        rc = device->nn_device_rewritemsg (device, from, to, 0, &hdr [n], rc);
+        if (nn_slow (rc == -1)) {
+            i = 0;
+            ++n;
+            goto fail;
+        }
+        else if (rc == 0) {
+
+            /*  The message is dropped. */
+            nn_freemsg (body [n]);
+            nn_freemsg (control [n]);
+            continue;
+        }
+        nn_assert (rc == 1);
+        ++n;
+    }
+
+    /*  Forward the whole batch. */
+    for (i = 0; i != n; ++i) {
+        rc = nn_sendmsg (to, &hdr [i], 0);
+        if (nn_slow (rc < 0)) {
+
+            /*  Failed send releases the ancillary data but leaves the body
+                to the caller. */
+            nn_freemsg (body [i]);
+            ++i;
+            goto fail;
+        }
+    }
+    return 0;
+
+fail:
+
+    /*  Drop the messages that weren't forwarded. */
+    rc = nn_errno ();
+    while (i != n) {
+        nn_freemsg (body [i]);
+        nn_freemsg (control [i]);
+        ++i;
+    }
+    errno = rc;
+    return -1;
+}
@@ -66,14 +66,26 @@ struct nn_device_recipe {
     */
     int (*nn_device_rewritemsg) (struct nn_device_recipe *device,
         int from, int to, int flags, struct nn_msghdr *msghdr, int bytes);
+
+    /*  Number of forwarding threads per direction. If zero, the value of
+        NN_DEVICE_THREADS environment variable is used, or a single thread
+        if the variable is not set. */
+    int threads;
 };
 
+/*  Maximum number of messages moved by a forwarding thread in one go. */
+#define NN_DEVICE_BATCH 64
+
+/*  Upper limit for the number of forwarding threads per direction. */
+#define NN_DEVICE_MAX_THREADS 64
+
 /*  Default implementations of the functions. */
 int nn_device_loopback (struct nn_device_recipe *device, int s);
 int nn_device_twoway (struct nn_device_recipe *device, int s1, int s2);
 int nn_device_oneway (struct nn_device_recipe *device, int s1, int s2);
 int nn_device_mvmsg (struct nn_device_recipe *device,
     int from, int to, int flags);
+int nn_device_mvbatch (struct nn_device_recipe *device, int from, int to);
 int nn_device_entry(struct nn_device_recipe *device,
     int s1, int s2, int flags);
 int nn_device_rewritemsg(struct nn_device_recipe *device,
@@ -106,6 +118,7 @@ static struct nn_device_recipe nn_ordinary_device = {
     nn_device_oneway,
     nn_device_loopback,
     nn_device_mvmsg,
-    nn_device_rewritemsg
+    nn_device_rewritemsg,
+    0
 };
 
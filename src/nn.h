@@ -216,6 +216,7 @@ NN_EXPORT const char *nn_symbol (int i, int *value);
 #define NN_UNIT_BOOLEAN 4
 #define NN_UNIT_MESSAGES 5
 #define NN_UNIT_COUNTER 6
+#define NN_UNIT_MICROSECONDS 7
 
 /*  Structure that is returned from nn_symbol  */
 struct nn_symbol_properties {
@@ -248,6 +249,12 @@ NN_EXPORT int nn_symbol_info (int i,
 
 NN_EXPORT void nn_term (void);
 
+/******************************************************************************/
+/*  Event tracing. Available only if built with NN_ENABLE_TRACE.              */
+/******************************************************************************/
+
+NN_EXPORT int nn_trace_dump (const char *filename);
+
 /******************************************************************************/
 /*  Zero-copy support.                                                        */
 /******************************************************************************/
@@ -335,13 +342,24 @@ NN_EXPORT  struct nn_cmsghdr *nn_cmsg_nxthdr_ (
 #define NN_SOCKET_NAME 15
 #define NN_RCVMAXSIZE 16
 #define NN_MAXTTL 17
+#define NN_INTERLEAVE 18
+#define NN_PARTSIZE 19
+#define NN_RCVCREDIT 20
 
 /*  Send/recv options.                                                        */
 #define NN_DONTWAIT 1
 
+/*  Load balancing policies (NN_PUSH_LB_POLICY and NN_REQ_LB_POLICY).         */
+#define NN_LB_ROUND_ROBIN 0
+#define NN_LB_LEAST_LOADED 1
+#define NN_LB_CONSISTENT_HASH 2
+
 /*  Ancillary data.                                                           */
 #define PROTO_SP 1
 #define SP_HDR 1
+#define SP_ROUTING_KEY 2
+#define SP_PRIORITY 3
+#define SP_MORE 4
 
 NN_EXPORT int nn_socket (int domain, int protocol);
 NN_EXPORT int nn_close (int s);
@@ -357,6 +375,19 @@ NN_EXPORT int nn_recv (int s, void *buf, size_t len, int flags);
 NN_EXPORT int nn_sendmsg (int s, const struct nn_msghdr *msghdr, int flags);
 NN_EXPORT int nn_recvmsg (int s, struct nn_msghdr *msghdr, int flags);
 
+/******************************************************************************/
+/*  Asynchronous send and receive.                                            */
+/******************************************************************************/
+
+/*  Invoked once an asynchronous operation is done. 'rc' is the size of
+    the message, or -1 with errno set in case of error. 'msg' is the message
+    received, or the message that failed to be sent, allocated as with
+    nn_allocmsg and owned by the callee. It's NULL otherwise. */
+typedef void (*nn_async_fn) (int s, int rc, void *msg, void *arg);
+
+NN_EXPORT int nn_recv_async (int s, nn_async_fn fn, void *arg);
+NN_EXPORT int nn_send_async (int s, void *msg, nn_async_fn fn, void *arg);
+
 /******************************************************************************/
 /*  Socket mutliplexing support.                                              */
 /******************************************************************************/
@@ -372,6 +403,18 @@ struct nn_pollfd {
 
 NN_EXPORT int nn_poll (struct nn_pollfd *fds, int nfds, int timeout);
 
+/*  Persistent set of sockets to poll on, for applications handling large
+    numbers of sockets. Sockets are added to the set once, rather than being
+    passed to each call as with nn_poll. */
+struct nn_pollset;
+
+NN_EXPORT struct nn_pollset *nn_pollset_create (void);
+NN_EXPORT int nn_pollset_close (struct nn_pollset *pollset);
+NN_EXPORT int nn_pollset_add (struct nn_pollset *pollset, int s, int events);
+NN_EXPORT int nn_pollset_rm (struct nn_pollset *pollset, int s);
+NN_EXPORT int nn_pollset_wait (struct nn_pollset *pollset,
+    struct nn_pollfd *fds, int nfds, int timeout);
+
 /******************************************************************************/
 /*  Built-in support for devices.                                             */
 /******************************************************************************/
@@ -390,6 +433,7 @@ NN_EXPORT int nn_device (int s1, int s2);
 #define NN_STAT_CONNECT_ERRORS          105
 #define NN_STAT_BIND_ERRORS             106
 #define NN_STAT_ACCEPT_ERRORS           107
+#define NN_STAT_ACCEPT_PAUSES           108
 
 #define NN_STAT_CURRENT_CONNECTIONS     201
 #define NN_STAT_INPROGRESS_CONNECTIONS  202
@@ -403,7 +447,54 @@ NN_EXPORT int nn_device (int s1, int s2);
 /*  Protocol statistics  */
 #define	NN_STAT_CURRENT_SND_PRIORITY    401
 
+/*  Latency statistics, in microseconds  */
+#define NN_STAT_SEND_LATENCY_COUNT      501
+#define NN_STAT_SEND_LATENCY_MEAN       502
+#define NN_STAT_SEND_LATENCY_P50        503
+#define NN_STAT_SEND_LATENCY_P90        504
+#define NN_STAT_SEND_LATENCY_P99        505
+#define NN_STAT_SEND_LATENCY_P999       506
+#define NN_STAT_SEND_LATENCY_MAX        507
+#define NN_STAT_RECV_LATENCY_COUNT      511
+#define NN_STAT_RECV_LATENCY_MEAN       512
+#define NN_STAT_RECV_LATENCY_P50        513
+#define NN_STAT_RECV_LATENCY_P90        514
+#define NN_STAT_RECV_LATENCY_P99        515
+#define NN_STAT_RECV_LATENCY_P999       516
+#define NN_STAT_RECV_LATENCY_MAX        517
+#define NN_STAT_REQ_RTT_COUNT           521
+#define NN_STAT_REQ_RTT_MEAN            522
+#define NN_STAT_REQ_RTT_P50             523
+#define NN_STAT_REQ_RTT_P90             524
+#define NN_STAT_REQ_RTT_P99             525
+#define NN_STAT_REQ_RTT_P999            526
+#define NN_STAT_REQ_RTT_MAX             527
+
 NN_EXPORT uint64_t nn_get_statistic (int s, int stat);
+NN_EXPORT int nn_get_statistics (int s, const int *stats, uint64_t *values,
+    int nstats);
+
+/*  Statistics of an individual connection (pipe) of the socket. */
+struct nn_pipe_stats {
+    /*  ID of the pipe, unique within the socket. */
+    int id;
+    /*  ID of the endpoint the pipe was created by. */
+    int eid;
+    /*  Address of the peer, if known, otherwise address of the endpoint. */
+    char addr [NN_SOCKADDR_MAX + 1];
+    /*  Byte counts include the protocol headers. */
+    uint64_t messages_sent;
+    uint64_t messages_received;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    /*  Bytes handed over to the transport that were not sent yet.  */
+    uint64_t queued_bytes;
+    /*  Total time the pipe was unable to accept a message, in microseconds. */
+    uint64_t blocked_us;
+};
+
+NN_EXPORT int nn_get_pipe_statistics (int s, struct nn_pipe_stats *stats,
+    int npipes);
 
 #ifdef __cplusplus
 }
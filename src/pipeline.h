@@ -33,6 +33,9 @@ extern "C" {
 #define NN_PUSH (NN_PROTO_PIPELINE * 16 + 0)
 #define NN_PULL (NN_PROTO_PIPELINE * 16 + 1)
 
+#define NN_PUSH_LB_POLICY 1
+#define NN_PULL_CONFLATE 2
+
 #ifdef __cplusplus
 }
 #endif
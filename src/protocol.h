@@ -31,6 +31,7 @@
 #include <stdint.h>
 
 struct nn_ctx;
+struct nn_pipe_stats;
 
 /******************************************************************************/
 /*  Pipe class.                                                               */
@@ -74,6 +75,21 @@ int nn_pipe_recv (struct nn_pipe *self, struct nn_msg *msg);
 void nn_pipe_getopt (struct nn_pipe *self, int level, int option,
     void *optval, size_t *optvallen);
 
+/*  Returns the address of the endpoint the pipe was created by. */
+const char *nn_pipe_getaddr (struct nn_pipe *self);
+
+/*  Returns the address of the peer. For connections accepted by a bound
+    endpoint it's the actual address of the remote side if the transport
+    reports it. Otherwise it's the address of the endpoint. */
+const char *nn_pipe_getpeer (struct nn_pipe *self);
+
+/*  Returns 1 if the pipe was accepted by a bound endpoint, 0 if it was
+    created by a connecting endpoint. */
+int nn_pipe_isbound (struct nn_pipe *self);
+
+/*  Fills in the statistics of the pipe. */
+void nn_pipe_getstats (struct nn_pipe *self, struct nn_pipe_stats *stats);
+
 
 /******************************************************************************/
 /*  Base class for all socket types.                                          */
@@ -155,6 +171,16 @@ int nn_sockbase_getopt (struct nn_sockbase *self, int option,
 void nn_sockbase_stat_increment (struct nn_sockbase *self, int name,
     int increment);
 
+/*  Latency histograms maintained by the socket. */
+#define NN_SOCKBASE_HIST_SEND_LATENCY 0
+#define NN_SOCKBASE_HIST_RECV_LATENCY 1
+#define NN_SOCKBASE_HIST_REQ_RTT 2
+#define NN_SOCKBASE_HIST_COUNT 3
+
+/*  Record a latency sample, in microseconds, into one of the histograms. */
+void nn_sockbase_stat_latency (struct nn_sockbase *self, int hist,
+    uint64_t us);
+
 /******************************************************************************/
 /*  The socktype class.                                                       */
 /******************************************************************************/
@@ -167,6 +193,10 @@ void nn_sockbase_stat_increment (struct nn_sockbase *self, int name,
 /*  Specifies that the socket type can be never used to send messages. */
 #define NN_SOCKTYPE_FLAG_NOSEND 2
 
+/*  Specifies that the socket type can send and receive messages in parts.
+    Only socket types with a single peer and no protocol header can do so. */
+#define NN_SOCKTYPE_FLAG_PARTS 4
+
 struct nn_socktype {
 
     /*  Domain and protocol IDs as specified in nn_socket() function. */
@@ -31,6 +31,9 @@
 #include "../../utils/fast.h"
 #include "../../utils/alloc.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
+#include "../../utils/random.h"
+#include "../../utils/wire.h"
 
 #include <stddef.h>
 #include <string.h>
@@ -40,6 +43,26 @@
     neccessary for the pointer to fit in 64-bit ID. */
 CT_ASSERT (sizeof (uint64_t) >= sizeof (struct nn_pipe*));
 
+/*  Default number of message IDs remembered for duplicate suppression. */
+#define NN_XBUS_DEDUP_MAX 1024
+
+/*  Initial number of slots in the message ID table. Must be a power of 2. */
+#define NN_XBUS_SLOTS 32
+
+/*  Recently seen message ID. */
+struct nn_xbus_id {
+    struct nn_list_item hitem;
+    struct nn_list_item item;
+    uint64_t id;
+    uint64_t expiry;
+};
+
+/*  Private functions. */
+static int nn_xbus_seen (struct nn_xbus *self, uint64_t id);
+static struct nn_list *nn_xbus_slot (struct nn_xbus *self, uint64_t id);
+static void nn_xbus_rehash (struct nn_xbus *self);
+static void nn_xbus_forget (struct nn_xbus *self, struct nn_xbus_id *id);
+
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_xbus_destroy (struct nn_sockbase *self);
 static const struct nn_sockbase_vfptr nn_xbus_sockbase_vfptr = {
@@ -52,20 +75,43 @@ static const struct nn_sockbase_vfptr nn_xbus_sockbase_vfptr = {
     nn_xbus_events,
     nn_xbus_send,
     nn_xbus_recv,
-    NULL,
-    NULL
+    nn_xbus_setopt,
+    nn_xbus_getopt
 };
 
 void nn_xbus_init (struct nn_xbus *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint)
 {
+    uint32_t i;
+
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_dist_init (&self->outpipes);
     nn_fq_init (&self->inpipes);
+    self->dedup = 0;
+    self->dedup_max = NN_XBUS_DEDUP_MAX;
+    self->nslots = NN_XBUS_SLOTS;
+    self->slots = nn_alloc (sizeof (struct nn_list) * self->nslots,
+        "message id table (xbus)");
+    alloc_assert (self->slots);
+    for (i = 0; i != self->nslots; ++i)
+        nn_list_init (&self->slots [i]);
+    nn_list_init (&self->idlist);
+    self->nids = 0;
+    nn_random_generate (&self->nodeid, sizeof (self->nodeid));
+    self->seqnum = 0;
 }
 
 void nn_xbus_term (struct nn_xbus *self)
 {
+    uint32_t i;
+
+    while (!nn_list_empty (&self->idlist))
+        nn_xbus_forget (self, nn_cont (nn_list_begin (&self->idlist),
+            struct nn_xbus_id, item));
+    nn_list_term (&self->idlist);
+    for (i = 0; i != self->nslots; ++i)
+        nn_list_term (&self->slots [i]);
+    nn_free (self->slots);
     nn_fq_term (&self->inpipes);
     nn_dist_term (&self->outpipes);
     nn_sockbase_term (&self->sockbase);
@@ -148,22 +194,46 @@ int nn_xbus_events (struct nn_sockbase *self)
 
 int nn_xbus_send (struct nn_sockbase *self, struct nn_msg *msg)
 {
+    struct nn_xbus *xbus;
     size_t hdrsz;
     struct nn_pipe *exclude;
+    uint64_t id;
 
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
+
+    /*  The header may contain ID of the pipe to exclude, followed by ID
+        of the message when forwarding messages with duplicate suppression
+        enabled. */
     hdrsz = nn_chunkref_size (&msg->sphdr);
-    if (hdrsz == 0)
-        exclude = NULL;
-    else if (hdrsz == sizeof (uint64_t)) {
+    exclude = NULL;
+    if (hdrsz == sizeof (uint64_t) ||
+          (xbus->dedup && hdrsz == 2 * sizeof (uint64_t)))
         memcpy (&exclude, nn_chunkref_data (&msg->sphdr), sizeof (exclude));
+    else if (hdrsz != 0)
+        return -EINVAL;
+
+    if (!xbus->dedup) {
         nn_chunkref_term (&msg->sphdr);
         nn_chunkref_init (&msg->sphdr, 0);
+        return nn_dist_send (&xbus->outpipes, msg, exclude);
     }
-    else
-        return -EINVAL;
 
-    return nn_dist_send (&nn_cont (self, struct nn_xbus, sockbase)->outpipes,
-        msg, exclude);
+    /*  Forwarded messages keep their original ID, new messages get a fresh
+        one. Either way, remember the ID so that the message is dropped
+        if it loops back to us. */
+    if (hdrsz == 2 * sizeof (uint64_t))
+        id = nn_getll ((uint8_t*) nn_chunkref_data (&msg->sphdr) +
+            sizeof (uint64_t));
+    else {
+        id = (((uint64_t) xbus->nodeid) << 32) | xbus->seqnum;
+        ++xbus->seqnum;
+    }
+    nn_xbus_seen (xbus, id);
+    nn_chunkref_term (&msg->sphdr);
+    nn_chunkref_init (&msg->sphdr, sizeof (uint64_t));
+    nn_putll (nn_chunkref_data (&msg->sphdr), id);
+
+    return nn_dist_send (&xbus->outpipes, msg, exclude);
 }
 
 int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
@@ -171,6 +241,7 @@ int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
     int rc;
     struct nn_xbus *xbus;
     struct nn_pipe *pipe;
+    uint64_t id;
 
     xbus = nn_cont (self, struct nn_xbus, sockbase);
 
@@ -181,21 +252,223 @@ int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg)
         if (nn_slow (rc < 0))
             return rc;
 
-        /*  The message should have no header. Drop malformed messages. */
-        if (nn_chunkref_size (&msg->sphdr) == 0)
+        /*  Without duplicate suppression the message should have no header.
+            Drop malformed messages. */
+        if (!xbus->dedup) {
+            if (nn_chunkref_size (&msg->sphdr) == 0)
+                break;
+            nn_msg_term (msg);
+            continue;
+        }
+
+        /*  Split the message ID from the body. */
+        if (!(rc & NN_PIPE_PARSED)) {
+            if (nn_slow (nn_chunkref_size (&msg->body) < sizeof (uint64_t))) {
+                nn_msg_term (msg);
+                continue;
+            }
+            nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
+            nn_chunkref_term (&msg->sphdr);
+            nn_chunkref_init (&msg->sphdr, sizeof (uint64_t));
+            memcpy (nn_chunkref_data (&msg->sphdr),
+                nn_chunkref_data (&msg->body), sizeof (uint64_t));
+            nn_chunkref_trim (&msg->body, sizeof (uint64_t));
+        }
+        if (nn_slow (nn_chunkref_size (&msg->sphdr) != sizeof (uint64_t))) {
+            nn_msg_term (msg);
+            continue;
+        }
+
+        /*  Drop the messages we've already seen. */
+        id = nn_getll (nn_chunkref_data (&msg->sphdr));
+        if (!nn_xbus_seen (xbus, id))
             break;
         nn_msg_term (msg);
     }
 
-    /*  Add pipe ID to the message header. */
+    /*  Add pipe ID to the message header, followed by the message ID if
+        there's one. */
     nn_chunkref_term (&msg->sphdr);
-    nn_chunkref_init (&msg->sphdr, sizeof (uint64_t));
+    if (!xbus->dedup) {
+        nn_chunkref_init (&msg->sphdr, sizeof (uint64_t));
+        memset (nn_chunkref_data (&msg->sphdr), 0, sizeof (uint64_t));
+        memcpy (nn_chunkref_data (&msg->sphdr), &pipe, sizeof (pipe));
+        return 0;
+    }
+    nn_chunkref_init (&msg->sphdr, 2 * sizeof (uint64_t));
     memset (nn_chunkref_data (&msg->sphdr), 0, sizeof (uint64_t));
     memcpy (nn_chunkref_data (&msg->sphdr), &pipe, sizeof (pipe));
+    nn_putll ((uint8_t*) nn_chunkref_data (&msg->sphdr) + sizeof (uint64_t),
+        id);
 
     return 0;
 }
 
+int nn_xbus_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_xbus *xbus;
+    int val;
+
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
+
+    if (level != NN_BUS)
+        return -ENOPROTOOPT;
+
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+
+    if (option == NN_BUS_DEDUP) {
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        xbus->dedup = val;
+        if (!val) {
+            while (!nn_list_empty (&xbus->idlist))
+                nn_xbus_forget (xbus, nn_cont (nn_list_begin (&xbus->idlist),
+                    struct nn_xbus_id, item));
+        }
+        return 0;
+    }
+
+    if (option == NN_BUS_DEDUP_MAX) {
+        if (nn_slow (val <= 0))
+            return -EINVAL;
+        xbus->dedup_max = val;
+        while (xbus->nids > xbus->dedup_max)
+            nn_xbus_forget (xbus, nn_cont (nn_list_begin (&xbus->idlist),
+                struct nn_xbus_id, item));
+        return 0;
+    }
+
+    return -ENOPROTOOPT;
+}
+
+int nn_xbus_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_xbus *xbus;
+
+    xbus = nn_cont (self, struct nn_xbus, sockbase);
+
+    if (level != NN_BUS)
+        return -ENOPROTOOPT;
+
+    if (option == NN_BUS_DEDUP) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xbus->dedup;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_BUS_DEDUP_MAX) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xbus->dedup_max;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    return -ENOPROTOOPT;
+}
+
+static int nn_xbus_seen (struct nn_xbus *self, uint64_t id)
+{
+    uint64_t now;
+    struct nn_list *slot;
+    struct nn_list_item *it;
+    struct nn_xbus_id *item;
+
+    /*  Forget the IDs that are out of the time window. */
+    now = nn_clock_ms ();
+    while (!nn_list_empty (&self->idlist)) {
+        item = nn_cont (nn_list_begin (&self->idlist), struct nn_xbus_id,
+            item);
+        if (item->expiry > now)
+            break;
+        nn_xbus_forget (self, item);
+    }
+
+    /*  IDs hashing to the same slot are chained, so any ID is matched
+        exactly. */
+    slot = nn_xbus_slot (self, id);
+    for (it = nn_list_begin (slot); it != nn_list_end (slot);
+          it = nn_list_next (slot, it))
+        if (nn_cont (it, struct nn_xbus_id, hitem)->id == id)
+            return 1;
+
+    /*  Remember the ID. If there are too many IDs already, forget the
+        oldest one, even if it's still within the time window. */
+    if (self->nids >= self->dedup_max)
+        nn_xbus_forget (self, nn_cont (nn_list_begin (&self->idlist),
+            struct nn_xbus_id, item));
+    item = nn_alloc (sizeof (struct nn_xbus_id), "message id (xbus)");
+    alloc_assert (item);
+    nn_list_item_init (&item->hitem);
+    nn_list_item_init (&item->item);
+    item->id = id;
+    item->expiry = now + self->dedup;
+    nn_list_insert (slot, &item->hitem, nn_list_end (slot));
+    nn_list_insert (&self->idlist, &item->item, nn_list_end (&self->idlist));
+    ++self->nids;
+
+    /*  Keep the chains short by doubling the table when it gets full. */
+    if (nn_slow ((uint32_t) self->nids > self->nslots &&
+          self->nslots < 0x80000000))
+        nn_xbus_rehash (self);
+
+    return 0;
+}
+
+static struct nn_list *nn_xbus_slot (struct nn_xbus *self, uint64_t id)
+{
+    /*  Fibonacci hashing mixes both halves of the ID into the top bits. */
+    return &self->slots [(uint32_t) ((id * 0x9e3779b97f4a7c15ULL) >> 32) &
+        (self->nslots - 1)];
+}
+
+static void nn_xbus_rehash (struct nn_xbus *self)
+{
+    uint32_t i;
+    uint32_t oldnslots;
+    struct nn_list *oldslots;
+    struct nn_list *slot;
+    struct nn_xbus_id *item;
+
+    oldnslots = self->nslots;
+    oldslots = self->slots;
+    self->nslots *= 2;
+    self->slots = nn_alloc (sizeof (struct nn_list) * self->nslots,
+        "message id table (xbus)");
+    alloc_assert (self->slots);
+    for (i = 0; i != self->nslots; ++i)
+        nn_list_init (&self->slots [i]);
+
+    for (i = 0; i != oldnslots; ++i) {
+        while (!nn_list_empty (&oldslots [i])) {
+            item = nn_cont (nn_list_begin (&oldslots [i]),
+                struct nn_xbus_id, hitem);
+            nn_list_erase (&oldslots [i], &item->hitem);
+            slot = nn_xbus_slot (self, item->id);
+            nn_list_insert (slot, &item->hitem, nn_list_end (slot));
+        }
+        nn_list_term (&oldslots [i]);
+    }
+
+    nn_free (oldslots);
+}
+
+static void nn_xbus_forget (struct nn_xbus *self, struct nn_xbus_id *id)
+{
+    nn_list_erase (nn_xbus_slot (self, id->id), &id->hitem);
+    nn_list_erase (&self->idlist, &id->item);
+    --self->nids;
+    nn_list_item_term (&id->item);
+    nn_list_item_term (&id->hitem);
+    nn_free (id);
+}
+
 static int nn_xbus_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_xbus *self;
@@ -29,6 +29,10 @@
 #include "../utils/dist.h"
 #include "../utils/fq.h"
 
+#include "../../utils/list.h"
+
+#include <stdint.h>
+
 struct nn_xbus_data {
     struct nn_dist_data outitem;
     struct nn_fq_data initem;
@@ -38,6 +42,26 @@ struct nn_xbus {
     struct nn_sockbase sockbase;
     struct nn_dist outpipes;
     struct nn_fq inpipes;
+
+    /*  For how long, in milliseconds, are message IDs remembered to drop
+        duplicate messages. Zero means that messages carry no IDs. */
+    int dedup;
+
+    /*  Maximum number of message IDs to remember. When reached, the oldest
+        IDs are forgotten even if they are still within the time window. */
+    int dedup_max;
+
+    /*  Recently seen message IDs, both hashed by the full 64-bit ID into
+        chained slots and ordered by the time they were seen. */
+    struct nn_list *slots;
+    uint32_t nslots;
+    struct nn_list idlist;
+    int nids;
+
+    /*  IDs of the messages originating from this socket are composed of
+        a random node ID and a sequence number. */
+    uint32_t nodeid;
+    uint32_t seqnum;
 };
 
 void nn_xbus_init (struct nn_xbus *self,
@@ -51,6 +75,10 @@ void nn_xbus_out (struct nn_sockbase *self, struct nn_pipe *pipe);
 int nn_xbus_events (struct nn_sockbase *self);
 int nn_xbus_send (struct nn_sockbase *self, struct nn_msg *msg);
 int nn_xbus_recv (struct nn_sockbase *self, struct nn_msg *msg);
+int nn_xbus_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen);
+int nn_xbus_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen);
 
 int nn_xbus_ispeer (int socktype);
 
@@ -27,6 +27,7 @@
 #include "../../pipeline.h"
 
 #include "../utils/fq.h"
+#include "../utils/conflate.h"
 
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
@@ -41,12 +42,19 @@ struct nn_xpull_data {
 struct nn_xpull {
     struct nn_sockbase sockbase;
     struct nn_fq fq;
+
+    /*  If set, only the newest message is kept. Messages are pulled from
+        the pipes as soon as they arrive and the last one is stored in
+        'conflated' until the user receives it. */
+    int conflate;
+    struct nn_conflate conflated;
 };
 
 /*  Private functions. */
 static void nn_xpull_init (struct nn_xpull *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint);
 static void nn_xpull_term (struct nn_xpull *self);
+static void nn_xpull_drain (struct nn_xpull *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_xpull_destroy (struct nn_sockbase *self);
@@ -56,6 +64,10 @@ static void nn_xpull_in (struct nn_sockbase *self, struct nn_pipe *pipe);
 static void nn_xpull_out (struct nn_sockbase *self, struct nn_pipe *pipe);
 static int nn_xpull_events (struct nn_sockbase *self);
 static int nn_xpull_recv (struct nn_sockbase *self, struct nn_msg *msg);
+static int nn_xpull_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen);
+static int nn_xpull_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_xpull_sockbase_vfptr = {
     NULL,
     nn_xpull_destroy,
@@ -66,8 +78,8 @@ static const struct nn_sockbase_vfptr nn_xpull_sockbase_vfptr = {
     nn_xpull_events,
     NULL,
     nn_xpull_recv,
-    NULL,
-    NULL
+    nn_xpull_setopt,
+    nn_xpull_getopt
 };
 
 static void nn_xpull_init (struct nn_xpull *self,
@@ -75,10 +87,13 @@ static void nn_xpull_init (struct nn_xpull *self,
 {
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_fq_init (&self->fq);
+    self->conflate = 0;
+    nn_conflate_init (&self->conflated);
 }
 
 static void nn_xpull_term (struct nn_xpull *self)
 {
+    nn_conflate_term (&self->conflated);
     nn_fq_term (&self->fq);
     nn_sockbase_term (&self->sockbase);
 }
@@ -135,6 +150,8 @@ static void nn_xpull_in (NN_UNUSED struct nn_sockbase *self,
     xpull = nn_cont (self, struct nn_xpull, sockbase);
     data = nn_pipe_getdata (pipe);
     nn_fq_in (&xpull->fq, &data->fq);
+    if (xpull->conflate)
+        nn_xpull_drain (xpull);
 }
 
 static void nn_xpull_out (NN_UNUSED struct nn_sockbase *self,
@@ -146,21 +163,97 @@ static void nn_xpull_out (NN_UNUSED struct nn_sockbase *self,
 
 static int nn_xpull_events (struct nn_sockbase *self)
 {
-    return nn_fq_can_recv (&nn_cont (self, struct nn_xpull, sockbase)->fq) ?
-        NN_SOCKBASE_EVENT_IN : 0;
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    return nn_conflate_can_recv (&xpull->conflated) ||
+        nn_fq_can_recv (&xpull->fq) ? NN_SOCKBASE_EVENT_IN : 0;
 }
 
 static int nn_xpull_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
+    struct nn_xpull *xpull;
 
-    rc = nn_fq_recv (&nn_cont (self, struct nn_xpull, sockbase)->fq,
-         msg, NULL);
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    /*  Conflated message goes first. It may have been left over even if
+        conflation was switched off in the meantime. */
+    if (xpull->conflate)
+        nn_xpull_drain (xpull);
+    if (nn_conflate_get (&xpull->conflated, msg) == 0)
+        return 0;
+
+    rc = nn_fq_recv (&xpull->fq, msg, NULL);
 
     /*  Discard NN_PIPEBASE_PARSED flag. */
     return rc < 0 ? rc : 0;
 }
 
+static void nn_xpull_drain (struct nn_xpull *self)
+{
+    int rc;
+    struct nn_msg msg;
+
+    /*  Pull all the available messages from the pipes, keeping only
+        the newest one. */
+    while (1) {
+        rc = nn_fq_recv (&self->fq, &msg, NULL);
+        if (rc == -EAGAIN)
+            return;
+        errnum_assert (rc >= 0, -rc);
+        nn_conflate_put (&self->conflated, &msg, 0);
+    }
+}
+
+static int nn_xpull_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
+{
+    int val;
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    if (level != NN_PULL)
+        return -ENOPROTOOPT;
+
+    if (option == NN_PULL_CONFLATE) {
+        if (optvallen != sizeof (int))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        xpull->conflate = val;
+        if (val)
+            nn_xpull_drain (xpull);
+        return 0;
+    }
+
+    return -ENOPROTOOPT;
+}
+
+static int nn_xpull_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_xpull *xpull;
+
+    xpull = nn_cont (self, struct nn_xpull, sockbase);
+
+    if (level != NN_PULL)
+        return -ENOPROTOOPT;
+
+    if (option == NN_PULL_CONFLATE) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xpull->conflate;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    return -ENOPROTOOPT;
+}
+
 int nn_xpull_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_xpull *self;
@@ -56,6 +56,10 @@ static void nn_xpush_in (struct nn_sockbase *self, struct nn_pipe *pipe);
 static void nn_xpush_out (struct nn_sockbase *self, struct nn_pipe *pipe);
 static int nn_xpush_events (struct nn_sockbase *self);
 static int nn_xpush_send (struct nn_sockbase *self, struct nn_msg *msg);
+static int nn_xpush_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen);
+static int nn_xpush_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_xpush_sockbase_vfptr = {
     NULL,
     nn_xpush_destroy,
@@ -66,8 +70,8 @@ static const struct nn_sockbase_vfptr nn_xpush_sockbase_vfptr = {
     nn_xpush_events,
     nn_xpush_send,
     NULL,
-    NULL,
-    NULL
+    nn_xpush_setopt,
+    nn_xpush_getopt
 };
 
 static void nn_xpush_init (struct nn_xpush *self,
@@ -160,6 +164,38 @@ static int nn_xpush_send (struct nn_sockbase *self, struct nn_msg *msg)
         msg, NULL);
 }
 
+static int nn_xpush_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_xpush *xpush;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+
+    if (level != NN_PUSH)
+        return -ENOPROTOOPT;
+
+    if (option == NN_PUSH_LB_POLICY)
+        return nn_lb_setpolicy (&xpush->lb, optval, optvallen);
+
+    return -ENOPROTOOPT;
+}
+
+static int nn_xpush_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_xpush *xpush;
+
+    xpush = nn_cont (self, struct nn_xpush, sockbase);
+
+    if (level != NN_PUSH)
+        return -ENOPROTOOPT;
+
+    if (option == NN_PUSH_LB_POLICY)
+        return nn_lb_getpolicy (&xpush->lb, optval, optvallen);
+
+    return -ENOPROTOOPT;
+}
+
 int nn_xpush_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_xpush *self;
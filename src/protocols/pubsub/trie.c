@@ -437,10 +437,20 @@ step5:
 }
 
 int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size)
+{
+    size_t len;
+
+    return nn_trie_match_len (self, data, size, &len);
+}
+
+int nn_trie_match_len (struct nn_trie *self, const uint8_t *data, size_t size,
+    size_t *len)
 {
     struct nn_trie_node *node;
     struct nn_trie_node **tmp;
+    const uint8_t *begin;
 
+    begin = data;
     node = self->root;
     while (1) {
 
@@ -458,8 +468,10 @@ int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size)
         size -= node->prefix_len;
 
         /*  If all the data are matched, return. */
-        if (nn_node_has_subscribers (node))
+        if (nn_node_has_subscribers (node)) {
+            *len = data - begin;
             return 1;
+        }
 
         /*  Move to the next node. */
         tmp = nn_node_next (node, *data);
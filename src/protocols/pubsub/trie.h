@@ -112,6 +112,12 @@ int nn_trie_unsubscribe (struct nn_trie *self, const uint8_t *data,
     it returns 0. */
 int nn_trie_match (struct nn_trie *self, const uint8_t *data, size_t size);
 
+/*  Same as nn_trie_match, except that in case of a match the length of
+    the matching subscription is stored in 'len'. If several subscriptions
+    match, the shortest one is reported. */
+int nn_trie_match_len (struct nn_trie *self, const uint8_t *data, size_t size,
+    size_t *len);
+
 /*  Debugging interface. */
 void nn_trie_dump (struct nn_trie *self);
 
@@ -29,6 +29,7 @@
 #include "../../pubsub.h"
 
 #include "../utils/fq.h"
+#include "../utils/conflate.h"
 
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
@@ -44,12 +45,19 @@ struct nn_xsub {
     struct nn_sockbase sockbase;
     struct nn_fq fq;
     struct nn_trie trie;
+
+    /*  If set, only the newest message for each subscription is kept.
+        Messages are pulled from the pipes as soon as they arrive and stored
+        in 'conflated' until the user receives them. */
+    int conflate;
+    struct nn_conflate conflated;
 };
 
 /*  Private functions. */
 static void nn_xsub_init (struct nn_xsub *self,
     const struct nn_sockbase_vfptr *vfptr, void *hint);
 static void nn_xsub_term (struct nn_xsub *self);
+static void nn_xsub_drain (struct nn_xsub *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_xsub_destroy (struct nn_sockbase *self);
@@ -61,6 +69,8 @@ static int nn_xsub_events (struct nn_sockbase *self);
 static int nn_xsub_recv (struct nn_sockbase *self, struct nn_msg *msg);
 static int nn_xsub_setopt (struct nn_sockbase *self, int level, int option,
     const void *optval, size_t optvallen);
+static int nn_xsub_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen);
 static const struct nn_sockbase_vfptr nn_xsub_sockbase_vfptr = {
     NULL,
     nn_xsub_destroy,
@@ -72,7 +82,7 @@ static const struct nn_sockbase_vfptr nn_xsub_sockbase_vfptr = {
     NULL,
     nn_xsub_recv,
     nn_xsub_setopt,
-    NULL
+    nn_xsub_getopt
 };
 
 static void nn_xsub_init (struct nn_xsub *self,
@@ -81,10 +91,13 @@ static void nn_xsub_init (struct nn_xsub *self,
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_fq_init (&self->fq);
     nn_trie_init (&self->trie);
+    self->conflate = 0;
+    nn_conflate_init (&self->conflated);
 }
 
 static void nn_xsub_term (struct nn_xsub *self)
 {
+    nn_conflate_term (&self->conflated);
     nn_trie_term (&self->trie);
     nn_fq_term (&self->fq);
     nn_sockbase_term (&self->sockbase);
@@ -141,6 +154,8 @@ static void nn_xsub_in (struct nn_sockbase *self, struct nn_pipe *pipe)
     xsub = nn_cont (self, struct nn_xsub, sockbase);
     data = nn_pipe_getdata (pipe);
     nn_fq_in (&xsub->fq, &data->fq);
+    if (xsub->conflate)
+        nn_xsub_drain (xsub);
 }
 
 static void nn_xsub_out (NN_UNUSED struct nn_sockbase *self,
@@ -153,8 +168,12 @@ static void nn_xsub_out (NN_UNUSED struct nn_sockbase *self,
 
 static int nn_xsub_events (struct nn_sockbase *self)
 {
-    return nn_fq_can_recv (&nn_cont (self, struct nn_xsub, sockbase)->fq) ?
-        NN_SOCKBASE_EVENT_IN : 0;
+    struct nn_xsub *xsub;
+
+    xsub = nn_cont (self, struct nn_xsub, sockbase);
+
+    return nn_conflate_can_recv (&xsub->conflated) ||
+        nn_fq_can_recv (&xsub->fq) ? NN_SOCKBASE_EVENT_IN : 0;
 }
 
 static int nn_xsub_recv (struct nn_sockbase *self, struct nn_msg *msg)
@@ -164,6 +183,13 @@ static int nn_xsub_recv (struct nn_sockbase *self, struct nn_msg *msg)
 
     xsub = nn_cont (self, struct nn_xsub, sockbase);
 
+    /*  Conflated messages go first. They may have been left over even if
+        conflation was switched off in the meantime. */
+    if (xsub->conflate)
+        nn_xsub_drain (xsub);
+    if (nn_conflate_get (&xsub->conflated, msg) == 0)
+        return 0;
+
     /*  Loop while a matching message is found or when there are no more
         messages to receive. */
     while (1) {
@@ -183,10 +209,32 @@ static int nn_xsub_recv (struct nn_sockbase *self, struct nn_msg *msg)
     }
 }
 
+static void nn_xsub_drain (struct nn_xsub *self)
+{
+    int rc;
+    size_t len;
+    struct nn_msg msg;
+
+    /*  Pull all the available messages from the pipes, keeping only
+        the newest one for each subscription. */
+    while (1) {
+        rc = nn_fq_recv (&self->fq, &msg, NULL);
+        if (rc == -EAGAIN)
+            return;
+        errnum_assert (rc >= 0, -rc);
+        if (nn_trie_match_len (&self->trie, nn_chunkref_data (&msg.body),
+              nn_chunkref_size (&msg.body), &len))
+            nn_conflate_put (&self->conflated, &msg, len);
+        else
+            nn_msg_term (&msg);
+    }
+}
+
 static int nn_xsub_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
     int rc;
+    int val;
     struct nn_xsub *xsub;
 
     xsub = nn_cont (self, struct nn_xsub, sockbase);
@@ -208,6 +256,39 @@ static int nn_xsub_setopt (struct nn_sockbase *self, int level, int option,
         return rc;
     }
 
+    if (option == NN_SUB_CONFLATE) {
+        if (optvallen != sizeof (int))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val != 0 && val != 1))
+            return -EINVAL;
+        xsub->conflate = val;
+        if (val)
+            nn_xsub_drain (xsub);
+        return 0;
+    }
+
+    return -ENOPROTOOPT;
+}
+
+static int nn_xsub_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_xsub *xsub;
+
+    xsub = nn_cont (self, struct nn_xsub, sockbase);
+
+    if (level != NN_SUB)
+        return -ENOPROTOOPT;
+
+    if (option == NN_SUB_CONFLATE) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = xsub->conflate;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
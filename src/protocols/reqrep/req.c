@@ -36,6 +36,7 @@
 #include "../../utils/random.h"
 #include "../../utils/wire.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
 
 #include <stddef.h>
 #include <string.h>
@@ -52,6 +53,7 @@
 #define NN_REQ_STATE_STOPPING_TIMER 7
 #define NN_REQ_STATE_DONE 8
 #define NN_REQ_STATE_STOPPING 9
+#define NN_REQ_STATE_PIPELINED 10
 
 #define NN_REQ_ACTION_START 1
 #define NN_REQ_ACTION_IN 2
@@ -62,6 +64,40 @@
 
 #define NN_REQ_SRC_RESEND_TIMER 1
 
+/*  A request sent in the pipelined mode. */
+struct nn_req_pending {
+
+    /*  Item in the 'pending' hash, keyed by the request ID. */
+    struct nn_hash_item hitem;
+
+    /*  Item in the 'unsent' list while waiting for a peer to be sent to,
+        in the 'replies' list once the reply arrives. */
+    struct nn_list_item item;
+
+    /*  Item in the 'resends' queue while waiting for the reply. */
+    struct nn_deadline_item resend;
+
+    /*  Stored request, so that it can be re-sent if needed. */
+    struct nn_msg request;
+
+    /*  The reply, once it arrives. */
+    struct nn_msg reply;
+
+    /*  Pipe the request was sent to, NULL if it is yet to be sent. */
+    struct nn_pipe *sent_to;
+
+    /*  Time when the user sent the request, in microseconds. */
+    uint64_t sent;
+};
+
+static void nn_req_pending_destroy (struct nn_req_pending *self);
+static void nn_req_pipeline_in (struct nn_req *self);
+static int nn_req_pipeline_send (struct nn_req *self,
+    struct nn_req_pending *pending);
+static void nn_req_pipeline_resend (struct nn_req *self);
+static void nn_req_pipeline_unsend (struct nn_req *self,
+    struct nn_req_pending *pending);
+
 static const struct nn_sockbase_vfptr nn_req_sockbase_vfptr = {
     nn_req_stop,
     nn_req_destroy,
@@ -97,12 +133,46 @@ void nn_req_init (struct nn_req *self,
 
     nn_task_init (&self->task, self->lastid);
 
+    self->pipeline = 0;
+    nn_hash_init (&self->pending);
+    nn_deadline_init (&self->resends, &self->task.timer);
+    nn_list_init (&self->unsent);
+    nn_list_init (&self->replies);
+    self->inflight = 0;
+
     /*  Start the state machine. */
     nn_fsm_start (&self->fsm);
 }
 
 void nn_req_term (struct nn_req *self)
 {
+    struct nn_req_pending *pending;
+
+    while (nn_deadline_first (&self->resends)) {
+        pending = nn_cont (nn_deadline_first (&self->resends),
+            struct nn_req_pending, resend);
+        nn_deadline_rm (&self->resends, &pending->resend);
+        nn_hash_erase (&self->pending, &pending->hitem);
+        nn_req_pending_destroy (pending);
+    }
+    while (!nn_list_empty (&self->unsent)) {
+        pending = nn_cont (nn_list_begin (&self->unsent),
+            struct nn_req_pending, item);
+        nn_list_erase (&self->unsent, &pending->item);
+        nn_hash_erase (&self->pending, &pending->hitem);
+        nn_req_pending_destroy (pending);
+    }
+    while (!nn_list_empty (&self->replies)) {
+        pending = nn_cont (nn_list_begin (&self->replies),
+            struct nn_req_pending, item);
+        nn_list_erase (&self->replies, &pending->item);
+        nn_req_pending_destroy (pending);
+    }
+    nn_list_term (&self->replies);
+    nn_list_term (&self->unsent);
+    nn_deadline_term (&self->resends);
+    nn_hash_term (&self->pending);
+
     nn_timer_term (&self->task.timer);
     nn_task_term (&self->task);
     nn_msg_term (&self->task.reply);
@@ -133,6 +203,8 @@ void nn_req_destroy (struct nn_sockbase *self)
 int nn_req_inprogress (struct nn_req *self)
 {
     /*  Return 1 if there's a request submitted. 0 otherwise. */
+    if (self->state == NN_REQ_STATE_PIPELINED)
+        return self->inflight ? 1 : 0;
     return self->state == NN_REQ_STATE_IDLE ||
         self->state == NN_REQ_STATE_PASSIVE ||
         self->state == NN_REQ_STATE_STOPPING ? 0 : 1;
@@ -149,6 +221,11 @@ void nn_req_in (struct nn_sockbase *self, struct nn_pipe *pipe)
     /*  Pass the pipe to the raw REQ socket. */
     nn_xreq_in (&req->xreq.sockbase, pipe);
 
+    if (req->state == NN_REQ_STATE_PIPELINED) {
+        nn_req_pipeline_in (req);
+        return;
+    }
+
     while (1) {
 
         /*  Get new reply. */
@@ -185,6 +262,10 @@ void nn_req_in (struct nn_sockbase *self, struct nn_pipe *pipe)
         nn_chunkref_term (&req->task.reply.sphdr);
         nn_chunkref_init (&req->task.reply.sphdr, 0);
 
+        /*  Account for the round-trip time, including any resends. */
+        nn_sockbase_stat_latency (&req->xreq.sockbase,
+            NN_SOCKBASE_HIST_REQ_RTT, nn_clock_us () - req->task.sent);
+
         /*  TODO: Deallocate the request here? */
 
         /*  Notify the state machine. */
@@ -204,6 +285,15 @@ void nn_req_out (struct nn_sockbase *self, struct nn_pipe *pipe)
     /*  Add the pipe to the underlying raw socket. */
     nn_xreq_out (&req->xreq.sockbase, pipe);
 
+    /*  Send the pipelined requests that were waiting for a peer. This
+        includes the requests that were due to be re-sent while no peer was
+        available. */
+    if (req->state == NN_REQ_STATE_PIPELINED) {
+        if (!nn_list_empty (&req->unsent))
+            nn_req_pipeline_resend (req);
+        return;
+    }
+
     /*  Notify the state machine. */
     if (req->state == NN_REQ_STATE_DELAYED)
         nn_fsm_action (&req->fsm, NN_REQ_ACTION_OUT);
@@ -216,6 +306,15 @@ int nn_req_events (struct nn_sockbase *self)
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    /*  In the pipelined mode, OUT is signalled while there's room for more
+        requests in flight. */
+    if (req->state == NN_REQ_STATE_PIPELINED) {
+        rc = req->inflight < req->pipeline ? NN_SOCKBASE_EVENT_OUT : 0;
+        if (!nn_list_empty (&req->replies))
+            rc |= NN_SOCKBASE_EVENT_IN;
+        return rc;
+    }
+
     /*  OUT is signalled all the time because sending a request while
         another one is being processed cancels the old one. */
     rc = NN_SOCKBASE_EVENT_OUT;
@@ -230,14 +329,52 @@ int nn_req_events (struct nn_sockbase *self)
 int nn_req_csend (struct nn_sockbase *self, struct nn_msg *msg)
 {
     struct nn_req *req;
+    struct nn_req_pending *pending;
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    /*  The request ID is generated by the socket. The user can't supply
+        a header of their own. */
+    if (nn_slow (nn_chunkref_size (&msg->sphdr) != 0))
+        return -EINVAL;
+
+    if (req->state == NN_REQ_STATE_PIPELINED) {
+        if (nn_slow (req->inflight >= req->pipeline))
+            return -EAGAIN;
+
+        /*  Tag the request with a new ID, same as in the lock-step mode. */
+        ++req->task.id;
+        nn_chunkref_term (&msg->sphdr);
+        nn_chunkref_init (&msg->sphdr, 4);
+        nn_putl (nn_chunkref_data (&msg->sphdr), req->task.id | 0x80000000);
+
+        /*  Store the request until the reply arrives. */
+        pending = nn_alloc (sizeof (struct nn_req_pending), "request");
+        alloc_assert (pending);
+        nn_hash_item_init (&pending->hitem);
+        nn_list_item_init (&pending->item);
+        nn_deadline_item_init (&pending->resend);
+        nn_msg_mv (&pending->request, msg);
+        nn_msg_init (&pending->reply, 0);
+        pending->sent_to = NULL;
+        pending->sent = nn_clock_us ();
+        nn_hash_insert (&req->pending, req->task.id & 0x7fffffff,
+            &pending->hitem);
+        nn_list_insert (&req->unsent, &pending->item,
+            nn_list_end (&req->unsent));
+        ++req->inflight;
+
+        /*  If there's no peer to send the request to, it will be sent once
+            one becomes available. */
+        nn_req_pipeline_send (req, pending);
+        return 0;
+    }
+
     /*  Generate new request ID for the new request and put it into message
         header. The most important bit is set to 1 to indicate that this is
         the bottom of the backtrace stack. */
     ++req->task.id;
-    nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
+    req->task.sent = nn_clock_us ();
     nn_chunkref_term (&msg->sphdr);
     nn_chunkref_init (&msg->sphdr, 4);
     nn_putl (nn_chunkref_data (&msg->sphdr), req->task.id | 0x80000000);
@@ -255,9 +392,26 @@ int nn_req_csend (struct nn_sockbase *self, struct nn_msg *msg)
 int nn_req_crecv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     struct nn_req *req;
+    struct nn_req_pending *pending;
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
+    /*  In the pipelined mode the replies are passed to the user in the order
+        they arrive. The request ID is left in the header so that the user
+        can match them with the requests. */
+    if (req->state == NN_REQ_STATE_PIPELINED) {
+        if (nn_slow (nn_list_empty (&req->replies)))
+            return req->inflight ? -EAGAIN : -EFSM;
+        pending = nn_cont (nn_list_begin (&req->replies),
+            struct nn_req_pending, item);
+        nn_list_erase (&req->replies, &pending->item);
+        nn_msg_mv (msg, &pending->reply);
+        nn_msg_init (&pending->reply, 0);
+        nn_req_pending_destroy (pending);
+        --req->inflight;
+        return 0;
+    }
+
     /*  No request was sent. Waiting for a reply doesn't make sense. */
     if (nn_slow (!nn_req_inprogress (req)))
         return -EFSM;
@@ -280,6 +434,7 @@ int nn_req_setopt (struct nn_sockbase *self, int level, int option,
         const void *optval, size_t optvallen)
 {
     struct nn_req *req;
+    int val;
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
@@ -293,7 +448,33 @@ int nn_req_setopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
-    return -ENOPROTOOPT;
+    if (option == NN_REQ_PIPELINE) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val < 0))
+            return -EINVAL;
+
+        /*  The mode can be switched only while there's no request
+            outstanding. When switching back to the lock-step mode, the
+            resend timer has to be stopped first. */
+        if (val > 0) {
+            if (req->state == NN_REQ_STATE_PASSIVE)
+                req->state = NN_REQ_STATE_PIPELINED;
+            else if (req->state != NN_REQ_STATE_PIPELINED)
+                return -EFSM;
+        }
+        else if (req->state == NN_REQ_STATE_PIPELINED) {
+            if (nn_slow (req->inflight))
+                return -EFSM;
+            if (nn_deadline_stop (&req->resends))
+                req->state = NN_REQ_STATE_PASSIVE;
+        }
+        req->pipeline = val;
+        return 0;
+    }
+
+    return nn_xreq_setopt (self, level, option, optval, optvallen);
 }
 
 int nn_req_getopt (struct nn_sockbase *self, int level, int option,
@@ -314,7 +495,23 @@ int nn_req_getopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
-    return -ENOPROTOOPT;
+    if (option == NN_REQ_PIPELINE) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = req->pipeline;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_REQ_LAST_ID) {
+        if (nn_slow (*optvallen < sizeof (uint32_t)))
+            return -EINVAL;
+        *(uint32_t*) optval = req->task.id | 0x80000000;
+        *optvallen = sizeof (uint32_t);
+        return 0;
+    }
+
+    return nn_xreq_getopt (self, level, option, optval, optvallen);
 }
 
 void nn_req_shutdown (struct nn_fsm *self, int src, int type,
@@ -436,6 +633,7 @@ void nn_req_handler (struct nn_fsm *self, int src, int type,
                 /*  New request was sent while the old one was still being
                     processed. Cancel the old request first. */
                 nn_timer_stop (&req->task.timer);
+                nn_xreq_cancel (&req->xreq.sockbase, req->task.sent_to);
                 req->task.sent_to = NULL;
                 req->state = NN_REQ_STATE_CANCELLING;
                 return;
@@ -456,6 +654,7 @@ void nn_req_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_TIMER_TIMEOUT:
                 nn_timer_stop (&req->task.timer);
+                nn_xreq_cancel (&req->xreq.sockbase, req->task.sent_to);
                 req->task.sent_to = NULL;
                 req->state = NN_REQ_STATE_TIMED_OUT;
                 return;
@@ -588,6 +787,38 @@ void nn_req_handler (struct nn_fsm *self, int src, int type,
             nn_fsm_bad_source (req->state, src, type);
         }
 
+/******************************************************************************/
+/*  PIPELINED state.                                                          */
+/*  Requests are sent without waiting for replies to the previous ones.       */
+/*  The timer is used to re-send the requests that weren't replied to.        */
+/******************************************************************************/
+    case NN_REQ_STATE_PIPELINED:
+        switch (src) {
+
+        case NN_REQ_SRC_RESEND_TIMER:
+            switch (type) {
+            case NN_TIMER_TIMEOUT:
+                nn_deadline_timeout (&req->resends);
+                return;
+            case NN_TIMER_STOPPED:
+                nn_deadline_stopped (&req->resends);
+
+                /*  Switching to the lock-step mode was requested. */
+                if (!req->pipeline) {
+                    req->state = NN_REQ_STATE_PASSIVE;
+                    return;
+                }
+
+                nn_req_pipeline_resend (req);
+                return;
+            default:
+                nn_fsm_bad_action (req->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (req->state, src, type);
+        }
+
 /******************************************************************************/
 /*  Invalid state.                                                            */
 /******************************************************************************/
@@ -634,6 +865,136 @@ void nn_req_action_send (struct nn_req *self, int allow_delay)
     errnum_assert (0, -rc);
 }
 
+static void nn_req_pending_destroy (struct nn_req_pending *self)
+{
+    nn_msg_term (&self->reply);
+    nn_msg_term (&self->request);
+    nn_deadline_item_term (&self->resend);
+    nn_list_item_term (&self->item);
+    nn_hash_item_term (&self->hitem);
+    nn_free (self);
+}
+
+static void nn_req_pipeline_in (struct nn_req *self)
+{
+    int rc;
+    struct nn_msg msg;
+    uint32_t reqid;
+    struct nn_hash_item *hitem;
+    struct nn_req_pending *pending;
+
+    while (1) {
+
+        /*  Get new reply. */
+        rc = nn_xreq_recv (&self->xreq.sockbase, &msg);
+        if (nn_slow (rc == -EAGAIN))
+            return;
+        errnum_assert (rc == 0, -rc);
+
+        /*  Ignore malformed replies. */
+        if (nn_slow (nn_chunkref_size (&msg.sphdr) != sizeof (uint32_t))) {
+            nn_msg_term (&msg);
+            continue;
+        }
+        reqid = nn_getl (nn_chunkref_data (&msg.sphdr));
+        if (nn_slow (!(reqid & 0x80000000))) {
+            nn_msg_term (&msg);
+            continue;
+        }
+
+        /*  Ignore replies to requests that are not pending, such as
+            duplicate replies to re-sent requests. */
+        hitem = nn_hash_get (&self->pending, reqid & 0x7fffffff);
+        if (nn_slow (!hitem)) {
+            nn_msg_term (&msg);
+            continue;
+        }
+        pending = nn_cont (hitem, struct nn_req_pending, hitem);
+
+        /*  The request won't be re-sent any more. */
+        nn_hash_erase (&self->pending, &pending->hitem);
+        if (pending->sent_to)
+            nn_deadline_rm (&self->resends, &pending->resend);
+        else
+            nn_list_erase (&self->unsent, &pending->item);
+        nn_msg_term (&pending->request);
+        nn_msg_init (&pending->request, 0);
+
+        /*  Store the reply till the user retrieves it. */
+        nn_msg_mv (&pending->reply, &msg);
+        nn_list_insert (&self->replies, &pending->item,
+            nn_list_end (&self->replies));
+
+        nn_sockbase_stat_latency (&self->xreq.sockbase,
+            NN_SOCKBASE_HIST_REQ_RTT, nn_clock_us () - pending->sent);
+    }
+}
+
+static int nn_req_pipeline_send (struct nn_req *self,
+    struct nn_req_pending *pending)
+{
+    int rc;
+    struct nn_msg msg;
+    struct nn_pipe *to;
+
+    nn_assert (!pending->sent_to);
+
+    nn_msg_cp (&msg, &pending->request);
+    rc = nn_xreq_send_to (&self->xreq.sockbase, &msg, &to);
+    if (nn_slow (rc == -EAGAIN)) {
+        nn_msg_term (&msg);
+        return -EAGAIN;
+    }
+    errnum_assert (rc == 0, -rc);
+    nn_assert (to);
+
+    /*  Move the request to the re-send queue. */
+    nn_list_erase (&self->unsent, &pending->item);
+    pending->sent_to = to;
+    nn_deadline_add (&self->resends, &pending->resend, self->resend_ivl);
+    return 0;
+}
+
+static void nn_req_pipeline_resend (struct nn_req *self)
+{
+    uint64_t now;
+    struct nn_deadline_item *item;
+    struct nn_req_pending *pending;
+
+    /*  Requests that were not replied to in time are re-sent the same way as
+        the requests that were never sent. If there's no peer to re-send them
+        to, they wait for one in the 'unsent' list rather than keeping the
+        timer firing. */
+    now = nn_clock_ms ();
+    while ((item = nn_deadline_expired (&self->resends, now)) != NULL) {
+        pending = nn_cont (item, struct nn_req_pending, resend);
+        nn_xreq_cancel (&self->xreq.sockbase, pending->sent_to);
+        nn_req_pipeline_unsend (self, pending);
+    }
+
+    /*  Send the requests in the order they were queued in. If there's no
+        peer available, wait till one arrives. */
+    while (!nn_list_empty (&self->unsent)) {
+        pending = nn_cont (nn_list_begin (&self->unsent),
+            struct nn_req_pending, item);
+        if (nn_req_pipeline_send (self, pending) < 0)
+            break;
+    }
+
+    nn_deadline_arm (&self->resends);
+}
+
+static void nn_req_pipeline_unsend (struct nn_req *self,
+    struct nn_req_pending *pending)
+{
+    nn_assert (pending->sent_to);
+
+    nn_deadline_rm (&self->resends, &pending->resend);
+    nn_list_insert (&self->unsent, &pending->item,
+        nn_list_end (&self->unsent));
+    pending->sent_to = NULL;
+}
+
 static int nn_req_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_req *self;
@@ -648,10 +1009,30 @@ static int nn_req_create (void *hint, struct nn_sockbase **sockbase)
 
 void nn_req_rm (struct nn_sockbase *self, struct nn_pipe *pipe) {
     struct nn_req *req;
+    struct nn_list_item *it;
+    struct nn_list_item *next;
+    struct nn_req_pending *pending;
 
     req = nn_cont (self, struct nn_req, xreq.sockbase);
 
     nn_xreq_rm (self, pipe);
+
+    /*  Re-send the pipelined requests sent to the pipe immediately. */
+    if (req->state == NN_REQ_STATE_PIPELINED) {
+        for (it = nn_list_begin (&req->resends.items);
+              it != nn_list_end (&req->resends.items);
+              it = next) {
+            next = nn_list_next (&req->resends.items, it);
+            pending = nn_cont (nn_cont (it, struct nn_deadline_item, item),
+                struct nn_req_pending, resend);
+            if (pending->sent_to == pipe)
+                nn_req_pipeline_unsend (req, pending);
+        }
+        if (!nn_list_empty (&req->unsent))
+            nn_req_pipeline_resend (req);
+        return;
+    }
+
     if (nn_slow (pipe == req->task.sent_to)) {
         nn_fsm_action (&req->fsm, NN_REQ_ACTION_PIPE_RM);
     }
@@ -27,8 +27,12 @@
 #include "xreq.h"
 #include "task.h"
 
+#include "../utils/deadline.h"
+
 #include "../../protocol.h"
 #include "../../aio/fsm.h"
+#include "../../utils/hash.h"
+#include "../../utils/list.h"
 
 struct nn_req {
 
@@ -47,6 +51,24 @@ struct nn_req {
 
     /*  The request being processed. */
     struct nn_task task;
+
+    /*  Maximum number of requests in flight set by NN_REQ_PIPELINE. Zero
+        means the lock-step mode where only 'task' is used. */
+    int pipeline;
+
+    /*  In the pipelined mode, requests waiting for a reply keyed by the
+        request ID. Those that were sent are also in 'resends', ordered by
+        the time they should be re-sent at. Those that are waiting for a peer
+        to be (re-)sent to are in 'unsent' instead. */
+    struct nn_hash pending;
+    struct nn_deadline resends;
+    struct nn_list unsent;
+
+    /*  Replies received but not yet retrieved by the user. */
+    struct nn_list replies;
+
+    /*  Number of requests sent whose replies weren't retrieved yet. */
+    int inflight;
 };
 
 /*  Some users may want to extend the REQ protocol similar to how REQ extends XREQ.
@@ -27,6 +27,7 @@
 void nn_task_init (struct nn_task *self, uint32_t id)
 {
     self->id = id;
+    self->sent = 0;
 }
 
 void nn_task_term (NN_UNUSED struct nn_task *self)
@@ -48,6 +48,10 @@ struct nn_task {
     /*  Pipe the current request has been sent to. This is an optimisation so
         that request can be re-sent immediately if the pipe disappears.  */
     struct nn_pipe *sent_to;
+
+    /*  Time when the user sent the request, in microseconds. Used to measure
+        the round-trip time. */
+    uint64_t sent;
 };
 
 void nn_task_init (struct nn_task *self, uint32_t id);
@@ -50,8 +50,8 @@ static const struct nn_sockbase_vfptr nn_xreq_sockbase_vfptr = {
     nn_xreq_events,
     nn_xreq_send,
     nn_xreq_recv,
-    NULL,
-    NULL
+    nn_xreq_setopt,
+    nn_xreq_getopt
 };
 
 void nn_xreq_init (struct nn_xreq *self, const struct nn_sockbase_vfptr *vfptr,
@@ -59,6 +59,7 @@ void nn_xreq_init (struct nn_xreq *self, const struct nn_sockbase_vfptr *vfptr,
 {
     nn_sockbase_init (&self->sockbase, vfptr, hint);
     nn_lb_init (&self->lb);
+    nn_lb_replies (&self->lb);
     nn_fq_init (&self->fq);
 }
 
@@ -178,12 +179,21 @@ int nn_xreq_send_to (struct nn_sockbase *self, struct nn_msg *msg,
 int nn_xreq_recv (struct nn_sockbase *self, struct nn_msg *msg)
 {
     int rc;
+    struct nn_xreq *xreq;
+    struct nn_pipe *pipe;
+    struct nn_xreq_data *data;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
 
-    rc = nn_fq_recv (&nn_cont (self, struct nn_xreq, sockbase)->fq, msg, NULL);
+    rc = nn_fq_recv (&xreq->fq, msg, &pipe);
     if (rc == -EAGAIN)
         return -EAGAIN;
     errnum_assert (rc >= 0, -rc);
 
+    /*  Let the load balancer know that the peer have processed a request. */
+    data = nn_pipe_getdata (pipe);
+    nn_lb_done (&xreq->lb, &data->lb);
+
     if (!(rc & NN_PIPE_PARSED)) {
 
         /*  Ignore malformed replies. */
@@ -204,6 +214,48 @@ int nn_xreq_recv (struct nn_sockbase *self, struct nn_msg *msg)
     return 0;
 }
 
+void nn_xreq_cancel (struct nn_sockbase *self, struct nn_pipe *pipe)
+{
+    struct nn_xreq *xreq;
+    struct nn_xreq_data *data;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
+    data = nn_pipe_getdata (pipe);
+    nn_lb_cancel (&xreq->lb, &data->lb);
+}
+
+int nn_xreq_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen)
+{
+    struct nn_xreq *xreq;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
+
+    if (level != NN_REQ)
+        return -ENOPROTOOPT;
+
+    if (option == NN_REQ_LB_POLICY)
+        return nn_lb_setpolicy (&xreq->lb, optval, optvallen);
+
+    return -ENOPROTOOPT;
+}
+
+int nn_xreq_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen)
+{
+    struct nn_xreq *xreq;
+
+    xreq = nn_cont (self, struct nn_xreq, sockbase);
+
+    if (level != NN_REQ)
+        return -ENOPROTOOPT;
+
+    if (option == NN_REQ_LB_POLICY)
+        return nn_lb_getpolicy (&xreq->lb, optval, optvallen);
+
+    return -ENOPROTOOPT;
+}
+
 static int nn_xreq_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_xreq *self;
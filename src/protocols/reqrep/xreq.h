@@ -49,6 +49,14 @@ int nn_xreq_send_to (struct nn_sockbase *self, struct nn_msg *msg,
     struct nn_pipe **to);
 int nn_xreq_recv (struct nn_sockbase *self, struct nn_msg *msg);
 
+/*  Tells the load balancer that the reply to the request sent to the pipe
+    is not expected any more. */
+void nn_xreq_cancel (struct nn_sockbase *self, struct nn_pipe *pipe);
+int nn_xreq_setopt (struct nn_sockbase *self, int level, int option,
+    const void *optval, size_t optvallen);
+int nn_xreq_getopt (struct nn_sockbase *self, int level, int option,
+    void *optval, size_t *optvallen);
+
 int nn_xreq_ispeer (int socktype);
 
 #endif
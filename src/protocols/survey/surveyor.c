@@ -23,6 +23,8 @@
 
 #include "xsurveyor.h"
 
+#include "../utils/deadline.h"
+
 #include "../../nn.h"
 #include "../../survey.h"
 
@@ -36,6 +38,8 @@
 #include "../../utils/alloc.h"
 #include "../../utils/random.h"
 #include "../../utils/attr.h"
+#include "../../utils/clock.h"
+#include "../../utils/hash.h"
 
 #include <string.h>
 
@@ -47,14 +51,31 @@
 #define NN_SURVEYOR_STATE_CANCELLING 4
 #define NN_SURVEYOR_STATE_STOPPING_TIMER 5
 #define NN_SURVEYOR_STATE_STOPPING 6
+#define NN_SURVEYOR_STATE_CONCURRENT 7
 
 #define NN_SURVEYOR_ACTION_START 1
 #define NN_SURVEYOR_ACTION_CANCEL 2
+#define NN_SURVEYOR_ACTION_COMPLETE 3
 
 #define NN_SURVEYOR_SRC_DEADLINE_TIMER 1
 
 #define NN_SURVEYOR_TIMEDOUT 1
 
+/*  A survey in progress in the concurrent mode. */
+struct nn_surveyor_survey {
+
+    /*  Item in the 'surveys' hash, keyed by the survey ID. */
+    struct nn_hash_item hitem;
+
+    /*  Item in the 'deadlines' queue. */
+    struct nn_deadline_item deadline;
+
+    /*  Number of peers the survey was sent to and the number of responses
+        received so far. */
+    int expected;
+    int responses;
+};
+
 struct nn_surveyor {
 
     /*  The underlying raw SP socket. */
@@ -76,8 +97,28 @@ struct nn_surveyor {
     /*  Protocol-specific socket options. */
     int deadline;
 
+    /*  Number of responses after which the survey is complete, zero to wait
+        for the deadline, NN_SURVEYOR_QUORUM_ALL to wait for all the peers
+        the survey was sent to. */
+    int quorum;
+
+    /*  Number of peers the current survey was sent to and the number of
+        responses received so far. */
+    int expected;
+    int responses;
+
     /*  Flag if surveyor has timed out */
     int timedout;
+
+    /*  Maximum number of surveys in progress set by NN_SURVEYOR_CONCURRENT.
+        Zero means that a new survey cancels the previous one. */
+    int concurrent;
+
+    /*  In the concurrent mode, surveys in progress, both keyed by the survey
+        ID and ordered by the deadline. */
+    struct nn_hash surveys;
+    struct nn_deadline deadlines;
+    int nsurveys;
 };
 
 /*  Private functions. */
@@ -90,6 +131,15 @@ static void nn_surveyor_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static int nn_surveyor_inprogress (struct nn_surveyor *self);
 static void nn_surveyor_resend (struct nn_surveyor *self);
+static int nn_surveyor_complete (struct nn_surveyor *self, int expected,
+    int responses);
+static int nn_surveyor_concurrent_send (struct nn_surveyor *self,
+    struct nn_msg *msg);
+static int nn_surveyor_concurrent_recv (struct nn_surveyor *self,
+    struct nn_msg *msg);
+static void nn_surveyor_survey_end (struct nn_surveyor *self,
+    struct nn_surveyor_survey *survey);
+static void nn_surveyor_expire (struct nn_surveyor *self);
 
 /*  Implementation of nn_sockbase's virtual functions. */
 static void nn_surveyor_stop (struct nn_sockbase *self);
@@ -130,6 +180,13 @@ static void nn_surveyor_init (struct nn_surveyor *self,
     nn_timer_init (&self->timer, NN_SURVEYOR_SRC_DEADLINE_TIMER, &self->fsm);
     nn_msg_init (&self->tosend, 0);
     self->deadline = NN_SURVEYOR_DEFAULT_DEADLINE;
+    self->quorum = 0;
+    self->expected = 0;
+    self->responses = 0;
+    self->concurrent = 0;
+    nn_hash_init (&self->surveys);
+    nn_deadline_init (&self->deadlines, &self->timer);
+    self->nsurveys = 0;
     self->timedout = 0;
 
     /*  Start the state machine. */
@@ -138,6 +195,12 @@ static void nn_surveyor_init (struct nn_surveyor *self,
 
 static void nn_surveyor_term (struct nn_surveyor *self)
 {
+    while (nn_deadline_first (&self->deadlines))
+        nn_surveyor_survey_end (self, nn_cont (
+            nn_deadline_first (&self->deadlines), struct nn_surveyor_survey,
+            deadline));
+    nn_deadline_term (&self->deadlines);
+    nn_hash_term (&self->surveys);
     nn_msg_term (&self->tosend);
     nn_timer_term (&self->timer);
     nn_fsm_term (&self->fsm);
@@ -165,9 +228,12 @@ void nn_surveyor_destroy (struct nn_sockbase *self)
 
 static int nn_surveyor_inprogress (struct nn_surveyor *self)
 {
-    /*  Return 1 if there's a survey going on. 0 otherwise. */
+    /*  Return 1 if there's a survey going on. 0 otherwise. Once the survey
+        is over, waiting for the timer to stop is not considered to be part
+        of it. */
     return self->state == NN_SURVEYOR_STATE_IDLE ||
         self->state == NN_SURVEYOR_STATE_PASSIVE ||
+        self->state == NN_SURVEYOR_STATE_STOPPING_TIMER ||
         self->state == NN_SURVEYOR_STATE_STOPPING ? 0 : 1;
 }
 
@@ -181,6 +247,17 @@ static int nn_surveyor_events (struct nn_sockbase *self)
     /*  Determine the actual readability/writability of the socket. */
     rc = nn_xsurveyor_events (&surveyor->xsurveyor.sockbase);
 
+    /*  In the concurrent mode, new survey can be started while there's
+        room for it. IN is signalled when all the surveys are over. */
+    if (surveyor->state == NN_SURVEYOR_STATE_CONCURRENT) {
+        rc &= ~NN_SOCKBASE_EVENT_OUT;
+        if (surveyor->nsurveys < surveyor->concurrent)
+            rc |= NN_SOCKBASE_EVENT_OUT;
+        if (surveyor->nsurveys == 0)
+            rc |= NN_SOCKBASE_EVENT_IN;
+        return rc;
+    }
+
     /*  If there's no survey going on we'll signal IN to interrupt polling
         when the survey expires. nn_recv() will return -EFSM afterwards. */
     if (!nn_surveyor_inprogress (surveyor))
@@ -195,12 +272,19 @@ static int nn_surveyor_send (struct nn_sockbase *self, struct nn_msg *msg)
 
     surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
 
+    /*  The survey ID is generated by the socket. The user can't supply
+        a header of their own. */
+    if (nn_slow (nn_chunkref_size (&msg->sphdr) != 0))
+        return -EINVAL;
+
+    if (surveyor->state == NN_SURVEYOR_STATE_CONCURRENT)
+        return nn_surveyor_concurrent_send (surveyor, msg);
+
     /*  Generate new survey ID. */
     ++surveyor->surveyid;
     surveyor->surveyid |= 0x80000000;
 
     /*  Tag the survey body with survey ID. */
-    nn_assert (nn_chunkref_size (&msg->sphdr) == 0);
     nn_chunkref_term (&msg->sphdr);
     nn_chunkref_init (&msg->sphdr, 4);
     nn_putl (nn_chunkref_data (&msg->sphdr), surveyor->surveyid);
@@ -238,6 +322,9 @@ static int nn_surveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
 
     surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
 
+    if (surveyor->state == NN_SURVEYOR_STATE_CONCURRENT)
+        return nn_surveyor_concurrent_recv (surveyor, msg);
+
     /*  If no survey is going on return EFSM error. */
     if (nn_slow (!nn_surveyor_inprogress (surveyor))) {
         if (surveyor->timedout == NN_SURVEYOR_TIMEDOUT) {
@@ -269,6 +356,13 @@ static int nn_surveyor_recv (struct nn_sockbase *self, struct nn_msg *msg)
         break;
     }
 
+    /*  Once enough responses were received, end the survey early. */
+    ++surveyor->responses;
+    if (surveyor->state == NN_SURVEYOR_STATE_ACTIVE &&
+          nn_surveyor_complete (surveyor, surveyor->expected,
+          surveyor->responses))
+        nn_fsm_action (&surveyor->fsm, NN_SURVEYOR_ACTION_COMPLETE);
+
     return 0;
 }
 
@@ -276,6 +370,7 @@ static int nn_surveyor_setopt (struct nn_sockbase *self, int level, int option,
     const void *optval, size_t optvallen)
 {
     struct nn_surveyor *surveyor;
+    int val;
 
     surveyor = nn_cont (self, struct nn_surveyor, xsurveyor.sockbase);
 
@@ -289,6 +384,41 @@ static int nn_surveyor_setopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
+    if (option == NN_SURVEYOR_QUORUM) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        if (nn_slow (*(int*) optval < NN_SURVEYOR_QUORUM_ALL))
+            return -EINVAL;
+        surveyor->quorum = *(int*) optval;
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_CONCURRENT) {
+        if (nn_slow (optvallen != sizeof (int)))
+            return -EINVAL;
+        val = *(int*) optval;
+        if (nn_slow (val < 0))
+            return -EINVAL;
+
+        /*  The mode can be switched only while there's no survey going on.
+            When switching back, the deadline timer has to be stopped
+            first. */
+        if (val > 0) {
+            if (surveyor->state == NN_SURVEYOR_STATE_PASSIVE)
+                surveyor->state = NN_SURVEYOR_STATE_CONCURRENT;
+            else if (surveyor->state != NN_SURVEYOR_STATE_CONCURRENT)
+                return -EFSM;
+        }
+        else if (surveyor->state == NN_SURVEYOR_STATE_CONCURRENT) {
+            if (nn_slow (surveyor->nsurveys))
+                return -EFSM;
+            if (nn_deadline_stop (&surveyor->deadlines))
+                surveyor->state = NN_SURVEYOR_STATE_PASSIVE;
+        }
+        surveyor->concurrent = val;
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -310,6 +440,30 @@ static int nn_surveyor_getopt (struct nn_sockbase *self, int level, int option,
         return 0;
     }
 
+    if (option == NN_SURVEYOR_QUORUM) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = surveyor->quorum;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_CONCURRENT) {
+        if (nn_slow (*optvallen < sizeof (int)))
+            return -EINVAL;
+        *(int*) optval = surveyor->concurrent;
+        *optvallen = sizeof (int);
+        return 0;
+    }
+
+    if (option == NN_SURVEYOR_LAST_ID) {
+        if (nn_slow (*optvallen < sizeof (uint32_t)))
+            return -EINVAL;
+        *(uint32_t*) optval = surveyor->surveyid;
+        *optvallen = sizeof (uint32_t);
+        return 0;
+    }
+
     return -ENOPROTOOPT;
 }
 
@@ -378,7 +532,7 @@ static void nn_surveyor_handler (struct nn_fsm *self, int src, int type,
                 nn_surveyor_resend (surveyor);
                 nn_timer_start (&surveyor->timer, surveyor->deadline);
                 surveyor->state = NN_SURVEYOR_STATE_ACTIVE;
-                return;
+                goto check_complete;
 
             default:
                 nn_fsm_bad_action (surveyor->state, src, type);
@@ -401,6 +555,14 @@ static void nn_surveyor_handler (struct nn_fsm *self, int src, int type,
                 nn_timer_stop (&surveyor->timer);
                 surveyor->state = NN_SURVEYOR_STATE_CANCELLING;
                 return;
+            case NN_SURVEYOR_ACTION_COMPLETE:
+
+                /*  Enough responses were received. Finish the survey the
+                    same way as if the deadline expired. */
+                nn_timer_stop (&surveyor->timer);
+                surveyor->state = NN_SURVEYOR_STATE_STOPPING_TIMER;
+                surveyor->timedout = NN_SURVEYOR_TIMEDOUT;
+                return;
             default:
                 nn_fsm_bad_action (surveyor->state, src, type);
             }
@@ -442,7 +604,7 @@ static void nn_surveyor_handler (struct nn_fsm *self, int src, int type,
                 nn_surveyor_resend (surveyor);
                 nn_timer_start (&surveyor->timer, surveyor->deadline);
                 surveyor->state = NN_SURVEYOR_STATE_ACTIVE;
-                return;
+                goto check_complete;
             default:
                 nn_fsm_bad_action (surveyor->state, src, type);
             }
@@ -460,6 +622,7 @@ static void nn_surveyor_handler (struct nn_fsm *self, int src, int type,
 
         case NN_FSM_ACTION:
             switch (type) {
+            case NN_SURVEYOR_ACTION_START:
             case NN_SURVEYOR_ACTION_CANCEL:
                 surveyor->state = NN_SURVEYOR_STATE_CANCELLING;
                 return;
@@ -480,12 +643,54 @@ static void nn_surveyor_handler (struct nn_fsm *self, int src, int type,
             nn_fsm_bad_source (surveyor->state, src, type);
         }
 
+/******************************************************************************/
+/*  CONCURRENT state.                                                         */
+/*  Multiple surveys can be going on. The timer is used to expire them.       */
+/******************************************************************************/
+    case NN_SURVEYOR_STATE_CONCURRENT:
+        switch (src) {
+
+        case NN_SURVEYOR_SRC_DEADLINE_TIMER:
+            switch (type) {
+            case NN_TIMER_TIMEOUT:
+                nn_deadline_timeout (&surveyor->deadlines);
+                return;
+            case NN_TIMER_STOPPED:
+                nn_deadline_stopped (&surveyor->deadlines);
+
+                /*  Switching to the single survey mode was requested. */
+                if (!surveyor->concurrent) {
+                    surveyor->state = NN_SURVEYOR_STATE_PASSIVE;
+                    return;
+                }
+
+                nn_surveyor_expire (surveyor);
+                return;
+            default:
+                nn_fsm_bad_action (surveyor->state, src, type);
+            }
+
+        default:
+            nn_fsm_bad_source (surveyor->state, src, type);
+        }
+
 /******************************************************************************/
 /*  Invalid state.                                                            */
 /******************************************************************************/
     default:
         nn_fsm_bad_state (surveyor->state, src, type);
     }
+
+check_complete:
+
+    /*  If the survey wasn't sent to enough peers, there are no responses to
+        wait for. */
+    if (nn_surveyor_complete (surveyor, surveyor->expected,
+          surveyor->responses)) {
+        nn_timer_stop (&surveyor->timer);
+        surveyor->state = NN_SURVEYOR_STATE_STOPPING_TIMER;
+        surveyor->timedout = NN_SURVEYOR_TIMEDOUT;
+    }
 }
 
 static void nn_surveyor_resend (struct nn_surveyor *self)
@@ -493,11 +698,152 @@ static void nn_surveyor_resend (struct nn_surveyor *self)
     int rc;
     struct nn_msg msg;
 
+    /*  The survey is sent to all the peers that are ready for sending. */
+    self->expected = (int) self->xsurveyor.outpipes.count;
+    self->responses = 0;
+
     nn_msg_cp (&msg, &self->tosend);
     rc = nn_xsurveyor_send (&self->xsurveyor.sockbase, &msg);
     errnum_assert (rc == 0, -rc);
 }
 
+static int nn_surveyor_complete (struct nn_surveyor *self, int expected,
+    int responses)
+{
+    /*  Without the quorum, the survey is complete when the deadline
+        expires. */
+    if (self->quorum == 0)
+        return 0;
+
+    /*  There's no point in waiting for more responses than the number of
+        peers the survey was sent to. */
+    if (self->quorum == NN_SURVEYOR_QUORUM_ALL || self->quorum > expected)
+        return responses >= expected;
+    return responses >= self->quorum;
+}
+
+static int nn_surveyor_concurrent_send (struct nn_surveyor *self,
+    struct nn_msg *msg)
+{
+    int rc;
+    int expected;
+    struct nn_surveyor_survey *survey;
+
+    if (nn_slow (self->nsurveys >= self->concurrent))
+        return -EAGAIN;
+
+    /*  Generate new survey ID and tag the survey body with it. */
+    ++self->surveyid;
+    self->surveyid |= 0x80000000;
+    nn_chunkref_term (&msg->sphdr);
+    nn_chunkref_init (&msg->sphdr, 4);
+    nn_putl (nn_chunkref_data (&msg->sphdr), self->surveyid);
+
+    /*  Send the survey. Other surveys in progress are left intact. */
+    expected = (int) self->xsurveyor.outpipes.count;
+    rc = nn_xsurveyor_send (&self->xsurveyor.sockbase, msg);
+    errnum_assert (rc == 0, -rc);
+
+    /*  If the survey wasn't sent to enough peers, there are no responses to
+        wait for. */
+    if (nn_surveyor_complete (self, expected, 0)) {
+        self->timedout = NN_SURVEYOR_TIMEDOUT;
+        return 0;
+    }
+
+    survey = nn_alloc (sizeof (struct nn_surveyor_survey), "survey");
+    alloc_assert (survey);
+    nn_hash_item_init (&survey->hitem);
+    nn_deadline_item_init (&survey->deadline);
+    survey->expected = expected;
+    survey->responses = 0;
+    nn_hash_insert (&self->surveys, self->surveyid, &survey->hitem);
+    ++self->nsurveys;
+    nn_deadline_add (&self->deadlines, &survey->deadline, self->deadline);
+
+    return 0;
+}
+
+static int nn_surveyor_concurrent_recv (struct nn_surveyor *self,
+    struct nn_msg *msg)
+{
+    int rc;
+    uint32_t surveyid;
+    struct nn_hash_item *hitem;
+    struct nn_surveyor_survey *survey;
+
+    /*  Once all the surveys are over, report the timeout once. */
+    if (nn_slow (self->nsurveys == 0)) {
+        if (self->timedout == NN_SURVEYOR_TIMEDOUT) {
+            self->timedout = 0;
+            return -ETIMEDOUT;
+        }
+        return -EFSM;
+    }
+
+    while (1) {
+
+        /*  Get next response. */
+        rc = nn_xsurveyor_recv (&self->xsurveyor.sockbase, msg);
+        if (nn_slow (rc == -EAGAIN))
+            return -EAGAIN;
+        errnum_assert (rc == 0, -rc);
+
+        /*  Find the survey the response belongs to. Ignore any stale
+            responses. */
+        if (nn_slow (nn_chunkref_size (&msg->sphdr) != sizeof (uint32_t))) {
+            nn_msg_term (msg);
+            continue;
+        }
+        surveyid = nn_getl (nn_chunkref_data (&msg->sphdr));
+        hitem = nn_hash_get (&self->surveys, surveyid);
+        if (nn_slow (!hitem)) {
+            nn_msg_term (msg);
+            continue;
+        }
+        survey = nn_cont (hitem, struct nn_surveyor_survey, hitem);
+        break;
+    }
+
+    /*  The survey ID is left in the header so that the user can tell the
+        surveys apart. Once enough responses were received, end the survey
+        early. */
+    ++survey->responses;
+    if (nn_surveyor_complete (self, survey->expected, survey->responses)) {
+        nn_surveyor_survey_end (self, survey);
+        self->timedout = NN_SURVEYOR_TIMEDOUT;
+    }
+
+    return 0;
+}
+
+static void nn_surveyor_survey_end (struct nn_surveyor *self,
+    struct nn_surveyor_survey *survey)
+{
+    nn_hash_erase (&self->surveys, &survey->hitem);
+    nn_deadline_rm (&self->deadlines, &survey->deadline);
+    --self->nsurveys;
+    nn_deadline_item_term (&survey->deadline);
+    nn_hash_item_term (&survey->hitem);
+    nn_free (survey);
+}
+
+static void nn_surveyor_expire (struct nn_surveyor *self)
+{
+    uint64_t now;
+    struct nn_deadline_item *item;
+
+    /*  All the responses to the expired surveys will be dropped. */
+    now = nn_clock_ms ();
+    while ((item = nn_deadline_expired (&self->deadlines, now)) != NULL) {
+        nn_surveyor_survey_end (self,
+            nn_cont (item, struct nn_surveyor_survey, deadline));
+        self->timedout = NN_SURVEYOR_TIMEDOUT;
+    }
+
+    nn_deadline_arm (&self->deadlines);
+}
+
 static int nn_surveyor_create (void *hint, struct nn_sockbase **sockbase)
 {
     struct nn_surveyor *self;
@@ -0,0 +1,98 @@
+/*
+    Copyright (c) 2012-2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "conflate.h"
+
+#include "../../utils/alloc.h"
+#include "../../utils/cont.h"
+#include "../../utils/err.h"
+
+#include <string.h>
+
+void nn_conflate_init (struct nn_conflate *self)
+{
+    nn_list_init (&self->items);
+}
+
+void nn_conflate_term (struct nn_conflate *self)
+{
+    struct nn_msg msg;
+
+    while (nn_conflate_get (self, &msg) == 0)
+        nn_msg_term (&msg);
+    nn_list_term (&self->items);
+}
+
+void nn_conflate_put (struct nn_conflate *self, struct nn_msg *msg,
+    size_t keylen)
+{
+    struct nn_list_item *it;
+    struct nn_conflate_item *item;
+
+    nn_assert (keylen <= nn_chunkref_size (&msg->body));
+
+    /*  If there's a message with the same key already, replace it. It keeps
+        its place in the queue so that frequently updated keys don't starve
+        the others. The number of items is bounded by the number of distinct
+        keys, which is expected to be small, hence the linear search. */
+    for (it = nn_list_begin (&self->items);
+          it != nn_list_end (&self->items);
+          it = nn_list_next (&self->items, it)) {
+        item = nn_cont (it, struct nn_conflate_item, item);
+        if (item->keylen == keylen &&
+              memcmp (nn_chunkref_data (&item->msg.body),
+              nn_chunkref_data (&msg->body), keylen) == 0) {
+            nn_msg_term (&item->msg);
+            nn_msg_mv (&item->msg, msg);
+            return;
+        }
+    }
+
+    item = nn_alloc (sizeof (struct nn_conflate_item), "conflated message");
+    alloc_assert (item);
+    nn_list_item_init (&item->item);
+    nn_msg_mv (&item->msg, msg);
+    item->keylen = keylen;
+    nn_list_insert (&self->items, &item->item, nn_list_end (&self->items));
+}
+
+int nn_conflate_get (struct nn_conflate *self, struct nn_msg *msg)
+{
+    struct nn_conflate_item *item;
+
+    if (nn_list_empty (&self->items))
+        return -EAGAIN;
+
+    item = nn_cont (nn_list_begin (&self->items), struct nn_conflate_item,
+        item);
+    nn_list_erase (&self->items, &item->item);
+    nn_list_item_term (&item->item);
+    nn_msg_mv (msg, &item->msg);
+    nn_free (item);
+
+    return 0;
+}
+
+int nn_conflate_can_recv (struct nn_conflate *self)
+{
+    return nn_list_empty (&self->items) ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+/*
+    Copyright (c) 2012-2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_CONFLATE_INCLUDED
+#define NN_CONFLATE_INCLUDED
+
+#include "../../utils/list.h"
+#include "../../utils/msg.h"
+
+#include <stddef.h>
+
+/*  This object keeps only the newest message for each key, the key being
+    the given number of initial bytes of the message body. To be used by
+    socket types that deliver the last value only, e.g. SUB or PULL with
+    conflation switched on. */
+
+struct nn_conflate_item {
+    struct nn_list_item item;
+    struct nn_msg msg;
+    size_t keylen;
+};
+
+struct nn_conflate {
+
+    /*  Messages with distinct keys, in the order the keys first arrived. */
+    struct nn_list items;
+
+};
+
+void nn_conflate_init (struct nn_conflate *self);
+void nn_conflate_term (struct nn_conflate *self);
+
+/*  Stores the message, dropping any earlier message with the same key.
+    The message is moved into the object and 'msg' is left uninitialised. */
+void nn_conflate_put (struct nn_conflate *self, struct nn_msg *msg,
+    size_t keylen);
+
+/*  Retrieves the oldest stored message. Returns -EAGAIN if there's none. */
+int nn_conflate_get (struct nn_conflate *self, struct nn_msg *msg);
+
+int nn_conflate_can_recv (struct nn_conflate *self);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "deadline.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/clock.h"
+
+#include <stddef.h>
+
+#define NN_DEADLINE_TIMER_IDLE 0
+#define NN_DEADLINE_TIMER_RUNNING 1
+#define NN_DEADLINE_TIMER_STOPPING 2
+
+void nn_deadline_init (struct nn_deadline *self, struct nn_timer *timer)
+{
+    nn_list_init (&self->items);
+    self->timer = timer;
+    self->state = NN_DEADLINE_TIMER_IDLE;
+    self->due = 0;
+}
+
+void nn_deadline_term (struct nn_deadline *self)
+{
+    nn_list_term (&self->items);
+}
+
+void nn_deadline_item_init (struct nn_deadline_item *self)
+{
+    nn_list_item_init (&self->item);
+    self->due = 0;
+}
+
+void nn_deadline_item_term (struct nn_deadline_item *self)
+{
+    nn_list_item_term (&self->item);
+}
+
+void nn_deadline_add (struct nn_deadline *self,
+    struct nn_deadline_item *item, int timeout)
+{
+    struct nn_list_item *it;
+
+    /*  Unless the timeout was changed, the new item goes to the end of
+        the queue. */
+    item->due = nn_clock_ms () + timeout;
+    it = nn_list_end (&self->items);
+    while (it != nn_list_begin (&self->items) &&
+          nn_cont (nn_list_prev (&self->items, it),
+          struct nn_deadline_item, item)->due > item->due)
+        it = nn_list_prev (&self->items, it);
+    nn_list_insert (&self->items, &item->item, it);
+
+    nn_deadline_arm (self);
+}
+
+void nn_deadline_rm (struct nn_deadline *self, struct nn_deadline_item *item)
+{
+    nn_list_erase (&self->items, &item->item);
+}
+
+struct nn_deadline_item *nn_deadline_expired (struct nn_deadline *self,
+    uint64_t now)
+{
+    struct nn_deadline_item *item;
+
+    item = nn_deadline_first (self);
+    return item && item->due <= now ? item : NULL;
+}
+
+struct nn_deadline_item *nn_deadline_first (struct nn_deadline *self)
+{
+    if (nn_list_empty (&self->items))
+        return NULL;
+    return nn_cont (nn_list_begin (&self->items), struct nn_deadline_item,
+        item);
+}
+
+void nn_deadline_arm (struct nn_deadline *self)
+{
+    struct nn_deadline_item *item;
+    uint64_t now;
+
+    item = nn_deadline_first (self);
+    if (!item)
+        return;
+
+    /*  If the new item expires earlier than the timer, restart the timer
+        once it is stopped. */
+    if (self->state == NN_DEADLINE_TIMER_RUNNING && item->due < self->due) {
+        nn_timer_stop (self->timer);
+        self->state = NN_DEADLINE_TIMER_STOPPING;
+        return;
+    }
+    if (self->state != NN_DEADLINE_TIMER_IDLE)
+        return;
+
+    now = nn_clock_ms ();
+    nn_timer_start (self->timer, item->due > now ? (int) (item->due - now) : 0);
+    self->state = NN_DEADLINE_TIMER_RUNNING;
+    self->due = item->due;
+}
+
+void nn_deadline_timeout (struct nn_deadline *self)
+{
+    /*  The timer may have been stopped already to be re-armed. */
+    if (self->state != NN_DEADLINE_TIMER_RUNNING)
+        return;
+    nn_timer_stop (self->timer);
+    self->state = NN_DEADLINE_TIMER_STOPPING;
+}
+
+void nn_deadline_stopped (struct nn_deadline *self)
+{
+    nn_assert (self->state == NN_DEADLINE_TIMER_STOPPING);
+    self->state = NN_DEADLINE_TIMER_IDLE;
+}
+
+int nn_deadline_stop (struct nn_deadline *self)
+{
+    if (self->state == NN_DEADLINE_TIMER_IDLE)
+        return 1;
+    if (self->state == NN_DEADLINE_TIMER_RUNNING) {
+        nn_timer_stop (self->timer);
+        self->state = NN_DEADLINE_TIMER_STOPPING;
+    }
+    return 0;
+}
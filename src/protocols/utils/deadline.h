@@ -0,0 +1,93 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_DEADLINE_INCLUDED
+#define NN_DEADLINE_INCLUDED
+
+#include "../../aio/timer.h"
+#include "../../utils/list.h"
+
+#include <stdint.h>
+
+/*  Queue of items ordered by the time they expire at, driven by a single
+    timer owned by the socket. The timer is always armed for the earliest
+    item in the queue. The owner of the timer has to pass its NN_TIMER_TIMEOUT
+    and NN_TIMER_STOPPED events to nn_deadline_timeout and
+    nn_deadline_stopped and process the expired items afterwards. Items that
+    are expired but can't be processed at the moment should be removed from
+    the queue, otherwise the timer would fire again straight away. */
+
+struct nn_deadline_item {
+    struct nn_list_item item;
+
+    /*  Time when the item expires, in milliseconds. */
+    uint64_t due;
+};
+
+struct nn_deadline {
+
+    /*  Items ordered by the expiry time. */
+    struct nn_list items;
+
+    /*  The timer, its state and the time it was armed for. */
+    struct nn_timer *timer;
+    int state;
+    uint64_t due;
+};
+
+void nn_deadline_init (struct nn_deadline *self, struct nn_timer *timer);
+void nn_deadline_term (struct nn_deadline *self);
+
+void nn_deadline_item_init (struct nn_deadline_item *self);
+void nn_deadline_item_term (struct nn_deadline_item *self);
+
+/*  Adds the item to the queue, expiring 'timeout' milliseconds from now,
+    and re-arms the timer if needed. */
+void nn_deadline_add (struct nn_deadline *self,
+    struct nn_deadline_item *item, int timeout);
+
+/*  Removes the item from the queue. The timer is left running; if it fires
+    with nothing expired, it is simply re-armed. */
+void nn_deadline_rm (struct nn_deadline *self, struct nn_deadline_item *item);
+
+/*  Returns the earliest item in the queue if it has expired by 'now',
+    NULL otherwise. */
+struct nn_deadline_item *nn_deadline_expired (struct nn_deadline *self,
+    uint64_t now);
+
+/*  Returns the earliest item in the queue or NULL if the queue is empty. */
+struct nn_deadline_item *nn_deadline_first (struct nn_deadline *self);
+
+/*  Arms the timer for the earliest item in the queue, or, if it is already
+    running but would expire too late, stops it so that it can be re-armed
+    once stopped. */
+void nn_deadline_arm (struct nn_deadline *self);
+
+/*  Handlers for the timer events. */
+void nn_deadline_timeout (struct nn_deadline *self);
+void nn_deadline_stopped (struct nn_deadline *self);
+
+/*  Stops the timer. Returns 1 if the timer is idle already, 0 if the owner
+    has to wait for NN_TIMER_STOPPED. */
+int nn_deadline_stop (struct nn_deadline *self);
+
+#endif
@@ -22,34 +22,129 @@
 
 #include "lb.h"
 
+#include "../../nn.h"
+
 #include "../../utils/err.h"
 #include "../../utils/cont.h"
+#include "../../utils/fast.h"
+#include "../../utils/clock.h"
+#include "../../utils/alloc.h"
+#include "../../utils/msg.h"
+#include "../../utils/attr.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*  Latency is kept in fixed point, 1/256 us units. */
+#define NN_LB_LATENCY_SCALE 256
+
+/*  Weight of the new latency sample is 1/8. */
+#define NN_LB_LATENCY_DECAY 8
+
+/*  Recorded latency is halved every second it is not updated. */
+#define NN_LB_HALFLIFE 1000000
+
+/*  Number of points each pipe occupies on the consistent hashing ring.
+    The more points there are the more evenly are the keys spread among
+    the pipes. */
+#define NN_LB_POINTS 64
 
-#include <stddef.h>
+/*  Private functions. */
+static struct nn_lb_data *nn_lb_least_loaded (struct nn_lb *self,
+    uint64_t now);
+static uint64_t nn_lb_latency (struct nn_lb_data *data, uint64_t now);
+static void nn_lb_sample (struct nn_lb_data *data, uint64_t sample,
+    uint64_t now);
+static int nn_lb_getkey (struct nn_msg *msg, const void **key,
+    size_t *keylen);
+static struct nn_lb_data *nn_lb_hashed (struct nn_lb *self, const void *key,
+    size_t keylen);
+static void nn_lb_build_ring (struct nn_lb *self);
+static void nn_lb_drop_ring (struct nn_lb *self);
+static int nn_lb_point_cmp (const void *a, const void *b);
+static uint32_t nn_lb_identity (struct nn_pipe *pipe);
+static uint32_t nn_lb_hash (const void *data, size_t size);
+static uint32_t nn_lb_mix (uint32_t h);
 
 void nn_lb_init (struct nn_lb *self)
 {
     nn_priolist_init (&self->priolist);
+    self->policy = NN_LB_ROUND_ROBIN;
+    self->replies = 0;
+    nn_list_init (&self->pipes);
+    self->ring = NULL;
+    self->npoints = 0;
 }
 
 void nn_lb_term (struct nn_lb *self)
 {
+    nn_lb_drop_ring (self);
+    nn_list_term (&self->pipes);
     nn_priolist_term (&self->priolist);
 }
 
 void nn_lb_add (struct nn_lb *self, struct nn_lb_data *data,
     struct nn_pipe *pipe, int priority)
 {
+    struct nn_list_item *it;
+    struct nn_lb_data *other;
+    uint64_t used;
+    int next;
+
     nn_priolist_add (&self->priolist, &data->priodata, pipe, priority);
+    data->pending = 0;
+    data->latency = 0;
+    data->stamp = 0;
+    data->busy = 0;
+    data->blocked = 0;
+    data->blockstamp = 0;
+
+    /*  Pick the lowest ordinal not used by any other pipe connected to the
+        same peer address. That way a pipe that reconnects gets the same
+        place on the hashing ring it had before. */
+    data->identity = nn_lb_identity (pipe);
+    used = 0;
+    next = 64;
+    for (it = nn_list_begin (&self->pipes); it != nn_list_end (&self->pipes);
+          it = nn_list_next (&self->pipes, it)) {
+        other = nn_cont (it, struct nn_lb_data, item);
+        if (other->identity != data->identity)
+            continue;
+        if (other->ordinal < 64)
+            used |= ((uint64_t) 1) << other->ordinal;
+        else if (other->ordinal >= next)
+            next = other->ordinal + 1;
+    }
+    for (data->ordinal = 0; data->ordinal != 64; ++data->ordinal)
+        if (!(used & (((uint64_t) 1) << data->ordinal)))
+            break;
+    if (data->ordinal == 64)
+        data->ordinal = next;
+
+    nn_list_item_init (&data->item);
+    nn_list_insert (&self->pipes, &data->item, nn_list_end (&self->pipes));
+    nn_lb_drop_ring (self);
 }
 
 void nn_lb_rm (struct nn_lb *self, struct nn_lb_data *data)
 {
+    nn_list_erase (&self->pipes, &data->item);
+    nn_list_item_term (&data->item);
+    nn_lb_drop_ring (self);
     nn_priolist_rm (&self->priolist, &data->priodata);
 }
 
 void nn_lb_out (struct nn_lb *self, struct nn_lb_data *data)
 {
+    uint64_t now;
+
+    /*  Account for the time the pipe was blocked by pushback. */
+    if (data->blocked) {
+        now = nn_clock_us ();
+        nn_lb_sample (data, now - data->blockstamp, now);
+        data->blocked = 0;
+    }
+
     nn_priolist_activate (&self->priolist, &data->priodata);
 }
 
@@ -66,16 +161,61 @@ int nn_lb_get_priority (struct nn_lb *self)
 int nn_lb_send (struct nn_lb *self, struct nn_msg *msg, struct nn_pipe **to)
 {
     int rc;
+    struct nn_lb_data *data;
+    struct nn_lb_data *hashed;
     struct nn_pipe *pipe;
+    const void *key;
+    size_t keylen;
+    uint64_t now;
 
     /*  Pipe is NULL only when there are no avialable pipes. */
     pipe = nn_priolist_getpipe (&self->priolist);
     if (nn_slow (!pipe))
         return -EAGAIN;
 
+    /*  Choose the least loaded pipe instead of the next one in line. */
+    data = nn_cont (nn_priolist_begin (&self->priolist),
+        struct nn_lb_data, priodata);
+    now = 0;
+    if (self->policy == NN_LB_LEAST_LOADED) {
+        now = nn_clock_us ();
+        data = nn_lb_least_loaded (self, now);
+        nn_priolist_select (&self->priolist, &data->priodata);
+        pipe = data->priodata.pipe;
+    }
+
+    /*  Choose the pipe the routing key maps to. Messages without the key
+        are round-robined. */
+    if (self->policy == NN_LB_CONSISTENT_HASH &&
+          nn_lb_getkey (msg, &key, &keylen)) {
+        hashed = nn_lb_hashed (self, key, keylen);
+        if (nn_fast (hashed != NULL)) {
+            data = hashed;
+            nn_priolist_select (&self->priolist, &data->priodata);
+            pipe = data->priodata.pipe;
+        }
+    }
+
     /*  Send the messsage. */
     rc = nn_pipe_send (pipe, msg);
     errnum_assert (rc >= 0, -rc);
+    if (self->replies) {
+        if (data->pending == 0)
+            data->busy = now;
+        ++data->pending;
+    }
+
+    /*  Every send is accounted for, so that the latency of a pipe that
+        doesn't get blocked decays towards zero. If there are replies,
+        they are accounted for instead. */
+    if (self->policy == NN_LB_LEAST_LOADED) {
+        if (rc & NN_PIPE_RELEASE) {
+            data->blocked = 1;
+            data->blockstamp = now;
+        }
+        else if (!self->replies)
+            nn_lb_sample (data, 0, now);
+    }
 
     /*  Move to the next pipe. */
     nn_priolist_advance (&self->priolist, rc & NN_PIPE_RELEASE);
@@ -86,3 +226,283 @@ int nn_lb_send (struct nn_lb *self, struct nn_msg *msg, struct nn_pipe **to)
     return rc & ~NN_PIPE_RELEASE;
 }
 
+void nn_lb_replies (struct nn_lb *self)
+{
+    self->replies = 1;
+}
+
+void nn_lb_done (struct nn_lb *self, struct nn_lb_data *data)
+{
+    uint64_t now;
+
+    if (nn_slow (data->pending == 0))
+        return;
+    --data->pending;
+
+    /*  Peers process requests one by one, so the time since the previous
+        reply, or since the request was sent if the peer was idle, is
+        the time it took to process this request. */
+    now = nn_clock_us ();
+    if (self->policy == NN_LB_LEAST_LOADED)
+        nn_lb_sample (data, now - data->busy, now);
+    data->busy = now;
+}
+
+void nn_lb_cancel (NN_UNUSED struct nn_lb *self, struct nn_lb_data *data)
+{
+    if (data->pending > 0)
+        --data->pending;
+}
+
+int nn_lb_setpolicy (struct nn_lb *self, const void *optval,
+    size_t optvallen)
+{
+    int val;
+
+    if (optvallen != sizeof (int))
+        return -EINVAL;
+    val = *(int*) optval;
+    if (val != NN_LB_ROUND_ROBIN && val != NN_LB_LEAST_LOADED &&
+          val != NN_LB_CONSISTENT_HASH)
+        return -EINVAL;
+    self->policy = val;
+    return 0;
+}
+
+int nn_lb_getpolicy (struct nn_lb *self, void *optval, size_t *optvallen)
+{
+    if (*optvallen < sizeof (int))
+        return -EINVAL;
+    *(int*) optval = self->policy;
+    *optvallen = sizeof (int);
+    return 0;
+}
+
+static struct nn_lb_data *nn_lb_least_loaded (struct nn_lb *self,
+    uint64_t now)
+{
+    struct nn_priolist_data *it;
+    struct nn_lb_data *data;
+    struct nn_lb_data *best;
+    uint64_t latency;
+    uint64_t best_latency;
+
+    /*  Pipe with fewer outstanding requests wins. If there's a tie, pipe
+        with lower recent latency wins. If there's still a tie, the pipe
+        that comes first in the round-robin order wins. */
+    it = nn_priolist_begin (&self->priolist);
+    best = nn_cont (it, struct nn_lb_data, priodata);
+    best_latency = nn_lb_latency (best, now);
+    while (1) {
+        it = nn_priolist_next (&self->priolist, it);
+        if (!it)
+            break;
+        data = nn_cont (it, struct nn_lb_data, priodata);
+        latency = nn_lb_latency (data, now);
+        if (data->pending < best->pending || (data->pending == best->pending &&
+              latency < best_latency)) {
+            best = data;
+            best_latency = latency;
+        }
+    }
+
+    return best;
+}
+
+static uint64_t nn_lb_latency (struct nn_lb_data *data, uint64_t now)
+{
+    uint64_t halvings;
+
+    halvings = now > data->stamp ? (now - data->stamp) / NN_LB_HALFLIFE : 0;
+    return halvings < 64 ? data->latency >> halvings : 0;
+}
+
+static void nn_lb_sample (struct nn_lb_data *data, uint64_t sample,
+    uint64_t now)
+{
+    data->latency = nn_lb_latency (data, now);
+    data->latency = data->latency - data->latency / NN_LB_LATENCY_DECAY +
+        (sample * NN_LB_LATENCY_SCALE) / NN_LB_LATENCY_DECAY;
+    data->stamp = now;
+}
+
+static int nn_lb_getkey (struct nn_msg *msg, const void **key,
+    size_t *keylen)
+{
+    struct nn_msghdr msghdr;
+    struct nn_cmsghdr *cmsg;
+
+    msghdr.msg_iov = NULL;
+    msghdr.msg_iovlen = 0;
+    msghdr.msg_controllen = nn_chunkref_size (&msg->hdrs);
+    if (msghdr.msg_controllen == 0)
+        return 0;
+    msghdr.msg_control = nn_chunkref_data (&msg->hdrs);
+
+    /*  The ancillary data come from the user. Stop at the first malformed
+        property and ignore a key that doesn't fit into the buffer. */
+    cmsg = NN_CMSG_FIRSTHDR (&msghdr);
+    while (cmsg && cmsg->cmsg_len >= NN_CMSG_LEN (0)) {
+        if (cmsg->cmsg_level == PROTO_SP &&
+              cmsg->cmsg_type == SP_ROUTING_KEY) {
+            if (nn_slow (cmsg->cmsg_len > msghdr.msg_controllen -
+                  ((char*) cmsg - (char*) msghdr.msg_control)))
+                return 0;
+            *key = NN_CMSG_DATA (cmsg);
+            *keylen = cmsg->cmsg_len - NN_CMSG_LEN (0);
+            return 1;
+        }
+        cmsg = NN_CMSG_NXTHDR (&msghdr, cmsg);
+    }
+
+    return 0;
+}
+
+static struct nn_lb_data *nn_lb_hashed (struct nn_lb *self, const void *key,
+    size_t keylen)
+{
+    uint32_t hash;
+    size_t lo;
+    size_t hi;
+    size_t mid;
+    size_t i;
+    struct nn_lb_data *data;
+
+    if (nn_slow (!self->ring))
+        nn_lb_build_ring (self);
+
+    /*  Find the first point on the ring at or after the hash of the key. */
+    hash = nn_lb_mix (nn_lb_hash (key, keylen));
+    lo = 0;
+    hi = self->npoints;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (self->ring [mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /*  If the pipe is blocked by pushback, or if it has lower priority than
+        the best pipe available, the message spills over to the next pipe
+        on the ring. This way only the keys owned by the unavailable pipe
+        are moved elsewhere. */
+    for (i = 0; i != self->npoints; ++i) {
+        data = self->ring [(lo + i) % self->npoints].data;
+        if (nn_priolist_is_selectable (&self->priolist, &data->priodata))
+            return data;
+    }
+
+    return NULL;
+}
+
+static void nn_lb_build_ring (struct nn_lb *self)
+{
+    struct nn_list_item *it;
+    struct nn_lb_data *data;
+    size_t npipes;
+    size_t pos;
+    int i;
+
+    npipes = 0;
+    for (it = nn_list_begin (&self->pipes); it != nn_list_end (&self->pipes);
+          it = nn_list_next (&self->pipes, it))
+        ++npipes;
+    if (npipes == 0)
+        return;
+
+    self->ring = nn_alloc (npipes * NN_LB_POINTS * sizeof (struct nn_lb_point),
+        "hashing ring");
+    alloc_assert (self->ring);
+    self->npoints = npipes * NN_LB_POINTS;
+
+    /*  Position of the points depends only on the peer address and
+        the ordinal of the pipe, thus it's the same in all the peers that
+        connect to the same set of addresses and it survives reconnects. */
+    pos = 0;
+    for (it = nn_list_begin (&self->pipes); it != nn_list_end (&self->pipes);
+          it = nn_list_next (&self->pipes, it)) {
+        data = nn_cont (it, struct nn_lb_data, item);
+        for (i = 0; i != NN_LB_POINTS; ++i) {
+            self->ring [pos].hash = nn_lb_mix (data->identity +
+                nn_lb_mix ((uint32_t) (data->ordinal * NN_LB_POINTS + i)));
+            self->ring [pos].data = data;
+            ++pos;
+        }
+    }
+    qsort (self->ring, self->npoints, sizeof (struct nn_lb_point),
+        nn_lb_point_cmp);
+}
+
+static void nn_lb_drop_ring (struct nn_lb *self)
+{
+    if (self->ring) {
+        nn_free (self->ring);
+        self->ring = NULL;
+        self->npoints = 0;
+    }
+}
+
+static int nn_lb_point_cmp (const void *a, const void *b)
+{
+    const struct nn_lb_point *pa;
+    const struct nn_lb_point *pb;
+
+    pa = (const struct nn_lb_point*) a;
+    pb = (const struct nn_lb_point*) b;
+    if (pa->hash != pb->hash)
+        return pa->hash < pb->hash ? -1 : 1;
+
+    /*  Break the ties deterministically. */
+    if (pa->data->ordinal != pb->data->ordinal)
+        return pa->data->ordinal < pb->data->ordinal ? -1 : 1;
+    return 0;
+}
+
+static uint32_t nn_lb_identity (struct nn_pipe *pipe)
+{
+    const char *peer;
+    const char *port;
+    size_t len;
+
+    /*  Connections accepted by a bound endpoint come from ephemeral ports
+        that change whenever the peer reconnects. Only the host part of
+        the remote address identifies the peer then. */
+    peer = nn_pipe_getpeer (pipe);
+    len = strlen (peer);
+    if (nn_pipe_isbound (pipe) && strcmp (peer, nn_pipe_getaddr (pipe)) != 0) {
+        port = strrchr (peer, ':');
+        if (port && port [1] != '/')
+            len = port - peer;
+    }
+
+    return nn_lb_hash (peer, len);
+}
+
+/*  FNV-1a hash. */
+static uint32_t nn_lb_hash (const void *data, size_t size)
+{
+    const uint8_t *pos;
+    uint32_t h;
+
+    pos = (const uint8_t*) data;
+    h = 2166136261u;
+    while (size) {
+        h ^= *pos;
+        h *= 16777619u;
+        ++pos;
+        --size;
+    }
+    return h;
+}
+
+/*  Finalisation step of MurmurHash3. Spreads the bits of the hash evenly. */
+static uint32_t nn_lb_mix (uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
@@ -27,14 +27,80 @@
 
 #include "priolist.h"
 
-/*  A load balancer. Round-robins messages to a set of pipes. */
+#include "../../utils/list.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  A load balancer. Distributes messages to a set of pipes. By default
+    it round-robins the messages among the pipes. With NN_LB_LEAST_LOADED
+    policy it sends each message to the least loaded pipe instead. With
+    NN_LB_CONSISTENT_HASH policy messages carrying SP_ROUTING_KEY control
+    message are mapped to pipes using a consistent hashing ring so that
+    messages with the same key end up in the same pipe. Pipe priorities
+    are observed in all cases. */
 
 struct nn_lb_data {
     struct nn_priolist_data priodata;
+
+    /*  Number of messages sent to the pipe that haven't been replied to yet.
+        Maintained only if the protocol reports replies using nn_lb_done. */
+    int pending;
+
+    /*  Exponentially weighted moving average of the recent latency of the
+        pipe, i.e. how long it stays blocked by pushback after each send and
+        how long it takes to process each request. In 1/256 us units. It is
+        halved every NN_LB_HALFLIFE microseconds since it was last updated so
+        that a pipe that was slow in the past gets another chance. */
+    uint64_t latency;
+
+    /*  The time when 'latency' was last updated. */
+    uint64_t stamp;
+
+    /*  The time when the peer started processing the current request, i.e.
+        when the request was sent to an idle peer or when the reply to
+        the previous request arrived. */
+    uint64_t busy;
+
+    /*  1 if the pipe was blocked by pushback after the last send, with
+        the time when that happened. */
+    int blocked;
+    uint64_t blockstamp;
+
+    /*  Hash of the address of the peer, and the ordinal number telling
+        apart pipes connected to the same peer address. Together they
+        determine the position of the pipe on the consistent hashing ring,
+        so that it doesn't depend on the order the peers connected in. */
+    uint32_t identity;
+    int ordinal;
+
+    /*  The structure is a member of nn_lb's 'pipes' list. */
+    struct nn_list_item item;
+};
+
+/*  A point on the consistent hashing ring. */
+struct nn_lb_point {
+    uint32_t hash;
+    struct nn_lb_data *data;
 };
 
 struct nn_lb {
     struct nn_priolist priolist;
+
+    /*  NN_LB_ROUND_ROBIN, NN_LB_LEAST_LOADED or NN_LB_CONSISTENT_HASH. */
+    int policy;
+
+    /*  1 if the protocol reports replies using nn_lb_done, 0 otherwise. */
+    int replies;
+
+    /*  All the pipes, whether active or not. */
+    struct nn_list pipes;
+
+    /*  Consistent hashing ring, sorted by the hash. It is built lazily when
+        the first keyed message is sent and dropped whenever the set of
+        pipes changes. NULL if not built. */
+    struct nn_lb_point *ring;
+    size_t npoints;
 };
 
 void nn_lb_init (struct nn_lb *self);
@@ -47,4 +113,22 @@ int nn_lb_can_send (struct nn_lb *self);
 int nn_lb_get_priority (struct nn_lb *self);
 int nn_lb_send (struct nn_lb *self, struct nn_msg *msg, struct nn_pipe **to);
 
+/*  Tells the load balancer that the protocol will report replies to the
+    sent messages. The number of requests outstanding on each pipe is then
+    taken into account by NN_LB_LEAST_LOADED policy. */
+void nn_lb_replies (struct nn_lb *self);
+
+/*  Notifies the load balancer that reply to a message sent to the pipe
+    was received. */
+void nn_lb_done (struct nn_lb *self, struct nn_lb_data *data);
+
+/*  Notifies the load balancer that no reply to a message sent to the pipe
+    is expected any more, e.g. because the message was re-sent. */
+void nn_lb_cancel (struct nn_lb *self, struct nn_lb_data *data);
+
+/*  Get or set the load balancing policy. */
+int nn_lb_setpolicy (struct nn_lb *self, const void *optval,
+    size_t optvallen);
+int nn_lb_getpolicy (struct nn_lb *self, void *optval, size_t *optvallen);
+
 #endif
@@ -146,6 +146,45 @@ struct nn_pipe *nn_priolist_getpipe (struct nn_priolist *self)
     return self->slots [self->current - 1].current->pipe;
 }
 
+struct nn_priolist_data *nn_priolist_begin (struct nn_priolist *self)
+{
+    if (nn_slow (self->current == -1))
+        return NULL;
+    return self->slots [self->current - 1].current;
+}
+
+struct nn_priolist_data *nn_priolist_next (struct nn_priolist *self,
+    struct nn_priolist_data *it)
+{
+    struct nn_priolist_slot *slot;
+    struct nn_list_item *next;
+
+    slot = &self->slots [self->current - 1];
+
+    /*  Move to the next pipe (with wrap-over). Stop once we get back
+        to the pipe we've started with. */
+    next = nn_list_next (&slot->pipes, &it->item);
+    if (!next)
+        next = nn_list_begin (&slot->pipes);
+    it = nn_cont (next, struct nn_priolist_data, item);
+    return it == slot->current ? NULL : it;
+}
+
+void nn_priolist_select (struct nn_priolist *self,
+    struct nn_priolist_data *data)
+{
+    nn_assert (self->current == data->priority);
+    nn_assert (nn_list_item_isinlist (&data->item));
+    self->slots [self->current - 1].current = data;
+}
+
+int nn_priolist_is_selectable (struct nn_priolist *self,
+    struct nn_priolist_data *data)
+{
+    return self->current == data->priority &&
+        nn_list_item_isinlist (&data->item) ? 1 : 0;
+}
+
 void nn_priolist_advance (struct nn_priolist *self, int release)
 {
     struct nn_priolist_slot *slot;
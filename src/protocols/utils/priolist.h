@@ -91,6 +91,22 @@ int nn_priolist_is_active (struct nn_priolist *self);
     NULL is returned. */
 struct nn_pipe *nn_priolist_getpipe (struct nn_priolist *self);
 
+/*  Iterate over the active pipes on the current priority level, starting
+    with the current pipe. NULL is returned once all of them were visited. */
+struct nn_priolist_data *nn_priolist_begin (struct nn_priolist *self);
+struct nn_priolist_data *nn_priolist_next (struct nn_priolist *self,
+    struct nn_priolist_data *it);
+
+/*  Makes the specified pipe current. The pipe must be active and have
+    the current priority level. */
+void nn_priolist_select (struct nn_priolist *self,
+    struct nn_priolist_data *data);
+
+/*  Returns 1 if the pipe is active and has the current priority level,
+    i.e. if it can be passed to nn_priolist_select, 0 otherwise. */
+int nn_priolist_is_selectable (struct nn_priolist *self,
+    struct nn_priolist_data *data);
+
 /*  Moves to the next pipe in the list. If 'release' is set to 1, the current
     pipe is removed from the list. To re-insert it into the list use
     nn_priolist_activate function. */
@@ -36,6 +36,11 @@ extern "C" {
 #define NN_REP (NN_PROTO_REQREP * 16 + 1)
 
 #define NN_REQ_RESEND_IVL 1
+#define NN_REQ_LB_POLICY 2
+#define NN_REQ_PIPELINE 3
+#define NN_REQ_LAST_ID 4
+
+#define NN_REP_PIPELINE 1
 
 typedef union nn_req_handle {
     int i;
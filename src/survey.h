@@ -37,6 +37,13 @@ extern "C" {
 #define NN_RESPONDENT (NN_PROTO_SURVEY * 16 + 3)
 
 #define NN_SURVEYOR_DEADLINE 1
+#define NN_SURVEYOR_QUORUM 2
+#define NN_SURVEYOR_CONCURRENT 3
+#define NN_SURVEYOR_LAST_ID 4
+
+/*  Value of NN_SURVEYOR_QUORUM meaning that responses from all the peers
+    are expected. */
+#define NN_SURVEYOR_QUORUM_ALL -1
 
 #ifdef __cplusplus
 }
@@ -30,6 +30,8 @@ extern "C" {
 #define NN_TCP -3
 
 #define NN_TCP_NODELAY 1
+#define NN_TCP_LISTENERS 2
+#define NN_TCP_MAX_HANDSHAKES 3
 
 #ifdef __cplusplus
 }
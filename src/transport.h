@@ -162,10 +162,31 @@ struct nn_pipebase {
     uint8_t instate;
     uint8_t outstate;
     struct nn_sock *sock;
+    struct nn_ep *ep;
     void *data;
     struct nn_fsm_event in;
     struct nn_fsm_event out;
     struct nn_ep_options options;
+    /*  Time when the outstanding asynchronous send was started and time
+        when the message waiting in the pipe arrived, zero if unknown. */
+    uint64_t sendstamp;
+    uint64_t recvstamp;
+
+    /*  Per-pipe statistics. The pipe is registered with the socket while
+        it is active so that the statistics can be enumerated. */
+    int id;
+    struct nn_list_item item;
+    char peer [NN_SOCKADDR_MAX + 1];
+    struct {
+        uint64_t messages_sent;
+        uint64_t messages_received;
+        uint64_t bytes_sent;
+        uint64_t bytes_received;
+        uint64_t queued_bytes;
+        uint64_t blocked_us;
+        /*  Time when the pipe became blocked, zero if it isn't. */
+        uint64_t blockstamp;
+    } statistics;
 };
 
 /*  Initialise the pipe.  */
@@ -187,6 +208,10 @@ void nn_pipebase_received (struct nn_pipebase *self);
 /*  Call this function when current outgoing message was fully sent. */
 void nn_pipebase_sent (struct nn_pipebase *self);
 
+/*  Set the address of the peer as reported in pipe statistics. By default
+    the address of the endpoint is used. */
+void nn_pipebase_setpeer (struct nn_pipebase *self, const char *addr);
+
 /*  Retrieve value of a socket option. */
 void nn_pipebase_getopt (struct nn_pipebase *self, int level, int option,
     void *optval, size_t *optvallen);
@@ -28,13 +28,26 @@
 
 #include <string.h>
 
+/*  Returns the amount of memory the message is accounted for. */
+static uint32_t nn_msgqueue_cost (struct nn_msgqueue *self,
+    struct nn_msg *msg)
+{
+    size_t msgsz;
+
+    msgsz = nn_chunkref_size (&msg->sphdr) + nn_chunkref_size (&msg->body);
+    return (uint32_t) (msgsz < self->maxmem ? msgsz : self->maxmem);
+}
+
 void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem)
 {
     struct nn_msgqueue_chunk *chunk;
 
-    self->count = 0;
-    self->mem = 0;
+    /*  Memory accounting is done in 32 bits. Twice the limit must fit. */
+    nn_assert (maxmem > 0 && maxmem <= 0x7fffffff);
     self->maxmem = maxmem;
+    nn_atomic_init (&self->count, 0);
+    nn_atomic_init (&self->mem, 0);
+    nn_atomic_ptr_init (&self->cache, NULL);
 
     chunk = nn_alloc (sizeof (struct nn_msgqueue_chunk), "msgqueue chunk");
     alloc_assert (chunk);
@@ -44,14 +57,13 @@ void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem)
     self->out.pos = 0;
     self->in.chunk = chunk;
     self->in.pos = 0;
-
-    self->cache = NULL;
 }
 
 void nn_msgqueue_term (struct nn_msgqueue *self)
 {
     int rc;
     struct nn_msg msg;
+    struct nn_msgqueue_chunk *chunk;
 
     /*  Deallocate messages in the pipe. */
     while (1) {
@@ -68,60 +80,80 @@ void nn_msgqueue_term (struct nn_msgqueue *self)
     nn_free (self->in.chunk);
 
     /*  Deallocate the cached chunk, if any. */
-    if (self->cache)
-        nn_free (self->cache);
-}
+    chunk = nn_atomic_ptr_swap (&self->cache, NULL);
+    if (chunk)
+        nn_free (chunk);
+    nn_atomic_ptr_term (&self->cache);
 
-int nn_msgqueue_empty (struct nn_msgqueue *self)
-{
-    return self->count == 0 ? 1 : 0;
+    nn_atomic_term (&self->mem);
+    nn_atomic_term (&self->count);
 }
 
 int nn_msgqueue_send (struct nn_msgqueue *self, struct nn_msg *msg)
 {
-    size_t msgsz;
+    int res;
+    uint32_t cost;
+    uint32_t mem;
+    struct nn_msgqueue_chunk *chunk;
 
-    /*  By allowing one message of arbitrary size to be written to the queue,
-        we allow even messages that exceed max buffer size to pass through.
-        Beyond that we'll apply the buffer limit as specified by the user. */
-    msgsz = nn_chunkref_size (&msg->sphdr) + nn_chunkref_size (&msg->body);
-    if (nn_slow (self->count > 0 && self->mem + msgsz >= self->maxmem))
-        return -EAGAIN;
+    res = 0;
 
-    /*  Adjust the statistics. */
-    ++self->count;
-    self->mem += msgsz;
+    /*  Account for the message before it becomes visible to the reader,
+        otherwise the reader could subtract its size before it was added. */
+    cost = nn_msgqueue_cost (self, msg);
+    mem = nn_atomic_inc (&self->mem, cost) + cost;
+    if (nn_slow (mem >= self->maxmem))
+        res |= NN_MSGQUEUE_FULL;
 
     /*  Move the content of the message to the pipe. */
     nn_msg_mv (&self->out.chunk->msgs [self->out.pos], msg);
     ++self->out.pos;
 
     /*  If there's no space for a new message in the pipe, either re-use
-        the cache chunk or allocate a new chunk if it does not exist. */
+        the chunk cached by the reader or allocate a new one. The chunk has
+        to be linked before the message is published so that the reader is
+        always able to move to the next chunk. */
     if (nn_slow (self->out.pos == NN_MSGQUEUE_GRANULARITY)) {
-        if (nn_slow (!self->cache)) {
-            self->cache = nn_alloc (sizeof (struct nn_msgqueue_chunk),
+        chunk = nn_atomic_ptr_swap (&self->cache, NULL);
+        if (nn_slow (!chunk)) {
+            chunk = nn_alloc (sizeof (struct nn_msgqueue_chunk),
                 "msgqueue chunk");
-            alloc_assert (self->cache);
-            self->cache->next = NULL;
+            alloc_assert (chunk);
         }
-        self->out.chunk->next = self->cache;
-        self->out.chunk = self->cache;
-        self->cache = NULL;
+        chunk->next = NULL;
+        self->out.chunk->next = chunk;
+        self->out.chunk = chunk;
         self->out.pos = 0;
     }
 
-    return 0;
+    /*  Publish the message. The atomic operation acts as a memory barrier
+        so the reader is guaranteed to see the message once it sees
+        the counter incremented. */
+    if (nn_atomic_inc (&self->count, 1) == 0)
+        res |= NN_MSGQUEUE_NOTIFY;
+
+    return res;
 }
 
 int nn_msgqueue_recv (struct nn_msgqueue *self, struct nn_msg *msg)
 {
+    int res;
+    uint32_t cost;
+    uint32_t count;
+    uint32_t mem;
     struct nn_msgqueue_chunk *o;
 
-    /*  If there is no message in the queue. */
-    if (nn_slow (!self->count))
+    /*  If there is no message in the queue. Given that only the reader
+        decrements the counter, a non-zero value can't change under us. */
+    if (nn_slow (!nn_atomic_load (&self->count)))
         return -EAGAIN;
 
+    /*  Claim the message. The atomic operation acts as a memory barrier
+        that makes the message content written by the writer visible. */
+    count = nn_atomic_dec (&self->count, 1);
+    nn_assert (count > 0);
+    res = count > 1 ? NN_MSGQUEUE_MORE : 0;
+
     /*  Move the message from the pipe to the user. */
     nn_msg_mv (msg, &self->in.chunk->msgs [self->in.pos]);
 
@@ -131,17 +163,20 @@ int nn_msgqueue_recv (struct nn_msgqueue *self, struct nn_msg *msg)
         o = self->in.chunk;
         self->in.chunk = self->in.chunk->next;
         self->in.pos = 0;
-        if (nn_fast (!self->cache))
-            self->cache = o;
-        else
+
+        /*  Keep the chunk for the writer to reuse. If there was one cached
+            already, deallocate the older one. */
+        o = nn_atomic_ptr_swap (&self->cache, o);
+        if (o)
             nn_free (o);
     }
 
-    /*  Adjust the statistics. */
-    --self->count;
-    self->mem -= (nn_chunkref_size (&msg->sphdr) +
-        nn_chunkref_size (&msg->body));
+    /*  Adjust the statistics. If the queue dropped below the limit the writer
+        may have been blocked on it. */
+    cost = nn_msgqueue_cost (self, msg);
+    mem = nn_atomic_dec (&self->mem, cost);
+    if (nn_slow (mem >= self->maxmem && mem - cost < self->maxmem))
+        res |= NN_MSGQUEUE_RESUME;
 
-    return 0;
+    return res;
 }
-
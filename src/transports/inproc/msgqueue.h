@@ -24,14 +24,42 @@
 #define NN_MSGQUEUE_INCLUDED
 
 #include "../../utils/msg.h"
+#include "../../utils/atomic.h"
 
 #include <stddef.h>
 
-/*  This class is a simple uni-directional message queue. */
+/*  This class is a uni-directional message queue. It is safe to use when
+    there's a single writer and a single reader, each possibly running in
+    a different thread, without any additional locking. The writer and the
+    reader are told about the state transitions that require the other side
+    to be woken up (empty to non-empty, full to non-full) so that they can
+    be signalled once per batch of messages rather than once per message. */
 
 /*  It's not 128 so that chunk including its footer fits into a memory page. */
 #define NN_MSGQUEUE_GRANULARITY 126
 
+/*  Size of the padding used to keep writer-side and reader-side data
+    in separate cache lines. */
+#define NN_MSGQUEUE_CACHELINE 64
+
+/*  Flags returned by nn_msgqueue_send. */
+
+/*  The queue was empty before the message was written. The reader has to be
+    notified that there are messages available. */
+#define NN_MSGQUEUE_NOTIFY 1
+
+/*  The queue have reached its size limit. The writer should not write
+    any more messages until it's resumed by the reader. */
+#define NN_MSGQUEUE_FULL 2
+
+/*  Flags returned by nn_msgqueue_recv. */
+
+/*  There are more messages in the queue to be read. */
+#define NN_MSGQUEUE_MORE 1
+
+/*  The queue dropped below its size limit. The writer should be resumed. */
+#define NN_MSGQUEUE_RESUME 2
+
 struct nn_msgqueue_chunk {
     struct nn_msg msgs [NN_MSGQUEUE_GRANULARITY];
     struct nn_msgqueue_chunk *next;
@@ -39,48 +67,63 @@ struct nn_msgqueue_chunk {
 
 struct nn_msgqueue {
 
+    /*  Maximal queue size (in bytes). Never changes after initialisation. */
+    size_t maxmem;
+
+    char pad1 [NN_MSGQUEUE_CACHELINE];
+
     /*  Pointer to the position where next message should be written into
-        the message queue. */
+        the message queue. Accessed by the writer only. */
     struct {
         struct nn_msgqueue_chunk *chunk;
         int pos;
     } out;
 
-    /*  Pointer to the first unread message in the message queue. */
+    char pad2 [NN_MSGQUEUE_CACHELINE];
+
+    /*  Pointer to the first unread message in the message queue. Accessed
+        by the reader only. */
     struct {
         struct nn_msgqueue_chunk *chunk;
         int pos;
     } in;
 
-    /*  Number of messages in the queue. */
-    size_t count;
+    char pad3 [NN_MSGQUEUE_CACHELINE];
 
-    /*  Amount of memory used by messages in the queue. */
-    size_t mem;
+    /*  Chunk released by the reader and kept for reuse by the writer, so that
+        a queue at steady state doesn't allocate and free a chunk each time
+        NN_MSGQUEUE_GRANULARITY messages pass through it. Exchanged
+        atomically as the reader and the writer may run in different
+        threads. */
+    struct nn_atomic_ptr cache;
 
-    /*   Maximal queue size (in bytes). */
-    size_t maxmem;
 
-    /*  One empty chunk is always cached so that in case of steady stream
-        of messages through the pipe there are no memory allocations. */
-    struct nn_msgqueue_chunk *cache;
+    /*  Number of messages in the queue. Incremented by the writer once
+        the message is fully written, decremented by the reader. */
+    struct nn_atomic count;
+
+    /*  Amount of memory used by messages in the queue. A single message is
+        accounted for at most 'maxmem' bytes so that the value always fits
+        into 32 bits. */
+    struct nn_atomic mem;
 };
 
 /*  Initialise the message pipe. maxmem is the maximal queue size in bytes. */
 void nn_msgqueue_init (struct nn_msgqueue *self, size_t maxmem);
 
-/*  Terminate the message pipe. */
+/*  Terminate the message pipe. Must not be called while there's a writer
+    or a reader accessing the queue. */
 void nn_msgqueue_term (struct nn_msgqueue *self);
 
-/*  Returns 1 if there are no messages in the queue, 0 otherwise. */
-int nn_msgqueue_empty (struct nn_msgqueue *self);
-
-/*  Writes a message to the pipe. -EAGAIN is returned if the message cannot
-    be sent because the queue is full. */
+/*  Writes a message to the pipe. Message of arbitrary size is accepted, but
+    once the size limit is reached NN_MSGQUEUE_FULL flag is returned and the
+    writer should wait until nn_msgqueue_recv reports NN_MSGQUEUE_RESUME.
+    Returns a combination of NN_MSGQUEUE_NOTIFY and NN_MSGQUEUE_FULL flags. */
 int nn_msgqueue_send (struct nn_msgqueue *self, struct nn_msg *msg);
 
 /*  Reads a message from the pipe. -EAGAIN is returned if there's no message
-    to receive. */
+    to receive. Otherwise returns a combination of NN_MSGQUEUE_MORE and
+    NN_MSGQUEUE_RESUME flags. */
 int nn_msgqueue_recv (struct nn_msgqueue *self, struct nn_msg *msg);
 
 #endif
@@ -40,15 +40,10 @@
 #define NN_SINPROC_ACTION_READY 1
 #define NN_SINPROC_ACTION_ACCEPTED 2
 
-/*  Set when SENT event was sent to the peer but RECEIVED haven't been
-    passed back yet. */
+/*  Set when the peer's inbound queue is full and we are waiting for the peer
+    to pass RECEIVED event back to us. */
 #define NN_SINPROC_FLAG_SENDING 1
 
-/*  Set when SENT event was received, but the new message cannot be written
-    to the queue yet, i.e. RECEIVED event haven't been returned
-    to the peer yet. */
-#define NN_SINPROC_FLAG_RECEIVING 2
-
 /*  Private functions. */
 static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
     void *srcptr);
@@ -78,7 +73,6 @@ void nn_sinproc_init (struct nn_sinproc *self, int src,
     nn_ep_getopt (ep, NN_SOL_SOCKET, NN_RCVBUF, &rcvbuf, &sz);
     nn_assert (sz == sizeof (rcvbuf));
     nn_msgqueue_init (&self->msgqueue, rcvbuf);
-    nn_msg_init (&self->msg, 0);
     nn_fsm_event_init (&self->event_connect);
     nn_fsm_event_init (&self->event_sent);
     nn_fsm_event_init (&self->event_received);
@@ -93,7 +87,6 @@ void nn_sinproc_term (struct nn_sinproc *self)
     nn_fsm_event_term (&self->event_received);
     nn_fsm_event_term (&self->event_sent);
     nn_fsm_event_term (&self->event_connect);
-    nn_msg_term (&self->msg);
     nn_msgqueue_term (&self->msgqueue);
     nn_pipebase_term (&self->pipebase);
     nn_fsm_term (&self->fsm);
@@ -136,6 +129,7 @@ void nn_sinproc_stop (struct nn_sinproc *self)
 
 static int nn_sinproc_send (struct nn_pipebase *self, struct nn_msg *msg)
 {
+    int rc;
     struct nn_sinproc *sinproc;
     struct nn_msg nmsg;
 
@@ -160,17 +154,32 @@ static int nn_sinproc_send (struct nn_pipebase *self, struct nn_msg *msg)
         nn_chunkref_size (&msg->sphdr),
         nn_chunkref_data (&msg->body),
         nn_chunkref_size (&msg->body));
+
+    /*  Other ancillary data stay local, but the peer has to know whether
+        the message is followed by further parts. */
+    if (nn_msg_more (msg))
+        nn_msg_setmore (&nmsg);
     nn_msg_term (msg);
 
-    /*  Expose the message to the peer. */
-    nn_msg_term (&sinproc->msg);
-    nn_msg_mv (&sinproc->msg, &nmsg);
+    /*  Write the message directly to the peer's inbound queue. We are
+        the only writer of that queue, so no locking is needed. */
+    rc = nn_msgqueue_send (&sinproc->peer->msgqueue, &nmsg);
+
+    /*  Notify the peer only if the queue was empty. If it was not, the peer
+        haven't drained the queue yet and will pick the message up anyway. */
+    if (rc & NN_MSGQUEUE_NOTIFY)
+        nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
+            &sinproc->peer->event_sent, NN_SINPROC_SRC_PEER,
+            NN_SINPROC_SENT, sinproc);
+
+    /*  If the peer's queue is full wait till the peer makes some space in it
+        and tells us so by passing RECEIVED event back. */
+    if (nn_slow (rc & NN_MSGQUEUE_FULL)) {
+        sinproc->flags |= NN_SINPROC_FLAG_SENDING;
+        return 0;
+    }
 
-    /*  Notify the peer that there's a message to get. */
-    sinproc->flags |= NN_SINPROC_FLAG_SENDING;
-    nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
-        &sinproc->peer->event_sent, NN_SINPROC_SRC_PEER,
-        NN_SINPROC_SENT, sinproc);
+    nn_pipebase_sent (&sinproc->pipebase);
 
     return 0;
 }
@@ -188,26 +197,20 @@ static int nn_sinproc_recv (struct nn_pipebase *self, struct nn_msg *msg)
 
     /*  Move the message to the caller. */
     rc = nn_msgqueue_recv (&sinproc->msgqueue, msg);
-    errnum_assert (rc == 0, -rc);
+    errnum_assert (rc >= 0, -rc);
 
-    /*  If there was a message from peer lingering because of the exceeded
-        buffer limit, try to enqueue it once again. */
+    /*  If the peer is blocked because of the exceeded buffer limit and
+        there's space in the queue now, let it continue sending. */
     if (sinproc->state != NN_SINPROC_STATE_DISCONNECTED) {
-        if (nn_slow (sinproc->flags & NN_SINPROC_FLAG_RECEIVING)) {
-            rc = nn_msgqueue_send (&sinproc->msgqueue, &sinproc->peer->msg);
-            nn_assert (rc == 0 || rc == -EAGAIN);
-            if (rc == 0) {
-                errnum_assert (rc == 0, -rc);
-                nn_msg_init (&sinproc->peer->msg, 0);
-                nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
-                    &sinproc->peer->event_received, NN_SINPROC_SRC_PEER,
-                    NN_SINPROC_RECEIVED, sinproc);
-                sinproc->flags &= ~NN_SINPROC_FLAG_RECEIVING;
-            }
-        }
+        if (nn_slow (rc & NN_MSGQUEUE_RESUME))
+            nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
+                &sinproc->peer->event_received, NN_SINPROC_SRC_PEER,
+                NN_SINPROC_RECEIVED, sinproc);
     }
 
-    if (!nn_msgqueue_empty (&sinproc->msgqueue))
+    /*  If the queue became empty, the peer will notify us about the next
+        message by SENT event. */
+    if (rc & NN_MSGQUEUE_MORE)
        nn_pipebase_received (&sinproc->pipebase);
 
     return 0;
@@ -315,7 +318,6 @@ static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
 {
     int rc;
     struct nn_sinproc *sinproc;
-    int empty;
 
     sinproc = nn_cont (self, struct nn_sinproc, fsm);
 
@@ -425,27 +427,10 @@ static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_SINPROC_SENT:
 
-                empty = nn_msgqueue_empty (&sinproc->msgqueue);
-
-                /*  Push the message to the inbound message queue. */
-                rc = nn_msgqueue_send (&sinproc->msgqueue,
-                    &sinproc->peer->msg);
-                if (rc == -EAGAIN) {
-                    sinproc->flags |= NN_SINPROC_FLAG_RECEIVING;
-                    return;
-                }
-                errnum_assert (rc == 0, -rc);
-                nn_msg_init (&sinproc->peer->msg, 0);
-
-                /*  Notify the user that there's a message to receive. */
-                if (empty)
-                    nn_pipebase_received (&sinproc->pipebase);
-
-                /*  Notify the peer that the message was received. */
-                nn_fsm_raiseto (&sinproc->fsm, &sinproc->peer->fsm,
-                    &sinproc->peer->event_received, NN_SINPROC_SRC_PEER,
-                    NN_SINPROC_RECEIVED, sinproc);
-
+                /*  The peer have written message(s) into the empty inbound
+                    queue. Notify the user that there's a message to
+                    receive. */
+                nn_pipebase_received (&sinproc->pipebase);
                 return;
 
             case NN_SINPROC_RECEIVED:
@@ -482,10 +467,13 @@ static void nn_sinproc_handler (struct nn_fsm *self, int src, int type,
         switch (src) {
         case NN_SINPROC_SRC_PEER:
             switch (type) {
+            case NN_SINPROC_SENT:
             case NN_SINPROC_RECEIVED:
-                /*  This case can safely be ignored. It may happen when
+                /*  These cases can safely be ignored. They may happen when
                     nn_close() comes before the already enqueued
-                    NN_SINPROC_RECEIVED has been delivered.  */
+                    NN_SINPROC_SENT or NN_SINPROC_RECEIVED have been
+                    delivered. Any messages left in the queue are
+                    deallocated when the object is terminated.  */
                 return;
             default:
                 nn_fsm_bad_action (sinproc->state, src, type);
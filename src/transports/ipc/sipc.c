@@ -29,9 +29,13 @@
 #include "../../utils/wire.h"
 #include "../../utils/attr.h"
 
+#include <limits.h>
+#include <string.h>
+
 /*  Types of messages passed via IPC transport. */
 #define NN_SIPC_MSG_NORMAL 1
 #define NN_SIPC_MSG_SHMEM 2
+#define NN_SIPC_MSG_CREDIT 3
 
 /*  States of the object as a whole. */
 #define NN_SIPC_STATE_IDLE 1
@@ -68,6 +72,14 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static void nn_sipc_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
+static void nn_sipc_recvhdr (struct nn_sipc *self);
+static void nn_sipc_sendframe (struct nn_sipc *self);
+static void nn_sipc_inframe (struct nn_sipc *self);
+static void nn_sipc_sendmsg (struct nn_sipc *self);
+static int nn_sipc_cangrant (struct nn_sipc *self);
+static void nn_sipc_sendgrant (struct nn_sipc *self);
+static int nn_sipc_credit (struct nn_sipc *self, uint64_t credits);
+static void nn_sipc_unblock (struct nn_sipc *self);
 
 void nn_sipc_init (struct nn_sipc *self, int src,
     struct nn_ep *ep, struct nn_fsm *owner)
@@ -84,6 +96,14 @@ void nn_sipc_init (struct nn_sipc *self, int src,
     nn_msg_init (&self->inmsg, 0);
     self->outstate = -1;
     nn_msg_init (&self->outmsg, 0);
+    nn_lanes_init (&self->lanes, 0);
+    self->sndbuf = 0;
+    self->outblocked = 0;
+    self->credit = -1;
+    self->window = 0;
+    self->grant = 0;
+    self->granting = 0;
+    self->outpending = 0;
     nn_fsm_event_init (&self->done);
 }
 
@@ -92,6 +112,7 @@ void nn_sipc_term (struct nn_sipc *self)
     nn_assert_state (self, NN_SIPC_STATE_IDLE);
 
     nn_fsm_event_term (&self->done);
+    nn_lanes_term (&self->lanes);
     nn_msg_term (&self->outmsg);
     nn_msg_term (&self->inmsg);
     nn_pipebase_term (&self->pipebase);
@@ -125,36 +146,65 @@ void nn_sipc_stop (struct nn_sipc *self)
 static int nn_sipc_send (struct nn_pipebase *self, struct nn_msg *msg)
 {
     struct nn_sipc *sipc;
-    struct nn_iovec iov [3];
 
     sipc = nn_cont (self, struct nn_sipc, pipebase);
 
     nn_assert_state (sipc, NN_SIPC_STATE_ACTIVE);
-    nn_assert (sipc->outstate == NN_SIPC_OUTSTATE_IDLE);
+
+    /*  Each message sent uses up one credit. */
+    if (sipc->credit > 0)
+        --sipc->credit;
+
+    /*  With interleaving, the message is queued in its lane. The pipe keeps
+        accepting messages while there's room in the send buffer, so that
+        urgent messages can overtake large ones being sent. */
+    if (sipc->lanes.framesz) {
+        nn_lanes_push (&sipc->lanes, msg);
+        if (sipc->outstate == NN_SIPC_OUTSTATE_IDLE)
+            nn_sipc_sendframe (sipc);
+        sipc->outblocked = 1;
+        nn_sipc_unblock (sipc);
+        return 0;
+    }
 
     /*  Move the message to the local storage. */
     nn_msg_term (&sipc->outmsg);
     nn_msg_mv (&sipc->outmsg, msg);
 
-    /*  Serialise the message header. */
-    sipc->outhdr [0] = NN_SIPC_MSG_NORMAL;
-    nn_putll (sipc->outhdr + 1, nn_chunkref_size (&sipc->outmsg.sphdr) +
-        nn_chunkref_size (&sipc->outmsg.body));
-
-    /*  Start async sending. */
-    iov [0].iov_base = sipc->outhdr;
-    iov [0].iov_len = sizeof (sipc->outhdr);
-    iov [1].iov_base = nn_chunkref_data (&sipc->outmsg.sphdr);
-    iov [1].iov_len = nn_chunkref_size (&sipc->outmsg.sphdr);
-    iov [2].iov_base = nn_chunkref_data (&sipc->outmsg.body);
-    iov [2].iov_len = nn_chunkref_size (&sipc->outmsg.body);
-    nn_usock_send (sipc->usock, iov, 3);
+    /*  If a credit grant is being sent, the message has to wait for it. */
+    if (sipc->outstate == NN_SIPC_OUTSTATE_SENDING) {
+        nn_assert (sipc->granting);
+        sipc->outpending = 1;
+        return 0;
+    }
 
-    sipc->outstate = NN_SIPC_OUTSTATE_SENDING;
+    nn_sipc_sendmsg (sipc);
 
     return 0;
 }
 
+/*  Starts sending the message stored in 'outmsg'. */
+static void nn_sipc_sendmsg (struct nn_sipc *self)
+{
+    struct nn_iovec iov [3];
+
+    /*  Serialise the message header. */
+    self->outhdr [0] = NN_SIPC_MSG_NORMAL;
+    nn_putll (self->outhdr + 1, nn_chunkref_size (&self->outmsg.sphdr) +
+        nn_chunkref_size (&self->outmsg.body));
+
+    /*  Start async sending. */
+    iov [0].iov_base = self->outhdr;
+    iov [0].iov_len = sizeof (self->outhdr);
+    iov [1].iov_base = nn_chunkref_data (&self->outmsg.sphdr);
+    iov [1].iov_len = nn_chunkref_size (&self->outmsg.sphdr);
+    iov [2].iov_base = nn_chunkref_data (&self->outmsg.body);
+    iov [2].iov_len = nn_chunkref_size (&self->outmsg.body);
+    nn_usock_send (self->usock, iov, 3);
+
+    self->outstate = NN_SIPC_OUTSTATE_SENDING;
+}
+
 static int nn_sipc_recv (struct nn_pipebase *self, struct nn_msg *msg)
 {
     struct nn_sipc *sipc;
@@ -168,13 +218,143 @@ static int nn_sipc_recv (struct nn_pipebase *self, struct nn_msg *msg)
     nn_msg_mv (msg, &sipc->inmsg);
     nn_msg_init (&sipc->inmsg, 0);
 
-    /*  Start receiving new message. */
-    sipc->instate = NN_SIPC_INSTATE_HDR;
-    nn_usock_recv (sipc->usock, sipc->inhdr, sizeof (sipc->inhdr), NULL);
+    /*  Once the peer's message was taken, the peer can send another one. */
+    if (sipc->window && (!sipc->lanes.framesz || sipc->lanes.inlast)) {
+        ++sipc->grant;
+        if (sipc->outstate == NN_SIPC_OUTSTATE_IDLE && nn_sipc_cangrant (sipc)) {
+            if (sipc->lanes.framesz)
+                nn_sipc_sendframe (sipc);
+            else
+                nn_sipc_sendgrant (sipc);
+        }
+    }
 
+    /*  Carry on with the frame being received, or start receiving new
+        message. */
+    if (sipc->lanes.framesz)
+        nn_sipc_inframe (sipc);
+    else
+        nn_sipc_recvhdr (sipc);
+
+    return 0;
+}
+
+/*  Starts receiving the header of the next message, or of the next frame
+    if interleaving is used. Frames replace the IPC message headers
+    altogether. */
+static void nn_sipc_recvhdr (struct nn_sipc *self)
+{
+    self->instate = NN_SIPC_INSTATE_HDR;
+    if (self->lanes.framesz)
+        nn_usock_recv (self->usock, self->lanes.inhdr,
+            sizeof (self->lanes.inhdr), NULL);
+    else
+        nn_usock_recv (self->usock, self->inhdr, sizeof (self->inhdr), NULL);
+}
+
+/*  Starts sending the next frame from the lanes, if there is any. */
+static void nn_sipc_sendframe (struct nn_sipc *self)
+{
+    int iovcnt;
+    struct nn_iovec iov [3];
+
+    /*  Credit grants go ahead of any messages. */
+    if (nn_sipc_cangrant (self)) {
+        nn_sipc_sendgrant (self);
+        return;
+    }
+
+    iovcnt = nn_lanes_frame (&self->lanes, iov);
+    if (!iovcnt) {
+        self->outstate = NN_SIPC_OUTSTATE_IDLE;
+        return;
+    }
+    nn_usock_send (self->usock, iov, iovcnt);
+    self->outstate = NN_SIPC_OUTSTATE_SENDING;
+}
+
+/*  Returns 1 if there are enough credits to grant the peer. To keep
+    the overhead low, credits are granted in batches of half the receive
+    window. */
+static int nn_sipc_cangrant (struct nn_sipc *self)
+{
+    return self->grant > 0 && self->grant >= (self->window + 1) / 2;
+}
+
+/*  Grants the peer the credits accumulated since the last grant. */
+static void nn_sipc_sendgrant (struct nn_sipc *self)
+{
+    struct nn_iovec iov;
+
+    if (self->lanes.framesz) {
+        memset (self->granthdr, 0, sizeof (self->granthdr));
+        self->granthdr [1] = NN_LANES_FLAG_CREDIT;
+        nn_putll (self->granthdr + 8, self->grant);
+        iov.iov_len = NN_LANES_HDRLEN;
+    }
+    else {
+        self->granthdr [0] = NN_SIPC_MSG_CREDIT;
+        nn_putll (self->granthdr + 1, self->grant);
+        iov.iov_len = 9;
+    }
+    iov.iov_base = self->granthdr;
+    nn_usock_send (self->usock, &iov, 1);
+    self->grant = 0;
+    self->granting = 1;
+    self->outstate = NN_SIPC_OUTSTATE_SENDING;
+}
+
+/*  Handles the credits granted by the peer. The peer that didn't announce
+    it would grant credits is not supposed to send any. */
+static int nn_sipc_credit (struct nn_sipc *self, uint64_t credits)
+{
+    if (nn_slow (self->credit < 0 || credits > INT_MAX ||
+          self->credit > INT_MAX - (int) credits))
+        return -EPROTO;
+    self->credit += (int) credits;
+    nn_sipc_unblock (self);
+    nn_sipc_recvhdr (self);
     return 0;
 }
 
+/*  Accepts another message from the owner once the peer granted a credit
+    for it and there's room in the send buffer. */
+static void nn_sipc_unblock (struct nn_sipc *self)
+{
+    if (!self->outblocked || self->credit == 0)
+        return;
+    if (self->lanes.framesz && self->lanes.queued >= self->sndbuf)
+        return;
+    self->outblocked = 0;
+    nn_pipebase_sent (&self->pipebase);
+}
+
+/*  Carries on receiving the current frame. Once a message, or a part of it,
+    is complete, notifies the owner that it can receive it. */
+static void nn_sipc_inframe (struct nn_sipc *self)
+{
+    int rc;
+    void *buf;
+    size_t len;
+
+    rc = nn_lanes_next (&self->lanes, &self->inmsg, &buf, &len);
+    switch (rc) {
+    case NN_LANES_HDR:
+        nn_sipc_recvhdr (self);
+        return;
+    case NN_LANES_DATA:
+        self->instate = NN_SIPC_INSTATE_BODY;
+        nn_usock_recv (self->usock, buf, len, NULL);
+        return;
+    case NN_LANES_MSG:
+        self->instate = NN_SIPC_INSTATE_HASMSG;
+        nn_pipebase_received (&self->pipebase);
+        return;
+    default:
+        nn_assert (0);
+    }
+}
+
 static void nn_sipc_shutdown (struct nn_fsm *self, int src, int type,
     NN_UNUSED void *srcptr)
 {
@@ -189,6 +369,12 @@ static void nn_sipc_shutdown (struct nn_fsm *self, int src, int type,
     }
     if (nn_slow (sipc->state == NN_SIPC_STATE_STOPPING)) {
         if (nn_streamhdr_isidle (&sipc->streamhdr)) {
+
+            /*  Drop the messages queued in the lanes. */
+            nn_lanes_term (&sipc->lanes);
+            nn_lanes_init (&sipc->lanes, 0);
+            sipc->outblocked = 0;
+
             nn_usock_swap_owner (sipc->usock, &sipc->usock_owner);
             sipc->usock = NULL;
             sipc->usock_owner.src = -1;
@@ -288,13 +474,50 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
                     return;
                  }
 
+                 /*  If both peers agreed, split messages into frames.
+                     Peers that use message parts only may not have
+                     NN_INTERLEAVE set; frames of the part size are used
+                     then. */
+                 if (sipc->streamhdr.features & NN_STREAMHDR_INTERLEAVE) {
+                     nn_pipebase_getopt (&sipc->pipebase, NN_SOL_SOCKET,
+                         NN_PARTSIZE, &opt, &opt_sz);
+                     if (sipc->streamhdr.features & NN_STREAMHDR_PARTS)
+                         sipc->lanes.partsz = (size_t) opt;
+                     sipc->lanes.framesz = (size_t) opt;
+                     nn_pipebase_getopt (&sipc->pipebase, NN_SOL_SOCKET,
+                         NN_INTERLEAVE, &opt, &opt_sz);
+                     if (opt > 0)
+                         sipc->lanes.framesz = (size_t) opt;
+                     nn_pipebase_getopt (&sipc->pipebase, NN_SOL_SOCKET,
+                         NN_SNDBUF, &opt, &opt_sz);
+                     sipc->sndbuf = (size_t) opt;
+                 }
+
+                 /*  If the peer limits the number of messages in flight,
+                     wait for its credits. The pipe starts as writable,
+                     which accounts for the first credit. Likewise, if we
+                     limit the peer, grant it the rest of the window. */
+                 sipc->credit = -1;
+                 sipc->window = 0;
+                 sipc->grant = 0;
+                 sipc->granting = 0;
+                 sipc->outpending = 0;
+                 if (sipc->streamhdr.peerfeatures & NN_STREAMHDR_GRANT)
+                     sipc->credit = 1;
+                 nn_pipebase_getopt (&sipc->pipebase, NN_SOL_SOCKET,
+                     NN_RCVCREDIT, &opt, &opt_sz);
+                 if (opt > 0) {
+                     sipc->window = opt;
+                     sipc->grant = opt - 1;
+                 }
+
                  /*  Start receiving a message in asynchronous manner. */
-                 sipc->instate = NN_SIPC_INSTATE_HDR;
-                 nn_usock_recv (sipc->usock, &sipc->inhdr,
-                     sizeof (sipc->inhdr), NULL);
+                 nn_sipc_recvhdr (sipc);
 
                  /*  Mark the pipe as available for sending. */
                  sipc->outstate = NN_SIPC_OUTSTATE_IDLE;
+                 if (nn_sipc_cangrant (sipc))
+                     nn_sipc_sendgrant (sipc);
 
                  sipc->state = NN_SIPC_STATE_ACTIVE;
                  return;
@@ -317,12 +540,42 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_USOCK_SENT:
 
-                /*  The message is now fully sent. */
+                /*  With interleaving, carry on with the next frame. Once
+                    there's room in the send buffer, accept more messages. */
+                if (sipc->lanes.framesz) {
+                    nn_assert (sipc->outstate == NN_SIPC_OUTSTATE_SENDING);
+                    if (sipc->granting)
+                        sipc->granting = 0;
+                    else
+                        nn_lanes_sent (&sipc->lanes);
+                    nn_sipc_sendframe (sipc);
+                    nn_sipc_unblock (sipc);
+                    return;
+                }
+
+                /*  Credit grant was sent. Send the message that was waiting
+                    for it, if any. */
                 nn_assert (sipc->outstate == NN_SIPC_OUTSTATE_SENDING);
                 sipc->outstate = NN_SIPC_OUTSTATE_IDLE;
+                if (sipc->granting) {
+                    sipc->granting = 0;
+                    if (sipc->outpending) {
+                        sipc->outpending = 0;
+                        nn_sipc_sendmsg (sipc);
+                    }
+                    else if (nn_sipc_cangrant (sipc))
+                        nn_sipc_sendgrant (sipc);
+                    return;
+                }
+
+                /*  The message is now fully sent. Accept the next one once
+                    the peer allows it. */
                 nn_msg_term (&sipc->outmsg);
                 nn_msg_init (&sipc->outmsg, 0);
-                nn_pipebase_sent (&sipc->pipebase);
+                if (nn_sipc_cangrant (sipc))
+                    nn_sipc_sendgrant (sipc);
+                sipc->outblocked = 1;
+                nn_sipc_unblock (sipc);
                 return;
 
             case NN_USOCK_RECEIVED:
@@ -330,14 +583,43 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
                 switch (sipc->instate) {
                 case NN_SIPC_INSTATE_HDR:
 
+                    nn_pipebase_getopt (&sipc->pipebase, NN_SOL_SOCKET,
+                        NN_RCVMAXSIZE, &opt, &opt_sz);
+
+                    /*  Frame header was received. Malformed frames and
+                        messages larger than NN_RCVMAXSIZE drop the
+                        connection. */
+                    if (sipc->lanes.framesz) {
+                        if (sipc->lanes.inhdr [1] & NN_LANES_FLAG_CREDIT)
+                            rc = nn_sipc_credit (sipc,
+                                nn_getll (sipc->lanes.inhdr + 8));
+                        else
+                            rc = nn_lanes_inframe (&sipc->lanes, opt);
+                        if (nn_slow (rc < 0)) {
+                            sipc->state = NN_SIPC_STATE_DONE;
+                            nn_fsm_raise (&sipc->fsm, &sipc->done,
+                                NN_SIPC_ERROR);
+                            return;
+                        }
+                        if (!(sipc->lanes.inhdr [1] & NN_LANES_FLAG_CREDIT))
+                            nn_sipc_inframe (sipc);
+                        return;
+                    }
+
                     /*  Message header was received. Check that message size
                         is acceptable by comparing with NN_RCVMAXSIZE;
                         if it's too large, drop the connection. */
-                    nn_assert (sipc->inhdr [0] == NN_SIPC_MSG_NORMAL);
                     size = nn_getll (sipc->inhdr + 1);
-
-                    nn_pipebase_getopt (&sipc->pipebase, NN_SOL_SOCKET,
-                        NN_RCVMAXSIZE, &opt, &opt_sz);
+                    if (sipc->inhdr [0] == NN_SIPC_MSG_CREDIT) {
+                        rc = nn_sipc_credit (sipc, size);
+                        if (nn_slow (rc < 0)) {
+                            sipc->state = NN_SIPC_STATE_DONE;
+                            nn_fsm_raise (&sipc->fsm, &sipc->done,
+                                NN_SIPC_ERROR);
+                        }
+                        return;
+                    }
+                    nn_assert (sipc->inhdr [0] == NN_SIPC_MSG_NORMAL);
 
                     if (opt >= 0 && size > (unsigned)opt) {
                         sipc->state = NN_SIPC_STATE_DONE;
@@ -366,6 +648,13 @@ static void nn_sipc_handler (struct nn_fsm *self, int src, int type,
 
                 case NN_SIPC_INSTATE_BODY:
 
+                    /*  Frame payload was received. If it completes
+                        a message, notify the owner. */
+                    if (sipc->lanes.framesz) {
+                        nn_sipc_inframe (sipc);
+                        return;
+                    }
+
                     /*  Message body was received. Notify the owner that it
                         can receive it. */
                     sipc->instate = NN_SIPC_INSTATE_HASMSG;
@@ -30,6 +30,7 @@
 #include "../../aio/usock.h"
 
 #include "../utils/streamhdr.h"
+#include "../utils/lanes.h"
 
 #include "../../utils/msg.h"
 
@@ -75,6 +76,37 @@ struct nn_sipc {
     /*  Message being sent at the moment. */
     struct nn_msg outmsg;
 
+    /*  Priority lanes used instead of 'inmsg' and 'outmsg' if both peers
+        agreed to interleave messages. */
+    struct nn_lanes lanes;
+
+    /*  Size of the send buffer. Once the size of the messages waiting in
+        the lanes exceeds it, the pipe doesn't accept more messages. Messages
+        that started being sent don't count, so that a large message doesn't
+        block the urgent ones. */
+    size_t sndbuf;
+    int outblocked;
+
+    /*  Number of messages the peer allows us to send, -1 if it doesn't
+        limit us. While there's no credit left, the pipe doesn't accept
+        more messages. */
+    int credit;
+
+    /*  Number of messages we allow the peer to have in flight, 0 if we
+        don't limit it, and number of messages taken by the owner since
+        the last credit grant was sent. */
+    int window;
+    int grant;
+
+    /*  Set if a credit grant is being sent at the moment. The message passed
+        to the pipe in the meantime waits in 'outmsg' with 'outpending'
+        set. */
+    int granting;
+    int outpending;
+
+    /*  Buffer used to store the credit grant being sent. */
+    uint8_t granthdr [NN_LANES_HDRLEN];
+
     /*  Event raised when the state machine ends. */
     struct nn_fsm_event done;
 };
@@ -67,7 +67,9 @@ void nn_atcp_init (struct nn_atcp *self, int src,
     self->listener_owner.src = -1;
     self->listener_owner.fsm = NULL;
     nn_stcp_init (&self->stcp, NN_ATCP_SRC_STCP, ep, &self->fsm);
+    self->established = 0;
     nn_fsm_event_init (&self->accepted);
+    nn_fsm_event_init (&self->established_event);
     nn_fsm_event_init (&self->done);
     nn_list_item_init (&self->item);
 }
@@ -78,6 +80,7 @@ void nn_atcp_term (struct nn_atcp *self)
 
     nn_list_item_term (&self->item);
     nn_fsm_event_term (&self->done);
+    nn_fsm_event_term (&self->established_event);
     nn_fsm_event_term (&self->accepted);
     nn_stcp_term (&self->stcp);
     nn_usock_term (&self->usock);
@@ -253,6 +256,11 @@ static void nn_atcp_handler (struct nn_fsm *self, int src, int type,
 
         case NN_ATCP_SRC_STCP:
             switch (type) {
+            case NN_STCP_ESTABLISHED:
+                atcp->established = 1;
+                nn_fsm_raise (&atcp->fsm, &atcp->established_event,
+                    NN_ATCP_ESTABLISHED);
+                return;
             case NN_STCP_ERROR:
                 nn_stcp_stop (&atcp->stcp);
                 atcp->state = NN_ATCP_STATE_STOPPING_STCP;
@@ -41,6 +41,7 @@
 #define NN_ATCP_ACCEPTED 34231
 #define NN_ATCP_ERROR 34232
 #define NN_ATCP_STOPPED 34233
+#define NN_ATCP_ESTABLISHED 34234
 
 struct nn_atcp {
 
@@ -61,8 +62,12 @@ struct nn_atcp {
     /*  State machine that takes care of the connection in the active state. */
     struct nn_stcp stcp;
 
+    /*  Set once the protocol header exchange on the connection is over. */
+    int established;
+
     /*  Events generated by atcp state machine. */
     struct nn_fsm_event accepted;
+    struct nn_fsm_event established_event;
     struct nn_fsm_event done;
 
     /*  This member can be used by owner to keep individual atcps in a list. */
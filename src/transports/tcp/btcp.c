@@ -24,11 +24,14 @@
 #include "btcp.h"
 #include "atcp.h"
 
+#include "../../tcp.h"
+
 #include "../utils/port.h"
 #include "../utils/iface.h"
 
 #include "../../aio/fsm.h"
 #include "../../aio/usock.h"
+#include "../../aio/timer.h"
 
 #include "../utils/backoff.h"
 
@@ -45,12 +48,18 @@
 #else
 #include <unistd.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #endif
 
 /*  The backlog is set relatively high so that there are not too many failed
     connection attempts during re-connection storms. */
 #define NN_BTCP_BACKLOG 100
 
+/*  Maximum number of connections accepted from a listening socket in one go.
+    Afterwards the listener yields to the worker thread so that a connection
+    storm doesn't starve the established connections handled by it. */
+#define NN_BTCP_ACCEPT_BATCH 64
+
 #define NN_BTCP_STATE_IDLE 1
 #define NN_BTCP_STATE_ACTIVE 2
 #define NN_BTCP_STATE_STOPPING_ATCP 3
@@ -60,9 +69,30 @@
 #define NN_BTCP_SRC_USOCK 1
 #define NN_BTCP_SRC_ATCP 2
 #define NN_BTCP_SRC_BTCP 3
+#define NN_BTCP_SRC_TIMER 4
 
 #define NN_BTCP_TYPE_LISTEN_ERR 1
 
+/*  A listening socket. With NN_TCP_LISTENERS set to more than one, several
+    listening sockets are bound to the same address using SO_REUSEPORT and
+    the kernel spreads incoming connections among them. Each of them is
+    polled by a worker thread chosen from the pool, however, all of them
+    share the socket's nn_ctx, so the accepts themselves are serialised. */
+struct nn_btcp_listener {
+
+    /*  The underlying listening TCP socket. */
+    struct nn_usock usock;
+
+    /*  The connection being accepted at the moment. NULL if accepting is
+        deferred. */
+    struct nn_atcp *atcp;
+
+    /*  Timer used to yield to the worker thread after a batch of accepts. */
+    struct nn_timer timer;
+
+    /*  Number of connections accepted since the listener last yielded. */
+    int accepted;
+};
 
 struct nn_btcp {
 
@@ -73,14 +103,25 @@ struct nn_btcp {
 
     struct nn_ep *ep;
 
-    /*  The underlying listening TCP socket. */
-    struct nn_usock usock;
-
-    /*  The connection being accepted at the moment. */
-    struct nn_atcp *atcp;
+    /*  Listening sockets. */
+    struct nn_btcp_listener *listeners;
+    int nlisteners;
 
     /*  List of accepted connections. */
     struct nn_list atcps;
+
+    /*  Number of handshake slots in use and the limit on it set by
+        NN_TCP_MAX_HANDSHAKES, zero meaning no limit. A slot is reserved by
+        each listener waiting for a connection and is kept by the accepted
+        connection till it is done exchanging protocol headers. Reserving
+        the slot before accepting keeps several listeners from exceeding
+        the limit between them. */
+    int handshakes;
+    int max_handshakes;
+
+    /*  Listener to be resumed first once a slot frees up, so that
+        the paused listeners take turns. */
+    int resume;
 };
 
 /*  nn_ep virtual interface implementation. */
@@ -97,7 +138,11 @@ static void nn_btcp_handler (struct nn_fsm *self, int src, int type,
 static void nn_btcp_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static int nn_btcp_listen (struct nn_btcp *self);
-static void nn_btcp_start_accepting (struct nn_btcp *self);
+static void nn_btcp_start_accepting (struct nn_btcp *self,
+    struct nn_btcp_listener *listener);
+static void nn_btcp_resume_accepting (struct nn_btcp *self,
+    struct nn_btcp_listener *listener);
+static void nn_btcp_handshake_done (struct nn_btcp *self);
 
 int nn_btcp_create (struct nn_ep *ep)
 {
@@ -110,6 +155,11 @@ int nn_btcp_create (struct nn_ep *ep)
     size_t sslen;
     int ipv4only;
     size_t ipv4onlylen;
+    int nlisteners;
+    size_t nlistenerslen;
+    int max_handshakes;
+    size_t max_handshakeslen;
+    int i;
 
     /*  Allocate the new endpoint object. */
     self = nn_alloc (sizeof (struct nn_btcp), "btcp");
@@ -145,18 +195,51 @@ int nn_btcp_create (struct nn_ep *ep)
         return -ENODEV;
     }
 
+    /*  Multiple listeners are supported only with SO_REUSEPORT. */
+    nlistenerslen = sizeof (nlisteners);
+    nn_ep_getopt (ep, NN_TCP, NN_TCP_LISTENERS, &nlisteners, &nlistenerslen);
+    nn_assert (nlistenerslen == sizeof (nlisteners));
+#if !defined SO_REUSEPORT
+    nlisteners = 1;
+#endif
+
+    max_handshakeslen = sizeof (max_handshakes);
+    nn_ep_getopt (ep, NN_TCP, NN_TCP_MAX_HANDSHAKES, &max_handshakes,
+        &max_handshakeslen);
+    nn_assert (max_handshakeslen == sizeof (max_handshakes));
+
+    /*  Each listener waiting for a connection holds a handshake slot. With
+        fewer slots than listeners, the listeners holding them could wait
+        for connections forever while connections queued on the others are
+        never accepted. */
+    if (max_handshakes > 0 && max_handshakes < nlisteners)
+        max_handshakes = nlisteners;
+
     /*  Initialise the structure. */
     nn_fsm_init_root (&self->fsm, nn_btcp_handler, nn_btcp_shutdown,
         nn_ep_getctx (ep));
     nn_fsm_event_init (&self->listen_error);
     self->state = NN_BTCP_STATE_IDLE;
-    self->atcp = NULL;
+    self->listeners = nn_alloc (sizeof (struct nn_btcp_listener) *
+        nlisteners, "btcp listeners");
+    alloc_assert (self->listeners);
+    self->nlisteners = nlisteners;
     nn_list_init (&self->atcps);
+    self->handshakes = 0;
+    self->max_handshakes = max_handshakes;
+    self->resume = 0;
 
     /*  Start the state machine. */
     nn_fsm_start (&self->fsm);
 
-    nn_usock_init (&self->usock, NN_BTCP_SRC_USOCK, &self->fsm);
+    for (i = 0; i != self->nlisteners; ++i) {
+        nn_usock_init (&self->listeners [i].usock, NN_BTCP_SRC_USOCK,
+            &self->fsm);
+        self->listeners [i].atcp = NULL;
+        nn_timer_init (&self->listeners [i].timer, NN_BTCP_SRC_TIMER,
+            &self->fsm);
+        self->listeners [i].accepted = 0;
+    }
 
     rc = nn_btcp_listen (self);
     if (rc != 0) {
@@ -178,11 +261,16 @@ static void nn_btcp_stop (void *self)
 static void nn_btcp_destroy (void *self)
 {
     struct nn_btcp *btcp = self;
+    int i;
 
     nn_assert_state (btcp, NN_BTCP_STATE_IDLE);
     nn_list_term (&btcp->atcps);
-    nn_assert (btcp->atcp == NULL);
-    nn_usock_term (&btcp->usock);
+    for (i = 0; i != btcp->nlisteners; ++i) {
+        nn_assert (btcp->listeners [i].atcp == NULL);
+        nn_timer_term (&btcp->listeners [i].timer);
+        nn_usock_term (&btcp->listeners [i].usock);
+    }
+    nn_free (btcp->listeners);
     nn_fsm_term (&btcp->fsm);
 
     nn_free (btcp);
@@ -194,30 +282,38 @@ static void nn_btcp_shutdown (struct nn_fsm *self, int src, int type,
     struct nn_btcp *btcp;
     struct nn_list_item *it;
     struct nn_atcp *atcp;
+    int i;
 
     btcp = nn_cont (self, struct nn_btcp, fsm);
 
     if (nn_slow (src == NN_FSM_ACTION && type == NN_FSM_STOP)) {
-        if (btcp->atcp) {
-            nn_atcp_stop (btcp->atcp);
-            btcp->state = NN_BTCP_STATE_STOPPING_ATCP;
-        }
-        else {
-            btcp->state = NN_BTCP_STATE_STOPPING_USOCK;
+        for (i = 0; i != btcp->nlisteners; ++i) {
+            if (btcp->listeners [i].atcp)
+                nn_atcp_stop (btcp->listeners [i].atcp);
+            nn_timer_stop (&btcp->listeners [i].timer);
         }
+        btcp->state = NN_BTCP_STATE_STOPPING_ATCP;
     }
     if (nn_slow (btcp->state == NN_BTCP_STATE_STOPPING_ATCP)) {
-        if (!nn_atcp_isidle (btcp->atcp))
-            return;
-        nn_atcp_term (btcp->atcp);
-        nn_free (btcp->atcp);
-        btcp->atcp = NULL;
-        nn_usock_stop (&btcp->usock);
+        for (i = 0; i != btcp->nlisteners; ++i)
+            if ((btcp->listeners [i].atcp &&
+                  !nn_atcp_isidle (btcp->listeners [i].atcp)) ||
+                  !nn_timer_isidle (&btcp->listeners [i].timer))
+                return;
+        for (i = 0; i != btcp->nlisteners; ++i) {
+            if (btcp->listeners [i].atcp) {
+                nn_atcp_term (btcp->listeners [i].atcp);
+                nn_free (btcp->listeners [i].atcp);
+                btcp->listeners [i].atcp = NULL;
+            }
+            nn_usock_stop (&btcp->listeners [i].usock);
+        }
         btcp->state = NN_BTCP_STATE_STOPPING_USOCK;
     }
     if (nn_slow (btcp->state == NN_BTCP_STATE_STOPPING_USOCK)) {
-       if (!nn_usock_isidle (&btcp->usock))
-            return;
+        for (i = 0; i != btcp->nlisteners; ++i)
+            if (!nn_usock_isidle (&btcp->listeners [i].usock))
+                return;
         for (it = nn_list_begin (&btcp->atcps);
               it != nn_list_end (&btcp->atcps);
               it = nn_list_next (&btcp->atcps, it)) {
@@ -255,6 +351,8 @@ static void nn_btcp_handler (struct nn_fsm *self, int src, int type,
 {
     struct nn_btcp *btcp;
     struct nn_atcp *atcp;
+    struct nn_btcp_listener *listener;
+    int i;
 
     btcp = nn_cont (self, struct nn_btcp, fsm);
 
@@ -276,6 +374,9 @@ static void nn_btcp_handler (struct nn_fsm *self, int src, int type,
     case NN_BTCP_STATE_ACTIVE:
         if (src == NN_BTCP_SRC_BTCP) {   
             nn_assert (type == NN_BTCP_TYPE_LISTEN_ERR);
+            for (i = 0; i != btcp->nlisteners; ++i)
+                nn_timer_term (&btcp->listeners [i].timer);
+            nn_free (btcp->listeners);
             nn_free (btcp);
             return;
         }
@@ -286,18 +387,47 @@ static void nn_btcp_handler (struct nn_fsm *self, int src, int type,
             return;
         }
 
+        if (src == NN_BTCP_SRC_TIMER) {
+            listener = nn_cont (srcptr, struct nn_btcp_listener, timer);
+            switch (type) {
+            case NN_TIMER_TIMEOUT:
+                nn_timer_stop (&listener->timer);
+                return;
+            case NN_TIMER_STOPPED:
+                listener->accepted = 0;
+                nn_btcp_resume_accepting (btcp, listener);
+                return;
+            default:
+                nn_fsm_bad_action (btcp->state, src, type);
+            }
+        }
+
         /*  All other events come from child atcp objects. */
         nn_assert (src == NN_BTCP_SRC_ATCP);
         atcp = (struct nn_atcp*) srcptr;
         switch (type) {
         case NN_ATCP_ACCEPTED:
-            nn_assert (btcp->atcp == atcp) ;
+            for (i = 0; btcp->listeners [i].atcp != atcp; ++i)
+                nn_assert (i + 1 < btcp->nlisteners);
+            listener = &btcp->listeners [i];
             nn_list_insert (&btcp->atcps, &atcp->item,
                 nn_list_end (&btcp->atcps));
-            btcp->atcp = NULL;
-            nn_btcp_start_accepting (btcp);
+            listener->atcp = NULL;
+
+            /*  After a batch of connections, give the worker thread a chance
+                to handle the established ones before accepting more. */
+            if (++listener->accepted >= NN_BTCP_ACCEPT_BATCH) {
+                nn_timer_start (&listener->timer, 0);
+                return;
+            }
+            nn_btcp_resume_accepting (btcp, listener);
+            return;
+        case NN_ATCP_ESTABLISHED:
+            nn_btcp_handshake_done (btcp);
             return;
         case NN_ATCP_ERROR:
+            if (!atcp->established)
+                nn_btcp_handshake_done (btcp);
             nn_atcp_stop (atcp);
             return;
         case NN_ATCP_STOPPED:
@@ -328,6 +458,11 @@ static int nn_btcp_listen (struct nn_btcp *self)
     const char *end;
     const char *pos;
     uint16_t port;
+    struct nn_usock *usock;
+#if defined SO_REUSEPORT
+    int opt;
+#endif
+    int i;
 
     /*  First, resolve the IP address. */
     addr = nn_ep_getaddr (self->ep);
@@ -370,40 +505,100 @@ static int nn_btcp_listen (struct nn_btcp *self)
     }
 
     /*  Start listening for incoming connections. */
-    rc = nn_usock_start (&self->usock, ss.ss_family, SOCK_STREAM, 0);
-    if (rc < 0) {
-        return rc;
-    }
-
-    rc = nn_usock_bind (&self->usock, (struct sockaddr*) &ss, (size_t) sslen);
-    if (rc < 0) {
-       nn_usock_stop (&self->usock);
-       return rc;
+    for (i = 0; i != self->nlisteners; ++i) {
+        usock = &self->listeners [i].usock;
+        rc = nn_usock_start (usock, ss.ss_family, SOCK_STREAM, 0);
+        if (rc < 0)
+            goto fail;
+#if defined SO_REUSEPORT
+        if (self->nlisteners > 1) {
+            opt = 1;
+            rc = nn_usock_setsockopt (usock, SOL_SOCKET, SO_REUSEPORT,
+                &opt, sizeof (opt));
+            if (rc < 0) {
+                nn_usock_stop (usock);
+                goto fail;
+            }
+        }
+#endif
+        rc = nn_usock_bind (usock, (struct sockaddr*) &ss, (size_t) sslen);
+        if (rc < 0) {
+            nn_usock_stop (usock);
+            goto fail;
+        }
+        rc = nn_usock_listen (usock, NN_BTCP_BACKLOG);
+        if (rc < 0) {
+            nn_usock_stop (usock);
+            goto fail;
+        }
     }
 
-    rc = nn_usock_listen (&self->usock, NN_BTCP_BACKLOG);
-    if (rc < 0) {
-        nn_usock_stop (&self->usock);
-        return rc;
-    }
-    nn_btcp_start_accepting(self);
+    /*  Accept on all the listeners only once they are all in place. */
+    for (i = 0; i != self->nlisteners; ++i)
+        nn_btcp_resume_accepting (self, &self->listeners [i]);
 
     return 0;
+
+fail:
+    while (i--)
+        nn_usock_stop (&self->listeners [i].usock);
+    return rc;
 }
 
 /******************************************************************************/
 /*  State machine actions.                                                    */
 /******************************************************************************/
 
-static void nn_btcp_start_accepting (struct nn_btcp *self)
+static void nn_btcp_start_accepting (struct nn_btcp *self,
+    struct nn_btcp_listener *listener)
 {
-    nn_assert (self->atcp == NULL);
+    nn_assert (listener->atcp == NULL);
+
+    /*  Reserve a handshake slot for the connection to be accepted. */
+    ++self->handshakes;
 
     /*  Allocate new atcp state machine. */
-    self->atcp = nn_alloc (sizeof (struct nn_atcp), "atcp");
-    alloc_assert (self->atcp);
-    nn_atcp_init (self->atcp, NN_BTCP_SRC_ATCP, self->ep, &self->fsm);
+    listener->atcp = nn_alloc (sizeof (struct nn_atcp), "atcp");
+    alloc_assert (listener->atcp);
+    nn_atcp_init (listener->atcp, NN_BTCP_SRC_ATCP, self->ep, &self->fsm);
 
     /*  Start waiting for a new incoming connection. */
-    nn_atcp_start (self->atcp, &self->usock);
+    nn_atcp_start (listener->atcp, &listener->usock);
+}
+
+static void nn_btcp_resume_accepting (struct nn_btcp *self,
+    struct nn_btcp_listener *listener)
+{
+    /*  If there are too many connections in the middle of the protocol header
+        exchange, accept no more until some of them are done with it. */
+    if (self->max_handshakes > 0 &&
+          self->handshakes >= self->max_handshakes) {
+        nn_ep_stat_increment (self->ep, NN_STAT_ACCEPT_PAUSES, 1);
+        return;
+    }
+
+    nn_btcp_start_accepting (self, listener);
+}
+
+static void nn_btcp_handshake_done (struct nn_btcp *self)
+{
+    int i;
+    int j;
+
+    nn_assert (self->handshakes > 0);
+    --self->handshakes;
+
+    /*  Resume accepting on a listener that was deferred, if any. A listener
+        that is yielding will resume once its timer fires. Start the search
+        after the listener resumed last time, so that the same listener is
+        not always preferred. */
+    for (i = 0; i != self->nlisteners; ++i) {
+        j = (self->resume + i) % self->nlisteners;
+        if (self->listeners [j].atcp == NULL &&
+              nn_timer_isidle (&self->listeners [j].timer)) {
+            self->resume = (j + 1) % self->nlisteners;
+            nn_btcp_start_accepting (self, &self->listeners [j]);
+            return;
+        }
+    }
 }
@@ -28,6 +28,10 @@
 
 /*  State machine managing bound TCP socket. */
 
+/*  Maximum number of listening sockets per bound endpoint, see
+    NN_TCP_LISTENERS option. */
+#define NN_BTCP_MAX_LISTENERS 64
+
 int nn_btcp_create (struct nn_ep *);
 
 #endif
@@ -377,6 +377,8 @@ static void nn_ctcp_handler (struct nn_fsm *self, int src, int type,
 
         case NN_CTCP_SRC_STCP:
             switch (type) {
+            case NN_STCP_ESTABLISHED:
+                return;
             case NN_STCP_ERROR:
                 nn_stcp_stop (&ctcp->stcp);
                 ctcp->state = NN_CTCP_STATE_STOPPING_STCP;
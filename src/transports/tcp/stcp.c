@@ -29,6 +29,17 @@
 #include "../../utils/wire.h"
 #include "../../utils/attr.h"
 
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined NN_HAVE_WINDOWS
+#include "../../utils/win.h"
+#else
+#include <sys/socket.h>
+#include <netdb.h>
+#endif
+
 /*  States of the object as a whole. */
 #define NN_STCP_STATE_IDLE 1
 #define NN_STCP_STATE_PROTOHDR 2
@@ -43,6 +54,9 @@
 #define NN_STCP_INSTATE_BODY 2
 #define NN_STCP_INSTATE_HASMSG 3
 
+/*  Flag in the message header marking a credit grant. */
+#define NN_STCP_CREDIT 0x8000000000000000ULL
+
 /*  Possible states of the outbound part of the object. */
 #define NN_STCP_OUTSTATE_IDLE 1
 #define NN_STCP_OUTSTATE_SENDING 2
@@ -64,6 +78,15 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
     void *srcptr);
 static void nn_stcp_shutdown (struct nn_fsm *self, int src, int type,
     void *srcptr);
+static void nn_stcp_setpeer (struct nn_stcp *self);
+static void nn_stcp_recvhdr (struct nn_stcp *self);
+static void nn_stcp_sendframe (struct nn_stcp *self);
+static void nn_stcp_inframe (struct nn_stcp *self);
+static void nn_stcp_sendmsg (struct nn_stcp *self);
+static int nn_stcp_cangrant (struct nn_stcp *self);
+static void nn_stcp_sendgrant (struct nn_stcp *self);
+static int nn_stcp_credit (struct nn_stcp *self, uint64_t credits);
+static void nn_stcp_unblock (struct nn_stcp *self);
 
 void nn_stcp_init (struct nn_stcp *self, int src,
     struct nn_ep *ep, struct nn_fsm *owner)
@@ -80,6 +103,15 @@ void nn_stcp_init (struct nn_stcp *self, int src,
     nn_msg_init (&self->inmsg, 0);
     self->outstate = -1;
     nn_msg_init (&self->outmsg, 0);
+    nn_lanes_init (&self->lanes, 0);
+    self->sndbuf = 0;
+    self->outblocked = 0;
+    self->credit = -1;
+    self->window = 0;
+    self->grant = 0;
+    self->granting = 0;
+    self->outpending = 0;
+    nn_fsm_event_init (&self->established);
     nn_fsm_event_init (&self->done);
 }
 
@@ -88,6 +120,8 @@ void nn_stcp_term (struct nn_stcp *self)
     nn_assert_state (self, NN_STCP_STATE_IDLE);
 
     nn_fsm_event_term (&self->done);
+    nn_fsm_event_term (&self->established);
+    nn_lanes_term (&self->lanes);
     nn_msg_term (&self->outmsg);
     nn_msg_term (&self->inmsg);
     nn_pipebase_term (&self->pipebase);
@@ -109,10 +143,39 @@ void nn_stcp_start (struct nn_stcp *self, struct nn_usock *usock)
     nn_usock_swap_owner (usock, &self->usock_owner);
     self->usock = usock;
 
+    nn_stcp_setpeer (self);
+
     /*  Launch the state machine. */
     nn_fsm_start (&self->fsm);
 }
 
+/*  Reports the actual address of the peer in pipe statistics, so that
+    individual connections accepted by a bound endpoint can be told apart. */
+static void nn_stcp_setpeer (struct nn_stcp *self)
+{
+    int rc;
+    struct sockaddr_storage ss;
+    size_t sslen;
+    char host [NN_SOCKADDR_MAX];
+    char serv [16];
+    char addr [NN_SOCKADDR_MAX + 1];
+
+    sslen = sizeof (ss);
+    rc = nn_usock_getpeer (self->usock, (struct sockaddr*) &ss, &sslen);
+    if (nn_slow (rc < 0))
+        return;
+    rc = getnameinfo ((struct sockaddr*) &ss, (socklen_t) sslen,
+        host, sizeof (host), serv, sizeof (serv),
+        NI_NUMERICHOST | NI_NUMERICSERV);
+    if (nn_slow (rc != 0))
+        return;
+    if (nn_slow (strlen (host) + strlen (serv) + 9 > NN_SOCKADDR_MAX))
+        return;
+    sprintf (addr, ss.ss_family == AF_INET6 ? "tcp://[%s]:%s" : "tcp://%s:%s",
+        host, serv);
+    nn_pipebase_setpeer (&self->pipebase, addr);
+}
+
 void nn_stcp_stop (struct nn_stcp *self)
 {
     nn_fsm_stop (&self->fsm);
@@ -121,35 +184,64 @@ void nn_stcp_stop (struct nn_stcp *self)
 static int nn_stcp_send (struct nn_pipebase *self, struct nn_msg *msg)
 {
     struct nn_stcp *stcp;
-    struct nn_iovec iov [3];
 
     stcp = nn_cont (self, struct nn_stcp, pipebase);
 
     nn_assert_state (stcp, NN_STCP_STATE_ACTIVE);
-    nn_assert (stcp->outstate == NN_STCP_OUTSTATE_IDLE);
+
+    /*  Each message sent uses up one credit. */
+    if (stcp->credit > 0)
+        --stcp->credit;
+
+    /*  With interleaving, the message is queued in its lane. The pipe keeps
+        accepting messages while there's room in the send buffer, so that
+        urgent messages can overtake large ones being sent. */
+    if (stcp->lanes.framesz) {
+        nn_lanes_push (&stcp->lanes, msg);
+        if (stcp->outstate == NN_STCP_OUTSTATE_IDLE)
+            nn_stcp_sendframe (stcp);
+        stcp->outblocked = 1;
+        nn_stcp_unblock (stcp);
+        return 0;
+    }
 
     /*  Move the message to the local storage. */
     nn_msg_term (&stcp->outmsg);
     nn_msg_mv (&stcp->outmsg, msg);
 
-    /*  Serialise the message header. */
-    nn_putll (stcp->outhdr, nn_chunkref_size (&stcp->outmsg.sphdr) +
-        nn_chunkref_size (&stcp->outmsg.body));
-
-    /*  Start async sending. */
-    iov [0].iov_base = stcp->outhdr;
-    iov [0].iov_len = sizeof (stcp->outhdr);
-    iov [1].iov_base = nn_chunkref_data (&stcp->outmsg.sphdr);
-    iov [1].iov_len = nn_chunkref_size (&stcp->outmsg.sphdr);
-    iov [2].iov_base = nn_chunkref_data (&stcp->outmsg.body);
-    iov [2].iov_len = nn_chunkref_size (&stcp->outmsg.body);
-    nn_usock_send (stcp->usock, iov, 3);
+    /*  If a credit grant is being sent, the message has to wait for it. */
+    if (stcp->outstate == NN_STCP_OUTSTATE_SENDING) {
+        nn_assert (stcp->granting);
+        stcp->outpending = 1;
+        return 0;
+    }
 
-    stcp->outstate = NN_STCP_OUTSTATE_SENDING;
+    nn_stcp_sendmsg (stcp);
 
     return 0;
 }
 
+/*  Starts sending the message stored in 'outmsg'. */
+static void nn_stcp_sendmsg (struct nn_stcp *self)
+{
+    struct nn_iovec iov [3];
+
+    /*  Serialise the message header. */
+    nn_putll (self->outhdr, nn_chunkref_size (&self->outmsg.sphdr) +
+        nn_chunkref_size (&self->outmsg.body));
+
+    /*  Start async sending. */
+    iov [0].iov_base = self->outhdr;
+    iov [0].iov_len = sizeof (self->outhdr);
+    iov [1].iov_base = nn_chunkref_data (&self->outmsg.sphdr);
+    iov [1].iov_len = nn_chunkref_size (&self->outmsg.sphdr);
+    iov [2].iov_base = nn_chunkref_data (&self->outmsg.body);
+    iov [2].iov_len = nn_chunkref_size (&self->outmsg.body);
+    nn_usock_send (self->usock, iov, 3);
+
+    self->outstate = NN_STCP_OUTSTATE_SENDING;
+}
+
 static int nn_stcp_recv (struct nn_pipebase *self, struct nn_msg *msg)
 {
     struct nn_stcp *stcp;
@@ -163,13 +255,141 @@ static int nn_stcp_recv (struct nn_pipebase *self, struct nn_msg *msg)
     nn_msg_mv (msg, &stcp->inmsg);
     nn_msg_init (&stcp->inmsg, 0);
 
-    /*  Start receiving new message. */
-    stcp->instate = NN_STCP_INSTATE_HDR;
-    nn_usock_recv (stcp->usock, stcp->inhdr, sizeof (stcp->inhdr), NULL);
+    /*  Once the peer's message was taken, the peer can send another one. */
+    if (stcp->window && (!stcp->lanes.framesz || stcp->lanes.inlast)) {
+        ++stcp->grant;
+        if (stcp->outstate == NN_STCP_OUTSTATE_IDLE && nn_stcp_cangrant (stcp)) {
+            if (stcp->lanes.framesz)
+                nn_stcp_sendframe (stcp);
+            else
+                nn_stcp_sendgrant (stcp);
+        }
+    }
+
+    /*  Carry on with the frame being received, or start receiving new
+        message. */
+    if (stcp->lanes.framesz)
+        nn_stcp_inframe (stcp);
+    else
+        nn_stcp_recvhdr (stcp);
+
+    return 0;
+}
+
+/*  Starts receiving the header of the next message, or of the next frame
+    if interleaving is used. */
+static void nn_stcp_recvhdr (struct nn_stcp *self)
+{
+    self->instate = NN_STCP_INSTATE_HDR;
+    if (self->lanes.framesz)
+        nn_usock_recv (self->usock, self->lanes.inhdr,
+            sizeof (self->lanes.inhdr), NULL);
+    else
+        nn_usock_recv (self->usock, self->inhdr, sizeof (self->inhdr), NULL);
+}
+
+/*  Starts sending the next frame from the lanes, if there is any. */
+static void nn_stcp_sendframe (struct nn_stcp *self)
+{
+    int iovcnt;
+    struct nn_iovec iov [3];
+
+    /*  Credit grants go ahead of any messages. */
+    if (nn_stcp_cangrant (self)) {
+        nn_stcp_sendgrant (self);
+        return;
+    }
+
+    iovcnt = nn_lanes_frame (&self->lanes, iov);
+    if (!iovcnt) {
+        self->outstate = NN_STCP_OUTSTATE_IDLE;
+        return;
+    }
+    nn_usock_send (self->usock, iov, iovcnt);
+    self->outstate = NN_STCP_OUTSTATE_SENDING;
+}
+
+/*  Returns 1 if there are enough credits to grant the peer. To keep
+    the overhead low, credits are granted in batches of half the receive
+    window. */
+static int nn_stcp_cangrant (struct nn_stcp *self)
+{
+    return self->grant > 0 && self->grant >= (self->window + 1) / 2;
+}
+
+/*  Grants the peer the credits accumulated since the last grant. */
+static void nn_stcp_sendgrant (struct nn_stcp *self)
+{
+    struct nn_iovec iov;
+
+    if (self->lanes.framesz) {
+        memset (self->granthdr, 0, sizeof (self->granthdr));
+        self->granthdr [1] = NN_LANES_FLAG_CREDIT;
+        nn_putll (self->granthdr + 8, self->grant);
+        iov.iov_len = NN_LANES_HDRLEN;
+    }
+    else {
+        nn_putll (self->granthdr, NN_STCP_CREDIT | self->grant);
+        iov.iov_len = 8;
+    }
+    iov.iov_base = self->granthdr;
+    nn_usock_send (self->usock, &iov, 1);
+    self->grant = 0;
+    self->granting = 1;
+    self->outstate = NN_STCP_OUTSTATE_SENDING;
+}
 
+/*  Handles the credits granted by the peer. The peer that didn't announce
+    it would grant credits is not supposed to send any. */
+static int nn_stcp_credit (struct nn_stcp *self, uint64_t credits)
+{
+    if (nn_slow (self->credit < 0 || credits > INT_MAX ||
+          self->credit > INT_MAX - (int) credits))
+        return -EPROTO;
+    self->credit += (int) credits;
+    nn_stcp_unblock (self);
+    nn_stcp_recvhdr (self);
     return 0;
 }
 
+/*  Accepts another message from the owner once the peer granted a credit
+    for it and there's room in the send buffer. */
+static void nn_stcp_unblock (struct nn_stcp *self)
+{
+    if (!self->outblocked || self->credit == 0)
+        return;
+    if (self->lanes.framesz && self->lanes.queued >= self->sndbuf)
+        return;
+    self->outblocked = 0;
+    nn_pipebase_sent (&self->pipebase);
+}
+
+/*  Carries on receiving the current frame. Once a message, or a part of it,
+    is complete, notifies the owner that it can receive it. */
+static void nn_stcp_inframe (struct nn_stcp *self)
+{
+    int rc;
+    void *buf;
+    size_t len;
+
+    rc = nn_lanes_next (&self->lanes, &self->inmsg, &buf, &len);
+    switch (rc) {
+    case NN_LANES_HDR:
+        nn_stcp_recvhdr (self);
+        return;
+    case NN_LANES_DATA:
+        self->instate = NN_STCP_INSTATE_BODY;
+        nn_usock_recv (self->usock, buf, len, NULL);
+        return;
+    case NN_LANES_MSG:
+        self->instate = NN_STCP_INSTATE_HASMSG;
+        nn_pipebase_received (&self->pipebase);
+        return;
+    default:
+        nn_assert (0);
+    }
+}
+
 static void nn_stcp_shutdown (struct nn_fsm *self, int src, int type,
     NN_UNUSED void *srcptr)
 {
@@ -184,6 +404,12 @@ static void nn_stcp_shutdown (struct nn_fsm *self, int src, int type,
     }
     if (nn_slow (stcp->state == NN_STCP_STATE_STOPPING)) {
         if (nn_streamhdr_isidle (&stcp->streamhdr)) {
+
+            /*  Drop the messages queued in the lanes. */
+            nn_lanes_term (&stcp->lanes);
+            nn_lanes_init (&stcp->lanes, 0);
+            stcp->outblocked = 0;
+
             nn_usock_swap_owner (stcp->usock, &stcp->usock_owner);
             stcp->usock = NULL;
             stcp->usock_owner.src = -1;
@@ -282,15 +508,54 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
                     return;
                  }
 
+                 /*  If both peers agreed, split messages into frames.
+                     Peers that use message parts only may not have
+                     NN_INTERLEAVE set; frames of the part size are used
+                     then. */
+                 if (stcp->streamhdr.features & NN_STREAMHDR_INTERLEAVE) {
+                     nn_pipebase_getopt (&stcp->pipebase, NN_SOL_SOCKET,
+                         NN_PARTSIZE, &opt, &opt_sz);
+                     if (stcp->streamhdr.features & NN_STREAMHDR_PARTS)
+                         stcp->lanes.partsz = (size_t) opt;
+                     stcp->lanes.framesz = (size_t) opt;
+                     nn_pipebase_getopt (&stcp->pipebase, NN_SOL_SOCKET,
+                         NN_INTERLEAVE, &opt, &opt_sz);
+                     if (opt > 0)
+                         stcp->lanes.framesz = (size_t) opt;
+                     nn_pipebase_getopt (&stcp->pipebase, NN_SOL_SOCKET,
+                         NN_SNDBUF, &opt, &opt_sz);
+                     stcp->sndbuf = (size_t) opt;
+                 }
+
+                 /*  If the peer limits the number of messages in flight,
+                     wait for its credits. The pipe starts as writable,
+                     which accounts for the first credit. Likewise, if we
+                     limit the peer, grant it the rest of the window. */
+                 stcp->credit = -1;
+                 stcp->window = 0;
+                 stcp->grant = 0;
+                 stcp->granting = 0;
+                 stcp->outpending = 0;
+                 if (stcp->streamhdr.peerfeatures & NN_STREAMHDR_GRANT)
+                     stcp->credit = 1;
+                 nn_pipebase_getopt (&stcp->pipebase, NN_SOL_SOCKET,
+                     NN_RCVCREDIT, &opt, &opt_sz);
+                 if (opt > 0) {
+                     stcp->window = opt;
+                     stcp->grant = opt - 1;
+                 }
+
                  /*  Start receiving a message in asynchronous manner. */
-                 stcp->instate = NN_STCP_INSTATE_HDR;
-                 nn_usock_recv (stcp->usock, &stcp->inhdr,
-                     sizeof (stcp->inhdr), NULL);
+                 nn_stcp_recvhdr (stcp);
 
                  /*  Mark the pipe as available for sending. */
                  stcp->outstate = NN_STCP_OUTSTATE_IDLE;
+                 if (nn_stcp_cangrant (stcp))
+                     nn_stcp_sendgrant (stcp);
 
                  stcp->state = NN_STCP_STATE_ACTIVE;
+                 nn_fsm_raise (&stcp->fsm, &stcp->established,
+                     NN_STCP_ESTABLISHED);
                  return;
 
             default:
@@ -311,12 +576,42 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
             switch (type) {
             case NN_USOCK_SENT:
 
-                /*  The message is now fully sent. */
+                /*  With interleaving, carry on with the next frame. Once
+                    there's room in the send buffer, accept more messages. */
+                if (stcp->lanes.framesz) {
+                    nn_assert (stcp->outstate == NN_STCP_OUTSTATE_SENDING);
+                    if (stcp->granting)
+                        stcp->granting = 0;
+                    else
+                        nn_lanes_sent (&stcp->lanes);
+                    nn_stcp_sendframe (stcp);
+                    nn_stcp_unblock (stcp);
+                    return;
+                }
+
+                /*  Credit grant was sent. Send the message that was waiting
+                    for it, if any. */
                 nn_assert (stcp->outstate == NN_STCP_OUTSTATE_SENDING);
                 stcp->outstate = NN_STCP_OUTSTATE_IDLE;
+                if (stcp->granting) {
+                    stcp->granting = 0;
+                    if (stcp->outpending) {
+                        stcp->outpending = 0;
+                        nn_stcp_sendmsg (stcp);
+                    }
+                    else if (nn_stcp_cangrant (stcp))
+                        nn_stcp_sendgrant (stcp);
+                    return;
+                }
+
+                /*  The message is now fully sent. Accept the next one once
+                    the peer allows it. */
                 nn_msg_term (&stcp->outmsg);
                 nn_msg_init (&stcp->outmsg, 0);
-                nn_pipebase_sent (&stcp->pipebase);
+                if (nn_stcp_cangrant (stcp))
+                    nn_stcp_sendgrant (stcp);
+                stcp->outblocked = 1;
+                nn_stcp_unblock (stcp);
                 return;
 
             case NN_USOCK_RECEIVED:
@@ -324,13 +619,45 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
                 switch (stcp->instate) {
                 case NN_STCP_INSTATE_HDR:
 
+                    nn_pipebase_getopt (&stcp->pipebase, NN_SOL_SOCKET,
+                        NN_RCVMAXSIZE, &opt, &opt_sz);
+
+                    /*  Frame header was received. Malformed frames and
+                        messages larger than NN_RCVMAXSIZE drop the
+                        connection. */
+                    if (stcp->lanes.framesz) {
+                        if (stcp->lanes.inhdr [1] & NN_LANES_FLAG_CREDIT)
+                            rc = nn_stcp_credit (stcp,
+                                nn_getll (stcp->lanes.inhdr + 8));
+                        else
+                            rc = nn_lanes_inframe (&stcp->lanes, opt);
+                        if (nn_slow (rc < 0)) {
+                            stcp->state = NN_STCP_STATE_DONE;
+                            nn_fsm_raise (&stcp->fsm, &stcp->done,
+                                NN_STCP_ERROR);
+                            return;
+                        }
+                        if (!(stcp->lanes.inhdr [1] & NN_LANES_FLAG_CREDIT))
+                            nn_stcp_inframe (stcp);
+                        return;
+                    }
+
                     /*  Message header was received. Check that message size
                         is acceptable by comparing with NN_RCVMAXSIZE;
                         if it's too large, drop the connection. */
                     size = nn_getll (stcp->inhdr);
 
-                    nn_pipebase_getopt (&stcp->pipebase, NN_SOL_SOCKET,
-                        NN_RCVMAXSIZE, &opt, &opt_sz);
+                    /*  Header with the most significant bit set carries
+                        credits granted by the peer instead. */
+                    if (size & NN_STCP_CREDIT) {
+                        rc = nn_stcp_credit (stcp, size & ~NN_STCP_CREDIT);
+                        if (nn_slow (rc < 0)) {
+                            stcp->state = NN_STCP_STATE_DONE;
+                            nn_fsm_raise (&stcp->fsm, &stcp->done,
+                                NN_STCP_ERROR);
+                        }
+                        return;
+                    }
 
                     if (opt >= 0 && size > (unsigned)opt) {
                         stcp->state = NN_STCP_STATE_DONE;
@@ -359,6 +686,13 @@ static void nn_stcp_handler (struct nn_fsm *self, int src, int type,
 
                 case NN_STCP_INSTATE_BODY:
 
+                    /*  Frame payload was received. If it completes
+                        a message, notify the owner. */
+                    if (stcp->lanes.framesz) {
+                        nn_stcp_inframe (stcp);
+                        return;
+                    }
+
                     /*  Message body was received. Notify the owner that it
                         can receive it. */
                     stcp->instate = NN_STCP_INSTATE_HASMSG;
@@ -48,6 +48,8 @@
 struct nn_tcp_optset {
     struct nn_optset base;
     int nodelay;
+    int listeners;
+    int max_handshakes;
 };
 
 static void nn_tcp_optset_destroy (struct nn_optset *self);
@@ -96,6 +98,8 @@ static struct nn_optset *nn_tcp_optset ()
 
     /*  Default values for TCP socket options. */
     optset->nodelay = 0;
+    optset->listeners = 1;
+    optset->max_handshakes = 0;
 
     return &optset->base;   
 }
@@ -127,6 +131,16 @@ static int nn_tcp_optset_setopt (struct nn_optset *self, int option,
             return -EINVAL;
         optset->nodelay = val;
         return 0;
+    case NN_TCP_LISTENERS:
+        if (nn_slow (val < 1 || val > NN_BTCP_MAX_LISTENERS))
+            return -EINVAL;
+        optset->listeners = val;
+        return 0;
+    case NN_TCP_MAX_HANDSHAKES:
+        if (nn_slow (val < 0))
+            return -EINVAL;
+        optset->max_handshakes = val;
+        return 0;
     default:
         return -ENOPROTOOPT;
     }
@@ -144,6 +158,12 @@ static int nn_tcp_optset_getopt (struct nn_optset *self, int option,
     case NN_TCP_NODELAY:
         intval = optset->nodelay;
         break;
+    case NN_TCP_LISTENERS:
+        intval = optset->listeners;
+        break;
+    case NN_TCP_MAX_HANDSHAKES:
+        intval = optset->max_handshakes;
+        break;
     default:
         return -ENOPROTOOPT;
     }
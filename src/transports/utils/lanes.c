@@ -0,0 +1,346 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "lanes.h"
+
+#include "../../utils/err.h"
+#include "../../utils/cont.h"
+#include "../../utils/fast.h"
+#include "../../utils/wire.h"
+#include "../../utils/alloc.h"
+
+#include <string.h>
+
+/*  Lane used for messages with no SP_PRIORITY specified. */
+#define NN_LANES_DEFAULT 8
+
+/*  Outbound message queued in a lane. */
+struct nn_lanes_item {
+    struct nn_list_item item;
+    struct nn_msg msg;
+    int lane;
+    int more;
+    size_t size;
+    size_t pos;
+};
+
+/*  Private functions. */
+static int nn_lanes_getprio (struct nn_msg *msg);
+static void nn_lanes_alloc (struct nn_lanes *self, int lane);
+
+void nn_lanes_init (struct nn_lanes *self, size_t framesz)
+{
+    int i;
+
+    self->framesz = framesz;
+    for (i = 0; i != NN_LANES_COUNT; ++i) {
+        nn_list_init (&self->out [i]);
+        nn_msg_init (&self->in [i], 0);
+        self->inpos [i] = 0;
+        self->inleft [i] = 0;
+    }
+    self->partsz = 0;
+    self->queued = 0;
+    self->outlock = -1;
+    self->outpart = -1;
+    self->sending = NULL;
+    self->sendlen = 0;
+    self->inbusy = 0;
+    self->inmore = 0;
+    self->inalloc = 0;
+    self->inlast = 0;
+    self->inlane = -1;
+    self->inframe = 0;
+    self->inlen = 0;
+}
+
+void nn_lanes_term (struct nn_lanes *self)
+{
+    int i;
+    struct nn_lanes_item *item;
+
+    for (i = 0; i != NN_LANES_COUNT; ++i) {
+        while (!nn_list_empty (&self->out [i])) {
+            item = nn_cont (nn_list_begin (&self->out [i]),
+                struct nn_lanes_item, item);
+            nn_list_erase (&self->out [i], &item->item);
+            nn_list_item_term (&item->item);
+            nn_msg_term (&item->msg);
+            nn_free (item);
+        }
+        nn_list_term (&self->out [i]);
+        nn_msg_term (&self->in [i]);
+    }
+}
+
+void nn_lanes_push (struct nn_lanes *self, struct nn_msg *msg)
+{
+    int lane;
+    struct nn_lanes_item *item;
+
+    /*  All the parts of a message go to the same lane. */
+    lane = self->outpart >= 0 ? self->outpart : nn_lanes_getprio (msg) - 1;
+
+    item = nn_alloc (sizeof (struct nn_lanes_item), "message (lanes)");
+    alloc_assert (item);
+    nn_list_item_init (&item->item);
+    item->more = nn_msg_more (msg);
+    nn_msg_mv (&item->msg, msg);
+    item->lane = lane;
+    self->outpart = item->more ? lane : -1;
+    item->size = nn_chunkref_size (&item->msg.sphdr) +
+        nn_chunkref_size (&item->msg.body);
+    item->pos = 0;
+    nn_list_insert (&self->out [lane], &item->item,
+        nn_list_end (&self->out [lane]));
+    self->queued += item->size;
+}
+
+int nn_lanes_frame (struct nn_lanes *self, struct nn_iovec *iov)
+{
+    int lane;
+    struct nn_lanes_item *item;
+    size_t hdrsz;
+    size_t pos;
+    size_t len;
+
+    nn_assert (self->sending == NULL);
+
+    /*  Frames of the highest priority message go first, unless the message
+        being sent can't be interrupted. */
+    if (self->outlock >= 0) {
+        lane = self->outlock;
+        if (nn_list_empty (&self->out [lane]))
+            return 0;
+    }
+    else {
+        for (lane = 0; lane != NN_LANES_COUNT; ++lane)
+            if (!nn_list_empty (&self->out [lane]))
+                break;
+        if (lane == NN_LANES_COUNT)
+            return 0;
+    }
+    item = nn_cont (nn_list_begin (&self->out [lane]),
+        struct nn_lanes_item, item);
+
+    /*  Compose the frame header. */
+    len = item->size - item->pos;
+    if (len > self->framesz)
+        len = self->framesz;
+    self->outhdr [0] = (uint8_t) lane;
+    self->outhdr [1] = (item->pos == 0 ? NN_LANES_FLAG_FIRST : 0) |
+        (item->more ? NN_LANES_FLAG_MORE : 0);
+    self->outhdr [2] = 0;
+    self->outhdr [3] = 0;
+    nn_putl (self->outhdr + 4, (uint32_t) len);
+    nn_putll (self->outhdr + 8, item->size);
+    self->sending = item;
+    self->sendlen = len;
+    if (item->pos == 0)
+        self->queued -= item->size;
+    iov [0].iov_base = self->outhdr;
+    iov [0].iov_len = sizeof (self->outhdr);
+
+    /*  The payload is the part of the message header and body that
+        falls into the frame. */
+    hdrsz = nn_chunkref_size (&item->msg.sphdr);
+    pos = item->pos;
+    if (pos < hdrsz) {
+        iov [1].iov_base = ((uint8_t*) nn_chunkref_data (&item->msg.sphdr)) +
+            pos;
+        iov [1].iov_len = len < hdrsz - pos ? len : hdrsz - pos;
+        pos += iov [1].iov_len;
+        len -= iov [1].iov_len;
+    }
+    else {
+        iov [1].iov_base = NULL;
+        iov [1].iov_len = 0;
+    }
+    iov [2].iov_base = ((uint8_t*) nn_chunkref_data (&item->msg.body)) +
+        (pos - hdrsz);
+    iov [2].iov_len = len;
+
+    return 3;
+}
+
+void nn_lanes_sent (struct nn_lanes *self)
+{
+    struct nn_lanes_item *item;
+
+    item = self->sending;
+    nn_assert (item);
+    self->sending = NULL;
+
+    item->pos += self->sendlen;
+    if (item->pos < item->size) {
+        if (self->partsz)
+            self->outlock = item->lane;
+        return;
+    }
+
+    /*  The message is fully sent. If it's followed by further parts, other
+        lanes have to wait for them. */
+    self->outlock = item->more ? item->lane : -1;
+    nn_list_erase (&self->out [item->lane], &item->item);
+    nn_list_item_term (&item->item);
+    nn_msg_term (&item->msg);
+    nn_free (item);
+}
+
+int nn_lanes_inframe (struct nn_lanes *self, int maxsize)
+{
+    int lane;
+    size_t framelen;
+    uint64_t size;
+
+    nn_assert (self->inlane < 0);
+
+    lane = self->inhdr [0];
+    framelen = nn_getl (self->inhdr + 4);
+    size = nn_getll (self->inhdr + 8);
+    if (nn_slow (lane >= NN_LANES_COUNT))
+        return -EPROTO;
+
+    if (self->inhdr [1] & NN_LANES_FLAG_FIRST) {
+
+        /*  Previous message in the lane have to be complete. */
+        if (nn_slow (self->inbusy & (1 << lane)))
+            return -EPROTO;
+        if (nn_slow (!self->partsz && maxsize >= 0 &&
+              size > (unsigned) maxsize))
+            return -EMSGSIZE;
+        self->inleft [lane] = size;
+        self->inbusy |= 1 << lane;
+        if (self->inhdr [1] & NN_LANES_FLAG_MORE)
+            self->inmore |= 1 << lane;
+        else
+            self->inmore &= ~(1 << lane);
+        nn_lanes_alloc (self, lane);
+    }
+    else if (nn_slow (!(self->inbusy & (1 << lane))))
+        return -EPROTO;
+
+    if (nn_slow (framelen > self->inleft [lane]))
+        return -EPROTO;
+
+    self->inlane = lane;
+    self->inframe = framelen;
+    self->inlen = 0;
+
+    return 0;
+}
+
+int nn_lanes_next (struct nn_lanes *self, struct nn_msg *msg, void **buf,
+    size_t *len)
+{
+    int lane;
+    size_t size;
+
+    lane = self->inlane;
+    nn_assert (lane >= 0);
+
+    /*  Account for the data received so far. */
+    self->inpos [lane] += self->inlen;
+    self->inframe -= self->inlen;
+    self->inleft [lane] -= self->inlen;
+    self->inlen = 0;
+
+    /*  If the buffer is full, hand it to the user. If there's more of
+        the message to come, mark it as a part followed by further parts. */
+    if (self->inalloc & (1 << lane) &&
+          self->inpos [lane] == nn_chunkref_size (&self->in [lane].body)) {
+        nn_msg_term (msg);
+        nn_msg_mv (msg, &self->in [lane]);
+        nn_msg_init (&self->in [lane], 0);
+        self->inalloc &= ~(1 << lane);
+        if (self->inleft [lane] || self->inmore & (1 << lane))
+            nn_msg_setmore (msg);
+        self->inlast = !self->inleft [lane];
+        if (self->inlast)
+            self->inbusy &= ~(1 << lane);
+        return NN_LANES_MSG;
+    }
+
+    if (!self->inframe) {
+        self->inlane = -1;
+        return NN_LANES_HDR;
+    }
+
+    /*  Receive as much of the frame as fits into the buffer. */
+    if (!(self->inalloc & (1 << lane)))
+        nn_lanes_alloc (self, lane);
+    size = nn_chunkref_size (&self->in [lane].body) - self->inpos [lane];
+    if (size > self->inframe)
+        size = self->inframe;
+    *buf = ((uint8_t*) nn_chunkref_data (&self->in [lane].body)) +
+        self->inpos [lane];
+    *len = size;
+    self->inlen = size;
+
+    return NN_LANES_DATA;
+}
+
+/*  Allocates the buffer for the rest of the message received in the lane,
+    or for its next part. */
+static void nn_lanes_alloc (struct nn_lanes *self, int lane)
+{
+    uint64_t size;
+
+    size = self->inleft [lane];
+    if (self->partsz && size > self->partsz)
+        size = self->partsz;
+    nn_msg_term (&self->in [lane]);
+    nn_msg_init (&self->in [lane], (size_t) size);
+    self->inpos [lane] = 0;
+    self->inalloc |= 1 << lane;
+}
+
+static int nn_lanes_getprio (struct nn_msg *msg)
+{
+    struct nn_msghdr msghdr;
+    struct nn_cmsghdr *cmsg;
+    int prio;
+
+    msghdr.msg_iov = NULL;
+    msghdr.msg_iovlen = 0;
+    msghdr.msg_controllen = nn_chunkref_size (&msg->hdrs);
+    if (msghdr.msg_controllen == 0)
+        return NN_LANES_DEFAULT;
+    msghdr.msg_control = nn_chunkref_data (&msg->hdrs);
+
+    cmsg = NN_CMSG_FIRSTHDR (&msghdr);
+    while (cmsg && cmsg->cmsg_len >= NN_CMSG_LEN (0)) {
+        if (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_PRIORITY &&
+              cmsg->cmsg_len == NN_CMSG_LEN (sizeof (int))) {
+            memcpy (&prio, NN_CMSG_DATA (cmsg), sizeof (prio));
+            if (prio < 1)
+                return 1;
+            if (prio > NN_LANES_COUNT)
+                return NN_LANES_COUNT;
+            return prio;
+        }
+        cmsg = NN_CMSG_NXTHDR (&msghdr, cmsg);
+    }
+
+    return NN_LANES_DEFAULT;
+}
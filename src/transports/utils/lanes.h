@@ -0,0 +1,163 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#ifndef NN_LANES_INCLUDED
+#define NN_LANES_INCLUDED
+
+#include "../../nn.h"
+
+#include "../../utils/list.h"
+#include "../../utils/msg.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  Splits messages sent over a stream-based connection into frames and
+    interleaves frames of messages of different priorities, so that urgent
+    messages don't have to wait for a large message to be fully sent.
+    There's one lane per message priority as set by SP_PRIORITY ancillary
+    data, with priority 1 being the highest. Messages within a lane are
+    sent in order.
+
+    Each frame consists of a 16-byte header followed by at most 'framesz'
+    bytes of the message. The header contains the lane number (1 byte),
+    flags (1 byte), two reserved bytes, size of the frame payload (4 bytes)
+    and the size of the whole message (8 bytes). The first frame of each
+    message has NN_LANES_FLAG_FIRST set. All the frames of a message that is
+    a part of a larger message and is followed by further parts (it was
+    sent with SP_MORE ancillary data) have NN_LANES_FLAG_MORE set. Parts of
+    a message are always sent in the same lane and frames of other lanes
+    are held back until the last part was sent.
+
+    If both peers use message parts, 'partsz' is set. Incoming messages are
+    then received and handed to the user in parts of at most 'partsz' bytes
+    each, rather than being reassembled in full. To keep the parts of
+    a message together, the frames of the message being sent are not
+    interleaved with frames of other messages. */
+
+#define NN_LANES_COUNT 16
+#define NN_LANES_HDRLEN 16
+#define NN_LANES_FLAG_FIRST 1
+#define NN_LANES_FLAG_MORE 2
+
+/*  Header with this flag set is not followed by any payload. It carries
+    the number of credits granted to the peer in the message size field. */
+#define NN_LANES_FLAG_CREDIT 4
+
+/*  Return values of nn_lanes_next. */
+#define NN_LANES_HDR 0
+#define NN_LANES_DATA 1
+#define NN_LANES_MSG 2
+
+struct nn_lanes {
+
+    /*  Maximum size of the frame payload. Zero if the connection doesn't
+        use frames at all. */
+    size_t framesz;
+
+    /*  Maximum size of the message parts handed to the user. Zero if
+        messages are delivered in full. */
+    size_t partsz;
+
+    /*  Outbound messages queued in each of the lanes. */
+    struct nn_list out [NN_LANES_COUNT];
+
+    /*  Total size of the queued messages that haven't started being sent
+        yet, in bytes. */
+    size_t queued;
+
+    /*  Lane the next frame has to be taken from, -1 if any lane will do. */
+    int outlock;
+
+    /*  Lane of the message whose parts are being queued, -1 if the last
+        message queued was complete. */
+    int outpart;
+
+    /*  Message the frame being sent at the moment belongs to, and the size
+        of the frame payload. */
+    struct nn_lanes_item *sending;
+    size_t sendlen;
+
+    /*  Buffer used to store the header of the outgoing frame. */
+    uint8_t outhdr [NN_LANES_HDRLEN];
+
+    /*  Buffer used to store the header of the incoming frame. */
+    uint8_t inhdr [NN_LANES_HDRLEN];
+
+    /*  Inbound messages (or parts of them) being reassembled in each of the
+        lanes, number of bytes already received into them and number of
+        bytes of the message yet to arrive. */
+    struct nn_msg in [NN_LANES_COUNT];
+    size_t inpos [NN_LANES_COUNT];
+    uint64_t inleft [NN_LANES_COUNT];
+
+    /*  Set if the last buffer handed to the user completed the message
+        sent by the peer. */
+    int inlast;
+
+    /*  Bitmaps of lanes with a message being received, of lanes where
+        the message is followed by further parts and of lanes with a buffer
+        allocated in 'in'. */
+    uint32_t inbusy;
+    uint32_t inmore;
+    uint32_t inalloc;
+
+    /*  Lane of the frame being received at the moment, number of payload
+        bytes of the frame yet to be received and size of the chunk of
+        the payload being received. */
+    int inlane;
+    size_t inframe;
+    size_t inlen;
+};
+
+void nn_lanes_init (struct nn_lanes *self, size_t framesz);
+void nn_lanes_term (struct nn_lanes *self);
+
+/*  Queues the message for sending. The message is moved to the lane
+    according to its priority. */
+void nn_lanes_push (struct nn_lanes *self, struct nn_msg *msg);
+
+/*  Fills in the header and the payload of the next frame to send. Returns
+    the number of elements of 'iov' used, at most 3. Returns 0 if there's
+    nothing to send. */
+int nn_lanes_frame (struct nn_lanes *self, struct nn_iovec *iov);
+
+/*  Called once the frame returned by nn_lanes_frame was fully sent. */
+void nn_lanes_sent (struct nn_lanes *self);
+
+/*  Parses the header of an incoming frame stored in 'inhdr'. Returns -EPROTO
+    if the frame is malformed and -EMSGSIZE if the message is larger than
+    'maxsize'. Negative 'maxsize' means no limit. The limit doesn't apply
+    when messages are delivered in parts. */
+int nn_lanes_inframe (struct nn_lanes *self, int maxsize);
+
+/*  Advances the processing of the incoming frame. Called once the frame
+    header was parsed, once the data asked for was received and once the
+    message returned was taken by the user. Returns NN_LANES_DATA if 'len'
+    bytes have to be received into 'buf', NN_LANES_MSG if a message (or
+    a part of it) was moved to 'msg' and NN_LANES_HDR if the frame is done
+    and the header of the next one should be received. */
+int nn_lanes_next (struct nn_lanes *self, struct nn_msg *msg, void **buf,
+    size_t *len);
+
+#endif
@@ -22,6 +22,7 @@
 */
 
 #include "streamhdr.h"
+#include "../../bus.h"
 
 #include "../../aio/timer.h"
 
@@ -64,6 +65,8 @@ void nn_streamhdr_init (struct nn_streamhdr *self, int src,
     self->usock_owner.src = -1;
     self->usock_owner.fsm = NULL;
     self->pipebase = NULL;
+    self->features = 0;
+    self->peerfeatures = 0;
 }
 
 void nn_streamhdr_term (struct nn_streamhdr *self)
@@ -85,6 +88,10 @@ void nn_streamhdr_start (struct nn_streamhdr *self, struct nn_usock *usock,
 {
     size_t sz;
     int protocol;
+    int interleave;
+    int partsize;
+    int rcvcredit;
+    int dedup;
 
     /*  Take ownership of the underlying socket. */
     nn_assert (self->usock == NULL && self->usock_owner.fsm == NULL);
@@ -99,9 +106,41 @@ void nn_streamhdr_start (struct nn_streamhdr *self, struct nn_usock *usock,
     nn_pipebase_getopt (pipebase, NN_SOL_SOCKET, NN_PROTOCOL, &protocol, &sz);
     nn_assert (sz == sizeof (protocol));
 
-    /*  Compose the protocol header. */
+    /*  Find out which optional features to offer. */
+    self->features = 0;
+    self->peerfeatures = 0;
+    sz = sizeof (interleave);
+    nn_pipebase_getopt (pipebase, NN_SOL_SOCKET, NN_INTERLEAVE,
+        &interleave, &sz);
+    nn_assert (sz == sizeof (interleave));
+    sz = sizeof (partsize);
+    nn_pipebase_getopt (pipebase, NN_SOL_SOCKET, NN_PARTSIZE,
+        &partsize, &sz);
+    nn_assert (sz == sizeof (partsize));
+    if (interleave > 0 || partsize > 0)
+        self->features |= NN_STREAMHDR_INTERLEAVE;
+    if (partsize > 0)
+        self->features |= NN_STREAMHDR_PARTS;
+    sz = sizeof (rcvcredit);
+    nn_pipebase_getopt (pipebase, NN_SOL_SOCKET, NN_RCVCREDIT,
+        &rcvcredit, &sz);
+    nn_assert (sz == sizeof (rcvcredit));
+    if (rcvcredit > 0)
+        self->features |= NN_STREAMHDR_CREDIT | NN_STREAMHDR_GRANT;
+    if (protocol == NN_BUS) {
+        sz = sizeof (dedup);
+        nn_pipebase_getopt (pipebase, NN_BUS, NN_BUS_DEDUP, &dedup, &sz);
+        nn_assert (sz == sizeof (dedup));
+        if (dedup > 0)
+            self->features |= NN_STREAMHDR_MSGID;
+    }
+
+    /*  Compose the protocol header. The features are advertised in the
+        first of the reserved bytes, which stays zero unless some feature
+        was explicitly enabled. Peers not aware of them send zero. */
     memcpy (self->protohdr, "\0SP\0\0\0\0\0", 8);
     nn_puts (self->protohdr + 4, (uint16_t) protocol);
+    self->protohdr [6] = (uint8_t) self->features;
 
     /*  Launch the state machine. */
     nn_fsm_start (&self->fsm);
@@ -224,6 +263,11 @@ static void nn_streamhdr_handler (struct nn_fsm *self, int src, int type,
                 protocol = nn_gets (streamhdr->protohdr + 4);
                 if (!nn_pipebase_ispeer (streamhdr->pipebase, protocol))
                     goto invalidhdr;
+                streamhdr->peerfeatures = streamhdr->protohdr [6];
+                if ((streamhdr->features ^ streamhdr->peerfeatures) &
+                      NN_STREAMHDR_MSGID)
+                    goto invalidhdr;
+                streamhdr->features &= streamhdr->peerfeatures;
                 nn_timer_stop (&streamhdr->timer);
                 streamhdr->state = NN_STREAMHDR_STATE_STOPPING_TIMER_DONE;
                 return;
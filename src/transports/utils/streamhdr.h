@@ -36,6 +36,25 @@
 #define NN_STREAMHDR_ERROR 2
 #define NN_STREAMHDR_STOPPED 3
 
+/*  Optional features negotiated during the header exchange. A feature is
+    used on the connection only if both peers support it. */
+#define NN_STREAMHDR_INTERLEAVE 1
+#define NN_STREAMHDR_PARTS 2
+
+/*  Credit-based flow control. The peer that limits the number of messages
+    in flight towards it (NN_RCVCREDIT) offers both NN_STREAMHDR_CREDIT,
+    meaning it understands credit frames, and NN_STREAMHDR_GRANT, meaning
+    it will send them. The other peer then sends only as many messages as
+    it was granted credits. Sockets without the limit offer neither, so
+    that the reserved byte stays zero for other SP implementations. */
+#define NN_STREAMHDR_CREDIT 4
+#define NN_STREAMHDR_GRANT 8
+
+/*  BUS messages are prefixed with a message ID (NN_BUS_DEDUP). Unlike the
+    features above this one is not optional: both peers have to either
+    offer it or not, otherwise the connection is rejected. */
+#define NN_STREAMHDR_MSGID 16
+
 struct nn_streamhdr {
 
     /*  The state machine. */
@@ -57,6 +76,13 @@ struct nn_streamhdr {
     /*  Protocol header. */
     uint8_t protohdr [8];
 
+    /*  Features offered to the peer. Once the header exchange is done,
+        features supported by both peers. */
+    int features;
+
+    /*  Features offered by the peer. */
+    int peerfeatures;
+
     /*  Event fired when the state machine ends. */
     struct nn_fsm_event done;
 };
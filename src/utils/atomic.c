@@ -83,3 +83,78 @@ uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n)
 #endif
 }
 
+uint32_t nn_atomic_load (struct nn_atomic *self)
+{
+#if defined NN_ATOMIC_WINAPI
+    return (uint32_t) InterlockedCompareExchange ((LONG*) &self->n, 0, 0);
+#elif defined NN_ATOMIC_SOLARIS
+    uint32_t res;
+    res = self->n;
+    membar_consumer ();
+    return res;
+#elif defined NN_ATOMIC_GCC_BUILTINS
+#if defined __ATOMIC_ACQUIRE
+    return __atomic_load_n (&self->n, __ATOMIC_ACQUIRE);
+#else
+    return (uint32_t) __sync_fetch_and_add (&self->n, 0);
+#endif
+#elif defined NN_ATOMIC_MUTEX
+    uint32_t res;
+    nn_mutex_lock (&self->sync);
+    res = self->n;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
+
+void nn_atomic_ptr_init (struct nn_atomic_ptr *self, void *p)
+{
+    self->p = p;
+#if defined NN_ATOMIC_MUTEX
+    nn_mutex_init (&self->sync);
+#endif
+}
+
+#if defined NN_ATOMIC_MUTEX
+void nn_atomic_ptr_term (struct nn_atomic_ptr *self)
+{
+    nn_mutex_term (&self->sync);
+}
+#else
+void nn_atomic_ptr_term (NN_UNUSED struct nn_atomic_ptr *self)
+{
+}
+#endif
+
+void *nn_atomic_ptr_swap (struct nn_atomic_ptr *self, void *p)
+{
+#if defined NN_ATOMIC_WINAPI
+    return InterlockedExchangePointer ((PVOID volatile*) &self->p, p);
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_swap_ptr (&self->p, p);
+#elif defined NN_ATOMIC_GCC_BUILTINS
+    void *old;
+
+    /*  __sync_lock_test_and_set is only an acquire barrier, so use
+        compare-and-swap which is a full barrier. */
+    do {
+#if defined __ATOMIC_RELAXED
+        old = __atomic_load_n (&self->p, __ATOMIC_RELAXED);
+#else
+        old = self->p;
+#endif
+    } while (!__sync_bool_compare_and_swap (&self->p, old, p));
+    return old;
+#elif defined NN_ATOMIC_MUTEX
+    void *res;
+    nn_mutex_lock (&self->sync);
+    res = self->p;
+    self->p = p;
+    nn_mutex_unlock (&self->sync);
+    return res;
+#else
+#error
+#endif
+}
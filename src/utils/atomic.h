@@ -45,6 +45,13 @@ struct nn_atomic {
     volatile uint32_t n;
 };
 
+struct nn_atomic_ptr {
+#if defined NN_ATOMIC_MUTEX
+    struct nn_mutex sync;
+#endif
+    void *volatile p;
+};
+
 /*  Initialise the object. Set it to value 'n'. */
 void nn_atomic_init (struct nn_atomic *self, uint32_t n);
 
@@ -57,5 +64,20 @@ uint32_t nn_atomic_inc (struct nn_atomic *self, uint32_t n);
 /*  Atomically subtract n from the object, return old value of the object. */
 uint32_t nn_atomic_dec (struct nn_atomic *self, uint32_t n);
 
+/*  Atomically read the value of the object. Acts as an acquire barrier, i.e.
+    whatever was written before the value was stored by another thread is
+    visible once the value is read. */
+uint32_t nn_atomic_load (struct nn_atomic *self);
+
+/*  Initialise the atomic pointer. Set it to value 'p'. */
+void nn_atomic_ptr_init (struct nn_atomic_ptr *self, void *p);
+
+/*  Destroy the atomic pointer. */
+void nn_atomic_ptr_term (struct nn_atomic_ptr *self);
+
+/*  Atomically replace the pointer by 'p', return the old value. Acts as
+    a full memory barrier. */
+void *nn_atomic_ptr_swap (struct nn_atomic_ptr *self, void *p);
+
 #endif
 
@@ -89,3 +89,54 @@ uint64_t nn_clock_ms (void)
 
 #endif
 }
+
+uint64_t nn_clock_us (void)
+{
+#if defined NN_HAVE_WINDOWS
+
+    LARGE_INTEGER tps;
+    LARGE_INTEGER time;
+    double tpus;
+
+    QueryPerformanceFrequency (&tps);
+    QueryPerformanceCounter (&time);
+    tpus = (double) tps.QuadPart / 1000000;
+    return (uint64_t) (time.QuadPart / tpus);
+
+#elif defined NN_HAVE_OSX
+
+    static mach_timebase_info_data_t nn_clock_timebase_info;
+    uint64_t ticks;
+
+    /*  If the global timebase info is not initialised yet, init it. */
+    if (nn_slow (!nn_clock_timebase_info.denom))
+        mach_timebase_info (&nn_clock_timebase_info);
+
+    ticks = mach_absolute_time ();
+    return ticks * nn_clock_timebase_info.numer /
+        nn_clock_timebase_info.denom / 1000;
+
+#elif defined NN_HAVE_GETHRTIME
+
+    return gethrtime () / 1000;
+
+#elif defined NN_HAVE_CLOCK_MONOTONIC
+
+    int rc;
+    struct timespec tv;
+
+    rc = clock_gettime (CLOCK_MONOTONIC, &tv);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000 + tv.tv_nsec / 1000;
+
+#else
+
+    int rc;
+    struct timeval tv;
+
+    rc = gettimeofday (&tv, NULL);
+    errno_assert (rc == 0);
+    return tv.tv_sec * (uint64_t) 1000000 + tv.tv_usec;
+
+#endif
+}
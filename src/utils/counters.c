@@ -0,0 +1,135 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "counters.h"
+#include "alloc.h"
+#include "err.h"
+#include "fast.h"
+
+#include <string.h>
+
+/*  Thread-local storage is used to remember the shard of the thread. When
+    it's not available, all the threads share a single shard. */
+#if defined NN_ATOMIC_WINAPI
+#define NN_COUNTERS_TLS __declspec(thread)
+#elif defined NN_ATOMIC_GCC_BUILTINS || defined NN_ATOMIC_SOLARIS
+#define NN_COUNTERS_TLS __thread
+#endif
+
+/*  Private functions. */
+static int nn_counters_shard (void);
+
+void nn_counters_init (struct nn_counters *self)
+{
+    size_t sz;
+
+    /*  The shards are aligned to the cache line boundary so that no two
+        shards share a cache line. */
+    sz = NN_COUNTERS_SHARDS * sizeof (struct nn_counters_shard);
+    self->mem = nn_alloc (sz + NN_COUNTERS_CACHELINE, "statistics counters");
+    alloc_assert (self->mem);
+    self->shards = (struct nn_counters_shard*)
+        (((uintptr_t) self->mem + NN_COUNTERS_CACHELINE - 1) &
+        ~((uintptr_t) NN_COUNTERS_CACHELINE - 1));
+    memset ((void*) self->shards, 0, sz);
+#if defined NN_ATOMIC_MUTEX
+    nn_mutex_init (&self->sync);
+#endif
+}
+
+void nn_counters_term (struct nn_counters *self)
+{
+#if defined NN_ATOMIC_MUTEX
+    nn_mutex_term (&self->sync);
+#endif
+    nn_free (self->mem);
+}
+
+void nn_counters_add (struct nn_counters *self, int counter, int64_t n)
+{
+    volatile int64_t *value;
+
+    nn_assert (counter >= 0 && counter < NN_COUNTERS_MAX);
+    value = &self->shards [nn_counters_shard ()].values [counter];
+
+#if defined NN_ATOMIC_WINAPI
+    InterlockedExchangeAdd64 ((LONGLONG*) value, n);
+#elif defined NN_ATOMIC_SOLARIS
+    atomic_add_64 ((volatile uint64_t*) value, n);
+#elif defined NN_ATOMIC_GCC_BUILTINS
+    __sync_fetch_and_add (value, n);
+#elif defined NN_ATOMIC_MUTEX
+    nn_mutex_lock (&self->sync);
+    *value += n;
+    nn_mutex_unlock (&self->sync);
+#else
+#error
+#endif
+}
+
+int64_t nn_counters_get (struct nn_counters *self, int counter)
+{
+    int i;
+    int64_t res;
+    volatile int64_t *value;
+
+    nn_assert (counter >= 0 && counter < NN_COUNTERS_MAX);
+
+#if defined NN_ATOMIC_MUTEX
+    nn_mutex_lock (&self->sync);
+#endif
+    res = 0;
+    for (i = 0; i != NN_COUNTERS_SHARDS; ++i) {
+        value = &self->shards [i].values [counter];
+
+        /*  Atomic read. Plain read could be torn on 32-bit platforms. */
+#if defined NN_ATOMIC_WINAPI
+        res += InterlockedCompareExchange64 ((LONGLONG*) value, 0, 0);
+#elif defined NN_ATOMIC_SOLARIS
+        res += (int64_t) atomic_add_64_nv ((volatile uint64_t*) value, 0);
+#elif defined NN_ATOMIC_GCC_BUILTINS
+        res += __sync_fetch_and_add (value, 0);
+#else
+        res += *value;
+#endif
+    }
+#if defined NN_ATOMIC_MUTEX
+    nn_mutex_unlock (&self->sync);
+#endif
+
+    return res;
+}
+
+static int nn_counters_shard (void)
+{
+#if defined NN_COUNTERS_TLS
+    static NN_COUNTERS_TLS int shard = -1;
+    static struct nn_atomic next = {0};
+
+    /*  First use of the counters in this thread. Pick the next shard. */
+    if (nn_slow (shard < 0))
+        shard = (int) (nn_atomic_inc (&next, 1) % NN_COUNTERS_SHARDS);
+    return shard;
+#else
+    return 0;
+#endif
+}
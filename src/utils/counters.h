@@ -0,0 +1,73 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_COUNTERS_INCLUDED
+#define NN_COUNTERS_INCLUDED
+
+#include "atomic.h"
+
+#include <stdint.h>
+
+/*  Set of statistics counters that can be updated concurrently from
+    multiple threads. The counters are sharded: each thread updates its own
+    copy of the counters, residing on its own cache lines, so that updating
+    a counter doesn't cause the cache lines to bounce between CPU cores.
+    The shards are summed up when the value is being read. */
+
+/*  Maximum number of counters in the set. */
+#define NN_COUNTERS_MAX 16
+
+/*  Number of shards. Threads are assigned to shards in round-robin fashion,
+    so if there are more threads than shards, some shards are shared, but
+    the updates are still atomic. */
+#define NN_COUNTERS_SHARDS 16
+
+/*  Expected size of a CPU cache line. */
+#define NN_COUNTERS_CACHELINE 64
+
+struct nn_counters_shard {
+    volatile int64_t values [NN_COUNTERS_MAX];
+};
+
+struct nn_counters {
+#if defined NN_ATOMIC_MUTEX
+    struct nn_mutex sync;
+#endif
+    /*  Cache-line-aligned array of shards. */
+    struct nn_counters_shard *shards;
+
+    /*  The memory block the shards were allocated from. */
+    void *mem;
+};
+
+/*  Initialise the set of counters. All the counters are set to zero. */
+void nn_counters_init (struct nn_counters *self);
+
+void nn_counters_term (struct nn_counters *self);
+
+/*  Adds 'n' to the counter. The value may be negative. */
+void nn_counters_add (struct nn_counters *self, int counter, int64_t n);
+
+/*  Returns the current value of the counter. */
+int64_t nn_counters_get (struct nn_counters *self, int counter);
+
+#endif
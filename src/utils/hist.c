@@ -0,0 +1,122 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "hist.h"
+
+#include <string.h>
+
+/*  Private functions. */
+static int nn_hist_bucket (uint64_t value);
+static uint64_t nn_hist_bound (int bucket);
+
+void nn_hist_init (struct nn_hist *self)
+{
+    memset (self, 0, sizeof (struct nn_hist));
+}
+
+void nn_hist_record (struct nn_hist *self, uint64_t value)
+{
+    ++self->count;
+    self->sum += value;
+    if (value > self->max)
+        self->max = value;
+    ++self->buckets [nn_hist_bucket (value)];
+}
+
+uint64_t nn_hist_percentile (struct nn_hist *self, int permille)
+{
+    uint64_t rank;
+    uint64_t seen;
+    uint64_t bound;
+    int i;
+
+    if (self->count == 0)
+        return 0;
+
+    /*  Find the bucket holding the value of the requested rank. */
+    rank = (self->count * permille + 999) / 1000;
+    if (rank == 0)
+        rank = 1;
+    seen = 0;
+    for (i = 0; i != NN_HIST_BUCKETS; ++i) {
+        seen += self->buckets [i];
+        if (seen >= rank)
+            break;
+    }
+
+    /*  Report the upper bound of the bucket, but never more than what was
+        actually recorded. */
+    bound = nn_hist_bound (i);
+    return bound < self->max ? bound : self->max;
+}
+
+void nn_hist_merge (struct nn_hist *self, const struct nn_hist *other)
+{
+    int i;
+
+    self->count += other->count;
+    self->sum += other->sum;
+    if (other->max > self->max)
+        self->max = other->max;
+    for (i = 0; i != NN_HIST_BUCKETS; ++i)
+        self->buckets [i] += other->buckets [i];
+}
+
+uint64_t nn_hist_mean (struct nn_hist *self)
+{
+    return self->count ? self->sum / self->count : 0;
+}
+
+static int nn_hist_bucket (uint64_t value)
+{
+    int msb;
+    int bucket;
+
+    /*  Small values have a bucket each. */
+    if (value < NN_HIST_SUBBUCKETS)
+        return (int) value;
+
+    /*  Find the most significant bit. Its position selects the group of
+        buckets, the three bits following it select the bucket within
+        the group. */
+    msb = 0;
+    while (value >> (msb + 1))
+        ++msb;
+    bucket = (msb - 2) * NN_HIST_SUBBUCKETS +
+        (int) ((value >> (msb - 3)) & (NN_HIST_SUBBUCKETS - 1));
+    return bucket < NN_HIST_BUCKETS ? bucket : NN_HIST_BUCKETS - 1;
+}
+
+static uint64_t nn_hist_bound (int bucket)
+{
+    int msb;
+    uint64_t sub;
+
+    if (bucket < NN_HIST_SUBBUCKETS)
+        return (uint64_t) bucket;
+
+    /*  Inverse of nn_hist_bucket. Returns the largest value falling into
+        the bucket. */
+    msb = bucket / NN_HIST_SUBBUCKETS + 2;
+    sub = bucket % NN_HIST_SUBBUCKETS;
+    return ((NN_HIST_SUBBUCKETS + sub + 1) << (msb - 3)) - 1;
+}
@@ -0,0 +1,59 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_HIST_INCLUDED
+#define NN_HIST_INCLUDED
+
+#include <stdint.h>
+
+/*  Histogram with logarithmic buckets. Each power of two is split into
+    eight linear sub-buckets, so values are recorded with precision of
+    12.5%, no matter how large they are. Values up to 2^40 can be recorded;
+    larger values are counted in the topmost bucket. */
+
+#define NN_HIST_SUBBUCKETS 8
+#define NN_HIST_BUCKETS 304
+
+struct nn_hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets [NN_HIST_BUCKETS];
+};
+
+void nn_hist_init (struct nn_hist *self);
+
+/*  Records a single value. */
+void nn_hist_record (struct nn_hist *self, uint64_t value);
+
+/*  Returns the value below which the specified fraction of the recorded
+    values lies. The fraction is expressed in 1/1000ths, e.g. 990 for 99th
+    percentile. Returns 0 if there are no values in the histogram. */
+uint64_t nn_hist_percentile (struct nn_hist *self, int permille);
+
+/*  Adds all the values recorded in 'other' to the histogram. */
+void nn_hist_merge (struct nn_hist *self, const struct nn_hist *other);
+
+/*  Returns the arithmetic mean of the recorded values. */
+uint64_t nn_hist_mean (struct nn_hist *self);
+
+#endif
@@ -22,6 +22,8 @@
 
 #include "msg.h"
 
+#include "../nn.h"
+
 #include <string.h>
 
 void nn_msg_init (struct nn_msg *self, size_t size)
@@ -79,3 +81,39 @@ void nn_msg_replace_body (struct nn_msg *self, struct nn_chunkref new_body)
     self->body = new_body;
 }
 
+int nn_msg_more (struct nn_msg *self)
+{
+    struct nn_msghdr msghdr;
+    struct nn_cmsghdr *cmsg;
+
+    msghdr.msg_iov = NULL;
+    msghdr.msg_iovlen = 0;
+    msghdr.msg_controllen = nn_chunkref_size (&self->hdrs);
+    if (msghdr.msg_controllen == 0)
+        return 0;
+    msghdr.msg_control = nn_chunkref_data (&self->hdrs);
+
+    /*  The ancillary data come from the user. Stop at the first malformed
+        property, e.g. the zeroed tail of the buffer. */
+    cmsg = NN_CMSG_FIRSTHDR (&msghdr);
+    while (cmsg && cmsg->cmsg_len >= NN_CMSG_LEN (0)) {
+        if (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_MORE)
+            return 1;
+        cmsg = NN_CMSG_NXTHDR (&msghdr, cmsg);
+    }
+
+    return 0;
+}
+
+void nn_msg_setmore (struct nn_msg *self)
+{
+    struct nn_cmsghdr *cmsg;
+
+    nn_chunkref_term (&self->hdrs);
+    nn_chunkref_init (&self->hdrs, NN_CMSG_SPACE (0));
+    cmsg = (struct nn_cmsghdr*) nn_chunkref_data (&self->hdrs);
+    memset (cmsg, 0, NN_CMSG_SPACE (0));
+    cmsg->cmsg_len = NN_CMSG_LEN (0);
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = SP_MORE;
+}
@@ -72,5 +72,12 @@ void nn_msg_bulkcopy_cp (struct nn_msg *dst, struct nn_msg *src);
     that substantially rewrite or preprocess the userland message to be written. */
 void nn_msg_replace_body(struct nn_msg *self, struct nn_chunkref newBody);
 
+/*  Returns 1 if the message is a part of a larger message that is followed
+    by further parts, i.e. if it has SP_MORE ancillary data attached. */
+int nn_msg_more (struct nn_msg *self);
+
+/*  Replaces the ancillary data of the message by SP_MORE. */
+void nn_msg_setmore (struct nn_msg *self);
+
 #endif
 
@@ -0,0 +1,430 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../nn.h"
+
+#include "trace.h"
+
+#if defined NN_TRACE
+
+#include "atomic.h"
+#include "alloc.h"
+#include "clock.h"
+#include "err.h"
+#include "fast.h"
+#include "once.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined NN_HAVE_WINDOWS
+#include "win.h"
+#include <intrin.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/*  Thread-local storage is used to find the ring of the thread. */
+#if defined NN_ATOMIC_WINAPI
+#define NN_TRACE_TLS __declspec(thread)
+#elif defined NN_ATOMIC_GCC_BUILTINS || defined NN_ATOMIC_SOLARIS
+#define NN_TRACE_TLS __thread
+#else
+#error "Tracing requires thread-local storage"
+#endif
+
+struct nn_trace_event {
+    uint64_t start;
+    uint64_t end;
+    const void *obj;
+    int kind;
+    int a;
+    int b;
+};
+
+/*  Ring buffer of a single thread. There's a single writer, the owning
+    thread. 'head' is the total number of events ever written; it is
+    published only after the event itself is written. 'owned' is cleared
+    when the owning thread exits, so that the ring can be taken over by
+    a new thread. The rings are never deallocated, thus nn_trace_dump()
+    can read them at any time. */
+struct nn_trace_ring {
+    volatile uint64_t head;
+    volatile uint32_t owned;
+    struct nn_trace_event events [NN_TRACE_RING_SIZE];
+};
+
+/*  Rings of all the traced threads. */
+static struct nn_trace_ring *volatile nn_trace_rings [NN_TRACE_MAX_THREADS];
+static volatile uint32_t nn_trace_nrings;
+
+/*  Number of threads that found no free ring. Their events are not
+    recorded. */
+static volatile uint32_t nn_trace_dropped;
+
+/*  Thread-specific key used to get notified about thread exit. */
+static nn_once_t nn_trace_once = NN_ONCE_INITIALIZER;
+#if defined NN_HAVE_WINDOWS
+static DWORD nn_trace_key;
+#else
+static pthread_key_t nn_trace_key;
+#endif
+
+/*  Reference point used to convert timestamps to microseconds. */
+static uint64_t nn_trace_base;
+static uint64_t nn_trace_base_us;
+
+/*  Private functions. */
+static struct nn_trace_ring *nn_trace_ring (void);
+static void nn_trace_init_key (void);
+#if defined NN_HAVE_WINDOWS
+static void WINAPI nn_trace_release (void *arg);
+#else
+static void nn_trace_release (void *arg);
+#endif
+static int nn_trace_claim (struct nn_trace_ring *ring);
+static struct nn_trace_ring *nn_trace_get (uint32_t idx);
+static void nn_trace_set (uint32_t idx, struct nn_trace_ring *ring);
+static uint32_t nn_trace_inc (volatile uint32_t *n);
+static void nn_trace_publish (struct nn_trace_ring *ring, uint64_t head);
+static uint64_t nn_trace_head (struct nn_trace_ring *ring);
+static const char *nn_trace_name (int kind);
+
+uint64_t nn_trace_now (void)
+{
+#if defined _MSC_VER && (defined _M_X64 || defined _M_IX86)
+    return __rdtsc ();
+#elif defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+    return __builtin_ia32_rdtsc ();
+#else
+    return nn_clock_us () * 1000;
+#endif
+}
+
+void nn_trace_record (int kind, const void *obj, int a, int b, uint64_t start)
+{
+    struct nn_trace_ring *ring;
+    struct nn_trace_event *ev;
+    uint64_t head;
+    int err;
+
+    /*  Callers inspect errno of the traced syscall after recording. */
+    err = errno;
+    ring = nn_trace_ring ();
+    if (nn_slow (!ring)) {
+        errno = err;
+        return;
+    }
+
+    head = ring->head;
+    ev = &ring->events [head % NN_TRACE_RING_SIZE];
+    ev->start = start;
+    ev->end = nn_trace_now ();
+    ev->obj = obj;
+    ev->kind = kind;
+    ev->a = a;
+    ev->b = b;
+    nn_trace_publish (ring, head + 1);
+    errno = err;
+}
+
+static struct nn_trace_ring *nn_trace_ring (void)
+{
+    static NN_TRACE_TLS struct nn_trace_ring *ring = NULL;
+    static NN_TRACE_TLS int full = 0;
+    uint32_t idx;
+#if !defined NN_HAVE_WINDOWS
+    int rc;
+#endif
+
+    if (nn_fast (ring != NULL))
+        return ring;
+    if (full)
+        return NULL;
+
+    /*  First event in this thread. Take over a ring left behind by a thread
+        that has already exited, or register a new one. */
+    nn_do_once (&nn_trace_once, nn_trace_init_key);
+    for (idx = 0; idx != NN_TRACE_MAX_THREADS; ++idx) {
+        ring = nn_trace_get (idx);
+        if (ring && nn_trace_claim (ring))
+            break;
+        ring = NULL;
+    }
+    if (!ring) {
+        idx = nn_trace_inc (&nn_trace_nrings);
+        if (nn_slow (idx >= NN_TRACE_MAX_THREADS)) {
+            nn_trace_inc (&nn_trace_dropped);
+            full = 1;
+            return NULL;
+        }
+        if (idx == 0) {
+            nn_trace_base = nn_trace_now ();
+            nn_trace_base_us = nn_clock_us ();
+        }
+        ring = nn_alloc (sizeof (struct nn_trace_ring), "trace ring");
+        alloc_assert (ring);
+        memset (ring, 0, sizeof (struct nn_trace_ring));
+        ring->owned = 1;
+        nn_trace_set (idx, ring);
+    }
+
+    /*  Release the ring when the thread exits. */
+#if defined NN_HAVE_WINDOWS
+    win_assert (FlsSetValue (nn_trace_key, ring));
+#else
+    rc = pthread_setspecific (nn_trace_key, ring);
+    errnum_assert (rc == 0, rc);
+#endif
+
+    return ring;
+}
+
+static void nn_trace_init_key (void)
+{
+#if defined NN_HAVE_WINDOWS
+    nn_trace_key = FlsAlloc (nn_trace_release);
+    win_assert (nn_trace_key != FLS_OUT_OF_INDEXES);
+#else
+    int rc;
+
+    rc = pthread_key_create (&nn_trace_key, nn_trace_release);
+    errnum_assert (rc == 0, rc);
+#endif
+}
+
+#if defined NN_HAVE_WINDOWS
+static void WINAPI nn_trace_release (void *arg)
+#else
+static void nn_trace_release (void *arg)
+#endif
+{
+    struct nn_trace_ring *ring;
+
+    /*  The events recorded so far stay in the ring until they are
+        overwritten by the thread that takes it over. */
+    ring = arg;
+    if (!ring)
+        return;
+#if defined NN_ATOMIC_WINAPI
+    MemoryBarrier ();
+    ring->owned = 0;
+#elif defined NN_ATOMIC_SOLARIS
+    membar_producer ();
+    ring->owned = 0;
+#else
+    __atomic_store_n (&ring->owned, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+static int nn_trace_claim (struct nn_trace_ring *ring)
+{
+#if defined NN_ATOMIC_WINAPI
+    return InterlockedCompareExchange ((LONG*) &ring->owned, 1, 0) == 0;
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_cas_32 (&ring->owned, 0, 1) == 0;
+#else
+    return __sync_bool_compare_and_swap (&ring->owned, 0, 1);
+#endif
+}
+
+/*  The ring is published only after it is initialised. */
+static struct nn_trace_ring *nn_trace_get (uint32_t idx)
+{
+    struct nn_trace_ring *ring;
+
+#if defined NN_ATOMIC_WINAPI
+    ring = nn_trace_rings [idx];
+    MemoryBarrier ();
+#elif defined NN_ATOMIC_SOLARIS
+    ring = nn_trace_rings [idx];
+    membar_consumer ();
+#else
+    ring = __atomic_load_n (&nn_trace_rings [idx], __ATOMIC_ACQUIRE);
+#endif
+    return ring;
+}
+
+static void nn_trace_set (uint32_t idx, struct nn_trace_ring *ring)
+{
+#if defined NN_ATOMIC_WINAPI
+    MemoryBarrier ();
+    nn_trace_rings [idx] = ring;
+#elif defined NN_ATOMIC_SOLARIS
+    membar_producer ();
+    nn_trace_rings [idx] = ring;
+#else
+    __atomic_store_n (&nn_trace_rings [idx], ring, __ATOMIC_RELEASE);
+#endif
+}
+
+/*  Increments the counter and returns its old value. */
+static uint32_t nn_trace_inc (volatile uint32_t *n)
+{
+#if defined NN_ATOMIC_WINAPI
+    return (uint32_t) InterlockedIncrement ((LONG*) n) - 1;
+#elif defined NN_ATOMIC_SOLARIS
+    return atomic_add_32_nv (n, 1) - 1;
+#else
+    return __sync_fetch_and_add (n, 1);
+#endif
+}
+
+static void nn_trace_publish (struct nn_trace_ring *ring, uint64_t head)
+{
+#if defined NN_ATOMIC_WINAPI
+    MemoryBarrier ();
+    ring->head = head;
+#elif defined NN_ATOMIC_SOLARIS
+    membar_producer ();
+    ring->head = head;
+#else
+    __atomic_store_n (&ring->head, head, __ATOMIC_RELEASE);
+#endif
+}
+
+static uint64_t nn_trace_head (struct nn_trace_ring *ring)
+{
+    uint64_t head;
+
+#if defined NN_ATOMIC_WINAPI
+    head = ring->head;
+    MemoryBarrier ();
+#elif defined NN_ATOMIC_SOLARIS
+    head = ring->head;
+    membar_consumer ();
+#else
+    head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+#endif
+    return head;
+}
+
+static const char *nn_trace_name (int kind)
+{
+    switch (kind) {
+    case NN_TRACE_FSM:
+        return "fsm";
+    case NN_TRACE_TIMER:
+        return "timer";
+    case NN_TRACE_SEND:
+        return "send";
+    case NN_TRACE_RECV:
+        return "recv";
+    case NN_TRACE_ACCEPT:
+        return "accept";
+    case NN_TRACE_CONNECT:
+        return "connect";
+    default:
+        return "unknown";
+    }
+}
+
+int nn_trace_dump (const char *filename)
+{
+    FILE *f;
+    int i;
+    int pid;
+    int first;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t pos;
+    uint64_t now;
+    uint64_t now_us;
+    double rate;
+    struct nn_trace_ring *ring;
+    struct nn_trace_event *copy;
+    struct nn_trace_event *ev;
+
+    f = fopen (filename, "w");
+    if (!f)
+        return -1;
+
+#if defined NN_HAVE_WINDOWS
+    pid = (int) GetCurrentProcessId ();
+#else
+    pid = (int) getpid ();
+#endif
+
+    /*  Ticks per microsecond. */
+    now = nn_trace_now ();
+    now_us = nn_clock_us ();
+    if (now_us > nn_trace_base_us)
+        rate = (double) (now - nn_trace_base) / (now_us - nn_trace_base_us);
+    else
+        rate = 1000.0;
+
+    copy = nn_alloc (sizeof (struct nn_trace_event) * NN_TRACE_RING_SIZE,
+        "trace copy");
+    alloc_assert (copy);
+
+    fprintf (f, "{\"traceEvents\":[\n");
+    first = 1;
+    for (i = 0; i != NN_TRACE_MAX_THREADS; ++i) {
+        ring = nn_trace_get (i);
+        if (!ring)
+            continue;
+
+        /*  Copy the events out of the ring. The events overwritten while
+            copying are dropped. */
+        head = nn_trace_head (ring);
+        tail = head > NN_TRACE_RING_SIZE ? head - NN_TRACE_RING_SIZE : 0;
+        for (pos = tail; pos != head; ++pos)
+            copy [pos % NN_TRACE_RING_SIZE] =
+                ring->events [pos % NN_TRACE_RING_SIZE];
+        pos = nn_trace_head (ring);
+        if (pos > NN_TRACE_RING_SIZE && pos - NN_TRACE_RING_SIZE > tail)
+            tail = pos - NN_TRACE_RING_SIZE;
+
+        for (pos = tail; pos < head; ++pos) {
+            ev = &copy [pos % NN_TRACE_RING_SIZE];
+            fprintf (f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+                "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"obj\":\"%p\","
+                "\"a\":%d,\"b\":%d}}\n", first ? "" : ",",
+                nn_trace_name (ev->kind), pid, i,
+                (double) (int64_t) (ev->start - nn_trace_base) / rate,
+                (double) (ev->end - ev->start) / rate, ev->obj, ev->a, ev->b);
+            first = 0;
+        }
+    }
+    fprintf (f, "],\"otherData\":{\"droppedThreads\":%u}}\n",
+        (unsigned) nn_trace_dropped);
+
+    nn_free (copy);
+    if (fclose (f) != 0)
+        return -1;
+    return 0;
+}
+
+#else
+
+#include <errno.h>
+
+int nn_trace_dump (const char *filename)
+{
+    (void) filename;
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#ifndef NN_TRACE_INCLUDED
+#define NN_TRACE_INCLUDED
+
+#include <stdint.h>
+
+/*  Tracing of state machine events and socket I/O. It's compiled in only
+    when NN_TRACE is defined (NN_ENABLE_TRACE CMake option). Each thread
+    records the events into its own ring buffer, so recording is lock-free.
+    The rings can be dumped using nn_trace_dump() in the JSON format
+    understood by timeline viewers such as chrome://tracing or Perfetto. */
+
+/*  Kinds of the recorded events. */
+#define NN_TRACE_FSM 1
+#define NN_TRACE_TIMER 2
+#define NN_TRACE_SEND 3
+#define NN_TRACE_RECV 4
+#define NN_TRACE_ACCEPT 5
+#define NN_TRACE_CONNECT 6
+
+/*  Number of events each thread keeps. Older events are overwritten. */
+#define NN_TRACE_RING_SIZE 4096
+
+/*  Maximum number of threads that can be traced at the same time. The ring
+    of an exited thread is reused by the next thread that starts tracing.
+    Threads beyond the limit are not traced; their number is reported in
+    the dump as "droppedThreads". */
+#define NN_TRACE_MAX_THREADS 64
+
+#if defined NN_TRACE
+
+/*  Returns the current timestamp. CPU timestamp counter is used where
+    available, as it's much cheaper than asking OS for the time. */
+uint64_t nn_trace_now (void);
+
+/*  Records an event that started at 'start' and ends now. 'obj' is the
+    object the event applies to, e.g. state machine or socket. 'a' and 'b'
+    are event-specific values, e.g. source and type of an FSM event, or
+    file descriptor and result of a syscall. */
+void nn_trace_record (int kind, const void *obj, int a, int b, uint64_t start);
+
+#endif
+
+#endif
@@ -0,0 +1,259 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+#include "../src/survey.h"
+
+#include "testutil.h"
+#include "../src/utils/atomic.c"
+
+#include <string.h>
+
+/*  Tests asynchronous send and receive operations. */
+
+#define SOCKET_ADDRESS "inproc://a"
+#define ROUNDTRIPS 100
+
+static struct nn_atomic done;
+static struct nn_atomic failed;
+static struct nn_atomic replies;
+static struct nn_atomic timedout;
+
+static void wait_for (struct nn_atomic *counter, uint32_t n)
+{
+    int i;
+
+    for (i = 0; i != 5000; ++i) {
+        if (nn_atomic_inc (counter, 0) >= n)
+            return;
+        nn_sleep (1);
+    }
+    nn_assert (0);
+}
+
+static void on_recv (NN_UNUSED int s, int rc, void *msg, void *arg)
+{
+    errno_assert (rc == (int) strlen ((char*) arg));
+    nn_assert (msg && memcmp (msg, arg, rc) == 0);
+    nn_freemsg (msg);
+    nn_atomic_inc (&done, 1);
+}
+
+static void on_send (NN_UNUSED int s, int rc, void *msg, NN_UNUSED void *arg)
+{
+    errno_assert (rc == 3);
+    nn_assert (msg == NULL);
+    nn_atomic_inc (&done, 1);
+}
+
+static void on_closed (NN_UNUSED int s, int rc, void *msg,
+    NN_UNUSED void *arg)
+{
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    nn_assert (msg == NULL);
+    nn_atomic_inc (&failed, 1);
+}
+
+static void on_timedout (NN_UNUSED int s, int rc, void *msg,
+    NN_UNUSED void *arg)
+{
+    nn_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    nn_assert (msg == NULL);
+    nn_atomic_inc (&timedout, 1);
+}
+
+static void send_async (int s, const char *data, nn_async_fn fn, void *arg)
+{
+    int rc;
+    void *msg;
+
+    msg = nn_allocmsg (strlen (data), 0);
+    alloc_assert (msg);
+    memcpy (msg, data, strlen (data));
+    rc = nn_send_async (s, msg, fn, arg);
+    errno_assert (rc == 0);
+}
+
+/*  Echoes every message back and waits for the next one. */
+static void on_echo (int s, int rc, void *msg, NN_UNUSED void *arg)
+{
+    if (rc < 0) {
+        nn_assert (nn_errno () == EBADF);
+        nn_atomic_inc (&failed, 1);
+        return;
+    }
+    rc = nn_send_async (s, msg, on_send, NULL);
+    errno_assert (rc == 0);
+    rc = nn_recv_async (s, on_echo, NULL);
+    errno_assert (rc == 0);
+}
+
+/*  Sends the next request once the reply arrives. */
+static void on_reply (int s, int rc, void *msg, NN_UNUSED void *arg)
+{
+    errno_assert (rc == 3);
+    nn_freemsg (msg);
+    if (nn_atomic_inc (&replies, 1) + 1 >= ROUNDTRIPS)
+        return;
+    rc = nn_recv_async (s, on_reply, NULL);
+    errno_assert (rc == 0);
+    send_async (s, "ABC", on_send, NULL);
+}
+
+static void roundtrips (const char *addr)
+{
+    int sb;
+    int sc;
+    int rc;
+    int i;
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, (char*) addr);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, (char*) addr);
+
+    /*  Callback-driven server, blocking client. */
+    nn_atomic_init (&done, 0);
+    nn_atomic_init (&failed, 0);
+    rc = nn_recv_async (sb, on_echo, NULL);
+    errno_assert (rc == 0);
+    for (i = 0; i != ROUNDTRIPS; ++i) {
+        test_send (sc, "ABC");
+        test_recv (sc, "ABC");
+    }
+    wait_for (&done, ROUNDTRIPS);
+
+    /*  Callback-driven on both sides. Requests and replies are sent from
+        within the callbacks. */
+    nn_atomic_init (&replies, 0);
+    rc = nn_recv_async (sc, on_reply, NULL);
+    errno_assert (rc == 0);
+    send_async (sc, "ABC", on_send, NULL);
+    wait_for (&replies, ROUNDTRIPS);
+
+    /*  The pending receive of the server fails once the socket is closed. */
+    test_close (sb);
+    nn_assert (nn_atomic_inc (&failed, 0) == 1);
+    test_close (sc);
+    nn_atomic_term (&replies);
+    nn_atomic_term (&failed);
+    nn_atomic_term (&done);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int sb;
+    int sc;
+    int sp;
+    int deadline;
+    void *msg;
+    char addr [128];
+
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+
+    /*  Receive operation completed when the message arrives. */
+    nn_atomic_init (&done, 0);
+    rc = nn_recv_async (sb, on_recv, "ABC");
+    errno_assert (rc == 0);
+    nn_sleep (10);
+    nn_assert (nn_atomic_inc (&done, 0) == 0);
+    test_send (sc, "ABC");
+    wait_for (&done, 1);
+
+    /*  Receive operation completed straight away. */
+    test_send (sc, "DEF");
+    nn_sleep (10);
+    rc = nn_recv_async (sb, on_recv, "DEF");
+    errno_assert (rc == 0);
+    wait_for (&done, 2);
+
+    /*  Operations complete in the order they were submitted. */
+    rc = nn_recv_async (sb, on_recv, "GHI");
+    errno_assert (rc == 0);
+    rc = nn_recv_async (sb, on_recv, "JKL");
+    errno_assert (rc == 0);
+    test_send (sc, "GHI");
+    test_send (sc, "JKL");
+    wait_for (&done, 4);
+
+    /*  Send operation. */
+    send_async (sc, "MNO", on_send, NULL);
+    wait_for (&done, 5);
+    test_recv (sb, "MNO");
+
+    /*  Pending operations fail when the socket is closed. */
+    nn_atomic_init (&failed, 0);
+    rc = nn_recv_async (sb, on_closed, NULL);
+    errno_assert (rc == 0);
+    rc = nn_recv_async (sb, on_closed, NULL);
+    errno_assert (rc == 0);
+    test_close (sb);
+    nn_assert (nn_atomic_inc (&failed, 0) == 2);
+    test_close (sc);
+    nn_atomic_term (&failed);
+    nn_atomic_term (&done);
+
+    /*  Operations completed by a protocol timer rather than by a pipe event.
+        The survey expires with no responses. */
+    nn_atomic_init (&timedout, 0);
+    sb = test_socket (AF_SP, NN_RESPONDENT);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_SURVEYOR);
+    deadline = 100;
+    test_setsockopt (sc, NN_SURVEYOR, NN_SURVEYOR_DEADLINE, &deadline,
+        sizeof (deadline));
+    test_connect (sc, SOCKET_ADDRESS);
+    test_send (sc, "ABC");
+    rc = nn_recv_async (sc, on_timedout, NULL);
+    errno_assert (rc == 0);
+    nn_sleep (10);
+    nn_assert (nn_atomic_inc (&timedout, 0) == 0);
+    wait_for (&timedout, 1);
+    test_close (sc);
+    test_close (sb);
+    nn_atomic_term (&timedout);
+
+    /*  Invalid arguments. */
+    sp = test_socket (AF_SP, NN_SUB);
+    rc = nn_recv_async (sp, NULL, NULL);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    msg = nn_allocmsg (3, 0);
+    alloc_assert (msg);
+    rc = nn_send_async (sp, msg, on_send, NULL);
+    nn_assert (rc == -1 && nn_errno () == ENOTSUP);
+    nn_freemsg (msg);
+    test_close (sp);
+    rc = nn_recv_async (sp, on_recv, NULL);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+
+    roundtrips (SOCKET_ADDRESS);
+    test_addr_from (addr, "tcp", "127.0.0.1", get_test_port (argc, argv));
+    roundtrips (addr);
+
+    return 0;
+}
@@ -26,14 +26,84 @@
 
 #define SOCKET_ADDRESS_A "inproc://a"
 #define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
+#define SOCKET_ADDRESS_D "inproc://d"
 
-int main ()
+/*  Forwards one message from the raw socket back to the bus, the same way
+    a loopback device would. Returns 0 if there was no message to forward. */
+static int forward (int sock)
+{
+    int rc;
+    void *body;
+    void *control;
+    struct nn_iovec iov;
+    struct nn_msghdr hdr;
+
+    iov.iov_base = &body;
+    iov.iov_len = NN_MSG;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_recvmsg (sock, &hdr, NN_DONTWAIT);
+    if (rc < 0) {
+        errno_assert (nn_errno () == EAGAIN);
+        return 0;
+    }
+    rc = nn_sendmsg (sock, &hdr, 0);
+    errno_assert (rc >= 0);
+    return 1;
+}
+
+/*  Sends a message from the raw socket with the specified message ID. */
+static void send_with_id (int sock, const char *data, uint64_t id)
+{
+    int rc;
+    int i;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    unsigned char ctrl [64];
+    unsigned char *ptr;
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    memset (ctrl, 0, sizeof (ctrl));
+    cmsg = (struct nn_cmsghdr*) ctrl;
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (size_t) + 16);
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = SP_HDR;
+    *(size_t*) NN_CMSG_DATA (cmsg) = 16;
+
+    /*  No pipe to exclude, followed by the message ID in network order. */
+    ptr = NN_CMSG_DATA (cmsg) + sizeof (size_t) + 8;
+    for (i = 0; i != 8; ++i)
+        ptr [i] = (unsigned char) (id >> (56 - 8 * i));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = NN_CMSG_SPACE (sizeof (size_t) + 16);
+    rc = nn_sendmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+}
+
+int main (int argc, const char *argv[])
 {
     int rc;
     int bus1;
     int bus2;
     int bus3;
     char buf [3];
+    int fwd [3];
+    int count [3];
+    int val;
+    int i;
+    int n;
+    size_t sz;
+    char socket_address [128];
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
 
     /*  Create a simple bus topology consisting of 3 nodes. */
     bus1 = test_socket (AF_SP, NN_BUS);
@@ -77,6 +147,128 @@ int main ()
     test_close (bus2);
     test_close (bus1);
 
+    /*  Test duplicate suppression. Three forwarders are connected into
+        a ring, so each message reaches each of them twice. */
+    for (i = 0; i != 3; ++i) {
+        fwd [i] = test_socket (AF_SP_RAW, NN_BUS);
+        val = -1;
+        rc = nn_setsockopt (fwd [i], NN_BUS, NN_BUS_DEDUP, &val, sizeof (val));
+        nn_assert (rc < 0 && nn_errno () == EINVAL);
+        val = 1000;
+        test_setsockopt (fwd [i], NN_BUS, NN_BUS_DEDUP, &val, sizeof (val));
+        count [i] = 0;
+    }
+    sz = sizeof (val);
+    rc = nn_getsockopt (fwd [0], NN_BUS, NN_BUS_DEDUP, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 1000);
+    test_bind (fwd [0], SOCKET_ADDRESS_A);
+    test_bind (fwd [1], SOCKET_ADDRESS_B);
+    test_bind (fwd [2], SOCKET_ADDRESS_C);
+    test_connect (fwd [0], SOCKET_ADDRESS_B);
+    test_connect (fwd [1], SOCKET_ADDRESS_C);
+    test_connect (fwd [2], SOCKET_ADDRESS_A);
+    bus1 = test_socket (AF_SP, NN_BUS);
+    test_setsockopt (bus1, NN_BUS, NN_BUS_DEDUP, &val, sizeof (val));
+    test_connect (bus1, SOCKET_ADDRESS_A);
+    bus2 = test_socket (AF_SP, NN_BUS);
+    test_setsockopt (bus2, NN_BUS, NN_BUS_DEDUP, &val, sizeof (val));
+    test_bind (bus2, SOCKET_ADDRESS_D);
+    test_connect (fwd [2], SOCKET_ADDRESS_D);
+    nn_sleep (10);
+
+    /*  Keep forwarding till the message stops circulating. */
+    test_send (bus1, "ABC");
+    for (n = 0; n != 10; ++n) {
+        nn_sleep (10);
+        for (i = 0; i != 3; ++i)
+            while (forward (fwd [i]))
+                ++count [i];
+    }
+    for (i = 0; i != 3; ++i)
+        nn_assert (count [i] == 1);
+
+    /*  The message is delivered once and doesn't loop back to the sender. */
+    test_recv (bus2, "ABC");
+    rc = nn_recv (bus2, buf, sizeof (buf), NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+    rc = nn_recv (bus1, buf, sizeof (buf), NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  Messages are suppressed even when the ID cache is small. */
+    val = 0;
+    rc = nn_setsockopt (fwd [0], NN_BUS, NN_BUS_DEDUP_MAX, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 2;
+    for (i = 0; i != 3; ++i)
+        test_setsockopt (fwd [i], NN_BUS, NN_BUS_DEDUP_MAX, &val, sizeof (val));
+    test_send (bus2, "DEF");
+    test_send (bus2, "GHI");
+    for (n = 0; n != 10; ++n) {
+        nn_sleep (10);
+        for (i = 0; i != 3; ++i)
+            while (forward (fwd [i]))
+                ++count [i];
+    }
+    for (i = 0; i != 3; ++i)
+        nn_assert (count [i] == 3);
+    test_recv (bus1, "DEF");
+    test_recv (bus1, "GHI");
+
+    /*  Distinct IDs are told apart even if their halves XOR to the same
+        value, and both are remembered. */
+    val = 100;
+    test_setsockopt (bus1, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    send_with_id (fwd [2], "X", 0x0000000100000000ULL);
+    send_with_id (fwd [2], "Y", 0x0000000000000001ULL);
+    nn_sleep (10);
+    for (i = 0; i != 2; ++i)
+        while (forward (fwd [i]))
+            ;
+    test_recv (bus1, "X");
+    test_recv (bus1, "Y");
+    send_with_id (fwd [2], "X", 0x0000000100000000ULL);
+    send_with_id (fwd [2], "Y", 0x0000000000000001ULL);
+    nn_sleep (10);
+    for (i = 0; i != 2; ++i)
+        while (forward (fwd [i]))
+            ;
+    rc = nn_recv (bus1, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+
+    test_close (bus2);
+    test_close (bus1);
+    for (i = 0; i != 3; ++i)
+        test_close (fwd [i]);
+
+    /*  Peers that differ in whether they prefix messages with an ID
+        refuse to connect to each other. */
+    val = 1000;
+    bus1 = test_socket (AF_SP, NN_BUS);
+    test_setsockopt (bus1, NN_BUS, NN_BUS_DEDUP, &val, sizeof (val));
+    test_bind (bus1, socket_address);
+    bus2 = test_socket (AF_SP, NN_BUS);
+    test_connect (bus2, socket_address);
+    bus3 = test_socket (AF_SP, NN_BUS);
+    test_setsockopt (bus3, NN_BUS, NN_BUS_DEDUP, &val, sizeof (val));
+    test_connect (bus3, socket_address);
+    nn_sleep (100);
+    test_send (bus2, "ABCDEFGHIJ");
+    test_send (bus3, "ABC");
+    test_send (bus1, "A");
+    test_recv (bus1, "ABC");
+    test_recv (bus3, "A");
+    val = 100;
+    test_setsockopt (bus1, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    test_setsockopt (bus2, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    rc = nn_recv (bus1, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    rc = nn_recv (bus2, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    test_close (bus3);
+    test_close (bus2);
+    test_close (bus1);
+
     return 0;
 }
 
@@ -0,0 +1,83 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/utils/err.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/counters.c"
+
+#define THREAD_COUNT 8
+#define ITERATIONS 100000
+
+static struct nn_counters counters;
+
+static void routine (NN_UNUSED void *arg)
+{
+    int i;
+
+    for (i = 0; i != ITERATIONS; ++i) {
+        nn_counters_add (&counters, 0, 1);
+        nn_counters_add (&counters, 1, -2);
+    }
+    nn_counters_add (&counters, NN_COUNTERS_MAX - 1, 1);
+}
+
+int main ()
+{
+    int i;
+    struct nn_thread threads [THREAD_COUNT];
+
+    nn_counters_init (&counters);
+
+    /*  Counters start at zero. */
+    for (i = 0; i != NN_COUNTERS_MAX; ++i)
+        nn_assert (nn_counters_get (&counters, i) == 0);
+
+    /*  Updates from a single thread. */
+    nn_counters_add (&counters, 2, 42);
+    nn_counters_add (&counters, 2, -2);
+    nn_assert (nn_counters_get (&counters, 2) == 40);
+
+    /*  Concurrent updates from multiple threads are not lost. */
+    for (i = 0; i != THREAD_COUNT; ++i)
+        nn_thread_init (&threads [i], routine, NULL);
+    for (i = 0; i != THREAD_COUNT; ++i)
+        nn_thread_term (&threads [i]);
+
+    nn_assert (nn_counters_get (&counters, 0) ==
+        (int64_t) THREAD_COUNT * ITERATIONS);
+    nn_assert (nn_counters_get (&counters, 1) ==
+        -2 * (int64_t) THREAD_COUNT * ITERATIONS);
+    nn_assert (nn_counters_get (&counters, NN_COUNTERS_MAX - 1) ==
+        THREAD_COUNT);
+    nn_assert (nn_counters_get (&counters, 2) == 40);
+
+    /*  The shards occupy separate cache lines. */
+    nn_assert (((uintptr_t) counters.shards) % NN_COUNTERS_CACHELINE == 0);
+    nn_assert (sizeof (struct nn_counters_shard) % NN_COUNTERS_CACHELINE == 0);
+
+    nn_counters_term (&counters);
+
+    return 0;
+}
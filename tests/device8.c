@@ -0,0 +1,166 @@
+/*
+    Copyright (c) 2012 Martin Sustrik  All rights reserved.
+    Copyright (c) 2013 GoPivotal, Inc.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+#include "../src/utils/attr.h"
+#include "../src/utils/thread.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SOCKET_ADDRESS_A "inproc://a"
+#define SOCKET_ADDRESS_B "inproc://b"
+#define SOCKET_ADDRESS_C "inproc://c"
+#define SOCKET_ADDRESS_D "inproc://d"
+
+#define MESSAGE_COUNT 1000
+
+void device1 (NN_UNUSED void *arg)
+{
+    int rc;
+    int deva;
+    int devb;
+
+    /*  Intialise the device sockets. */
+    deva = test_socket (AF_SP_RAW, NN_PAIR);
+    test_bind (deva, SOCKET_ADDRESS_A);
+    devb = test_socket (AF_SP_RAW, NN_PAIR);
+    test_bind (devb, SOCKET_ADDRESS_B);
+
+    /*  Run the device. */
+    rc = nn_device (deva, devb);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    /*  Clean up. */
+    test_close (devb);
+    test_close (deva);
+}
+
+void device2 (NN_UNUSED void *arg)
+{
+    int rc;
+    int devc;
+    int devd;
+
+    /*  Intialise the device sockets. */
+    devc = test_socket (AF_SP_RAW, NN_PULL);
+    test_bind (devc, SOCKET_ADDRESS_C);
+    devd = test_socket (AF_SP_RAW, NN_PUSH);
+    test_bind (devd, SOCKET_ADDRESS_D);
+
+    /*  Run the device. */
+    rc = nn_device (devc, devd);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    /*  Clean up. */
+    test_close (devd);
+    test_close (devc);
+}
+
+int main ()
+{
+    int enda;
+    int endb;
+    int endc;
+    int endd;
+    int i;
+    int rc;
+    int val;
+    char buf [16];
+    char seen [MESSAGE_COUNT];
+    struct nn_thread thread1;
+    struct nn_thread thread2;
+
+    /*  Run the devices with several forwarding threads per direction. */
+#if defined NN_HAVE_WINDOWS
+    _putenv ("NN_DEVICE_THREADS=4");
+#else
+    setenv ("NN_DEVICE_THREADS", "4", 1);
+#endif
+
+    /*  Test the bi-directional device. */
+
+    /*  Start the device. */
+    nn_thread_init (&thread1, device1, NULL);
+
+    /*  Create two sockets to connect to the device. */
+    enda = test_socket (AF_SP, NN_PAIR);
+    test_connect (enda, SOCKET_ADDRESS_A);
+    endb = test_socket (AF_SP, NN_PAIR);
+    test_connect (endb, SOCKET_ADDRESS_B);
+
+    /*  Pass a message between endpoints. */
+    test_send (enda, "ABC");
+    test_recv (endb, "ABC");
+
+    /*  Pass a message in the opposite direction. */
+    test_send (endb, "XYZ");
+    test_recv (enda, "XYZ");
+
+    /*  Test the uni-directional device. */
+
+    /*  Start the device. */
+    nn_thread_init (&thread2, device2, NULL);
+
+    /*  Create two sockets to connect to the device. */
+    endc = test_socket (AF_SP, NN_PUSH);
+    test_connect (endc, SOCKET_ADDRESS_C);
+    endd = test_socket (AF_SP, NN_PULL);
+    test_connect (endd, SOCKET_ADDRESS_D);
+    val = 5000;
+    test_setsockopt (endd, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+
+    /*  The forwarders may reorder the messages, but none of them may be lost
+        or duplicated. */
+    for (i = 0; i != MESSAGE_COUNT; ++i) {
+        sprintf (buf, "%d", i);
+        test_send (endc, buf);
+    }
+    memset (seen, 0, sizeof (seen));
+    for (i = 0; i != MESSAGE_COUNT; ++i) {
+        rc = nn_recv (endd, buf, sizeof (buf) - 1, 0);
+        errno_assert (rc > 0);
+        buf [rc] = 0;
+        rc = atoi (buf);
+        nn_assert (rc >= 0 && rc < MESSAGE_COUNT && !seen [rc]);
+        seen [rc] = 1;
+    }
+
+    /*  Clean up. */
+    test_close (endd);
+    test_close (endc);
+    test_close (endb);
+    test_close (enda);
+
+    /*  Shut down the devices. */
+    nn_term ();
+    nn_thread_term (&thread1);
+    nn_thread_term (&thread2);
+
+    return 0;
+}
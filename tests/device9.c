@@ -0,0 +1,117 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pipeline.h"
+
+#include "testutil.h"
+#include "../src/utils/attr.h"
+#include "../src/utils/thread.c"
+
+#include <string.h>
+
+/*  Tests the in-library device under pushback. */
+
+#define SOCKET_ADDRESS_A "inproc://a"
+#define SOCKET_ADDRESS_B "inproc://b"
+
+#define MESSAGE_COUNT 2000
+#define MESSAGE_SIZE 1024
+
+void device (NN_UNUSED void *arg)
+{
+    int rc;
+    int deva;
+    int devb;
+
+    /*  Intialise the device sockets. */
+    deva = test_socket (AF_SP_RAW, NN_PULL);
+    test_bind (deva, SOCKET_ADDRESS_A);
+    devb = test_socket (AF_SP_RAW, NN_PUSH);
+    test_bind (devb, SOCKET_ADDRESS_B);
+
+    /*  Run the device. */
+    rc = nn_device (deva, devb);
+    nn_assert (rc < 0 && nn_errno () == EBADF);
+
+    /*  Clean up. */
+    test_close (devb);
+    test_close (deva);
+}
+
+void sender (void *arg)
+{
+    int rc;
+    int i;
+    char buf [MESSAGE_SIZE];
+
+    for (i = 0; i != MESSAGE_COUNT; ++i) {
+        memset (buf, 'A' + i % 26, sizeof (buf));
+        rc = nn_send (*(int*) arg, buf, sizeof (buf), 0);
+        errno_assert (rc == sizeof (buf));
+    }
+}
+
+int main ()
+{
+    int enda;
+    int endb;
+    int i;
+    int rc;
+    int val;
+    char buf [MESSAGE_SIZE];
+    struct nn_thread thread1;
+    struct nn_thread thread2;
+
+    /*  Start the device. */
+    nn_thread_init (&thread1, device, NULL);
+
+    /*  Create two sockets to connect to the device. */
+    enda = test_socket (AF_SP, NN_PUSH);
+    test_connect (enda, SOCKET_ADDRESS_A);
+    endb = test_socket (AF_SP, NN_PULL);
+    test_connect (endb, SOCKET_ADDRESS_B);
+    val = 5000;
+    test_setsockopt (endb, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+
+    /*  Send more data than fits into the buffers, so that the device has to
+        deal with pushback. Messages must arrive complete and in order. */
+    nn_thread_init (&thread2, sender, &enda);
+    nn_sleep (100);
+    for (i = 0; i != MESSAGE_COUNT; ++i) {
+        rc = nn_recv (endb, buf, sizeof (buf), 0);
+        errno_assert (rc == sizeof (buf));
+        nn_assert (buf [0] == 'A' + i % 26);
+        nn_assert (buf [MESSAGE_SIZE - 1] == 'A' + i % 26);
+    }
+    nn_thread_term (&thread2);
+
+    /*  Clean up. */
+    test_close (endb);
+    test_close (enda);
+
+    /*  Shut down the device. */
+    nn_term ();
+    nn_thread_term (&thread1);
+
+    return 0;
+}
@@ -28,6 +28,8 @@
 
 #include "testutil.h"
 
+#include <string.h>
+
 /*  Tests inproc transport. */
 
 #define SOCKET_ADDRESS "inproc://test"
@@ -41,6 +43,7 @@ int main ()
     int i;
     char buf [256];
     int val;
+    int more;
     struct nn_msghdr hdr;
     struct nn_iovec iovec;
     unsigned char body [3];
@@ -168,6 +171,23 @@ int main ()
     test_close (sc);
     test_close (sb);
 
+    /*  Test passing message parts. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    val = 1024;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_PARTSIZE, &val, sizeof (val));
+    test_connect (sc, SOCKET_ADDRESS);
+    rc = send_part (sc, "ABC");
+    errno_assert (rc == 3);
+    test_send (sc, "DEF");
+    rc = recv_part (sb, (char*) buf, sizeof (buf), &more);
+    nn_assert (rc == 3 && more && memcmp (buf, "ABC", 3) == 0);
+    rc = recv_part (sb, (char*) buf, sizeof (buf), &more);
+    nn_assert (rc == 3 && !more && memcmp (buf, "DEF", 3) == 0);
+    test_close (sc);
+    test_close (sb);
+
     /* Test binding a new socket after originally bound socket shuts down. */
     sb = test_socket (AF_SP, NN_BUS);
     test_bind (sb, SOCKET_ADDRESS);
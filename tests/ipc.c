@@ -30,8 +30,12 @@
 
 /*  Tests IPC transport. */
 
+#include <string.h>
+
 #define SOCKET_ADDRESS "ipc://test.ipc"
 
+#define BIG_MSG_SIZE (16 * 1024 * 1024)
+
 int main ()
 {
 #ifndef NN_HAVE_WSL
@@ -46,6 +50,9 @@ int main ()
 
     int size;
     char * buf;
+    int more;
+    size_t sz;
+    static char part [65536];
 
     /*  Try closing a IPC socket while it not connected. */
     sc = test_socket (AF_SP, NN_PAIR);
@@ -158,6 +165,85 @@ int main ()
     errno_assert (nn_errno () == EINVAL);
     test_close (sb);
 
+    /*  Test an urgent message overtaking a large one. The receiver doesn't
+        read the first message, so that the large message gets stuck. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = -1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_INTERLEAVE, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    opt = 4096;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_INTERLEAVE, &opt, sizeof (opt));
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_INTERLEAVE, &opt, sizeof (opt));
+    test_connect (sc, SOCKET_ADDRESS);
+    test_send (sc, "XYZ");
+    dummy_buf = nn_allocmsg (BIG_MSG_SIZE, 0);
+    alloc_assert (dummy_buf);
+    memset (dummy_buf, 'A', BIG_MSG_SIZE);
+    rc = nn_send (sc, &dummy_buf, NN_MSG, 0);
+    errno_assert (rc == BIG_MSG_SIZE);
+    send_prio (sc, "ABC", 1);
+    test_recv (sb, "XYZ");
+    test_recv (sb, "ABC");
+    rc = nn_recv (sb, &dummy_buf, NN_MSG, 0);
+    errno_assert (rc == BIG_MSG_SIZE);
+    nn_assert (((char*) dummy_buf) [BIG_MSG_SIZE - 1] == 'A');
+    nn_freemsg (dummy_buf);
+
+    /*  Messages of the same priority are not reordered. */
+    send_prio (sc, "DEF", 1);
+    send_prio (sc, "GHI", 1);
+    test_send (sc, "JKL");
+    test_recv (sb, "DEF");
+    test_recv (sb, "GHI");
+    test_recv (sb, "JKL");
+    test_close (sc);
+
+    /*  Peer that doesn't interleave messages still works. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, SOCKET_ADDRESS);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    send_prio (sb, "DEF", 1);
+    test_recv (sc, "DEF");
+    test_close (sc);
+    test_close (sb);
+
+    /*  Test receiving a large message in parts. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = 65536;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_PARTSIZE, &opt, sizeof (opt));
+    test_bind (sb, SOCKET_ADDRESS);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_PARTSIZE, &opt, sizeof (opt));
+    test_connect (sc, SOCKET_ADDRESS);
+    dummy_buf = nn_allocmsg (BIG_MSG_SIZE, 0);
+    alloc_assert (dummy_buf);
+    memset (dummy_buf, 'A', BIG_MSG_SIZE);
+    rc = nn_send (sc, &dummy_buf, NN_MSG, 0);
+    errno_assert (rc == BIG_MSG_SIZE);
+    sz = 0;
+    do {
+        rc = recv_part (sb, part, sizeof (part), &more);
+        nn_assert (rc == (int) sizeof (part));
+        nn_assert (part [0] == 'A' && part [rc - 1] == 'A');
+        sz += rc;
+    } while (more);
+    nn_assert (sz == BIG_MSG_SIZE);
+
+    /*  Parts sent by the user are delivered as such. */
+    rc = send_part (sc, "ABC");
+    errno_assert (rc == 3);
+    test_send (sc, "DEF");
+    rc = recv_part (sb, part, sizeof (part), &more);
+    nn_assert (rc == 3 && more && memcmp (part, "ABC", 3) == 0);
+    rc = recv_part (sb, part, sizeof (part), &more);
+    nn_assert (rc == 3 && !more && memcmp (part, "DEF", 3) == 0);
+    test_close (sc);
+    test_close (sb);
+
     /*  Test closing a socket that is waiting to connect. */
     sc = test_socket (AF_SP, NN_PAIR);
     test_connect (sc, SOCKET_ADDRESS);
@@ -0,0 +1,102 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+
+#include "../src/utils/err.c"
+#include "../src/utils/alloc.c"
+#include "../src/utils/atomic.c"
+#include "../src/utils/mutex.c"
+#include "../src/utils/thread.c"
+#include "../src/utils/wire.c"
+#include "../src/utils/chunk.c"
+#include "../src/utils/chunkref.c"
+#include "../src/utils/msg.c"
+#include "../src/transports/inproc/msgqueue.c"
+
+/*  Enough messages to go through the chunks many times over. */
+#define MESSAGES (NN_MSGQUEUE_GRANULARITY * 1000 + 7)
+
+static struct nn_msgqueue queue;
+
+static void writer (NN_UNUSED void *arg)
+{
+    uint32_t i;
+    struct nn_msg msg;
+
+    for (i = 0; i != MESSAGES; ++i) {
+        nn_msg_init (&msg, sizeof (uint32_t));
+        nn_putl (nn_chunkref_data (&msg.body), i);
+        nn_msgqueue_send (&queue, &msg);
+    }
+}
+
+int main ()
+{
+    int rc;
+    uint32_t i;
+    struct nn_msg msg;
+    struct nn_thread thread;
+
+    nn_msgqueue_init (&queue, 1024 * 1024);
+
+    /*  Messages come out in order across the chunk boundaries. */
+    for (i = 0; i != 3 * NN_MSGQUEUE_GRANULARITY; ++i) {
+        nn_msg_init (&msg, sizeof (uint32_t));
+        nn_putl (nn_chunkref_data (&msg.body), i);
+        rc = nn_msgqueue_send (&queue, &msg);
+        nn_assert (!(rc & NN_MSGQUEUE_FULL));
+        nn_assert (i ? !(rc & NN_MSGQUEUE_NOTIFY) : rc & NN_MSGQUEUE_NOTIFY);
+    }
+    for (i = 0; i != 3 * NN_MSGQUEUE_GRANULARITY; ++i) {
+        rc = nn_msgqueue_recv (&queue, &msg);
+        errnum_assert (rc >= 0, -rc);
+        nn_assert (i == 3 * NN_MSGQUEUE_GRANULARITY - 1 ?
+            !(rc & NN_MSGQUEUE_MORE) : rc & NN_MSGQUEUE_MORE);
+        nn_assert (nn_getl (nn_chunkref_data (&msg.body)) == i);
+        nn_msg_term (&msg);
+    }
+    rc = nn_msgqueue_recv (&queue, &msg);
+    nn_assert (rc == -EAGAIN);
+
+    /*  Released chunk is kept for reuse. */
+    nn_assert (queue.cache.p);
+
+    /*  Concurrent writer and reader. */
+    nn_thread_init (&thread, writer, NULL);
+    i = 0;
+    while (i != MESSAGES) {
+        rc = nn_msgqueue_recv (&queue, &msg);
+        if (rc == -EAGAIN)
+            continue;
+        errnum_assert (rc >= 0, -rc);
+        nn_assert (nn_getl (nn_chunkref_data (&msg.body)) == i);
+        nn_msg_term (&msg);
+        ++i;
+    }
+    nn_thread_term (&thread);
+    rc = nn_msgqueue_recv (&queue, &msg);
+    nn_assert (rc == -EAGAIN);
+
+    nn_msgqueue_term (&queue);
+
+    return 0;
+}
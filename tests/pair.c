@@ -27,10 +27,18 @@
 
 #define SOCKET_ADDRESS "inproc://a"
 
-int main ()
+int main (int argc, const char *argv[])
 {
+    int rc;
     int sb;
     int sc;
+    int val;
+    int i;
+    char buf [3];
+    char socket_address [128];
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
 
     sb = test_socket (AF_SP, NN_PAIR);
     test_bind (sb, SOCKET_ADDRESS);
@@ -45,6 +53,37 @@ int main ()
     test_close (sc);
     test_close (sb);
 
+    /*  Credit-based flow control is not available on sockets that send,
+        as the grants could get stuck behind the data going the other way. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    val = 2;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_RCVCREDIT, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 0;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVCREDIT, &val, sizeof (val));
+
+    /*  Two-way traffic over a stream connection: the peer echoes the
+        messages back while the sender is not receiving yet. */
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    val = 1000;
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_SNDTIMEO, &val, sizeof (val));
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_SNDTIMEO, &val, sizeof (val));
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVTIMEO, &val, sizeof (val));
+    test_connect (sc, socket_address);
+    for (i = 0; i != 10; ++i) {
+        test_send (sc, "ABC");
+        rc = nn_recv (sb, buf, sizeof (buf), 0);
+        errno_assert (rc == 3);
+        rc = nn_send (sb, buf, 3, 0);
+        errno_assert (rc == 3);
+    }
+    for (i = 0; i != 10; ++i)
+        test_recv (sc, "ABC");
+
+    test_close (sc);
+    test_close (sb);
+
     return 0;
 }
 
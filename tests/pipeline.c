@@ -25,14 +25,115 @@
 #include "../src/pipeline.h"
 #include "testutil.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define SOCKET_ADDRESS "inproc://a"
 
-int main ()
+/*  Sends a message with the routing key attached. */
+static void send_keyed (int sock, const char *key, const char *data)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    unsigned char ctrl [64];
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    memset (ctrl, 0, sizeof (ctrl));
+    cmsg = (struct nn_cmsghdr*) ctrl;
+    cmsg->cmsg_len = NN_CMSG_LEN (strlen (key));
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = SP_ROUTING_KEY;
+    memcpy (NN_CMSG_DATA (cmsg), key, strlen (key));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = NN_CMSG_SPACE (strlen (key));
+    rc = nn_sendmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+}
+
+/*  Sends a message with a routing key header claiming the given length. */
+static void send_badkey (int sock, size_t cmsg_len, const char *data)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    unsigned char ctrl [64];
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    memset (ctrl, 0, sizeof (ctrl));
+    cmsg = (struct nn_cmsghdr*) ctrl;
+    cmsg->cmsg_len = cmsg_len;
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = SP_ROUTING_KEY;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = NN_CMSG_SPACE (4);
+    rc = nn_sendmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+}
+
+/*  Returns number of messages waiting in the socket. */
+static int drain (int sock)
+{
+    int rc;
+    int count;
+    char buf [16];
+
+    count = 0;
+    while (1) {
+        rc = nn_recv (sock, buf, sizeof (buf), NN_DONTWAIT);
+        if (rc < 0) {
+            errno_assert (nn_errno () == EAGAIN);
+            return count;
+        }
+        ++count;
+    }
+}
+
+/*  Returns the set of keys the messages waiting in the socket were sent
+    with. The message body is expected to be the key itself. */
+static uint32_t keys (int sock)
+{
+    int rc;
+    uint32_t res;
+    char buf [16];
+
+    res = 0;
+    while (1) {
+        rc = nn_recv (sock, buf, sizeof (buf) - 1, NN_DONTWAIT);
+        if (rc < 0) {
+            errno_assert (nn_errno () == EAGAIN);
+            return res;
+        }
+        buf [rc] = 0;
+        res |= ((uint32_t) 1) << atoi (buf + 4);
+    }
+}
+
+int main (int argc, const char *argv[])
 {
     int push1;
     int push2;
     int pull1;
     int pull2;
+    int rc;
+    int val;
+    int i;
+    int n1;
+    int n2;
+    uint32_t k1;
+    uint32_t k2;
+    size_t sz;
+    char key [16];
+    char socket_address [128];
 
     /*  Test fan-out. */
 
@@ -76,6 +177,248 @@ int main ()
     test_close (push1);
     test_close (push2);
 
+    /*  Test least-loaded fan-out. */
+
+    push1 = test_socket (AF_SP, NN_PUSH);
+    sz = sizeof (val);
+    rc = nn_getsockopt (push1, NN_PUSH, NN_PUSH_LB_POLICY, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == NN_LB_ROUND_ROBIN);
+    val = 42;
+    rc = nn_setsockopt (push1, NN_PUSH, NN_PUSH_LB_POLICY, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = NN_LB_LEAST_LOADED;
+    test_setsockopt (push1, NN_PUSH, NN_PUSH_LB_POLICY, &val, sizeof (val));
+    sz = sizeof (val);
+    rc = nn_getsockopt (push1, NN_PUSH, NN_PUSH_LB_POLICY, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == NN_LB_LEAST_LOADED);
+
+    test_bind (push1, SOCKET_ADDRESS);
+    pull1 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull1, SOCKET_ADDRESS);
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull2, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    /*  With no load on either pipe the messages are still spread evenly. */
+    test_send (push1, "ABC");
+    test_send (push1, "DEF");
+
+    test_recv (pull1, "ABC");
+    test_recv (pull2, "DEF");
+
+    test_close (push1);
+    test_close (pull1);
+    test_close (pull2);
+
+    /*  Peer that was slow recently is avoided. The first puller lets only
+        a single message in flight and is slow to receive it. */
+    push1 = test_socket (AF_SP, NN_PUSH);
+    val = NN_LB_LEAST_LOADED;
+    test_setsockopt (push1, NN_PUSH, NN_PUSH_LB_POLICY, &val, sizeof (val));
+    pull1 = test_socket (AF_SP, NN_PULL);
+    val = 1;
+    test_setsockopt (pull1, NN_SOL_SOCKET, NN_RCVCREDIT, &val, sizeof (val));
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv) + 1);
+    test_bind (pull1, socket_address);
+    test_connect (push1, socket_address);
+    nn_sleep (100);
+    test_send (push1, "ABC");
+    nn_sleep (100);
+    test_recv (pull1, "ABC");
+
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv) + 2);
+    test_bind (pull2, socket_address);
+    test_connect (push1, socket_address);
+    nn_sleep (100);
+    for (i = 0; i != 10; ++i)
+        test_send (push1, "DEF");
+    nn_sleep (100);
+    nn_assert (drain (pull1) == 0);
+    nn_assert (drain (pull2) == 10);
+
+    test_close (push1);
+    test_close (pull1);
+    test_close (pull2);
+
+    /*  Test consistent hashing fan-out. */
+
+    push1 = test_socket (AF_SP, NN_PUSH);
+    val = NN_LB_CONSISTENT_HASH;
+    test_setsockopt (push1, NN_PUSH, NN_PUSH_LB_POLICY, &val, sizeof (val));
+    test_bind (push1, SOCKET_ADDRESS);
+    pull1 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull1, SOCKET_ADDRESS);
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull2, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    /*  Messages with the same key always go to the same peer. */
+    for (i = 0; i != 10; ++i)
+        send_keyed (push1, "KEY", "ABC");
+    nn_sleep (10);
+    n1 = drain (pull1);
+    n2 = drain (pull2);
+    nn_assert ((n1 == 10 && n2 == 0) || (n1 == 0 && n2 == 10));
+
+    /*  Different keys are spread among the peers. */
+    for (i = 0; i != 32; ++i) {
+        sprintf (key, "key-%d", i);
+        send_keyed (push1, key, "ABC");
+    }
+    nn_sleep (10);
+    n1 = drain (pull1);
+    n2 = drain (pull2);
+    nn_assert (n1 > 0 && n2 > 0 && n1 + n2 == 32);
+
+    /*  Messages without the key are still round-robined. */
+    test_send (push1, "ABC");
+    test_send (push1, "DEF");
+    nn_sleep (10);
+    nn_assert (drain (pull1) == 1);
+    nn_assert (drain (pull2) == 1);
+
+    /*  Malformed or truncated keys are ignored, too. */
+    send_badkey (push1, 1, "ABC");
+    send_badkey (push1, NN_CMSG_LEN (1000), "DEF");
+    nn_sleep (10);
+    nn_assert (drain (pull1) == 1);
+    nn_assert (drain (pull2) == 1);
+
+    test_close (push1);
+    test_close (pull1);
+    test_close (pull2);
+
+    /*  Keys map to the same peers after the peers reconnect to a bound
+        socket, even in a different order. The peers connect from different
+        local addresses to be told apart. */
+    push1 = test_socket (AF_SP, NN_PUSH);
+    val = NN_LB_CONSISTENT_HASH;
+    test_setsockopt (push1, NN_PUSH, NN_PUSH_LB_POLICY, &val, sizeof (val));
+    sprintf (socket_address, "tcp://127.0.0.1:%d",
+        get_test_port (argc, argv) + 3);
+    test_bind (push1, socket_address);
+    sprintf (socket_address, "tcp://127.0.0.2;127.0.0.1:%d",
+        get_test_port (argc, argv) + 3);
+    pull1 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull1, socket_address);
+    nn_sleep (100);
+    sprintf (socket_address, "tcp://127.0.0.3;127.0.0.1:%d",
+        get_test_port (argc, argv) + 3);
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull2, socket_address);
+    nn_sleep (100);
+    for (i = 0; i != 32; ++i) {
+        sprintf (key, "key-%d", i);
+        send_keyed (push1, key, key);
+    }
+    nn_sleep (100);
+    k1 = keys (pull1);
+    k2 = keys (pull2);
+    nn_assert (k1 != 0 && k2 != 0 && (k1 | k2) == 0xffffffff);
+    test_close (pull1);
+    test_close (pull2);
+
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull2, socket_address);
+    nn_sleep (100);
+    sprintf (socket_address, "tcp://127.0.0.2;127.0.0.1:%d",
+        get_test_port (argc, argv) + 3);
+    pull1 = test_socket (AF_SP, NN_PULL);
+    test_connect (pull1, socket_address);
+    nn_sleep (100);
+    for (i = 0; i != 32; ++i) {
+        sprintf (key, "key-%d", i);
+        send_keyed (push1, key, key);
+    }
+    nn_sleep (100);
+    nn_assert (keys (pull1) == k1);
+    nn_assert (keys (pull2) == k2);
+
+    test_close (push1);
+    test_close (pull1);
+    test_close (pull2);
+
+    /*  Test conflation. Only the newest message is kept. */
+
+    pull1 = test_socket (AF_SP, NN_PULL);
+    sz = sizeof (val);
+    rc = nn_getsockopt (pull1, NN_PULL, NN_PULL_CONFLATE, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 0);
+    val = 1;
+    test_setsockopt (pull1, NN_PULL, NN_PULL_CONFLATE, &val, sizeof (val));
+    test_bind (pull1, SOCKET_ADDRESS);
+    push1 = test_socket (AF_SP, NN_PUSH);
+    test_connect (push1, SOCKET_ADDRESS);
+    push2 = test_socket (AF_SP, NN_PUSH);
+    test_connect (push2, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    test_send (push1, "ABC");
+    test_send (push2, "DEF");
+    nn_sleep (10);
+    test_send (push1, "GHI");
+    nn_sleep (10);
+    test_recv (pull1, "GHI");
+    nn_assert (drain (pull1) == 0);
+
+    test_close (pull1);
+    test_close (push1);
+    test_close (push2);
+
+    /*  Test credit-based flow control. The pusher sends only as many
+        messages as the puller has granted credits for. */
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+    pull1 = test_socket (AF_SP, NN_PULL);
+    val = -1;
+    rc = nn_setsockopt (pull1, NN_SOL_SOCKET, NN_RCVCREDIT, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 4;
+    test_setsockopt (pull1, NN_SOL_SOCKET, NN_RCVCREDIT, &val, sizeof (val));
+    test_bind (pull1, socket_address);
+    push1 = test_socket (AF_SP, NN_PUSH);
+    val = 100;
+    test_setsockopt (push1, NN_SOL_SOCKET, NN_SNDTIMEO, &val, sizeof (val));
+    test_connect (push1, socket_address);
+    nn_sleep (100);
+
+    for (i = 0; i != 4; ++i)
+        test_send (push1, "ABC");
+    rc = nn_send (push1, "ABC", 3, 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+
+    /*  Credits are granted back in batches of half the window. */
+    test_recv (pull1, "ABC");
+    test_recv (pull1, "ABC");
+    nn_sleep (10);
+    test_send (push1, "DEF");
+    test_send (push1, "DEF");
+    rc = nn_send (push1, "DEF", 3, 0);
+    nn_assert (rc < 0 && nn_errno () == ETIMEDOUT);
+
+    /*  Peer that ran out of credits is skipped by the load balancer. */
+    pull2 = test_socket (AF_SP, NN_PULL);
+    test_bind (pull2, SOCKET_ADDRESS);
+    test_connect (push1, SOCKET_ADDRESS);
+    nn_sleep (10);
+    test_send (push1, "GHI");
+    test_recv (pull2, "GHI");
+
+    test_recv (pull1, "ABC");
+    test_recv (pull1, "ABC");
+    test_recv (pull1, "DEF");
+    test_recv (pull1, "DEF");
+
+    test_close (pull1);
+    test_close (push1);
+    test_close (pull2);
+
     return 0;
 }
 
@@ -0,0 +1,153 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+
+#include "testutil.h"
+
+#include <stdio.h>
+
+/*  Test of the persistent pollset. */
+
+#define NPAIRS 50
+
+int main ()
+{
+    int rc;
+    int i;
+    int sub;
+    int a [NPAIRS];
+    int b [NPAIRS];
+    char addr [32];
+    struct nn_pollset *ps;
+    struct nn_pollfd fds [NPAIRS];
+
+    for (i = 0; i != NPAIRS; ++i) {
+        sprintf (addr, "inproc://pollset%d", i);
+        a [i] = test_socket (AF_SP, NN_PAIR);
+        test_bind (a [i], addr);
+        b [i] = test_socket (AF_SP, NN_PAIR);
+        test_connect (b [i], addr);
+    }
+
+    ps = nn_pollset_create ();
+    nn_assert (ps);
+    for (i = 0; i != NPAIRS; ++i) {
+        rc = nn_pollset_add (ps, a [i], NN_POLLIN);
+        errno_assert (rc == 0);
+    }
+
+    /*  Nothing to receive yet. */
+    rc = nn_pollset_wait (ps, fds, NPAIRS, 0);
+    errno_assert (rc == 0);
+    rc = nn_pollset_wait (ps, fds, NPAIRS, 10);
+    errno_assert (rc == 0);
+
+    /*  Only the sockets with pending messages are reported. */
+    test_send (b [3], "ABC");
+    test_send (b [17], "ABC");
+    test_send (b [42], "ABC");
+    nn_sleep (10);
+    rc = nn_pollset_wait (ps, fds, NPAIRS, 1000);
+    errno_assert (rc == 3);
+    for (i = 0; i != 3; ++i) {
+        nn_assert (fds [i].fd == a [3] || fds [i].fd == a [17] ||
+            fds [i].fd == a [42]);
+        nn_assert (fds [i].events == NN_POLLIN);
+        nn_assert (fds [i].revents == NN_POLLIN);
+    }
+
+    /*  Readiness is level-triggered. If the output is too small the rest
+        of the sockets is reported by the next call. */
+    rc = nn_pollset_wait (ps, fds, 2, 0);
+    errno_assert (rc == 2);
+    test_recv (fds [0].fd, "ABC");
+    test_recv (fds [1].fd, "ABC");
+    rc = nn_pollset_wait (ps, fds, 2, 0);
+    errno_assert (rc == 1);
+    test_recv (fds [0].fd, "ABC");
+    rc = nn_pollset_wait (ps, fds, NPAIRS, 0);
+    errno_assert (rc == 0);
+
+    /*  Both directions are reported in a single entry. */
+    rc = nn_pollset_add (ps, a [5], NN_POLLIN | NN_POLLOUT);
+    errno_assert (rc == 0);
+    test_send (b [5], "ABC");
+    nn_sleep (10);
+    rc = nn_pollset_wait (ps, fds, NPAIRS, 1000);
+    errno_assert (rc == 1);
+    nn_assert (fds [0].fd == a [5]);
+    nn_assert (fds [0].events == (NN_POLLIN | NN_POLLOUT));
+    nn_assert (fds [0].revents == (NN_POLLIN | NN_POLLOUT));
+
+    /*  Re-adding replaces the events. */
+    rc = nn_pollset_add (ps, a [5], NN_POLLOUT);
+    errno_assert (rc == 0);
+    rc = nn_pollset_wait (ps, fds, NPAIRS, 0);
+    errno_assert (rc == 1);
+    nn_assert (fds [0].fd == a [5] && fds [0].revents == NN_POLLOUT);
+
+    /*  Removed sockets are not reported. */
+    rc = nn_pollset_rm (ps, a [5]);
+    errno_assert (rc == 0);
+    rc = nn_pollset_wait (ps, fds, NPAIRS, 0);
+    errno_assert (rc == 0);
+    test_recv (a [5], "ABC");
+    rc = nn_pollset_rm (ps, a [5]);
+    nn_assert (rc == -1 && nn_errno () == ENOENT);
+
+    /*  Invalid arguments. */
+    rc = nn_pollset_add (ps, -1, NN_POLLIN);
+    nn_assert (rc == -1 && nn_errno () == EBADF);
+    rc = nn_pollset_add (ps, a [0], 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    rc = nn_pollset_wait (ps, fds, 0, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
+    /*  SUB socket can't send. Failed registration leaves nothing behind. */
+    sub = test_socket (AF_SP, NN_SUB);
+    rc = nn_pollset_add (ps, sub, NN_POLLIN | NN_POLLOUT);
+    nn_assert (rc == -1 && nn_errno () == ENOPROTOOPT);
+    rc = nn_pollset_rm (ps, sub);
+    nn_assert (rc == -1 && nn_errno () == ENOENT);
+    test_close (sub);
+
+    /*  Remaining sockets are still polled correctly. */
+    test_send (b [NPAIRS - 1], "DEF");
+    nn_sleep (10);
+    rc = nn_pollset_wait (ps, fds, NPAIRS, 1000);
+    errno_assert (rc == 1);
+    nn_assert (fds [0].fd == a [NPAIRS - 1]);
+    test_recv (a [NPAIRS - 1], "DEF");
+
+    rc = nn_pollset_close (ps);
+    errno_assert (rc == 0);
+
+    for (i = 0; i != NPAIRS; ++i) {
+        test_close (b [i]);
+        test_close (a [i]);
+    }
+
+    return 0;
+}
@@ -34,6 +34,7 @@ int main ()
     int pub2;
     int sub1;
     int sub2;
+    int val;
     char buf [8];
     size_t sz;
 
@@ -83,6 +84,54 @@ int main ()
     test_close (pub1);
     test_close (sub1);
 
+    /*  Test conflation. Only the newest message for each subscription
+        is kept. */
+
+    sub1 = test_socket (AF_SP, NN_SUB);
+    sz = sizeof (val);
+    rc = nn_getsockopt (sub1, NN_SUB, NN_SUB_CONFLATE, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 0);
+    val = 2;
+    rc = nn_setsockopt (sub1, NN_SUB, NN_SUB_CONFLATE, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 1;
+    test_setsockopt (sub1, NN_SUB, NN_SUB_CONFLATE, &val, sizeof (val));
+    test_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "A", 1);
+    test_setsockopt (sub1, NN_SUB, NN_SUB_SUBSCRIBE, "B", 1);
+    test_bind (sub1, SOCKET_ADDRESS);
+    pub1 = test_socket (AF_SP, NN_PUB);
+    test_connect (pub1, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    test_send (pub1, "A1");
+    test_send (pub1, "B1");
+    test_send (pub1, "A2");
+    test_send (pub1, "C1");
+    test_send (pub1, "A3");
+    nn_sleep (10);
+    test_recv (sub1, "A3");
+    test_recv (sub1, "B1");
+    rc = nn_recv (sub1, buf, sizeof (buf), NN_DONTWAIT);
+    nn_assert (rc < 0 && nn_errno () == EAGAIN);
+
+    test_send (pub1, "B2");
+    test_recv (sub1, "B2");
+
+    /*  Messages already conflated are delivered even when conflation is
+        switched off. */
+    test_send (pub1, "A4");
+    test_send (pub1, "A5");
+    nn_sleep (10);
+    val = 0;
+    test_setsockopt (sub1, NN_SUB, NN_SUB_CONFLATE, &val, sizeof (val));
+    test_send (pub1, "A6");
+    test_recv (sub1, "A5");
+    test_recv (sub1, "A6");
+
+    test_close (pub1);
+    test_close (sub1);
+
     return 0;
 }
 
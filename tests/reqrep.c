@@ -27,6 +27,56 @@
 
 #define SOCKET_ADDRESS "inproc://test"
 
+/*  Receives a request along with its header. */
+static void recv_with_hdr (int sock, const char *data, void **control)
+{
+    int rc;
+    char buf [16];
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof (buf);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_recvmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+    nn_assert (memcmp (buf, data, strlen (data)) == 0);
+}
+
+/*  Sends a reply to the request identified by the header. */
+static void send_with_hdr (int sock, const char *data, void *control)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_sendmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+}
+
+/*  Extracts the request ID from the header. */
+static uint32_t hdr_id (void *control)
+{
+    struct nn_cmsghdr *cmsg;
+    uint8_t *ptr;
+
+    cmsg = (struct nn_cmsghdr*) control;
+    nn_assert (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_HDR);
+    ptr = NN_CMSG_DATA (cmsg) + sizeof (size_t);
+    nn_assert (*(size_t*) NN_CMSG_DATA (cmsg) == 4);
+    return (((uint32_t) ptr [0]) << 24) | (((uint32_t) ptr [1]) << 16) |
+        (((uint32_t) ptr [2]) << 8) | ((uint32_t) ptr [3]);
+}
+
 int main ()
 {
     int rc;
@@ -37,6 +87,15 @@ int main ()
     int resend_ivl;
     char buf [7];
     int timeo;
+    int val;
+    char req [5];
+    size_t sz;
+    uint32_t id;
+    uint32_t ids [4];
+    void *hdrs [4];
+    void *hdr;
+    struct nn_iovec iov;
+    struct nn_msghdr msghdr;
 
     /*  Test req/rep with full socket types. */
     rep1 = test_socket (AF_SP, NN_REP);
@@ -89,6 +148,42 @@ int main ()
     test_close (rep1);
     test_close (req1);
 
+    /*  Check least-loaded balancing of requests. The peer that have already
+    replied gets the next request even though it's not its turn. */
+    req1 = test_socket (AF_SP_RAW, NN_REQ);
+    val = NN_LB_LEAST_LOADED;
+    test_setsockopt (req1, NN_REQ, NN_REQ_LB_POLICY, &val, sizeof (val));
+    test_bind (req1, SOCKET_ADDRESS);
+    rep1 = test_socket (AF_SP, NN_REP);
+    test_connect (rep1, SOCKET_ADDRESS);
+    rep2 = test_socket (AF_SP, NN_REP);
+    test_connect (rep2, SOCKET_ADDRESS);
+    timeo = 100;
+    test_setsockopt (rep1, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+
+    memcpy (req, "\x80\x00\x00\x01" "A", 5);
+    rc = nn_send (req1, req, 5, 0);
+    errno_assert (rc == 5);
+    memcpy (req, "\x80\x00\x00\x02" "B", 5);
+    rc = nn_send (req1, req, 5, 0);
+    errno_assert (rc == 5);
+
+    test_recv (rep2, "B");
+    test_send (rep2, "B");
+    test_recv (req1, "B");
+
+    memcpy (req, "\x80\x00\x00\x03" "C", 5);
+    rc = nn_send (req1, req, 5, 0);
+    errno_assert (rc == 5);
+
+    test_recv (rep2, "C");
+    test_recv (rep1, "A");
+    test_drop (rep1, ETIMEDOUT);
+
+    test_close (rep2);
+    test_close (rep1);
+    test_close (req1);
+
     /*  Test re-sending of the request. */
     rep1 = test_socket (AF_SP, NN_REP);
     test_bind (rep1, SOCKET_ADDRESS);
@@ -173,6 +268,146 @@ int main ()
     test_close (req1);
     test_close (rep1);
 
+    /*  Test pipelined requests. */
+    rep1 = test_socket (AF_SP, NN_REP);
+    val = 1;
+    test_setsockopt (rep1, NN_REP, NN_REP_PIPELINE, &val, sizeof (val));
+    test_bind (rep1, SOCKET_ADDRESS);
+    req1 = test_socket (AF_SP, NN_REQ);
+    val = -1;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_PIPELINE, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    val = 4;
+    test_setsockopt (req1, NN_REQ, NN_REQ_PIPELINE, &val, sizeof (val));
+    sz = sizeof (val);
+    rc = nn_getsockopt (req1, NN_REQ, NN_REQ_PIPELINE, &val, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (val) && val == 4);
+    test_connect (req1, SOCKET_ADDRESS);
+
+    /*  Nothing was sent, there's nothing to receive. */
+    rc = nn_recv (req1, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == EFSM);
+
+    /*  Up to four requests can be in flight. */
+    test_send (req1, "A");
+    sz = sizeof (ids [0]);
+    rc = nn_getsockopt (req1, NN_REQ, NN_REQ_LAST_ID, &ids [0], &sz);
+    errno_assert (rc == 0);
+    test_send (req1, "B");
+    sz = sizeof (ids [1]);
+    rc = nn_getsockopt (req1, NN_REQ, NN_REQ_LAST_ID, &ids [1], &sz);
+    errno_assert (rc == 0);
+    test_send (req1, "C");
+    test_send (req1, "D");
+    rc = nn_send (req1, "E", 1, NN_DONTWAIT);
+    nn_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  The mode can't be switched with requests in flight. */
+    val = 0;
+    rc = nn_setsockopt (req1, NN_REQ, NN_REQ_PIPELINE, &val, sizeof (val));
+    nn_assert (rc < 0 && nn_errno () == EFSM);
+
+    /*  Replies sent in reverse order are received in reverse order. */
+    recv_with_hdr (rep1, "A", &hdrs [0]);
+    recv_with_hdr (rep1, "B", &hdrs [1]);
+    recv_with_hdr (rep1, "C", &hdrs [2]);
+    recv_with_hdr (rep1, "D", &hdrs [3]);
+    send_with_hdr (rep1, "d", hdrs [3]);
+    send_with_hdr (rep1, "c", hdrs [2]);
+    test_recv (req1, "d");
+    test_recv (req1, "c");
+
+    /*  Once replies are retrieved, new requests can be sent. The request ID
+        is passed along with the reply. */
+    test_send (req1, "E");
+    send_with_hdr (rep1, "b", hdrs [1]);
+    recv_with_hdr (req1, "b", &hdr);
+    id = hdr_id (hdr);
+    nn_assert (id == ids [1]);
+    nn_freemsg (hdr);
+    send_with_hdr (rep1, "a", hdrs [0]);
+    recv_with_hdr (req1, "a", &hdr);
+    nn_assert (hdr_id (hdr) == ids [0]);
+    nn_freemsg (hdr);
+
+    /*  Without the header the reply goes to the last request received. */
+    test_recv (rep1, "E");
+    test_send (rep1, "e");
+    test_recv (req1, "e");
+
+    /*  Pipelined requests are re-sent if not replied to. Duplicate replies
+        are dropped. */
+    resend_ivl = 100;
+    test_setsockopt (req1, NN_REQ, NN_REQ_RESEND_IVL,
+        &resend_ivl, sizeof (resend_ivl));
+    test_send (req1, "F");
+    recv_with_hdr (rep1, "F", &hdrs [0]);
+    recv_with_hdr (rep1, "F", &hdrs [1]);
+    send_with_hdr (rep1, "f", hdrs [0]);
+    send_with_hdr (rep1, "f", hdrs [1]);
+    test_recv (req1, "f");
+    timeo = 100;
+    test_setsockopt (req1, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    rc = nn_recv (req1, buf, sizeof (buf), 0);
+    nn_assert (rc == -1 && nn_errno () == EFSM);
+
+    /*  A request sent with a shorter re-send interval is re-sent first. Let
+        the timer armed for the previous request expire beforehand. */
+    nn_sleep (300);
+    timeo = 1000;
+    test_setsockopt (rep1, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    resend_ivl = 10000;
+    test_setsockopt (req1, NN_REQ, NN_REQ_RESEND_IVL,
+        &resend_ivl, sizeof (resend_ivl));
+    test_send (req1, "H");
+    resend_ivl = 100;
+    test_setsockopt (req1, NN_REQ, NN_REQ_RESEND_IVL,
+        &resend_ivl, sizeof (resend_ivl));
+    test_send (req1, "I");
+    recv_with_hdr (rep1, "H", &hdrs [0]);
+    recv_with_hdr (rep1, "I", &hdrs [1]);
+    recv_with_hdr (rep1, "I", &hdrs [2]);
+    send_with_hdr (rep1, "h", hdrs [0]);
+    send_with_hdr (rep1, "i", hdrs [1]);
+    nn_freemsg (hdrs [2]);
+    test_recv (req1, "h");
+    test_recv (req1, "i");
+
+    /*  Drain the re-sent copies of the requests. */
+    timeo = 200;
+    test_setsockopt (rep1, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    while (nn_recv (rep1, buf, sizeof (buf), 0) >= 0)
+        ;
+
+    /*  The request ID is assigned by the socket. The user can't supply it. */
+    test_send (req1, "J");
+    recv_with_hdr (rep1, "J", &hdr);
+    iov.iov_base = "K";
+    iov.iov_len = 1;
+    msghdr.msg_iov = &iov;
+    msghdr.msg_iovlen = 1;
+    msghdr.msg_control = &hdr;
+    msghdr.msg_controllen = NN_MSG;
+    rc = nn_sendmsg (req1, &msghdr, 0);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    test_send (rep1, "j");
+    test_recv (req1, "j");
+
+    while (nn_recv (rep1, buf, sizeof (buf), 0) >= 0)
+        ;
+
+    /*  With no requests in flight, the lock-step mode can be restored. */
+    val = 0;
+    test_setsockopt (req1, NN_REQ, NN_REQ_PIPELINE, &val, sizeof (val));
+    test_send (req1, "G");
+    test_recv (rep1, "G");
+    test_send (rep1, "g");
+    test_recv (req1, "g");
+
+    test_close (req1);
+    test_close (rep1);
+
     return 0;
 }
 
@@ -26,18 +26,35 @@
 
 #include "testutil.h"
 
+#include <string.h>
+
 int main (int argc, const char *argv[])
 {
     int rep1;
     int req1;
+    int eid;
+    int rc;
+    int i;
     char socket_address[128];
+    uint64_t values [7];
+    const int rtt [] = {
+        NN_STAT_REQ_RTT_COUNT,
+        NN_STAT_REQ_RTT_MEAN,
+        NN_STAT_REQ_RTT_P50,
+        NN_STAT_REQ_RTT_P90,
+        NN_STAT_REQ_RTT_P99,
+        NN_STAT_REQ_RTT_P999,
+        NN_STAT_REQ_RTT_MAX
+    };
+    const int bad [] = {NN_STAT_REQ_RTT_COUNT, 42};
+    struct nn_pipe_stats pipes [2];
 
     test_addr_from(socket_address, "tcp", "127.0.0.1",
             get_test_port(argc, argv));
 
     /*  Test req/rep with full socket types. */
     rep1 = test_socket (AF_SP, NN_REP);
-    test_bind (rep1, socket_address);
+    eid = test_bind (rep1, socket_address);
     nn_sleep (100);
 
     req1 = test_socket (AF_SP, NN_REQ);
@@ -84,6 +101,56 @@ int main (int argc, const char *argv[])
     nn_assert (nn_get_statistic(rep1, NN_STAT_MESSAGES_RECEIVED) == 1);
     nn_assert (nn_get_statistic(rep1, NN_STAT_BYTES_RECEIVED) == 3);
 
+    /*  Latency histograms. */
+    nn_assert (nn_get_statistic(req1, NN_STAT_SEND_LATENCY_COUNT) == 1);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_SEND_LATENCY_COUNT) == 1);
+    nn_assert (nn_get_statistic(req1, NN_STAT_RECV_LATENCY_COUNT) == 1);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_RECV_LATENCY_COUNT) == 1);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_REQ_RTT_COUNT) == 0);
+
+    /*  The request was waiting in rep1 while the test was sleeping. */
+    nn_assert (nn_get_statistic(rep1, NN_STAT_RECV_LATENCY_P50) >= 50000);
+    nn_assert (nn_get_statistic(rep1, NN_STAT_RECV_LATENCY_MAX) >= 50000);
+
+    rc = nn_get_statistics (req1, rtt, values, 7);
+    errno_assert (rc == 0);
+    nn_assert (values [0] == 1);
+    nn_assert (values [1] >= 50000);
+    for (i = 2; i != 6; ++i)
+        nn_assert (values [i] >= 50000 && values [i] <= values [i + 1]);
+
+    rc = nn_get_statistics (req1, bad, values, 2);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+    nn_assert (nn_get_statistic(req1, 42) == (uint64_t) -1);
+    nn_assert (nn_get_statistic(req1, NN_STAT_REQ_RTT_COUNT + 7) ==
+        (uint64_t) -1);
+
+    /*  Per-pipe statistics. */
+    rc = nn_get_pipe_statistics (rep1, NULL, 0);
+    nn_assert (rc == 1);
+    rc = nn_get_pipe_statistics (rep1, pipes, 2);
+    nn_assert (rc == 1);
+    nn_assert (pipes [0].id > 0);
+    nn_assert (pipes [0].eid == eid);
+    nn_assert (strncmp (pipes [0].addr, "tcp://127.0.0.1:", 16) == 0);
+    /*  Pipe statistics include the 4-byte request ID. */
+    nn_assert (pipes [0].messages_sent == 1);
+    nn_assert (pipes [0].bytes_sent == 6);
+    nn_assert (pipes [0].messages_received == 1);
+    nn_assert (pipes [0].bytes_received == 7);
+    nn_assert (pipes [0].queued_bytes == 0);
+
+    rc = nn_get_pipe_statistics (req1, pipes, 1);
+    nn_assert (rc == 1);
+    nn_assert (strcmp (pipes [0].addr, socket_address) == 0);
+    nn_assert (pipes [0].messages_sent == 1);
+    nn_assert (pipes [0].bytes_sent == 7);
+    nn_assert (pipes [0].messages_received == 1);
+    nn_assert (pipes [0].bytes_received == 6);
+
+    rc = nn_get_pipe_statistics (req1, NULL, 1);
+    nn_assert (rc == -1 && nn_errno () == EINVAL);
+
     test_close (req1);
 
     nn_sleep (100);
@@ -91,6 +158,7 @@ int main (int argc, const char *argv[])
     nn_assert (nn_get_statistic(rep1, NN_STAT_ACCEPTED_CONNECTIONS) == 1);
     nn_assert (nn_get_statistic(rep1, NN_STAT_ESTABLISHED_CONNECTIONS) == 0);
     nn_assert (nn_get_statistic(rep1, NN_STAT_CURRENT_CONNECTIONS) == 0);
+    nn_assert (nn_get_pipe_statistics (rep1, pipes, 2) == 0);
 
     test_close (rep1);
 
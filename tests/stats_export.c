@@ -0,0 +1,101 @@
+/*
+    Copyright (c) 2013 Martin Sustrik  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/pair.h"
+#include "../src/pubsub.h"
+
+#include "testutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*  Test the statistics reporter enabled by NN_STATISTICS_SOCKET. */
+
+#define STATISTICS_ADDRESS "inproc://statistics"
+#define SOCKET_ADDRESS "inproc://a"
+
+int main ()
+{
+    int sub;
+    int pair1;
+    int pair2;
+    int rc;
+    int i;
+    int timeo;
+    int found;
+    char *buf;
+
+#if defined NN_HAVE_WINDOWS
+    _putenv ("NN_STATISTICS_SOCKET=" STATISTICS_ADDRESS);
+    _putenv ("NN_STATISTICS_INTERVAL=50");
+    _putenv ("NN_APPLICATION_NAME=app");
+#else
+    setenv ("NN_STATISTICS_SOCKET", STATISTICS_ADDRESS, 1);
+    setenv ("NN_STATISTICS_INTERVAL", "50", 1);
+    setenv ("NN_APPLICATION_NAME", "app", 1);
+#endif
+
+    sub = test_socket (AF_SP, NN_SUB);
+    test_setsockopt (sub, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+    timeo = 1000;
+    test_setsockopt (sub, NN_SOL_SOCKET, NN_RCVTIMEO, &timeo, sizeof (timeo));
+    test_bind (sub, STATISTICS_ADDRESS);
+
+    pair1 = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (pair1, NN_SOL_SOCKET, NN_SOCKET_NAME, "pair1", 5);
+    test_bind (pair1, SOCKET_ADDRESS);
+    pair2 = test_socket (AF_SP, NN_PAIR);
+    test_connect (pair2, SOCKET_ADDRESS);
+    test_send (pair1, "ABC");
+    test_recv (pair2, "ABC");
+
+    /*  Wait for the report on pair1. The reports of other sockets
+        are ignored. */
+    found = 0;
+    for (i = 0; i != 100 && !found; ++i) {
+        rc = nn_recv (sub, &buf, NN_MSG, 0);
+        errno_assert (rc >= 0);
+        if (rc > 0 && memcmp (buf + rc - 1, "\n", 1) == 0) {
+            buf [rc - 1] = 0;
+            if (strstr (buf, " app pair1 ")) {
+                nn_assert (strstr (buf, "\nMESSAGES_SENT 1\n"));
+                nn_assert (strstr (buf, "\nBYTES_SENT 3\n"));
+                nn_assert (strstr (buf, "\nMESSAGES_RECEIVED 0\n"));
+                nn_assert (strstr (buf, "\nSEND_LATENCY_COUNT 1\n"));
+                found = 1;
+            }
+        }
+        nn_freemsg (buf);
+    }
+    nn_assert (found);
+
+    test_close (pair2);
+    test_close (pair1);
+    test_close (sub);
+
+    /*  The library can be re-initialised with the reporter running. */
+    sub = test_socket (AF_SP, NN_SUB);
+    test_close (sub);
+
+    return 0;
+}
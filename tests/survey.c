@@ -25,9 +25,67 @@
 #include "../src/survey.h"
 
 #include "testutil.h"
+#include "../src/utils/stopwatch.c"
+
+#include <string.h>
 
 #define SOCKET_ADDRESS "inproc://test"
 
+/*  Receives a message along with its header. */
+static void recv_with_hdr (int sock, const char *data, void **control)
+{
+    int rc;
+    char buf [16];
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof (buf);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_recvmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+    nn_assert (memcmp (buf, data, strlen (data)) == 0);
+}
+
+/*  Sends a response to the survey identified by the header. */
+static void send_with_hdr (int sock, const char *data, void *control)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_sendmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+}
+
+/*  Receives a response and returns ID of the survey it belongs to. */
+static uint32_t recv_survey_id (int sock, const char *data)
+{
+    void *control;
+    struct nn_cmsghdr *cmsg;
+    uint8_t *ptr;
+    uint32_t id;
+
+    recv_with_hdr (sock, data, &control);
+    cmsg = (struct nn_cmsghdr*) control;
+    nn_assert (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_HDR);
+    nn_assert (*(size_t*) NN_CMSG_DATA (cmsg) == 4);
+    ptr = NN_CMSG_DATA (cmsg) + sizeof (size_t);
+    id = (((uint32_t) ptr [0]) << 24) | (((uint32_t) ptr [1]) << 16) |
+        (((uint32_t) ptr [2]) << 8) | ((uint32_t) ptr [3]);
+    nn_freemsg (control);
+    return id;
+}
+
 int main ()
 {
     int rc;
@@ -36,7 +94,16 @@ int main ()
     int respondent2;
     int respondent3;
     int deadline;
+    int quorum;
+    int concurrent;
+    uint32_t id1;
+    uint32_t id2;
+    void *hdr1;
+    void *hdr2;
+    size_t sz;
     char buf [7];
+    struct nn_stopwatch stopwatch;
+    uint64_t elapsed;
 
     /*  Test a simple survey with three respondents. */
     surveyor = test_socket (AF_SP, NN_SURVEYOR);
@@ -90,11 +157,184 @@ int main ()
     rc = nn_recv (surveyor, buf, sizeof (buf), 0);
     errno_assert (rc == -1 && nn_errno () == EFSM);
 
+    /*  Test completing the survey once all the respondents answered, well
+        before the deadline. */
+    deadline = 5000;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    quorum = -2;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_QUORUM,
+        &quorum, sizeof (quorum));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    quorum = NN_SURVEYOR_QUORUM_ALL;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_QUORUM,
+        &quorum, sizeof (quorum));
+    sz = sizeof (quorum);
+    rc = nn_getsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_QUORUM,
+        &quorum, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (quorum) && quorum == NN_SURVEYOR_QUORUM_ALL);
+
+    /*  Drop the surveys the respondents didn't answer to. */
+    test_recv (respondent1, "ABC");
+    test_recv (respondent2, "ABC");
+    test_recv (respondent3, "ABC");
+
+    nn_stopwatch_init (&stopwatch);
+    test_send (surveyor, "ABC");
+    test_recv (respondent1, "ABC");
+    test_send (respondent1, "DEF");
+    test_recv (respondent2, "ABC");
+    test_send (respondent2, "DEF");
+    test_recv (respondent3, "ABC");
+    test_send (respondent3, "DEF");
+    test_recv (surveyor, "DEF");
+    test_recv (surveyor, "DEF");
+    test_recv (surveyor, "DEF");
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    nn_assert (elapsed < 1000000);
+
+    /*  Test completing the survey once the quorum is reached. The late
+        response is not delivered. */
+    quorum = 2;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_QUORUM,
+        &quorum, sizeof (quorum));
+    nn_stopwatch_init (&stopwatch);
+    test_send (surveyor, "ABC");
+    test_recv (respondent1, "ABC");
+    test_send (respondent1, "DEF");
+    test_recv (respondent2, "ABC");
+    test_send (respondent2, "DEF");
+    test_recv (surveyor, "DEF");
+    test_recv (surveyor, "DEF");
+    test_recv (respondent3, "ABC");
+    test_send (respondent3, "GHI");
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    elapsed = nn_stopwatch_term (&stopwatch);
+    nn_assert (elapsed < 1000000);
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == EFSM);
+
     test_close (surveyor);
     test_close (respondent1);
     test_close (respondent2);
     test_close (respondent3);
 
+    /*  Survey sent to nobody is complete straight away. */
+    surveyor = test_socket (AF_SP, NN_SURVEYOR);
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    quorum = NN_SURVEYOR_QUORUM_ALL;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_QUORUM,
+        &quorum, sizeof (quorum));
+    test_send (surveyor, "ABC");
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    test_close (surveyor);
+
+    /*  Test overlapping surveys. */
+    surveyor = test_socket (AF_SP, NN_SURVEYOR);
+    concurrent = -1;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_CONCURRENT,
+        &concurrent, sizeof (concurrent));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    concurrent = 2;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_CONCURRENT,
+        &concurrent, sizeof (concurrent));
+    sz = sizeof (concurrent);
+    rc = nn_getsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_CONCURRENT,
+        &concurrent, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (concurrent) && concurrent == 2);
+    deadline = 500;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    test_bind (surveyor, SOCKET_ADDRESS);
+    respondent1 = test_socket (AF_SP_RAW, NN_RESPONDENT);
+    test_connect (respondent1, SOCKET_ADDRESS);
+    nn_sleep (10);
+
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == EFSM);
+
+    /*  Responses are demultiplexed by the survey ID. */
+    test_send (surveyor, "A");
+    sz = sizeof (id1);
+    rc = nn_getsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_LAST_ID,
+        &id1, &sz);
+    errno_assert (rc == 0);
+    test_send (surveyor, "B");
+    sz = sizeof (id2);
+    rc = nn_getsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_LAST_ID,
+        &id2, &sz);
+    errno_assert (rc == 0);
+    nn_assert (id1 != id2);
+    rc = nn_send (surveyor, "C", 1, NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+    recv_with_hdr (respondent1, "A", &hdr1);
+    recv_with_hdr (respondent1, "B", &hdr2);
+    send_with_hdr (respondent1, "b", hdr2);
+    send_with_hdr (respondent1, "a", hdr1);
+    nn_assert (recv_survey_id (surveyor, "b") == id2);
+    nn_assert (recv_survey_id (surveyor, "a") == id1);
+
+    /*  Once all the surveys are over, ETIMEDOUT is reported once. */
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == EFSM);
+
+    /*  Each survey expires on its own deadline. */
+    deadline = 100;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    test_send (surveyor, "A");
+    deadline = 1000;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    test_send (surveyor, "B");
+    sz = sizeof (id2);
+    rc = nn_getsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_LAST_ID,
+        &id2, &sz);
+    errno_assert (rc == 0);
+    recv_with_hdr (respondent1, "A", &hdr1);
+    recv_with_hdr (respondent1, "B", &hdr2);
+    nn_sleep (200);
+    send_with_hdr (respondent1, "a", hdr1);
+    send_with_hdr (respondent1, "b", hdr2);
+    nn_assert (recv_survey_id (surveyor, "b") == id2);
+    test_send (surveyor, "C");
+    rc = nn_send (surveyor, "D", 1, NN_DONTWAIT);
+    errno_assert (rc == -1 && nn_errno () == EAGAIN);
+
+    /*  Switching back to the single survey mode is possible only once all
+        the surveys are over. */
+    concurrent = 0;
+    rc = nn_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_CONCURRENT,
+        &concurrent, sizeof (concurrent));
+    nn_assert (rc < 0 && nn_errno () == EFSM);
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_CONCURRENT,
+        &concurrent, sizeof (concurrent));
+    recv_with_hdr (respondent1, "C", &hdr1);
+    nn_freemsg (hdr1);
+    deadline = 100;
+    test_setsockopt (surveyor, NN_SURVEYOR, NN_SURVEYOR_DEADLINE,
+        &deadline, sizeof (deadline));
+    test_send (surveyor, "A");
+    recv_with_hdr (respondent1, "A", &hdr1);
+    send_with_hdr (respondent1, "a", hdr1);
+    test_recv (surveyor, "a");
+    rc = nn_recv (surveyor, buf, sizeof (buf), 0);
+    errno_assert (rc == -1 && nn_errno () == ETIMEDOUT);
+
+    test_close (surveyor);
+    test_close (respondent1);
+
     return 0;
 }
 
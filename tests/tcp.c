@@ -25,12 +25,17 @@
 #include "../src/nn.h"
 #include "../src/pair.h"
 #include "../src/pubsub.h"
+#include "../src/pipeline.h"
 #include "../src/tcp.h"
 
 #include "testutil.h"
 
+#include <string.h>
+
 /*  Tests TCP transport. */
 
+#define BIG_MSG_SIZE (16 * 1024 * 1024)
+
 int sc;
 
 int main (int argc, const char *argv[])
@@ -44,6 +49,9 @@ int main (int argc, const char *argv[])
     void * dummy_buf;
     char addr[128];
     char socket_address[128];
+    int clients [16];
+    int more;
+    static char part [65536];
 
     int port = get_test_port(argc, argv);
 
@@ -214,6 +222,195 @@ int main (int argc, const char *argv[])
     errno_assert (nn_errno () == EINVAL);
     test_close (sb);
 
+    /*  Test multiple listeners per bound endpoint. */
+    sb = test_socket (AF_SP, NN_PULL);
+    opt = 0;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    opt = 4;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, sizeof (opt));
+    errno_assert (rc == 0);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 4);
+    test_bind (sb, socket_address);
+    for (i = 0; i != 16; ++i) {
+        clients [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (clients [i], socket_address);
+    }
+    for (i = 0; i != 16; ++i)
+        test_send (clients [i], "ABC");
+    for (i = 0; i != 16; ++i)
+        test_recv (sb, "ABC");
+
+    /*  Sockets not using SO_REUSEPORT still can't bind the address. */
+    s1 = test_socket (AF_SP, NN_PULL);
+    rc = nn_bind (s1, socket_address);
+    nn_assert (rc < 0 && nn_errno () == EADDRINUSE);
+    test_close (s1);
+
+    for (i = 0; i != 16; ++i)
+        test_close (clients [i]);
+    test_close (sb);
+
+    /*  Test limiting the number of connections in the middle of the protocol
+        header exchange. */
+    sb = test_socket (AF_SP, NN_PULL);
+    opt = -1;
+    rc = nn_setsockopt (sb, NN_TCP, NN_TCP_MAX_HANDSHAKES, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    sz = sizeof (opt);
+    rc = nn_getsockopt (sb, NN_TCP, NN_TCP_MAX_HANDSHAKES, &opt, &sz);
+    errno_assert (rc == 0);
+    nn_assert (sz == sizeof (opt) && opt == 0);
+    opt = 1;
+    test_setsockopt (sb, NN_TCP, NN_TCP_MAX_HANDSHAKES, &opt, sizeof (opt));
+    test_bind (sb, socket_address);
+    for (i = 0; i != 16; ++i) {
+        clients [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (clients [i], socket_address);
+    }
+    for (i = 0; i != 16; ++i)
+        test_send (clients [i], "ABC");
+    for (i = 0; i != 16; ++i)
+        test_recv (sb, "ABC");
+    nn_assert (nn_get_statistic (sb, NN_STAT_ACCEPTED_CONNECTIONS) == 16);
+
+    /*  Each accepted connection holds off accepting the next one. */
+    nn_assert (nn_get_statistic (sb, NN_STAT_ACCEPT_PAUSES) == 16);
+    for (i = 0; i != 16; ++i)
+        test_close (clients [i]);
+    test_close (sb);
+
+    /*  Listeners share the limit, which is raised to the number of
+        listeners. Connections queued on any of them get accepted. */
+    sb = test_socket (AF_SP, NN_PULL);
+    opt = 1;
+    test_setsockopt (sb, NN_TCP, NN_TCP_MAX_HANDSHAKES, &opt, sizeof (opt));
+    opt = 4;
+    test_setsockopt (sb, NN_TCP, NN_TCP_LISTENERS, &opt, sizeof (opt));
+    test_bind (sb, socket_address);
+    for (i = 0; i != 16; ++i) {
+        clients [i] = test_socket (AF_SP, NN_PUSH);
+        test_connect (clients [i], socket_address);
+    }
+    for (i = 0; i != 16; ++i)
+        test_send (clients [i], "ABC");
+    for (i = 0; i != 16; ++i)
+        test_recv (sb, "ABC");
+    nn_assert (nn_get_statistic (sb, NN_STAT_ACCEPTED_CONNECTIONS) == 16);
+    for (i = 0; i != 16; ++i)
+        test_close (clients [i]);
+    test_close (sb);
+
+    /*  Test an urgent message overtaking a large one. The receiver doesn't
+        read the first message, so that the large message gets stuck. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    opt = -1;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_INTERLEAVE, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_RCVMAXSIZE, &opt, sizeof (opt));
+    opt = 4096;
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_INTERLEAVE, &opt, sizeof (opt));
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_INTERLEAVE, &opt, sizeof (opt));
+    test_connect (sc, socket_address);
+    test_send (sc, "XYZ");
+    dummy_buf = nn_allocmsg (BIG_MSG_SIZE, 0);
+    alloc_assert (dummy_buf);
+    memset (dummy_buf, 'A', BIG_MSG_SIZE);
+    rc = nn_send (sc, &dummy_buf, NN_MSG, 0);
+    errno_assert (rc == BIG_MSG_SIZE);
+    send_prio (sc, "ABC", 1);
+    test_recv (sb, "XYZ");
+    test_recv (sb, "ABC");
+    rc = nn_recv (sb, &dummy_buf, NN_MSG, 0);
+    errno_assert (rc == BIG_MSG_SIZE);
+    nn_assert (((char*) dummy_buf) [BIG_MSG_SIZE - 1] == 'A');
+    nn_freemsg (dummy_buf);
+
+    /*  Messages of the same priority are not reordered. */
+    send_prio (sc, "DEF", 1);
+    send_prio (sc, "GHI", 1);
+    test_send (sc, "JKL");
+    test_recv (sb, "DEF");
+    test_recv (sb, "GHI");
+    test_recv (sb, "JKL");
+    test_close (sc);
+
+    /*  Peer that doesn't interleave messages still works. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+    test_send (sc, "ABC");
+    test_recv (sb, "ABC");
+    send_prio (sb, "DEF", 1);
+    test_recv (sc, "DEF");
+    test_close (sc);
+    test_close (sb);
+
+    /*  Only sockets with a single peer can use message parts. */
+    sb = test_socket (AF_SP, NN_PUSH);
+    opt = 65536;
+    rc = nn_setsockopt (sb, NN_SOL_SOCKET, NN_PARTSIZE, &opt, sizeof (opt));
+    nn_assert (rc < 0 && nn_errno () == ENOPROTOOPT);
+    test_close (sb);
+
+    /*  Test receiving a large message in parts. */
+    sb = test_socket (AF_SP, NN_PAIR);
+    test_setsockopt (sb, NN_SOL_SOCKET, NN_PARTSIZE, &opt, sizeof (opt));
+    test_bind (sb, socket_address);
+    sc = test_socket (AF_SP, NN_PAIR);
+    rc = send_part (sc, "ABC");
+    nn_assert (rc < 0 && nn_errno () == EINVAL);
+    test_setsockopt (sc, NN_SOL_SOCKET, NN_PARTSIZE, &opt, sizeof (opt));
+    test_connect (sc, socket_address);
+    dummy_buf = nn_allocmsg (BIG_MSG_SIZE, 0);
+    alloc_assert (dummy_buf);
+    memset (dummy_buf, 'A', BIG_MSG_SIZE);
+    rc = nn_send (sc, &dummy_buf, NN_MSG, 0);
+    errno_assert (rc == BIG_MSG_SIZE);
+
+    /*  Urgent message doesn't get in between the parts. */
+    send_prio (sc, "XYZ", 1);
+    sz = 0;
+    do {
+        rc = recv_part (sb, part, sizeof (part), &more);
+        nn_assert (rc == (int) sizeof (part));
+        nn_assert (part [0] == 'A' && part [rc - 1] == 'A');
+        sz += rc;
+    } while (more);
+    nn_assert (sz == BIG_MSG_SIZE);
+    test_recv (sb, "XYZ");
+
+    /*  Parts sent by the user are delivered as such. Priority of a part
+        other than the first one is ignored. */
+    rc = send_part (sc, "ABC");
+    errno_assert (rc == 3);
+    send_prio (sc, "DEF", 1);
+    test_send (sc, "GHI");
+    rc = recv_part (sb, part, sizeof (part), &more);
+    nn_assert (rc == 3 && more && memcmp (part, "ABC", 3) == 0);
+    rc = recv_part (sb, part, sizeof (part), &more);
+    nn_assert (rc == 3 && !more && memcmp (part, "DEF", 3) == 0);
+    test_recv (sb, "GHI");
+    test_close (sc);
+
+    /*  Peer that doesn't use parts gets whole messages. */
+    sc = test_socket (AF_SP, NN_PAIR);
+    test_connect (sc, socket_address);
+    test_send (sc, "ABC");
+    rc = recv_part (sb, part, sizeof (part), &more);
+    nn_assert (rc == 3 && !more);
+    rc = send_part (sb, "DEF");
+    errno_assert (rc == 3);
+    test_send (sb, "GHI");
+    test_recv (sc, "DEF");
+    test_recv (sc, "GHI");
+    test_close (sc);
+    test_close (sb);
+
     /*  Test closing a socket that is waiting to connect. */
     sc = test_socket (AF_SP, NN_PAIR);
     test_connect (sc, socket_address);
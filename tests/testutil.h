@@ -183,6 +183,82 @@ static void NN_UNUSED test_recv_impl (char *file, int line, int sock, char *data
     free (buf);
 }
 
+/*  Sends a message with the specified priority. */
+static void NN_UNUSED send_prio (int sock, const char *data, int prio)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    unsigned char ctrl [64];
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    memset (ctrl, 0, sizeof (ctrl));
+    cmsg = (struct nn_cmsghdr*) ctrl;
+    cmsg->cmsg_len = NN_CMSG_LEN (sizeof (prio));
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = SP_PRIORITY;
+    memcpy (NN_CMSG_DATA (cmsg), &prio, sizeof (prio));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = NN_CMSG_SPACE (sizeof (prio));
+    rc = nn_sendmsg (sock, &hdr, 0);
+    errno_assert (rc == (int) strlen (data));
+}
+
+/*  Sends a part of a message that is followed by further parts. */
+static int NN_UNUSED send_part (int sock, const char *data)
+{
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    unsigned char ctrl [64];
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = strlen (data);
+    memset (ctrl, 0, sizeof (ctrl));
+    cmsg = (struct nn_cmsghdr*) ctrl;
+    cmsg->cmsg_len = NN_CMSG_LEN (0);
+    cmsg->cmsg_level = PROTO_SP;
+    cmsg->cmsg_type = SP_MORE;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = ctrl;
+    hdr.msg_controllen = NN_CMSG_SPACE (0);
+    return nn_sendmsg (sock, &hdr, 0);
+}
+
+/*  Receives a message or a part of it. Sets 'more' if further parts of
+    the message follow. */
+static int NN_UNUSED recv_part (int sock, char *buf, size_t len, int *more)
+{
+    int rc;
+    struct nn_msghdr hdr;
+    struct nn_iovec iov;
+    struct nn_cmsghdr *cmsg;
+    void *control;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &control;
+    hdr.msg_controllen = NN_MSG;
+    rc = nn_recvmsg (sock, &hdr, 0);
+    errno_assert (rc >= 0);
+    *more = 0;
+    cmsg = NN_CMSG_FIRSTHDR (&hdr);
+    while (cmsg) {
+        if (cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_MORE)
+            *more = 1;
+        cmsg = NN_CMSG_NXTHDR (&hdr, cmsg);
+    }
+    nn_freemsg (control);
+    return rc;
+}
+
 static void NN_UNUSED test_drop_impl (char *file, int line, int sock, int err)
 {
     int rc;
@@ -0,0 +1,129 @@
+/*
+    Copyright (c) 2012 Martin Sustrik  All rights reserved.
+    Copyright (c) 2013 GoPivotal, Inc.  All rights reserved.
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"),
+    to deal in the Software without restriction, including without limitation
+    the rights to use, copy, modify, merge, publish, distribute, sublicense,
+    and/or sell copies of the Software, and to permit persons to whom
+    the Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included
+    in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+    THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+    IN THE SOFTWARE.
+*/
+
+#include "../src/nn.h"
+#include "../src/reqrep.h"
+#include "../src/pipeline.h"
+#include "testutil.h"
+#include "../src/utils/thread.c"
+
+#include <stdio.h>
+#include <string.h>
+
+/*  Tests dumping of the event trace. */
+
+#define THREAD_COUNT 100
+
+/*  Records a few events in a short-lived thread. */
+static void NN_UNUSED worker (void *arg)
+{
+    int s;
+
+    s = test_socket (AF_SP, NN_PULL);
+    test_connect (s, (char*) arg);
+    test_recv (s, "ABC");
+    test_close (s);
+}
+
+int main (int argc, const char *argv[])
+{
+    int rc;
+    int rep;
+    int req;
+    int push;
+    int i;
+    FILE *f;
+    size_t sz;
+    char buf [256];
+    char filename [64];
+    struct nn_thread thread;
+    char socket_address [128];
+
+    test_addr_from (socket_address, "tcp", "127.0.0.1",
+        get_test_port (argc, argv));
+    sprintf (filename, "trace-%d.json", get_test_port (argc, argv));
+
+    rep = test_socket (AF_SP, NN_REP);
+    test_bind (rep, socket_address);
+    req = test_socket (AF_SP, NN_REQ);
+    test_connect (req, socket_address);
+    for (i = 0; i != 10; ++i) {
+        test_send (req, "ABC");
+        test_recv (rep, "ABC");
+        test_send (rep, "DEF");
+        test_recv (req, "DEF");
+    }
+
+    rc = nn_trace_dump (filename);
+#if defined NN_TRACE
+    errno_assert (rc == 0);
+
+    /*  The dump is a JSON object with the list of the events. */
+    f = fopen (filename, "r");
+    nn_assert (f);
+    sz = fread (buf, 1, sizeof (buf) - 1, f);
+    buf [sz] = 0;
+    fclose (f);
+    nn_assert (strncmp (buf, "{\"traceEvents\":[", 16) == 0);
+    nn_assert (strstr (buf, "\"ph\":\"X\"") != NULL);
+    remove (filename);
+
+    /*  Rings of the exited threads are reused, so more threads than the
+        maximum can be traced one after another. */
+    push = test_socket (AF_SP, NN_PUSH);
+    test_bind (push, "inproc://trace");
+    for (i = 0; i != THREAD_COUNT; ++i) {
+        nn_thread_init (&thread, worker, "inproc://trace");
+        test_send (push, "ABC");
+        nn_thread_term (&thread);
+    }
+    test_close (push);
+    rc = nn_trace_dump (filename);
+    errno_assert (rc == 0);
+    f = fopen (filename, "r");
+    nn_assert (f);
+    rc = fseek (f, -64, SEEK_END);
+    errno_assert (rc == 0);
+    sz = fread (buf, 1, sizeof (buf) - 1, f);
+    buf [sz] = 0;
+    fclose (f);
+    nn_assert (strstr (buf, "\"droppedThreads\":0}") != NULL);
+    remove (filename);
+
+    /*  Non-existent directory. */
+    rc = nn_trace_dump ("no-such-directory/trace.json");
+    nn_assert (rc == -1);
+#else
+    (void) f;
+    (void) thread;
+    (void) push;
+    (void) sz;
+    (void) buf;
+    nn_assert (rc == -1 && nn_errno () == ENOTSUP);
+#endif
+
+    test_close (req);
+    test_close (rep);
+
+    return 0;
+}
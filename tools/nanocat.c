@@ -32,6 +32,7 @@
 #include "options.h"
 #include "../src/utils/sleep.c"
 #include "../src/utils/clock.c"
+#include "../src/utils/hist.c"
 
 #include <stdio.h>
 #include <string.h>
@@ -41,8 +42,14 @@
 #include <ctype.h>
 #if !defined NN_HAVE_WINDOWS
 #include <unistd.h>
+#include <sys/time.h>
 #endif
 
+/*  Generated messages of at least this size carry a timestamp, so that
+    the receiving nanocat can compute the latency. */
+#define NN_LOAD_MAGIC "nanocat"
+#define NN_LOAD_HDR_SIZE 16
+
 enum echo_format {
     NN_NO_ECHO,
     NN_ECHO_RAW,
@@ -72,8 +79,29 @@ typedef struct nn_options {
 
     /* Input options */
     enum echo_format echo_format;
+
+    /* Load options */
+    float load_rate;
+    long load_size;
+    long load_count;
+    float stats_interval;
 } nn_options_t;
 
+/*  Rates and latencies of the messages sent or received so far. */
+struct nn_load_stats {
+    const char *name;
+    uint64_t interval;
+    uint64_t start;
+    uint64_t last_report;
+    uint64_t msgs;
+    uint64_t bytes;
+    uint64_t total_msgs;
+    uint64_t total_bytes;
+    uint64_t last;
+    struct nn_hist latency;
+    struct nn_hist total_latency;
+};
+
 /*  Constants to get address of in option declaration  */
 static const int nn_push = NN_PUSH;
 static const int nn_pull = NN_PULL;
@@ -126,6 +154,7 @@ struct nn_enum_item echo_formats[] = {
 #define NN_MASK_SOCK_SUB 8
 #define NN_MASK_DATA 16
 #define NN_MASK_ENDPOINT 32
+#define NN_MASK_LOAD 64
 #define NN_NO_PROVIDES 0
 #define NN_NO_CONFLICTS 0
 #define NN_NO_REQUIRES 0
@@ -293,6 +322,28 @@ struct nn_option nn_options[] = {
      NN_MASK_DATA, NN_MASK_DATA, NN_MASK_WRITEABLE,
      "Output Options", "PATH", "Same as --data but get data from file PATH"},
 
+    /* Load Options */
+    {"rate", 0, NULL,
+     NN_OPT_FLOAT, offsetof (nn_options_t, load_rate), NULL,
+     NN_MASK_LOAD, NN_NO_CONFLICTS, NN_MASK_WRITEABLE,
+     "Load Options", "MSGS", "Send MSGS messages (or requests) per second. "
+     "Zero means sending as fast as possible."},
+    {"size", 0, NULL,
+     NN_OPT_INT, offsetof (nn_options_t, load_size), NULL,
+     NN_MASK_DATA|NN_MASK_LOAD, NN_MASK_DATA, NN_MASK_WRITEABLE,
+     "Load Options", "BYTES", "Send generated messages of BYTES bytes. "
+     "Messages of 16 bytes or more carry a timestamp used by the receiving "
+     "nanocat to compute the latency."},
+    {"count", 0, NULL,
+     NN_OPT_INT, offsetof (nn_options_t, load_count), NULL,
+     NN_MASK_LOAD, NN_NO_CONFLICTS, NN_MASK_WRITEABLE,
+     "Load Options", "NUM", "Send NUM messages (or requests) and quit"},
+    {"stats", 0, NULL,
+     NN_OPT_FLOAT, offsetof (nn_options_t, stats_interval), NULL,
+     NN_NO_PROVIDES, NN_NO_CONFLICTS, NN_NO_REQUIRES,
+     "Load Options", "SEC", "Print message rate, throughput and latency "
+     "percentiles to stderr every SEC seconds"},
+
     /* Sentinel */
     {NULL, 0, NULL,
      0, 0, NULL,
@@ -469,6 +520,252 @@ void nn_connect_socket (nn_options_t *options, int sock)
     }
 }
 
+uint64_t nn_wallclock_us (void)
+{
+#if defined NN_HAVE_WINDOWS
+    FILETIME ft;
+    ULARGE_INTEGER t;
+
+    GetSystemTimeAsFileTime (&ft);
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    return t.QuadPart / 10;
+#else
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+int nn_load_mode (nn_options_t *options)
+{
+    return options->load_rate >= 0 || options->load_size >= 0 ||
+        options->load_count > 0;
+}
+
+/*  Returns latency of a message sent by a load-generating nanocat, or -1
+    if the message doesn't carry a timestamp. Wall clock is used, so the
+    result is meaningful across the machines only if their clocks are
+    synchronised. */
+int64_t nn_load_latency (char *buf, int buflen)
+{
+    uint64_t stamp;
+    uint64_t now;
+
+    if (buflen < NN_LOAD_HDR_SIZE ||
+          memcmp (buf, NN_LOAD_MAGIC, sizeof (NN_LOAD_MAGIC)) != 0)
+        return -1;
+    memcpy (&stamp, buf + sizeof (NN_LOAD_MAGIC), sizeof (stamp));
+    now = nn_wallclock_us ();
+    return now > stamp ? (int64_t) (now - stamp) : 0;
+}
+
+void nn_load_stats_init (nn_options_t *options, struct nn_load_stats *stats,
+    const char *name)
+{
+    memset (stats, 0, sizeof (struct nn_load_stats));
+    stats->name = name;
+    if (options->stats_interval > 0)
+        stats->interval = (uint64_t) (options->stats_interval * 1000000);
+    stats->start = nn_clock_us ();
+    stats->last_report = stats->start;
+    nn_hist_init (&stats->latency);
+    nn_hist_init (&stats->total_latency);
+}
+
+void nn_load_stats_print (struct nn_load_stats *stats, const char *what,
+    uint64_t msgs, uint64_t bytes, struct nn_hist *latency, uint64_t elapsed)
+{
+    double secs;
+
+    secs = elapsed ? (double) elapsed / 1000000 : 1;
+    fprintf (stderr, "%s %s: %llu msgs, %.0f msg/s, %.3f MB/s", stats->name,
+        what, (unsigned long long) msgs, msgs / secs, bytes / secs / 1000000);
+    if (latency->count) {
+        fprintf (stderr, ", latency [us]: p50 %llu, p90 %llu, p99 %llu, "
+            "p99.9 %llu, max %llu",
+            (unsigned long long) nn_hist_percentile (latency, 500),
+            (unsigned long long) nn_hist_percentile (latency, 900),
+            (unsigned long long) nn_hist_percentile (latency, 990),
+            (unsigned long long) nn_hist_percentile (latency, 999),
+            (unsigned long long) latency->max);
+    }
+    fprintf (stderr, "\n");
+}
+
+/*  Accounts for a single message. Negative latency means that it is not
+    known. Live statistics are printed every stats interval. */
+void nn_load_stats_add (struct nn_load_stats *stats, int buflen,
+    int64_t latency)
+{
+    uint64_t now;
+
+    /*  Don't count the time spent waiting for the first message. */
+    if (!stats->total_msgs) {
+        stats->start = nn_clock_us ();
+        stats->last_report = stats->start;
+    }
+    ++stats->msgs;
+    stats->bytes += buflen;
+    ++stats->total_msgs;
+    stats->total_bytes += buflen;
+    if (latency >= 0) {
+        nn_hist_record (&stats->latency, (uint64_t) latency);
+        nn_hist_record (&stats->total_latency, (uint64_t) latency);
+    }
+    if (!stats->interval)
+        return;
+    now = nn_clock_us ();
+    stats->last = now;
+    if (now - stats->last_report >= stats->interval) {
+        nn_load_stats_print (stats, "now", stats->msgs, stats->bytes,
+            &stats->latency, now - stats->last_report);
+        stats->msgs = 0;
+        stats->bytes = 0;
+        nn_hist_init (&stats->latency);
+        stats->last_report = now;
+    }
+}
+
+/*  Prints the summary. The rate is computed till the last message. */
+void nn_load_stats_term (struct nn_load_stats *stats)
+{
+    if (!stats->interval)
+        return;
+    nn_load_stats_print (stats, "total", stats->total_msgs,
+        stats->total_bytes, &stats->total_latency, stats->last - stats->start);
+}
+
+/*  Waits till the message number 'seq' is due according to the rate. */
+void nn_load_pace (nn_options_t *options, uint64_t start, long seq)
+{
+    uint64_t scheduled;
+    uint64_t now;
+
+    if (options->load_rate <= 0)
+        return;
+    scheduled = start + (uint64_t) (seq * 1000000.0 / options->load_rate);
+    while (1) {
+        now = nn_clock_us ();
+        if (now >= scheduled)
+            return;
+        if (scheduled - now > 2000)
+            nn_sleep ((int) ((scheduled - now) / 1000) - 1);
+    }
+}
+
+/*  Returns the message to send in the load mode. If no data was specified
+    a message of the requested size is generated. */
+char *nn_load_message (nn_options_t *options, size_t *len, int *stamped)
+{
+    char *buf;
+
+    *stamped = 0;
+    if (options->data_to_send.data) {
+        *len = options->data_to_send.length;
+        buf = malloc (*len ? *len : 1);
+        nn_assert_errno (buf != NULL, "Can't allocate message");
+        memcpy (buf, options->data_to_send.data, *len);
+        return buf;
+    }
+    *len = options->load_size > 0 ? (size_t) options->load_size : 0;
+    buf = malloc (*len ? *len : 1);
+    nn_assert_errno (buf != NULL, "Can't allocate message");
+    memset (buf, 'x', *len);
+    if (*len >= NN_LOAD_HDR_SIZE) {
+        memcpy (buf, NN_LOAD_MAGIC, sizeof (NN_LOAD_MAGIC));
+        *stamped = 1;
+    }
+    return buf;
+}
+
+void nn_load_stamp (char *buf)
+{
+    uint64_t now;
+
+    now = nn_wallclock_us ();
+    memcpy (buf + sizeof (NN_LOAD_MAGIC), &now, sizeof (now));
+}
+
+void nn_load_send_loop (nn_options_t *options, int sock)
+{
+    int rc;
+    int stamped;
+    long i;
+    size_t len;
+    char *buf;
+    uint64_t start;
+    struct nn_load_stats stats;
+
+    buf = nn_load_message (options, &len, &stamped);
+    nn_load_stats_init (options, &stats, "sent");
+    start = nn_clock_us ();
+    for (i = 0; options->load_count <= 0 || i < options->load_count; ++i) {
+        nn_load_pace (options, start, i);
+        if (stamped)
+            nn_load_stamp (buf);
+        rc = nn_send (sock, buf, len, 0);
+        if (rc < 0 && errno == EAGAIN) {
+            fprintf (stderr, "Message not sent (EAGAIN)\n");
+            continue;
+        } else {
+            nn_assert_errno (rc >= 0, "Can't send");
+        }
+        nn_load_stats_add (&stats, rc, -1);
+    }
+    nn_load_stats_term (&stats);
+    free (buf);
+}
+
+/*  Sends requests (or surveys) and measures time till the replies arrive. */
+void nn_load_rw_loop (nn_options_t *options, int sock)
+{
+    int rc;
+    int stamped;
+    long i;
+    size_t len;
+    char *buf;
+    void *reply;
+    uint64_t start;
+    uint64_t sent;
+    struct nn_load_stats stats;
+
+    buf = nn_load_message (options, &len, &stamped);
+    nn_load_stats_init (options, &stats, "received");
+    start = nn_clock_us ();
+    for (i = 0; options->load_count <= 0 || i < options->load_count; ++i) {
+        nn_load_pace (options, start, i);
+        if (stamped)
+            nn_load_stamp (buf);
+        sent = nn_clock_us ();
+        rc = nn_send (sock, buf, len, 0);
+        if (rc < 0 && errno == EAGAIN) {
+            fprintf (stderr, "Message not sent (EAGAIN)\n");
+            continue;
+        } else {
+            nn_assert_errno (rc >= 0, "Can't send");
+        }
+        for (;;) {
+            rc = nn_recv (sock, &reply, NN_MSG, 0);
+            if (rc < 0 && errno == EAGAIN) {
+                continue;
+            } else if (rc < 0 && (errno == ETIMEDOUT || errno == EFSM)) {
+                break;
+            } else {
+                nn_assert_errno (rc >= 0, "Can't recv");
+            }
+            nn_load_stats_add (&stats, rc, nn_clock_us () - sent);
+            nn_print_message (options, reply, rc);
+            nn_freemsg (reply);
+            if (options->socket_type == NN_REQ)
+                break;
+        }
+    }
+    nn_load_stats_term (&stats);
+    free (buf);
+}
+
 void nn_send_loop (nn_options_t *options, int sock)
 {
     int rc;
@@ -502,16 +799,21 @@ void nn_recv_loop (nn_options_t *options, int sock)
 {
     int rc;
     void *buf;
+    struct nn_load_stats stats;
 
+    nn_load_stats_init (options, &stats, "received");
     for (;;) {
         rc = nn_recv (sock, &buf, NN_MSG, 0);
         if (rc < 0 && errno == EAGAIN) {
             continue;
         } else if (rc < 0 && (errno == ETIMEDOUT || errno == EFSM)) {
+            nn_load_stats_term (&stats);
             return;  /*  No more messages possible  */
         } else {
             nn_assert_errno (rc >= 0, "Can't recv");
         }
+        if (stats.interval)
+            nn_load_stats_add (&stats, rc, nn_load_latency (buf, rc));
         nn_print_message (options, buf, rc);
         nn_freemsg (buf);
     }
@@ -574,7 +876,9 @@ void nn_resp_loop (nn_options_t *options, int sock)
 {
     int rc;
     void *buf;
+    struct nn_load_stats stats;
 
+    nn_load_stats_init (options, &stats, "received");
     for (;;) {
         rc = nn_recv (sock, &buf, NN_MSG, 0);
         if (rc < 0 && errno == EAGAIN) {
@@ -582,6 +886,8 @@ void nn_resp_loop (nn_options_t *options, int sock)
         } else {
             nn_assert_errno (rc >= 0, "Can't recv");
         }
+        if (stats.interval)
+            nn_load_stats_add (&stats, rc, nn_load_latency (buf, rc));
         nn_print_message (options, buf, rc);
         nn_freemsg (buf);
         rc = nn_send (sock,
@@ -610,7 +916,11 @@ int main (int argc, char **argv)
         /* send_delay        */ 0.f,
         /* send_interval     */ -1.f,
         /* data_to_send      */ {NULL, 0, 0},
-        /* echo_format       */ NN_NO_ECHO
+        /* echo_format       */ NN_NO_ECHO,
+        /* load_rate         */ -1.f,
+        /* load_size         */ -1,
+        /* load_count        */ 0,
+        /* stats_interval    */ -1.f
     };
 
     nn_parse_options (&nn_cli, &options, argc, argv);
@@ -620,7 +930,11 @@ int main (int argc, char **argv)
     switch (options.socket_type) {
     case NN_PUB:
     case NN_PUSH:
-        nn_send_loop (&options, sock);
+        if (nn_load_mode (&options)) {
+            nn_load_send_loop (&options, sock);
+        } else {
+            nn_send_loop (&options, sock);
+        }
         break;
     case NN_SUB:
     case NN_PULL:
@@ -628,7 +942,9 @@ int main (int argc, char **argv)
         break;
     case NN_BUS:
     case NN_PAIR:
-        if (options.data_to_send.data) {
+        if (nn_load_mode (&options)) {
+            nn_load_send_loop (&options, sock);
+        } else if (options.data_to_send.data) {
             nn_rw_loop (&options, sock);
         } else {
             nn_recv_loop (&options, sock);
@@ -636,7 +952,11 @@ int main (int argc, char **argv)
         break;
     case NN_SURVEYOR:
     case NN_REQ:
-        nn_rw_loop (&options, sock);
+        if (nn_load_mode (&options)) {
+            nn_load_rw_loop (&options, sock);
+        } else {
+            nn_rw_loop (&options, sock);
+        }
         break;
     case NN_REP:
     case NN_RESPONDENT: